@@ -0,0 +1,49 @@
+#ifndef __UHOOK_BENCH_H__
+#define __UHOOK_BENCH_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Get monotonic time in nanoseconds.
+ */
+uint64_t bench_now_ns(void);
+
+/**
+ * @brief Print one benchmark result.
+ * @param[in] name      Benchmark name
+ * @param[in] loops     Amount of iterations
+ * @param[in] cost_ns   Total time in nanoseconds
+ */
+void bench_report(const char* name, size_t loops, uint64_t cost_ns);
+
+/**
+ * @brief Measure inject and uninject cost of one hook, and per-instruction
+ *   cost of full and minimal mode decoding.
+ */
+void bench_inject(void);
+
+/**
+ * @brief Measure throughput of hook planner over whole modules.
+ */
+void bench_plan(void);
+
+/**
+ * @brief Measure per-call cost of detours, guards, generic handlers and
+ *   tracer.
+ */
+void bench_handler(void);
+
+/**
+ * @brief Measure how per-CPU hook counters and atomic counters scale with
+ *   threads.
+ */
+void bench_stat(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,163 @@
+#include "bench.h"
+#include "uhook.h"
+#include <stdio.h>
+
+#define BENCH_HANDLER_LOOPS 1000000
+
+typedef int (*fn_sig)(int);
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+/**
+ * @brief Big enough to patch, small enough that hook dominates the cost.
+ */
+__asm__(
+    ".text\n"
+    ".p2align 4\n"
+    ".globl uhook_bench_handler_target\n"
+    ".type uhook_bench_handler_target, @function\n"
+    "uhook_bench_handler_target:\n"
+    "    leal 1(%rdi), %eax\n"
+    "    nop\n"
+    "    nop\n"
+    "    nop\n"
+    "    nop\n"
+    "    nop\n"
+    "    nop\n"
+    "    nop\n"
+    "    ret\n"
+    ".size uhook_bench_handler_target, .-uhook_bench_handler_target\n"
+);
+
+int uhook_bench_handler_target(int a);
+
+static int bench_handler_detour(int a)
+{
+    return a + 1;
+}
+
+static int bench_handler_ctx_detour(int a)
+{
+    return ((fn_sig)uhook_get_ctx()->fcall)(a);
+}
+
+static void bench_handler_nop(uhook_regs_t* regs, void* ctx)
+{
+    (void)regs; (void)ctx;
+}
+
+/**
+ * @brief Call through a volatile pointer so the loop is not folded.
+ */
+static void _bench_handler_run(const char* name)
+{
+    fn_sig volatile fn = uhook_bench_handler_target;
+    size_t i;
+    int sum = 0;
+
+    uint64_t start = bench_now_ns();
+    for (i = 0; i < BENCH_HANDLER_LOOPS; i++)
+    {
+        sum += fn((int)i);
+    }
+    bench_report(name, BENCH_HANDLER_LOOPS, bench_now_ns() - start);
+
+    if (sum == 0)
+    {
+        printf("unexpected sum\n");
+    }
+}
+
+static void _bench_handler_mode(const char* name, uhook_handler_fn enter,
+    uhook_handler_fn leave, unsigned flags)
+{
+    uhook_token_t token;
+    uhook_handler_t handler = { enter, leave, NULL, flags };
+    if (uhook_inject_handler(&token, (void*)uhook_bench_handler_target, &handler) != UHOOK_SUCCESS)
+    {
+        printf("%s: inject failed\n", name);
+        return;
+    }
+    _bench_handler_run(name);
+    uhook_uninject(&token);
+}
+
+void bench_handler(void)
+{
+    uhook_token_t token;
+
+    _bench_handler_run("call:direct");
+
+    if (uhook_inject(&token, (void*)uhook_bench_handler_target, (void*)bench_handler_detour) == UHOOK_SUCCESS)
+    {
+        _bench_handler_run("call:detour");
+        uhook_uninject(&token);
+    }
+
+    if (uhook_inject_ctx(&token, (void*)uhook_bench_handler_target, (void*)bench_handler_ctx_detour, NULL) == UHOOK_SUCCESS)
+    {
+        _bench_handler_run("call:ctx");
+        uhook_uninject(&token);
+    }
+
+    uhook_opt_t opt = { 0, 0, UHOOK_INJECT_BYPASS };
+    if (uhook_inject_ex(&token, (void*)uhook_bench_handler_target, (void*)bench_handler_detour, &opt) == UHOOK_SUCCESS)
+    {
+        _bench_handler_run("call:bypass-check");
+        uhook_bypass(1);
+        _bench_handler_run("call:bypassed");
+        uhook_bypass(0);
+        uhook_uninject(&token);
+    }
+
+    opt.flags = UHOOK_INJECT_GUARD;
+    if (uhook_inject_ex(&token, (void*)uhook_bench_handler_target, (void*)bench_handler_detour, &opt) == UHOOK_SUCCESS)
+    {
+        _bench_handler_run("call:guard");
+        uhook_uninject(&token);
+    }
+
+    /* Argument never matches, every call goes to original function */
+    uhook_filter_t filter = { UHOOK_FILTER_ARG, 0, UHOOK_FILTER_EQ, 0, (unsigned long long)-1, NULL, NULL };
+    if (uhook_inject_filter(&token, (void*)uhook_bench_handler_target, (void*)bench_handler_detour, &filter) == UHOOK_SUCCESS)
+    {
+        _bench_handler_run("call:filter-miss");
+        uhook_uninject(&token);
+    }
+
+    static uhook_counter_t counter;
+    uhook_snippet_t snippet;
+    if (uhook_snippet_count(&snippet, &counter) == UHOOK_SUCCESS
+        && uhook_inject_snippet(&token, (void*)uhook_bench_handler_target, &snippet) == UHOOK_SUCCESS)
+    {
+        _bench_handler_run("snippet:count");
+        uhook_uninject(&token);
+    }
+
+    _bench_handler_mode("handler:enter", bench_handler_nop, NULL, 0);
+    _bench_handler_mode("handler:enter+leave", bench_handler_nop, bench_handler_nop, 0);
+    _bench_handler_mode("handler:vector:enter", bench_handler_nop, NULL, UHOOK_HANDLER_VECTOR);
+    _bench_handler_mode("handler:vector:both", bench_handler_nop, bench_handler_nop, UHOOK_HANDLER_VECTOR);
+
+    /* Two records per call, ring is overwritten */
+    if (uhook_inject_trace(&token, (void*)uhook_bench_handler_target, 1) == UHOOK_SUCCESS)
+    {
+        _bench_handler_run("trace:enter+leave");
+        uhook_uninject(&token);
+    }
+
+    if (uhook_inject_hist(&token, (void*)uhook_bench_handler_target) == UHOOK_SUCCESS)
+    {
+        _bench_handler_run("hist:enter+leave");
+        uhook_uninject(&token);
+    }
+}
+
+#else
+
+void bench_handler(void)
+{
+    printf("handler: not supported\n");
+}
+
+#endif
@@ -0,0 +1,133 @@
+#include "bench.h"
+#include "uhook.h"
+#include <stdio.h>
+#if defined(__x86_64__)
+#include <Zydis/Zydis.h>
+#endif
+
+#define BENCH_INJECT_LOOPS  10000
+
+/**
+ * @brief Bytes of target to decode at most.
+ */
+#define BENCH_DECODE_LIMIT  256
+
+typedef int (*fn_sig)(const int*, int);
+
+/**
+ * @brief A function with a few branches and calls, so the decoder has
+ *   something to chew on.
+ */
+static int bench_target(const int* data, int size)
+{
+    int i, sum = 0;
+    for (i = 0; i < size; i++)
+    {
+        if (data[i] & 1)
+        {
+            sum += data[i] * 3;
+        }
+        else if (data[i] > 100)
+        {
+            sum -= data[i] / 7;
+        }
+        else
+        {
+            sum ^= data[i];
+        }
+    }
+    return sum > 0 ? sum : printf("%d\n", sum);
+}
+
+static int bench_detour(const int* data, int size)
+{
+    (void)data;
+    return size;
+}
+
+#if defined(__x86_64__)
+
+/**
+ * @brief Decode target until `ret`.
+ * @return              Amount of instructions
+ */
+static size_t bench_decode_target(const ZydisDecoder* decoder)
+{
+    ZydisDecodedInstruction instruction;
+    const uint8_t* code = (const uint8_t*)(void*)bench_target;
+
+    size_t pos, num = 0;
+    for (pos = 0;
+        pos < BENCH_DECODE_LIMIT
+        && ZYAN_SUCCESS(ZydisDecoderDecodeBuffer(decoder, code + pos, BENCH_DECODE_LIMIT - pos, &instruction));
+        pos += instruction.length)
+    {
+        num++;
+        if (instruction.mnemonic == ZYDIS_MNEMONIC_RET)
+        {
+            break;
+        }
+    }
+
+    return num;
+}
+
+/**
+ * @brief Compare full mode decoding, which was used before, with minimal
+ *   mode decoding used by scanning passes now.
+ */
+static void bench_decode(void)
+{
+    ZydisDecoder full, minimal;
+    ZydisDecoderInit(&full, ZYDIS_MACHINE_MODE_LONG_64, ZYDIS_ADDRESS_WIDTH_64);
+    ZydisDecoderInit(&minimal, ZYDIS_MACHINE_MODE_LONG_64, ZYDIS_ADDRESS_WIDTH_64);
+    ZydisDecoderEnableMode(&minimal, ZYDIS_DECODER_MODE_MINIMAL, ZYAN_TRUE);
+
+    size_t i, num = 0;
+    uint64_t start = bench_now_ns();
+    for (i = 0; i < BENCH_INJECT_LOOPS; i++)
+    {
+        num += bench_decode_target(&full);
+    }
+    bench_report("decode full", num, bench_now_ns() - start);
+
+    num = 0;
+    start = bench_now_ns();
+    for (i = 0; i < BENCH_INJECT_LOOPS; i++)
+    {
+        num += bench_decode_target(&minimal);
+    }
+    bench_report("decode minimal", num, bench_now_ns() - start);
+}
+
+#endif
+
+void bench_inject(void)
+{
+    uhook_token_t token;
+    int data[4] = { 1, 3, 5, 7 };
+
+    /* Warm up caches of module symbols */
+    if (uhook_inject(&token, (void*)bench_target, (void*)bench_detour) != UHOOK_SUCCESS)
+    {
+        printf("inject failed\n");
+        return;
+    }
+    uhook_uninject(&token);
+
+    size_t i;
+    uint64_t start = bench_now_ns();
+    for (i = 0; i < BENCH_INJECT_LOOPS; i++)
+    {
+        uhook_inject(&token, (void*)bench_target, (void*)bench_detour);
+        uhook_uninject(&token);
+    }
+    bench_report("inject+uninject", BENCH_INJECT_LOOPS, bench_now_ns() - start);
+
+#if defined(__x86_64__)
+    bench_decode();
+#endif
+
+    /* Keep target alive */
+    bench_target(data, 4);
+}
@@ -0,0 +1,25 @@
+#define _POSIX_C_SOURCE 199309L
+#include "bench.h"
+#include <stdio.h>
+#include <time.h>
+
+uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+void bench_report(const char* name, size_t loops, uint64_t cost_ns)
+{
+    printf("%-24s %10zu loops %12.1f ns/op\n", name, loops, (double)cost_ns / (double)loops);
+}
+
+int main(void)
+{
+    bench_inject();
+    bench_plan();
+    bench_handler();
+    bench_stat();
+    return 0;
+}
@@ -0,0 +1,42 @@
+#include "bench.h"
+#include "uhook.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static void bench_plan_module(const char* name, void* symbol, unsigned threads)
+{
+    uhook_plan_summary_t summary;
+
+    uint64_t start = bench_now_ns();
+    if (uhook_plan_module(symbol, threads, &summary) != UHOOK_SUCCESS)
+    {
+        printf("%s: plan failed\n", name);
+        return;
+    }
+    uint64_t cost = bench_now_ns() - start;
+
+    char title[64];
+    if (threads == 0)
+    {
+        snprintf(title, sizeof(title), "plan %s all cpus", name);
+    }
+    else
+    {
+        snprintf(title, sizeof(title), "plan %s x%u", name, threads);
+    }
+    bench_report(title, summary.func_num, cost);
+
+    printf("  functions %zu, hookable %zu (trampoline %zu, sled %zu, thunk %zu, cave %zu)\n",
+        summary.func_num, summary.hookable, summary.method[UHOOK_PLAN_TRAMPOLINE],
+        summary.method[UHOOK_PLAN_SLED], summary.method[UHOOK_PLAN_THUNK], summary.cave);
+    printf("  too small %zu, relocation failure %zu, rip relative %zu, branch into patch %zu\n",
+        summary.small_func, summary.reloc_fail, summary.rip_relative, summary.branch_in);
+    printf("  patched bytes %zu\n", summary.patch_bytes);
+}
+
+void bench_plan(void)
+{
+    /* libc is large enough to keep a thread pool busy */
+    bench_plan_module("libc", (void*)abort, 1);
+    bench_plan_module("libc", (void*)abort, 0);
+}
@@ -0,0 +1,152 @@
+#include "bench.h"
+#include "uhook.h"
+#include <pthread.h>
+#include <stdio.h>
+
+#define BENCH_STAT_LOOPS    1000000
+#define BENCH_STAT_THREADS  16
+
+typedef int (*fn_sig)(int);
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+/**
+ * @brief Big enough to patch, small enough that hook dominates the cost.
+ */
+__asm__(
+    ".text\n"
+    ".p2align 4\n"
+    ".globl uhook_bench_stat_target\n"
+    ".type uhook_bench_stat_target, @function\n"
+    "uhook_bench_stat_target:\n"
+    "    leal 1(%rdi), %eax\n"
+    "    nop\n"
+    "    nop\n"
+    "    nop\n"
+    "    nop\n"
+    "    nop\n"
+    "    nop\n"
+    "    nop\n"
+    "    ret\n"
+    ".size uhook_bench_stat_target, .-uhook_bench_stat_target\n"
+);
+
+int uhook_bench_stat_target(int a);
+
+/**
+ * @brief Shared counters of the atomic baseline, updated and timed the same
+ *   way as a stat hook does.
+ */
+static struct
+{
+    unsigned long long  calls;
+    unsigned long long  returns;
+    unsigned long long  ticks;
+}s_bench_stat_atomic;
+
+static __thread unsigned long long s_bench_stat_tick;
+static int s_bench_stat_start;
+
+static unsigned long long _bench_stat_rdtsc(void)
+{
+    unsigned lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+static void _bench_stat_atomic_enter(uhook_regs_t* regs, void* ctx)
+{
+    (void)regs; (void)ctx;
+    __atomic_fetch_add(&s_bench_stat_atomic.calls, 1, __ATOMIC_RELAXED);
+    s_bench_stat_tick = _bench_stat_rdtsc();
+}
+
+static void _bench_stat_atomic_leave(uhook_regs_t* regs, void* ctx)
+{
+    (void)regs; (void)ctx;
+    unsigned long long ticks = _bench_stat_rdtsc() - s_bench_stat_tick;
+    __atomic_fetch_add(&s_bench_stat_atomic.returns, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s_bench_stat_atomic.ticks, ticks, __ATOMIC_RELAXED);
+}
+
+static void* _bench_stat_worker(void* arg)
+{
+    fn_sig volatile fn = uhook_bench_stat_target;
+    size_t i;
+
+    while (!__atomic_load_n(&s_bench_stat_start, __ATOMIC_ACQUIRE))
+    {
+    }
+
+    for (i = 0; i < BENCH_STAT_LOOPS; i++)
+    {
+        fn((int)i);
+    }
+    return arg;
+}
+
+/**
+ * @brief Call target from \p num threads at once. Cost is wall time, so it
+ *   stays flat as long as threads do not contend.
+ */
+static void _bench_stat_run(const char* name, unsigned num)
+{
+    pthread_t threads[BENCH_STAT_THREADS];
+    unsigned i, started = 0;
+    char buf[64];
+
+    s_bench_stat_start = 0;
+    for (i = 0; i < num; i++)
+    {
+        if (pthread_create(&threads[i], NULL, _bench_stat_worker, NULL) != 0)
+        {
+            break;
+        }
+        started++;
+    }
+
+    uint64_t start = bench_now_ns();
+    __atomic_store_n(&s_bench_stat_start, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    uint64_t cost = bench_now_ns() - start;
+
+    snprintf(buf, sizeof(buf), "%s:%ut", name, started);
+    bench_report(buf, BENCH_STAT_LOOPS, cost);
+}
+
+void bench_stat(void)
+{
+    uhook_token_t token;
+    unsigned num;
+
+    if (uhook_inject_stat(&token, (void*)uhook_bench_stat_target) == UHOOK_SUCCESS)
+    {
+        for (num = 1; num <= BENCH_STAT_THREADS; num *= 2)
+        {
+            _bench_stat_run("stat:percpu", num);
+        }
+        uhook_uninject(&token);
+    }
+
+    uhook_handler_t handler = { _bench_stat_atomic_enter, _bench_stat_atomic_leave, NULL, 0 };
+    if (uhook_inject_handler(&token, (void*)uhook_bench_stat_target, &handler) == UHOOK_SUCCESS)
+    {
+        for (num = 1; num <= BENCH_STAT_THREADS; num *= 2)
+        {
+            _bench_stat_run("stat:atomic", num);
+        }
+        uhook_uninject(&token);
+    }
+}
+
+#else
+
+void bench_stat(void)
+{
+    printf("stat: not supported\n");
+}
+
+#endif
@@ -14,6 +14,8 @@ extern "C" {
 #   define UHOOK_API
 #endif
 
+#include <stddef.h>
+
 enum uhook_errno
 {
     UHOOK_SUCCESS       = 0,    /**< Success */
@@ -22,8 +24,17 @@ enum uhook_errno
     UHOOK_SMALLFUNC     = -3,   /**< Function is too small to inject inline hook opcode */
     UHOOK_NOFUNCSIZE    = -4,   /**< Can not get function size, may be stripped? */
     UHOOK_GOTNOTFOUND   = -5,   /**< Function not found in GOT/PLT */
+    UHOOK_DUPLICATE     = -6,   /**< GOT/PLT slot is already injected */
+    UHOOK_NOCALLSITE    = -7,   /**< No direct call to function is found */
+    UHOOK_INVALID       = -8,   /**< Invalid argument */
 };
 
+/**
+ * @brief Inject context.
+ *
+ * All functions can be called from several threads at the same time, as long
+ * as the same token is not operated by two threads at once.
+ */
 typedef struct uhook_token
 {
     void*           fcall;      /**< Original function, cast to original protocol to call it. */
@@ -31,6 +42,449 @@ typedef struct uhook_token
     void*           token;      /**< Inject token */
 }uhook_token_t;
 
+enum uhook_inject_flag
+{
+    /**
+     * @brief Build trampoline on first call to `fcall`.
+     *
+     * Inject only writes the redirect opcode, so hooking a lot of functions
+     * whose original is rarely called is cheaper. Only affects the first
+     * hook on a target, and is ignored by platforms that do not support it.
+     */
+    UHOOK_INJECT_LAZY   = 0x01,
+
+    /**
+     * @brief Fall back to `int3` breakpoint if target cannot take a jump.
+     *
+     * Every call to target raises SIGTRAP and is routed to detour by signal
+     * handler, so it is much slower. Use #uhook_trap_stat() to find hooks
+     * that run in this mode. Only supported by x86_64 Linux.
+     */
+    UHOOK_INJECT_BREAKPOINT = 0x02,
+
+    /**
+     * @brief Hook the end of jump chain instead of target.
+     *
+     * If target is a thunk or PLT stub that jumps to another function, that
+     * function is hooked, so calls that do not go through target are hooked
+     * too. Only supported by x86_64.
+     */
+    UHOOK_INJECT_FOLLOW_JMP = 0x04,
+
+    /**
+     * @brief Recursion guard.
+     *
+     * While detour runs on a thread, calls to target from the same thread,
+     * for example by functions detour calls, go to `fcall` directly. Calls
+     * from threads that set #uhook_bypass() go to `fcall` too. At most 31
+     * hooks can be guarded at the same time. Only supported by x86_64.
+     *
+     * @note If detour is left by `longjmp()` or exception, the hook stays
+     *   skipped on that thread until a guarded or leave handled hook returns
+     *   at outer frame.
+     */
+    UHOOK_INJECT_GUARD      = 0x08,
+
+    /**
+     * @brief Go to `fcall` directly from threads that set #uhook_bypass().
+     * Only supported by x86_64.
+     */
+    UHOOK_INJECT_BYPASS     = 0x10,
+};
+
+/**
+ * @brief Inject options
+ */
+typedef struct uhook_opt
+{
+    /**
+     * @brief Dispatch priority.
+     *
+     * A target can be injected several times. The hook with higher priority
+     * is called first, and its `fcall` calls the next one. Hooks that have
+     * the same priority are called in inject order.
+     */
+    int             priority;
+
+    /**
+     * @brief Hook group.
+     *
+     * All hooks in the same group can be removed at once by
+     * #uhook_uninject_group().
+     */
+    unsigned        group;
+
+    /**
+     * @brief Bit-OR of #uhook_inject_flag.
+     */
+    unsigned        flags;
+}uhook_opt_t;
+
+/**
+ * @brief Hook context published by #uhook_inject_ctx().
+ */
+typedef struct uhook_ctx
+{
+    void*           ctx;        /**< User data given at inject */
+    void*           fcall;      /**< Original function, the same as `fcall` of token */
+}uhook_ctx_t;
+
+/**
+ * @brief Registers seen by handlers of #uhook_inject_handler().
+ *
+ * Registers follow System V AMD64 calling convention. On enter, changes to
+ * argument registers are passed to original function. On leave, only
+ * `rax`, `rdx`, `sp` and `vector` are valid, and changes to `rax`, `rdx` and
+ * vector state are returned to caller.
+ */
+typedef struct uhook_regs
+{
+    unsigned long long  rdi;    /**< The 1st integer argument */
+    unsigned long long  rsi;    /**< The 2nd integer argument */
+    unsigned long long  rdx;    /**< The 3rd integer argument, or the 2nd return value on leave */
+    unsigned long long  rcx;    /**< The 4th integer argument */
+    unsigned long long  r8;     /**< The 5th integer argument */
+    unsigned long long  r9;     /**< The 6th integer argument */
+    unsigned long long  rax;    /**< Return value on leave, amount of vector arguments of variadic call on enter */
+    unsigned long long  r10;    /**< Static chain pointer */
+
+    /**
+     * @brief Stack pointer at function entry, read only.
+     *
+     * Return address is at `sp`, and stack arguments start at `sp + 8`.
+     */
+    unsigned long long  sp;
+
+    /**
+     * @brief Vector state saved by `XSAVEC`, `XSAVE` or `FXSAVE`, NULL unless
+     *   #UHOOK_HANDLER_VECTOR is set.
+     *
+     * `xmm0` to `xmm15` start at offset 160, 16 bytes each. The state is
+     * restored after handler returns.
+     */
+    void*               vector;
+}uhook_regs_t;
+
+/**
+ * @brief Handler of #uhook_inject_handler().
+ * @param[in,out] regs      Registers
+ * @param[in] ctx           User data of handler
+ */
+typedef void (*uhook_handler_fn)(uhook_regs_t* regs, void* ctx);
+
+enum uhook_handler_flag
+{
+    /**
+     * @brief Save vector state around handlers.
+     *
+     * Without it, `xmm0` to `xmm7` are kept for arguments and `xmm0`,
+     * `xmm1` for return value, so float and double pass through. Set it
+     * if handlers read vector registers, or target takes or returns AVX
+     * values or `long double`. Only features enabled by OS are saved, by
+     * `XSAVEC` if CPU supports.
+     */
+    UHOOK_HANDLER_VECTOR    = 0x01,
+};
+
+/**
+ * @brief Generic handlers
+ */
+typedef struct uhook_handler
+{
+    uhook_handler_fn    enter;  /**< Called before original function, NULL to skip */
+    uhook_handler_fn    leave;  /**< Called after original function returns, NULL to skip */
+    void*               ctx;    /**< User data passed to handlers */
+    unsigned            flags;  /**< Bit-OR of #uhook_handler_flag */
+}uhook_handler_t;
+
+enum uhook_filter_flag
+{
+    /**
+     * @brief Compare integer argument `arg` with `arg_value` by `cmp`.
+     */
+    UHOOK_FILTER_ARG        = 0x01,
+
+    /**
+     * @brief Return address must be in [`caller_begin`, `caller_end`).
+     */
+    UHOOK_FILTER_CALLER     = 0x02,
+
+    /**
+     * @brief One call in `sample`, counted per thread, starting from the
+     *   first one. At most 64 hooks can be sampled at the same time.
+     * @note Counters are reused after uninject, so the first sample of a new
+     *   hook on a thread may come up to one period of the old hook late.
+     */
+    UHOOK_FILTER_SAMPLE     = 0x04,
+};
+
+enum uhook_filter_cmp
+{
+    UHOOK_FILTER_EQ         = 0,    /**< `arg == arg_value` */
+    UHOOK_FILTER_NE         = 1,    /**< `arg != arg_value` */
+    UHOOK_FILTER_LT         = 2,    /**< `arg < arg_value`, unsigned */
+    UHOOK_FILTER_GE         = 3,    /**< `arg >= arg_value`, unsigned */
+};
+
+/**
+ * @brief Filter of #uhook_inject_filter(), compiled into generated stub.
+ *
+ * Detour is called only if all conditions in `flags` match, other calls go
+ * to `fcall` in a few instructions. Conditions are checked in the order of
+ * #uhook_filter_flag, so sampler only counts calls matched by others.
+ */
+typedef struct uhook_filter
+{
+    unsigned            flags;          /**< Bit-OR of #uhook_filter_flag */
+    unsigned            arg;            /**< Index of integer argument, 0 to 5 */
+    unsigned            cmp;            /**< #uhook_filter_cmp */
+    unsigned            sample;         /**< Sampling period, at least 1 */
+    unsigned long long  arg_value;      /**< Value to compare argument with */
+    const void*         caller_begin;   /**< Start of caller range */
+    const void*         caller_end;     /**< End of caller range, exclusive */
+}uhook_filter_t;
+
+/**
+ * @brief Max size of machine code in #uhook_snippet_t.
+ */
+#define UHOOK_SNIPPET_MAX       64
+
+/**
+ * @brief Amount of per CPU slots in #uhook_counter_t.
+ */
+#define UHOOK_COUNTER_CPUS      256
+
+/**
+ * @brief Machine code that runs at function entry instead of a detour.
+ *
+ * Snippet runs with arguments of function in registers and the return
+ * address at top of stack. Running past its end, or jumping to its end,
+ * continues to original function, so registers other than `r11` and flags
+ * must be kept in that case. It may also `ret` to caller directly.
+ */
+typedef struct uhook_snippet
+{
+    unsigned char       code[UHOOK_SNIPPET_MAX];    /**< Machine code */
+    size_t              size;                       /**< Size of code */
+
+    /**
+     * @brief Address the code is assembled for.
+     *
+     * `rip` relative operands, and branches that leave snippet, are
+     * relocated from it. NULL if code is position independent, then such
+     * instructions are rejected.
+     */
+    const void*         origin;
+}uhook_snippet_t;
+
+/**
+ * @brief Counter with one cache line per CPU, so CPUs do not contend.
+ * @see uhook_snippet_count()
+ */
+typedef struct uhook_counter
+{
+    struct
+    {
+        unsigned long long  value;      /**< Count of this CPU */
+        unsigned long long  pad[7];     /**< Keep slots on their own cache line */
+    }cpus[UHOOK_COUNTER_CPUS];
+}uhook_counter_t;
+
+/**
+ * @brief Max amount of hooks that are injected by #uhook_inject_stat() at
+ *   the same time.
+ */
+#define UHOOK_STAT_MAX          1024
+
+/**
+ * @brief Statistics of a hook injected by #uhook_inject_stat().
+ */
+typedef struct uhook_stat
+{
+    unsigned long long  calls;      /**< Amount of calls entered */
+    unsigned long long  returns;    /**< Amount of calls returned, `ns` covers these only */
+    unsigned long long  ns;         /**< Total time spent in returned calls, in nanoseconds */
+}uhook_stat_t;
+
+/**
+ * @brief Max amount of hooks that are injected by #uhook_inject_hist() at
+ *   the same time.
+ */
+#define UHOOK_HIST_MAX          128
+
+/**
+ * @brief Latency of a hook injected by #uhook_inject_hist(), in
+ *   nanoseconds.
+ *
+ * Values come from buckets at most 1/32 of their value wide, so they are off
+ * by about 1.6%.
+ */
+typedef struct uhook_hist
+{
+    unsigned long long  count;      /**< Amount of calls returned */
+    unsigned long long  min;        /**< Shortest call */
+    unsigned long long  max;        /**< Longest call */
+    unsigned long long  mean;       /**< Average of calls */
+    unsigned long long  p50;        /**< Median */
+    unsigned long long  p90;        /**< 90th percentile */
+    unsigned long long  p99;        /**< 99th percentile */
+    unsigned long long  p999;       /**< 99.9th percentile */
+    unsigned long long  overhead;   /**< Hook overhead taken off each call */
+}uhook_hist_t;
+
+/**
+ * @brief Default amount of records in trace ring of each thread.
+ */
+#define UHOOK_TRACE_RECORDS     4096
+
+enum uhook_trace_type
+{
+    UHOOK_TRACE_ENTER       = 0,    /**< Function is entered */
+    UHOOK_TRACE_LEAVE       = 1,    /**< Function returns */
+};
+
+enum uhook_trace_policy
+{
+    UHOOK_TRACE_OVERWRITE   = 0,    /**< Overwrite oldest records if ring is full */
+    UHOOK_TRACE_DROP        = 1,    /**< Drop new records if ring is full */
+};
+
+/**
+ * @brief Event recorded by hooks of #uhook_inject_trace().
+ */
+typedef struct uhook_trace_record
+{
+    unsigned long long  ticks;      /**< Time stamp, converted by #uhook_trace_ns() */
+    unsigned long long  caller;     /**< Return address of the call */
+    unsigned            tid;        /**< Thread id */
+    unsigned            id;         /**< Hook id given at inject */
+    unsigned            type;       /**< #uhook_trace_type */
+    unsigned            reserved;   /**< Zero */
+}uhook_trace_record_t;
+
+/**
+ * @brief Trace options
+ */
+typedef struct uhook_trace_opt
+{
+    /**
+     * @brief Amount of records in ring of each thread, rounded up to power
+     *   of 2. 0 to use #UHOOK_TRACE_RECORDS.
+     */
+    size_t              records;
+    unsigned            policy;     /**< #uhook_trace_policy */
+}uhook_trace_opt_t;
+
+enum uhook_xref_type
+{
+    UHOOK_XREF_CALL     = 0x01, /**< `call` */
+    UHOOK_XREF_JMP      = 0x02, /**< `jmp`, usually tail call or PLT stub */
+    UHOOK_XREF_INDIRECT = 0x04, /**< Through GOT slot, bit-OR with #UHOOK_XREF_CALL or #UHOOK_XREF_JMP */
+};
+
+/**
+ * @brief A branch to the function queried by #uhook_find_callers().
+ */
+typedef struct uhook_xref
+{
+    void*           site;       /**< Address of branch instruction */
+    unsigned        type;       /**< Bit-OR of #uhook_xref_type */
+}uhook_xref_t;
+
+/**
+ * @brief Signature scan options
+ */
+typedef struct uhook_sig_opt
+{
+    /**
+     * @brief Only scan modules whose path contains it.
+     *
+     * The main program has empty path. NULL to scan all modules.
+     */
+    const char*     module;
+
+    /**
+     * @brief Cache file, NULL to disable cache.
+     *
+     * Matches are saved by module build-id, so the next process that runs
+     * the same binaries only compares bytes at the saved addresses. Modules
+     * without build-id are always scanned.
+     */
+    const char*     cache;
+
+    /**
+     * @brief Position of rel32 in pattern, 0 to disable.
+     *
+     * If set, the result is `match + rel_end + rel32`, which is how
+     * `call`/`jmp`/`lea` reference their operand.
+     */
+    unsigned        rel_pos;
+
+    /**
+     * @brief End of instruction that rel32 is relative to.
+     */
+    unsigned        rel_end;
+
+    /**
+     * @brief Added to result.
+     */
+    long            offset;
+}uhook_sig_opt_t;
+
+enum uhook_plan_method
+{
+    UHOOK_PLAN_TRAMPOLINE   = 0,    /**< Entry is redirected, original function runs in a relocated copy */
+    UHOOK_PLAN_SLED         = 1,    /**< NOP sled reserved by compiler is redirected */
+    UHOOK_PLAN_THUNK        = 2,    /**< Target is a thunk, original function is the end of jump chain */
+};
+
+/**
+ * @brief What #uhook_inject() would do to a function.
+ */
+typedef struct uhook_plan
+{
+    int             result;         /**< #uhook_errno that inject would return */
+    unsigned        method;         /**< #uhook_plan_method */
+    int             cave;           /**< Whether entry jumps to detour through a code cave */
+    size_t          func_size;      /**< Function size, 0 if unknown */
+    size_t          patch_size;     /**< Bytes overwritten at entry */
+    size_t          trampoline_size;/**< Worst case trampoline size */
+    unsigned        reloc_num;      /**< Branches out of function that need relocation */
+    unsigned        reloc_fail;     /**< Branches and operands that cannot be relocated */
+
+    /**
+     * @brief Amount of `[rip + disp32]` operands.
+     *
+     * They cannot be relocated if trampoline is more than 2GB away, then
+     * inject fails and they are counted in `reloc_fail` too.
+     */
+    unsigned        rip_relative;
+
+    /**
+     * @brief Branches in function whose destination is inside patched bytes.
+     *
+     * The relocated copy is not affected, but such branch in the original
+     * body lands in the middle of the redirect jump.
+     */
+    unsigned        branch_in;
+}uhook_plan_t;
+
+/**
+ * @brief Summary of #uhook_plan_module().
+ */
+typedef struct uhook_plan_summary
+{
+    size_t          func_num;       /**< Amount of analyzed functions */
+    size_t          hookable;       /**< Functions that can be hooked */
+    size_t          method[UHOOK_PLAN_THUNK + 1];   /**< Hookable functions by #uhook_plan_method */
+    size_t          cave;           /**< Hookable functions that need a code cave */
+    size_t          small_func;     /**< Functions that are too small */
+    size_t          reloc_fail;     /**< Functions that fail relocation */
+    size_t          rip_relative;   /**< Functions that have `[rip + disp32]` operand */
+    size_t          branch_in;      /**< Functions that branch into their patched bytes */
+    size_t          patch_bytes;    /**< Total bytes overwritten by hooking all hookable functions */
+}uhook_plan_summary_t;
+
 /**
  * @brief Inject function
  * @param[out] origin       Inject Context, also can be called as original function.
@@ -41,6 +495,397 @@ typedef struct uhook_token
  */
 UHOOK_API int uhook_inject(uhook_token_t* token, void* target, void* detour);
 
+/**
+ * @brief Inject function with options.
+ *
+ * Every hook on the same target becomes one layer of a dispatch chain.
+ * Target always jumps to the first layer, and `fcall` of each layer jumps
+ * to the next layer, so adding more hooks never stacks jumps in target, and
+ * hooks can be uninjected in any order.
+ *
+ * @param[out] token        Inject Context, also can be called as original function.
+ * @param[in] target        The function to be inject
+ * @param[in] detour        The function to replace original function
+ * @param[in] opt           Inject options, NULL to use default value.
+ * @return                  Inject result
+ */
+UHOOK_API int uhook_inject_ex(uhook_token_t* token, void* target, void* detour, const uhook_opt_t* opt);
+
+/**
+ * @brief Inject with user data, so one detour can serve many hooks.
+ *
+ * A small thunk is generated for each hook. It stores the address of hook
+ * context into a thread local slot and jumps to \p detour, so \p detour
+ * finds out which hook it runs for by #uhook_get_ctx().
+ *
+ * @param[out] token        Inject context
+ * @param[in] target        The function to be inject
+ * @param[in] detour        Detour shared by hooks
+ * @param[in] ctx           User data
+ * @return                  Inject result, #UHOOK_UNKNOWN if platform is not
+ *                          supported.
+ */
+UHOOK_API int uhook_inject_ctx(uhook_token_t* token, void* target, void* detour, void* ctx);
+
+/**
+ * @brief Inject with user data and options.
+ * @see uhook_inject_ctx()
+ * @param[out] token        Inject context
+ * @param[in] target        The function to be inject
+ * @param[in] detour        Detour shared by hooks
+ * @param[in] ctx           User data
+ * @param[in] opt           Inject options, NULL to use default value.
+ * @return                  Inject result
+ */
+UHOOK_API int uhook_inject_ctx_ex(uhook_token_t* token, void* target, void* detour, void* ctx,
+    const uhook_opt_t* opt);
+
+/**
+ * @brief Get context of the hook that current thread entered last.
+ *
+ * The slot is overwritten when the thread enters another hook made by
+ * #uhook_inject_ctx(), so read it before calling anything that may be
+ * hooked.
+ *
+ * @return                  Hook context, or NULL if none.
+ */
+UHOOK_API const uhook_ctx_t* uhook_get_ctx(void);
+
+/**
+ * @brief Skip detours of hooks injected with #UHOOK_INJECT_GUARD or
+ *   #UHOOK_INJECT_BYPASS on current thread.
+ *
+ * Skipped calls go to `fcall` without running any C code, so it is cheap
+ * to wrap code that must not be traced, like the tracer itself.
+ *
+ * @param[in] enable    Whether to skip
+ * @return              Previous state
+ */
+UHOOK_API int uhook_bypass(int enable);
+
+/**
+ * @brief Inject hook whose detour is only called for calls matched by
+ *   \p filter.
+ *
+ * Filter is compiled into a stub in front of detour, so unmatched calls do
+ * not pay a call into detour.
+ *
+ * @note Only supported by x86_64.
+ * @param[out] token        Inject context
+ * @param[in] target        The function to be inject
+ * @param[in] detour        Detour function
+ * @param[in] filter        Filter, copied into stub.
+ * @return                  Inject result, #UHOOK_INVALID if \p filter is
+ *                          malformed.
+ */
+UHOOK_API int uhook_inject_filter(uhook_token_t* token, void* target, void* detour, const uhook_filter_t* filter);
+
+/**
+ * @brief Inject filtered hook with options.
+ *
+ * #UHOOK_INJECT_GUARD and #UHOOK_INJECT_BYPASS are checked before filter.
+ *
+ * @see uhook_inject_filter()
+ * @param[out] token        Inject context
+ * @param[in] target        The function to be inject
+ * @param[in] detour        Detour function
+ * @param[in] filter        Filter, copied into stub.
+ * @param[in] opt           Inject options, NULL to use default value.
+ * @return                  Inject result
+ */
+UHOOK_API int uhook_inject_filter_ex(uhook_token_t* token, void* target, void* detour,
+    const uhook_filter_t* filter, const uhook_opt_t* opt);
+
+/**
+ * @brief Inject generic handlers.
+ *
+ * A stub is generated for each hook. It saves argument registers into
+ * #uhook_regs_t, calls `enter`, and continues to original function with
+ * registers loaded back. If `leave` is set, return address is moved to a per
+ * thread shadow stack and the stub calls original function, so it returns
+ * into the stub, which calls `leave` and returns to the real caller. Every
+ * `ret` still pairs with a `call`, so return prediction of CPU is kept.
+ *
+ * Calls skipped by `longjmp()`, or by an exception caught in a handler, are
+ * dropped from shadow stack next time a hooked function is entered or left.
+ *
+ * @note Only supported by x86_64.
+ * @note Exceptions must not be thrown through original function, it runs as
+ *   a copy without unwind information.
+ * @param[out] token        Inject context
+ * @param[in] target        The function to be inject
+ * @param[in] handler       Handlers, copied into stub.
+ * @return                  Inject result, #UHOOK_UNKNOWN if platform is not
+ *                          supported.
+ */
+UHOOK_API int uhook_inject_handler(uhook_token_t* token, void* target, const uhook_handler_t* handler);
+
+/**
+ * @brief Inject generic handlers with options.
+ * @see uhook_inject_handler()
+ * @param[out] token        Inject context
+ * @param[in] target        The function to be inject
+ * @param[in] handler       Handlers, copied into stub.
+ * @param[in] opt           Inject options, NULL to use default value.
+ * @return                  Inject result
+ */
+UHOOK_API int uhook_inject_handler_ex(uhook_token_t* token, void* target, const uhook_handler_t* handler,
+    const uhook_opt_t* opt);
+
+/**
+ * @brief Inject machine code snippet.
+ *
+ * Snippet is verified by decoding, relocated into a stub, and runs at
+ * entry of \p target without any call into C code.
+ *
+ * @note Only supported by x86_64.
+ * @param[out] token        Inject context
+ * @param[in] target        The function to be inject
+ * @param[in] snippet       Snippet, copied into stub.
+ * @return                  Inject result, #UHOOK_INVALID if snippet is
+ *                          rejected.
+ */
+UHOOK_API int uhook_inject_snippet(uhook_token_t* token, void* target, const uhook_snippet_t* snippet);
+
+/**
+ * @brief Inject machine code snippet with options.
+ * @see uhook_inject_snippet()
+ * @param[out] token        Inject context
+ * @param[in] target        The function to be inject
+ * @param[in] snippet       Snippet, copied into stub.
+ * @param[in] opt           Inject options, NULL to use default value.
+ * @return                  Inject result
+ */
+UHOOK_API int uhook_inject_snippet_ex(uhook_token_t* token, void* target, const uhook_snippet_t* snippet,
+    const uhook_opt_t* opt);
+
+/**
+ * @brief Build a snippet that returns \p value without calling original
+ *   function.
+ * @param[out] snippet      Snippet
+ * @param[in] value         Return value, in `rax`
+ * @return                  #uhook_errno
+ */
+UHOOK_API int uhook_snippet_return(uhook_snippet_t* snippet, unsigned long long value);
+
+/**
+ * @brief Build a snippet that returns at once, so function does nothing.
+ * @param[out] snippet      Snippet
+ * @return                  #uhook_errno
+ */
+UHOOK_API int uhook_snippet_skip(uhook_snippet_t* snippet);
+
+/**
+ * @brief Build a snippet that adds one to slot of current CPU in \p counter
+ *   and continues to original function.
+ * @param[out] snippet      Snippet
+ * @param[in] counter       Counter, must live longer than the hook.
+ * @return                  #uhook_errno
+ */
+UHOOK_API int uhook_snippet_count(uhook_snippet_t* snippet, uhook_counter_t* counter);
+
+/**
+ * @brief Sum all slots of \p counter.
+ * @param[in] counter       Counter
+ * @return                  Total count
+ */
+UHOOK_API unsigned long long uhook_counter_read(const uhook_counter_t* counter);
+
+/**
+ * @brief Count calls to \p target and time spent in them.
+ *
+ * Counters of each CPU are updated by restartable sequences of Linux, so
+ * threads never contend on a cache line and no locked instruction is used.
+ * If rseq is unavailable, each thread counts in its own slab instead. Both
+ * are summed by #uhook_stat_read().
+ *
+ * Time is measured by `rdtsc` from enter to leave of generic handlers, so
+ * calls left by `longjmp()` are counted but not timed.
+ *
+ * @note Only supported by x86_64.
+ * @param[out] token        Inject context
+ * @param[in] target        The function to be inject
+ * @return                  Inject result, #UHOOK_NOMEM if there are already
+ *                          #UHOOK_STAT_MAX such hooks.
+ */
+UHOOK_API int uhook_inject_stat(uhook_token_t* token, void* target);
+
+/**
+ * @brief Count calls with options.
+ * @see uhook_inject_stat()
+ * @param[out] token        Inject context
+ * @param[in] target        The function to be inject
+ * @param[in] opt           Inject options, NULL to use default value.
+ * @return                  Inject result
+ */
+UHOOK_API int uhook_inject_stat_ex(uhook_token_t* token, void* target, const uhook_opt_t* opt);
+
+/**
+ * @brief Sum counters of a hook injected by #uhook_inject_stat().
+ * @param[in] token         Inject context
+ * @param[out] stat         Statistics
+ * @return                  #uhook_errno, #UHOOK_INVALID if \p token is not
+ *                          injected by #uhook_inject_stat().
+ */
+UHOOK_API int uhook_stat_read(const uhook_token_t* token, uhook_stat_t* stat);
+
+/**
+ * @brief Record latency of calls to \p target in a log-linear histogram.
+ *
+ * Each thread records into its own histogram without lock or locked
+ * instruction, and #uhook_hist_snapshot() merges them.
+ *
+ * Time is measured by `rdtsc` from enter to leave of generic handlers. On
+ * first inject an empty function is hooked and called to measure time the
+ * hook itself adds, which is taken off every call, so short functions are
+ * not reported longer than they are. Calls left by `longjmp()` are not
+ * recorded.
+ *
+ * @note Only supported by x86_64.
+ * @param[out] token        Inject context
+ * @param[in] target        The function to be inject
+ * @return                  Inject result, #UHOOK_NOMEM if there are already
+ *                          #UHOOK_HIST_MAX such hooks.
+ */
+UHOOK_API int uhook_inject_hist(uhook_token_t* token, void* target);
+
+/**
+ * @brief Record latency with options.
+ * @see uhook_inject_hist()
+ * @param[out] token        Inject context
+ * @param[in] target        The function to be inject
+ * @param[in] opt           Inject options, NULL to use default value.
+ * @return                  Inject result
+ */
+UHOOK_API int uhook_inject_hist_ex(uhook_token_t* token, void* target, const uhook_opt_t* opt);
+
+/**
+ * @brief Merge histograms of a hook injected by #uhook_inject_hist().
+ *
+ * Calls since last reset are merged. Reset does not stop recording, calls
+ * returned during snapshot are in either this one or the next one.
+ *
+ * @param[in] token         Inject context
+ * @param[out] hist         Latency, NULL to only reset.
+ * @param[in] reset         Boolean, start over after this snapshot.
+ * @return                  #uhook_errno, #UHOOK_INVALID if \p token is not
+ *                          injected by #uhook_inject_hist().
+ */
+UHOOK_API int uhook_hist_snapshot(const uhook_token_t* token, uhook_hist_t* hist, int reset);
+
+/**
+ * @brief Set how trace records are kept.
+ * @note Must be called before any call is traced. Default is
+ *   #UHOOK_TRACE_RECORDS records with #UHOOK_TRACE_OVERWRITE.
+ * @param[in] opt           Trace options
+ * @return                  #uhook_errno, #UHOOK_INVALID if \p opt is invalid
+ *                          or records are already written.
+ */
+UHOOK_API int uhook_trace_config(const uhook_trace_opt_t* opt);
+
+/**
+ * @brief Record entry and exit of calls to \p target.
+ *
+ * Each thread writes fixed-size records into its own ring without lock or
+ * locked instruction, and #uhook_trace_drain() reads them from any thread.
+ *
+ * @note Only supported by x86_64.
+ * @param[out] token        Inject context
+ * @param[in] target        The function to be inject
+ * @param[in] id            Hook id written into records
+ * @return                  Inject result
+ */
+UHOOK_API int uhook_inject_trace(uhook_token_t* token, void* target, unsigned id);
+
+/**
+ * @brief Record calls with options.
+ * @see uhook_inject_trace()
+ * @param[out] token        Inject context
+ * @param[in] target        The function to be inject
+ * @param[in] id            Hook id written into records
+ * @param[in] opt           Inject options, NULL to use default value.
+ * @return                  Inject result
+ */
+UHOOK_API int uhook_inject_trace_ex(uhook_token_t* token, void* target, unsigned id, const uhook_opt_t* opt);
+
+/**
+ * @brief Move trace records out of rings.
+ *
+ * Records of a thread are in time order, records of different threads are
+ * not merged. Calls from several threads are serialized.
+ *
+ * @param[out] records      Buffer of records
+ * @param[in] cap           Capacity of \p records
+ * @return                  Amount of records written
+ */
+UHOOK_API size_t uhook_trace_drain(uhook_trace_record_t* records, size_t cap);
+
+/**
+ * @brief Amount of records dropped or overwritten before drained.
+ * @return                  Lost records
+ */
+UHOOK_API unsigned long long uhook_trace_lost(void);
+
+/**
+ * @brief Name hook \p id in trace file.
+ *
+ * Each name is written once into every file opened by #uhook_trace_open(),
+ * and is used by #uhook_trace_to_json(). If a name is given to the same id
+ * again, the later one is used.
+ *
+ * @param[in] id            Hook id given at #uhook_inject_trace()
+ * @param[in] name          Name, usually the function name.
+ * @return                  #uhook_errno
+ */
+UHOOK_API int uhook_trace_name(unsigned id, const char* name);
+
+/**
+ * @brief Stream trace records into \p path.
+ *
+ * A writer thread drains rings every few milliseconds and writes them in
+ * large sequential pieces, so traced threads never wait for I/O. Calls
+ * made by the writer thread are not traced. Records should not be drained
+ * by #uhook_trace_drain() at the same time, or they are not in the file.
+ * Rings should be large enough to hold records of about 10 milliseconds,
+ * see #uhook_trace_config().
+ *
+ * The file is chunked with delta encoded time stamps and varint ids. It is
+ * readable even if process dies before #uhook_trace_close().
+ *
+ * @param[in] path          Trace file, truncated if exists.
+ * @return                  #uhook_errno, #UHOOK_INVALID if a file is
+ *                          already open or \p path cannot be created.
+ */
+UHOOK_API int uhook_trace_open(const char* path);
+
+/**
+ * @brief Write records left in rings and close trace file.
+ * @return                  #uhook_errno, #UHOOK_UNKNOWN if a write failed,
+ *                          #UHOOK_INVALID if no file is open.
+ */
+UHOOK_API int uhook_trace_close(void);
+
+/**
+ * @brief Convert trace file to Chrome trace event JSON, which is viewed by
+ *   Perfetto or `chrome://tracing`.
+ *
+ * Trace file is mapped and decoded in place. Enter and leave are written as
+ * `B` and `E` events, time stamps are microseconds since the first record.
+ *
+ * @param[in] path          Trace file written by #uhook_trace_open()
+ * @param[in] json_path     JSON file, truncated if exists.
+ * @return                  #uhook_errno, #UHOOK_INVALID if \p path is not a
+ *                          valid trace file.
+ */
+UHOOK_API int uhook_trace_to_json(const char* path, const char* json_path);
+
+/**
+ * @brief Convert time stamp of trace record to nanoseconds.
+ * @param[in] ticks         Time stamp, or difference of time stamps
+ * @return                  Nanoseconds
+ */
+UHOOK_API unsigned long long uhook_trace_ns(unsigned long long ticks);
+
 /**
  * @brief Inject GOT/PLT
  * @param[out] token        Inject context
@@ -50,12 +895,212 @@ UHOOK_API int uhook_inject(uhook_token_t* token, void* target, void* detour);
  */
 UHOOK_API int uhook_inject_got(uhook_token_t* token, const char* name, void* detour);
 
+/**
+ * @brief Inject GOT/PLT with options.
+ * @note A GOT/PLT slot can only be injected once, `priority` is ignored.
+ * @param[out] token        Inject context
+ * @param[in] name          Function name. If '@' followed, inject specify library.
+ * @param[in] detour        The function to replace original function
+ * @param[in] opt           Inject options, NULL to use default value.
+ * @return                  Inject result
+ */
+UHOOK_API int uhook_inject_got_ex(uhook_token_t* token, const char* name, void* detour, const uhook_opt_t* opt);
+
+/**
+ * @brief Rewrite direct calls to target instead of target itself.
+ *
+ * Text of all loaded modules is scanned for `call rel32` and
+ * `call [rip + disp32]` whose destination is \p target, and each of them is
+ * rewritten to call \p detour. Target is untouched, so `fcall` is \p target
+ * itself and calling it costs nothing.
+ *
+ * @note Calls through function pointers, tail calls and modules loaded after
+ *   inject are not hooked. Rewritten calls no longer point to target, so
+ *   another call-site hook on the same target finds nothing.
+ * @param[out] token        Inject context
+ * @param[in] target        Function whose callers are rewritten
+ * @param[in] detour        The function to replace original function
+ * @return                  Inject result, #UHOOK_NOCALLSITE if no call is
+ *                          found or platform is not supported.
+ */
+UHOOK_API int uhook_inject_callsites(uhook_token_t* token, void* target, void* detour);
+
+/**
+ * @brief Rewrite direct calls to target with options.
+ * @note Only `group` is used.
+ * @see uhook_inject_callsites()
+ * @param[out] token        Inject context
+ * @param[in] target        Function whose callers are rewritten
+ * @param[in] detour        The function to replace original function
+ * @param[in] opt           Inject options, NULL to use default value.
+ * @return                  Inject result
+ */
+UHOOK_API int uhook_inject_callsites_ex(uhook_token_t* token, void* target, void* detour, const uhook_opt_t* opt);
+
+/**
+ * @brief Find branches to function in text of all loaded modules.
+ *
+ * Direct `call`/`jmp` and branches through GOT slot are reported, each of
+ * them is confirmed to be a real instruction of a known function. Branches
+ * of each module are indexed on first query, later queries only look up
+ * the index.
+ *
+ * @note Branches written by uhook and calls through function pointers are
+ *   not reported. The result is in no particular order.
+ * @param[in] target        Function address
+ * @param[out] xrefs        Found branches, can be NULL if \p cap is 0.
+ * @param[in] cap           Capacity of \p xrefs
+ * @return                  Amount of branches, may be larger than \p cap.
+ */
+UHOOK_API size_t uhook_find_callers(const void* target, uhook_xref_t* xrefs, size_t cap);
+
+/**
+ * @brief Find code by byte signature.
+ *
+ * Executable segments of loaded modules are searched for \p pattern, which
+ * is hex bytes separated by space, and `?` or `??` matches any byte. For
+ * example `"48 8b 05 ?? ?? ?? ?? c3"`. It is mainly for finding functions
+ * in stripped binaries.
+ *
+ * @param[in] pattern       Signature
+ * @param[in] opt           Scan options, NULL to use default value.
+ * @param[out] addrs        Results, can be NULL if \p cap is 0.
+ * @param[in] cap           Capacity of \p addrs
+ * @param[out] num          Amount of matches, may be larger than \p cap.
+ * @return                  #UHOOK_SUCCESS, or #UHOOK_INVALID if pattern is
+ *                          malformed.
+ */
+UHOOK_API int uhook_find_signature(const char* pattern, const uhook_sig_opt_t* opt,
+    void** addrs, size_t cap, size_t* num);
+
+/**
+ * @brief Analyze how target would be injected, without allocating memory
+ *   or patching anything.
+ *
+ * Detour is assumed to be reachable by a near jump, and the trampoline to
+ * be far away from target, which is the worst case for relocation.
+ *
+ * @param[in] target        The function to analyze
+ * @param[out] report       Analyze result
+ * @return                  The same as \p report->result
+ */
+UHOOK_API int uhook_plan(void* target, uhook_plan_t* report);
+
+/**
+ * @brief Analyze every function of a module.
+ * @param[in] symbol        Any address in the module
+ * @param[in] threads       Amount of worker threads, 0 to use one per CPU.
+ * @param[out] summary      Analyze summary
+ * @return                  #uhook_errno
+ */
+UHOOK_API int uhook_plan_module(void* symbol, unsigned threads, uhook_plan_summary_t* summary);
+
+/**
+ * @brief Load hook plans saved by last run and start recording new plans.
+ *
+ * A plan is how a function is relocated into trampoline: function size and
+ * offsets of instructions that depend on where the code is. Plans are keyed
+ * by build-id of module and offset of function. When a cached plan matches
+ * the bytes of target, uhook_inject() skips symbol lookup and decodes only
+ * the listed instructions, so hooking at startup reads no file except the
+ * cache itself, which is mapped in place.
+ *
+ * @note Call it before inject. It only affects trampoline inject on x86_64.
+ * @param[in] path          Cache file
+ * @return                  #UHOOK_SUCCESS, or #UHOOK_INVALID if file does not
+ *                          exist or is malformed. Plans are recorded anyway.
+ */
+UHOOK_API int uhook_plan_cache_load(const char* path);
+
+/**
+ * @brief Save loaded and recorded hook plans.
+ * @see uhook_plan_cache_load()
+ * @param[in] path          Cache file, replaced atomically.
+ * @return                  #uhook_errno
+ */
+UHOOK_API int uhook_plan_cache_save(const char* path);
+
 /**
  * @brief Uninject function
  * @param[in,out] origin    The context to be uninject. This value will be set to NULL.
  */
 UHOOK_API void uhook_uninject(uhook_token_t* token);
 
+/**
+ * @brief Uninject all hooks in group.
+ *
+ * All affected targets are restored in one pass, targets in the same page
+ * only pay for one memory protect switch.
+ *
+ * @note The tokens of uninjected hooks are set to zero, so they must stay at
+ *   the address used for inject.
+ * @param[in] group         Hook group
+ * @return                  Amount of uninjected hooks
+ */
+UHOOK_API size_t uhook_uninject_group(unsigned group);
+
+/**
+ * @brief Uninject all hooks.
+ * @see uhook_uninject_group()
+ * @return                  Amount of uninjected hooks
+ */
+UHOOK_API size_t uhook_uninject_all(void);
+
+/**
+ * @brief Check whether address is hooked.
+ * @param[in] addr          Function address for inline hook, or GOT/PLT slot
+ *                          address for GOT/PLT hook.
+ * @return                  bool
+ */
+UHOOK_API int uhook_is_hooked(const void* addr);
+
+/**
+ * @brief Get statistics of breakpoint hook.
+ * @see UHOOK_INJECT_BREAKPOINT
+ * @param[in] target        Function address
+ * @param[out] hits         How many times the breakpoint is hit
+ * @return                  bool, whether target is hooked by breakpoint
+ */
+UHOOK_API int uhook_trap_stat(const void* target, unsigned long long* hits);
+
+/**
+ * @brief Temporarily restore original function without uninject.
+ *
+ * The trampoline and backup opcode are kept, only the patched entry is
+ * flipped back, so no memory is allocated and no instruction is decoded.
+ *
+ * @param[in,out] token     Inject context
+ * @return                  Result
+ */
+UHOOK_API int uhook_disable(uhook_token_t* token);
+
+/**
+ * @brief Enable a hook disabled by #uhook_disable().
+ * @param[in,out] token     Inject context
+ * @return                  Result
+ */
+UHOOK_API int uhook_enable(uhook_token_t* token);
+
+/**
+ * @brief Disable a list of hooks.
+ *
+ * Hooks in the same page only pay for one memory protect switch.
+ *
+ * @param[in,out] tokens    A list of inject context
+ * @param[in] num           Amount of tokens
+ * @return                  Result
+ */
+UHOOK_API int uhook_disable_batch(uhook_token_t* tokens[], size_t num);
+
+/**
+ * @brief Enable a list of hooks.
+ * @see uhook_disable_batch()
+ * @param[in,out] tokens    A list of inject context
+ * @param[in] num           Amount of tokens
+ * @return                  Result
+ */
+UHOOK_API int uhook_enable_batch(uhook_token_t* tokens[], size_t num);
+
 #ifdef __cplusplus
 }
 #endif
@@ -97,7 +97,7 @@ static int _arm_fill_jump_code(uint32_t jump_code[2], void* target, void* detour
 
 static size_t _arm_get_opcode_size(const arm_trampoline_t* handle)
 {
-	return handle->redirect_opcode[sizeof(handle->redirect_opcode) - 1] == 0 ? 1 : 2;
+	return handle->redirect_opcode[sizeof(handle->redirect_opcode) / sizeof(handle->redirect_opcode[0]) - 1] == 0 ? 1 : 2;
 }
 
 static void _arm_do_inject(void* arg)
@@ -236,5 +236,77 @@ void uhook_arm_uninject(void* token)
         assert(!"modify opcode failed");
     }
     _flush_instruction_cache(handle->addr_target, sizeof(handle->redirect_opcode));
-    _free_execute_memory(handle);
+    uhook_arm_release(handle);
+}
+
+void uhook_arm_release(void* token)
+{
+    _free_execute_memory(token);
+}
+
+void uhook_arm_patch_range(void* token, void** addr, size_t* size)
+{
+    arm_trampoline_t* handle = token;
+
+    *addr = handle->addr_target;
+    *size = _arm_get_opcode_size(handle) * sizeof(uint32_t);
+}
+
+void uhook_arm_toggle(void* token, int enable)
+{
+    arm_trampoline_t* handle = token;
+    size_t copy_size = _arm_get_opcode_size(handle) * sizeof(uint32_t);
+
+    memcpy(handle->addr_target, enable ? handle->redirect_opcode : handle->backup_opcode, copy_size);
+    _flush_instruction_cache(handle->addr_target, copy_size);
+}
+
+int uhook_arm_retarget(void* token, void* detour)
+{
+    arm_trampoline_t* handle = token;
+
+    uint32_t redirect_opcode[2] = { 0, 0 };
+    int ret = _arm_fill_jump_code(redirect_opcode, handle->addr_target, detour);
+
+    /* wrap opcode was generated for the instructions overwritten at inject time */
+    if ((size_t)ret > _arm_get_opcode_size(handle))
+    {
+        return -1;
+    }
+
+    memcpy(handle->redirect_opcode, redirect_opcode, sizeof(redirect_opcode));
+    handle->addr_detour = detour;
+    return 0;
+}
+
+/**
+ * ```
+ * ldr  pc, [pc, #-4]
+ * .word    address
+ * ```
+ */
+void* uhook_arm_forward_create(void* dst)
+{
+    uint32_t* stub = _alloc_execute_block(sizeof(uint32_t) * 2);
+    if (stub == NULL)
+    {
+        return NULL;
+    }
+
+    _arm_fill_jump_code_far(stub, dst);
+    _flush_instruction_cache(stub, sizeof(uint32_t) * 2);
+
+    return stub;
+}
+
+void uhook_arm_forward_update(void* stub, void* dst)
+{
+    uint32_t* code = stub;
+    __atomic_store_n(&code[1], (uint32_t)dst, __ATOMIC_RELEASE);
+    _flush_instruction_cache(&code[1], sizeof(uint32_t));
+}
+
+void uhook_arm_forward_destroy(void* stub)
+{
+    _free_execute_block(stub, sizeof(uint32_t) * 2);
 }
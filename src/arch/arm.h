@@ -5,10 +5,63 @@ extern "C" {
 #endif
 
 #include "defs.h"
+#include <stddef.h>
 
 API_LOCAL int uhook_arm_inject(void** token, void** fn_call, void* target, void* detour);
 API_LOCAL void uhook_arm_uninject(void* token);
 
+/**
+ * @brief Release inject token without touching target.
+ *
+ * Use it after original opcode is written back by #uhook_arm_toggle().
+ *
+ * @param[in] token     Inject token
+ */
+API_LOCAL void uhook_arm_release(void* token);
+
+/**
+ * @brief Get the code region that #uhook_arm_toggle() writes.
+ * @param[in] token     Inject token
+ * @param[out] addr     Start address of patched region
+ * @param[out] size     Size of patched region
+ */
+API_LOCAL void uhook_arm_patch_range(void* token, void** addr, size_t* size);
+
+/**
+ * @brief Write redirect opcode or original opcode back to target.
+ * @param[in] token     Inject token
+ * @param[in] enable    Non-zero to write redirect opcode, zero to restore
+ */
+API_LOCAL void uhook_arm_toggle(void* token, int enable);
+
+/**
+ * @brief Change the detour function that target is redirected to.
+ * @param[in] token     Inject token
+ * @param[in] detour    New detour function
+ * @return              0 if success, otherwise failure
+ */
+API_LOCAL int uhook_arm_retarget(void* token, void* detour);
+
+/**
+ * @brief Create a stub that jumps to \p dst.
+ * @param[in] dst   Destination address
+ * @return          Stub address, or NULL if failure.
+ */
+API_LOCAL void* uhook_arm_forward_create(void* dst);
+
+/**
+ * @brief Atomically change destination of forward stub.
+ * @param[in] stub  Stub created by #uhook_arm_forward_create()
+ * @param[in] dst   New destination address
+ */
+API_LOCAL void uhook_arm_forward_update(void* stub, void* dst);
+
+/**
+ * @brief Destroy stub created by #uhook_arm_forward_create()
+ * @param[in] stub  Stub address
+ */
+API_LOCAL void uhook_arm_forward_destroy(void* stub);
+
 #ifdef __cplusplus
 }
 #endif
@@ -2,10 +2,20 @@
 #include "arch/x86_64.h"
 #include "os/os.h"
 #include "os/elf.h"
+#include "cave.h"
+#include "trap.h"
+#include "xref.h"
+#include "plancache.h"
+#include "mutex.h"
+#include "once.h"
 #include <inttypes.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 #include <Zydis/Zydis.h>
+#if defined(__SSE2__)
+#   include <emmintrin.h>
+#endif
 
 #define INLINE_HOOK_DEBUG
 #include "log.h"
@@ -16,6 +26,20 @@
 #define X86_64_OPCODE_SIZE_JUMP_FAR         14
 #define X86_64_OPCODE_INT3                  (0xcc)
 
+/**
+ * @brief Max amount of jumps to follow from target.
+ */
+#define X86_64_JUMP_CHAIN_MAX_DEPTH         8
+
+/**
+ * @brief Size of block that holds a forward stub.
+ *
+ * The far jump starts at offset 2 so its 8 bytes destination is naturally
+ * aligned and can be replaced by a single store.
+ */
+#define X86_64_FORWARD_BLOCK_SIZE           16
+#define X86_64_FORWARD_OFFSET               2
+
 /**
  * @brief List of conditional jump instructions
  */
@@ -68,24 +92,140 @@ typedef struct x86_64_patch_ctx
 }x86_64_patch_ctx_t;
 #define X86_64_PATCH_CTX_INIT { 0 }
 
+/**
+ * @brief Decoders shared by all hooks, they are read only after initialize.
+ */
+typedef struct x86_64_decoder_ctx
+{
+    ZydisDecoder    minimal;            /**< Only length, mnemonic and raw fields */
+    ZydisDecoder    full;               /**< Full operand decoding */
+}x86_64_decoder_ctx_t;
+
+static x86_64_decoder_ctx_t s_x86_64_decoder;
+static pthread_once_t s_x86_64_decoder_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Entry of a lazy trampoline.
+ *
+ * ```
+ * 4c 8d 1d 11 00 00 00        lea r11, [rip + handle]
+ * ff 25 03 00 00 00           jmp qword ptr [rip + jmp_slot]
+ * ```
+ *
+ * `jmp_slot` points to #uhook_x86_64_lazy_resolver until the trampoline is
+ * built, then to the trampoline itself.
+ */
+typedef struct x86_64_lazy_cell
+{
+    uint8_t     code[16];                                       /**< Entry code */
+    uint64_t    jmp_slot;                                       /**< Jump destination */
+    uint64_t    handle;                                         /**< Address of #x86_64_trampoline_t */
+}x86_64_lazy_cell_t;
+
 /**
  * @see https://www.felixcloutier.com/x86/
  */
 typedef struct x86_64_trampoline
 {
+    x86_64_lazy_cell_t lazy;                                    /**< Lazy entry, keep it first so it is 16 bytes aligned */
     uint8_t*    addr_target;                                    /**< Target function address */
     uint8_t*    addr_detour;                                    /**< Detour function address */
     size_t      size_target;                                    /**< Function size of target */
 
     size_t      redirect_size;                                  /**< Size of redirect code */
+    size_t      patch_size;                                     /**< Max size of redirect code ever written */
     uint8_t     redirect_opcode[X86_64_OPCODE_SIZE_JUMP_FAR];   /**< Opcode to redirect to detour function */
     uint8_t     backup_opcode[X86_64_OPCODE_SIZE_JUMP_FAR];     /**< Original function code for recover inject */
 
+    uint8_t*    cave;                                           /**< Code cave that jumps to detour, NULL if not used */
+    size_t      cave_size;                                      /**< Size of code cave */
+    size_t      cave_opcode_size;                               /**< Size of jump in code cave */
+    uint8_t     cave_opcode[X86_64_OPCODE_SIZE_JUMP_FAR];       /**< Jump from code cave to detour */
+    uint8_t     cave_backup[X86_64_OPCODE_SIZE_JUMP_FAR];       /**< Original content of code cave */
+
+    int         in_block;                                       /**< Handle is allocated by #_alloc_execute_block() */
+    int         is_trap;                                        /**< Target is redirected by breakpoint */
     size_t      trampoline_cap;                                 /**< The capacity of trampoline */
     size_t      trampoline_size;                                /**< The size of trampoline */
-    uint8_t     trampoline[];                                   /**< Trampoline */
+    uint8_t*    trampoline;                                     /**< Trampoline */
+    uint8_t*    lazy_buffer;                                    /**< Trampoline memory reserved by lazy inject */
+    uint8_t     storage[];                                      /**< Trampoline storage of eager inject */
 }x86_64_trampoline_t;
 
+/**
+ * @brief Serialize building of lazy trampolines.
+ */
+static uhook_mutex_t s_x86_64_lazy_mutex;
+static pthread_once_t s_x86_64_lazy_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Shared entry of all lazy trampolines that are not built yet.
+ *
+ * It saves argument registers, builds the trampoline of handle pointed by
+ * `r11`, and jumps into it as if the trampoline is called directly.
+ */
+API_LOCAL void uhook_x86_64_lazy_resolver(void);
+
+/**
+ * @brief Build trampoline for lazy inject.
+ * @param[in] handle    Inject handle
+ * @return              Trampoline address
+ */
+API_LOCAL void* uhook_x86_64_lazy_resolve(x86_64_trampoline_t* handle);
+
+#if defined(__x86_64__)
+__asm__(
+    ".text\n"
+    ".p2align 4\n"
+    ".globl uhook_x86_64_lazy_resolver\n"
+    ".hidden uhook_x86_64_lazy_resolver\n"
+    ".type uhook_x86_64_lazy_resolver, @function\n"
+    "uhook_x86_64_lazy_resolver:\n"
+    "    pushq %rbp\n"
+    "    movq %rsp, %rbp\n"
+    "    pushq %rdi\n"
+    "    pushq %rsi\n"
+    "    pushq %rdx\n"
+    "    pushq %rcx\n"
+    "    pushq %r8\n"
+    "    pushq %r9\n"
+    "    pushq %rax\n"
+    "    pushq %r10\n"
+    "    subq $128, %rsp\n"
+    "    movdqu %xmm0, 0(%rsp)\n"
+    "    movdqu %xmm1, 16(%rsp)\n"
+    "    movdqu %xmm2, 32(%rsp)\n"
+    "    movdqu %xmm3, 48(%rsp)\n"
+    "    movdqu %xmm4, 64(%rsp)\n"
+    "    movdqu %xmm5, 80(%rsp)\n"
+    "    movdqu %xmm6, 96(%rsp)\n"
+    "    movdqu %xmm7, 112(%rsp)\n"
+    "    movq (%r11), %rdi\n"
+    "    call uhook_x86_64_lazy_resolve\n"
+    "    movq %rax, %r11\n"
+    "    movdqu 0(%rsp), %xmm0\n"
+    "    movdqu 16(%rsp), %xmm1\n"
+    "    movdqu 32(%rsp), %xmm2\n"
+    "    movdqu 48(%rsp), %xmm3\n"
+    "    movdqu 64(%rsp), %xmm4\n"
+    "    movdqu 80(%rsp), %xmm5\n"
+    "    movdqu 96(%rsp), %xmm6\n"
+    "    movdqu 112(%rsp), %xmm7\n"
+    "    addq $128, %rsp\n"
+    "    popq %r10\n"
+    "    popq %rax\n"
+    "    popq %r9\n"
+    "    popq %r8\n"
+    "    popq %rcx\n"
+    "    popq %rdx\n"
+    "    popq %rsi\n"
+    "    popq %rdi\n"
+    "    popq %rbp\n"
+    "    jmp *%r11\n"
+    ".size uhook_x86_64_lazy_resolver, .-uhook_x86_64_lazy_resolver\n"
+);
+#endif
+
 static int _x86_64_is_8bit_size(ptrdiff_t addr_diff)
 {
     return -128 <= addr_diff && addr_diff <= 127;
@@ -181,16 +321,122 @@ static int _x86_64_fill_jump_code(uint8_t buffer[], size_t size, void* src_addr,
     return _x86_64_fill_jump_code_far(buffer, size, dst_addr);
 }
 
+/**
+ * @brief Replace 16 bytes at \p addr if it still contains \p expect.
+ * @note \p addr must be 16 bytes aligned.
+ * @return bool
+ */
+static int _x86_64_cas16(void* addr, uint64_t expect[2], const uint64_t desired[2])
+{
+    uint8_t ok;
+    __asm__ __volatile__("lock cmpxchg16b %1\n\tsete %0"
+        : "=q"(ok), "+m"(*(volatile uint64_t(*)[2])addr), "+a"(expect[0]), "+d"(expect[1])
+        : "b"(desired[0]), "c"(desired[1])
+        : "memory", "cc");
+    return ok;
+}
+
+/**
+ * @brief Write opcode that may be executing by other threads.
+ *
+ * If the region lies inside one naturally aligned 8 bytes word (or 16 bytes
+ * block) it is replaced by a single atomic store, so other threads see either
+ * the old or the new instruction, never a mix of both.
+ *
+ * Otherwise `int3` is written to the first byte before the rest, and threads
+ * that hit it are parked there until the first byte is written last.
+ *
+ * @param[in] dst   Destination address
+ * @param[in] src   Opcode to write
+ * @param[in] size  Opcode size
+ */
+static void _x86_64_write_opcode(uint8_t* dst, const uint8_t* src, size_t size)
+{
+    uintptr_t offset = (uintptr_t)dst & 0x07;
+    if (offset + size <= sizeof(uint64_t))
+    {
+        /* Neighbour bytes may belong to another hook, such as a code cave */
+        uint64_t* word = (uint64_t*)((uintptr_t)dst - offset);
+        uint64_t expect = __atomic_load_n(word, __ATOMIC_RELAXED);
+        uint64_t desired;
+        do
+        {
+            desired = expect;
+            memcpy((uint8_t*)&desired + offset, src, size);
+        } while (!__atomic_compare_exchange_n(word, &expect, desired, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        return;
+    }
+
+    offset = (uintptr_t)dst & 0x0f;
+    if (offset + size <= sizeof(uint64_t) * 2)
+    {
+        uint64_t* block = (uint64_t*)((uintptr_t)dst - offset);
+        uint64_t expect[2] = { block[0], block[1] };
+        uint64_t desired[2];
+        do
+        {
+            memcpy(desired, expect, sizeof(desired));
+            memcpy((uint8_t*)desired + offset, src, size);
+        } while (!_x86_64_cas16(block, expect, desired));
+        return;
+    }
+
+    /* Breakpoint jumps back to itself, so a thread waits until it is gone */
+    if (uhook_trap_register(dst, dst) != UHOOK_SUCCESS)
+    {
+        LOG("cannot park threads at %p, opcode is not written atomically", (void*)dst);
+        memcpy(dst, src, size);
+        return;
+    }
+
+    static const uint8_t int3 = X86_64_OPCODE_INT3;
+    _x86_64_write_opcode(dst, &int3, 1);
+    memcpy(dst + 1, src + 1, size - 1);
+    _x86_64_write_opcode(dst, src, 1);
+
+    /* A thread already in handler sees `int3` is gone and executes new opcode */
+    uhook_trap_unregister(dst);
+}
+
 static void _x86_64_do_inject(void* arg)
 {
     x86_64_trampoline_t* handle = arg;
-    memcpy(handle->addr_target, handle->redirect_opcode, handle->redirect_size);
+
+    /* Code cave must be ready before target jumps into it */
+    if (handle->cave != NULL)
+    {
+        _x86_64_write_opcode(handle->cave, handle->cave_opcode, handle->cave_opcode_size);
+    }
+    _x86_64_write_opcode(handle->addr_target, handle->redirect_opcode, handle->redirect_size);
 }
 
 static void _x86_64_undo_inject(void* arg)
 {
     x86_64_trampoline_t* handle = arg;
-    memcpy(handle->addr_target, handle->backup_opcode, handle->redirect_size);
+
+    _x86_64_write_opcode(handle->addr_target, handle->backup_opcode, handle->patch_size);
+    if (handle->cave != NULL)
+    {
+        _x86_64_write_opcode(handle->cave, handle->cave_backup, handle->cave_size);
+    }
+}
+
+/**
+ * @brief Get the code region that redirect touches, including code cave.
+ */
+static void _x86_64_get_patch_range(x86_64_trampoline_t* handle, size_t size, uint8_t** addr, size_t* len)
+{
+    uint8_t* lo = handle->addr_target;
+    uint8_t* hi = handle->addr_target + size;
+
+    if (handle->cave != NULL)
+    {
+        lo = handle->cave < lo ? handle->cave : lo;
+        hi = handle->cave + handle->cave_size > hi ? handle->cave + handle->cave_size : hi;
+    }
+
+    *addr = lo;
+    *len = hi - lo;
 }
 
 static ZydisAddressWidth _x86_64_get_address_width(void)
@@ -222,6 +468,20 @@ static ZydisMachineMode _x86_64_get_machine_mode(void)
     }
 }
 
+static void _x86_64_init_decoder(void)
+{
+    ZydisDecoderInit(&s_x86_64_decoder.full, _x86_64_get_machine_mode(), _x86_64_get_address_width());
+
+    ZydisDecoderInit(&s_x86_64_decoder.minimal, _x86_64_get_machine_mode(), _x86_64_get_address_width());
+    ZydisDecoderEnableMode(&s_x86_64_decoder.minimal, ZYDIS_DECODER_MODE_MINIMAL, ZYAN_TRUE);
+}
+
+static x86_64_decoder_ctx_t* _x86_64_get_decoder(void)
+{
+    pthread_once(&s_x86_64_decoder_once, _x86_64_init_decoder);
+    return &s_x86_64_decoder;
+}
+
 static unsigned _x86_64_calc_mini_addr_width(ptrdiff_t addr_diff)
 {
     if (_x86_64_is_8bit_size(addr_diff))
@@ -292,7 +552,8 @@ static int _x86_64_fix_jcc(x86_64_trampoline_t* handle, x86_64_patch_ctx_t* patc
      * jcc have three type of operand: rel8 / rel16 / rel32.
      * We must keep instruction width unchanged.
      */
-    ptrdiff_t addr_diff = dst_addr - (uintptr_t)&handle->trampoline[patch->pos_insn];
+    /* Relative operand counts from the end of instruction */
+    ptrdiff_t addr_diff = dst_addr - (uintptr_t)&handle->trampoline[patch->pos_insn + insn->length];
     unsigned mini_rel_width = _x86_64_calc_mini_addr_width(addr_diff);
 
     /* If original operand width is large enough, just modify it */
@@ -302,7 +563,7 @@ static int _x86_64_fix_jcc(x86_64_trampoline_t* handle, x86_64_patch_ctx_t* patc
     }
 
     /* If operand width is not enough, we need to build a forward instruction */
-    ptrdiff_t fi_diff = &handle->trampoline[handle->trampoline_size] - &handle->trampoline[patch->pos_insn];
+    ptrdiff_t fi_diff = &handle->trampoline[handle->trampoline_size] - &handle->trampoline[patch->pos_insn + insn->length];
     /* If we cannot jump to forward instruction, then no magic can be done. */
     if (_x86_64_calc_mini_addr_width(fi_diff) > insn->operands[0].size)
     {
@@ -361,6 +622,59 @@ static int _x86_64_fix_call(x86_64_trampoline_t* handle, x86_64_patch_ctx_t* pat
     return _x86_64_fix_jcc(handle, patch, insn);
 }
 
+/**
+ * @brief Whether \p insn address memory by `[rip + disp32]`.
+ * @note Works with minimal decoded instruction.
+ * @return bool
+ */
+static int _x86_64_is_rip_relative(const ZydisDecodedInstruction* insn)
+{
+    return sizeof(void*) == 8
+        && (insn->attributes & ZYDIS_ATTRIB_HAS_MODRM)
+        && insn->raw.modrm.mod == 0 && insn->raw.modrm.rm == 5;
+}
+
+/**
+ * @brief Displacement of `[rip + disp32]` in \p insn after it is moved from
+ *   \p src to \p dst.
+ * @return bool, false if memory is out of reach from \p dst.
+ */
+static int _x86_64_rebase_rip_relative(const ZydisDecodedInstruction* insn, const uint8_t* src,
+    const uint8_t* dst, int32_t* disp)
+{
+    int64_t value = insn->raw.disp.value + (src - dst);
+    if (insn->raw.disp.size != 32 || !_x86_64_is_32bit_size(value))
+    {
+        return 0;
+    }
+
+    *disp = (int32_t)value;
+    return 1;
+}
+
+/**
+ * @brief Rebase `[rip + disp32]` so the copy still address the same memory.
+ *
+ * Only the raw displacement is touched, so no operand decoding is needed.
+ *
+ * @return  1 if patch success; -1 if it cannot be relocated
+ */
+static int _x86_64_fix_rip_relative(x86_64_trampoline_t* handle, x86_64_patch_ctx_t* patch,
+    const ZydisDecodedInstruction* insn)
+{
+    /* The copy would address wrong memory, so trampoline is not usable */
+    int32_t code;
+    if (!_x86_64_rebase_rip_relative(insn, &handle->addr_target[patch->pos_insn],
+        &handle->trampoline[patch->pos_insn], &code))
+    {
+        LOG("cannot relocate rip relative address at %p", (void*)&handle->addr_target[patch->pos_insn]);
+        return -1;
+    }
+
+    memcpy(&handle->trampoline[patch->pos_insn + insn->raw.disp.offset], &code, sizeof(code));
+    return 1;
+}
+
 /**
  * we only need to fix relative address that outside original function body.
  * @return  0 if do nothing; 1 if patch success; -1 if patch failure
@@ -390,26 +704,94 @@ static int _x86_64_patch_instruction(x86_64_trampoline_t* handle, x86_64_patch_c
 #undef X86_64_PATCH_JCC
 }
 
+static int _x86_64_is_jump_insn(ZydisMnemonic insn);
+
+/**
+ * @brief Relocate instruction at \p patch->pos_insn of trampoline.
+ * @param[in,out] insn  Minimal decoded instruction, branches are decoded
+ *   again with operands.
+ * @return  0 if do nothing; 1 if patch success; -1 if patch failure
+ */
+static int _x86_64_relocate_instruction(x86_64_trampoline_t* handle, x86_64_patch_ctx_t* patch,
+    ZydisDecodedInstruction* insn)
+{
+    if (_x86_64_is_rip_relative(insn))
+    {
+        return _x86_64_fix_rip_relative(handle, patch, insn);
+    }
+
+    if (!_x86_64_is_jump_insn(insn->mnemonic))
+    {
+        return 0;
+    }
+
+    x86_64_decoder_ctx_t* decoder = _x86_64_get_decoder();
+    if (!ZYAN_SUCCESS(ZydisDecoderDecodeBuffer(&decoder->full, handle->trampoline + patch->pos_insn,
+        handle->size_target - patch->pos_insn, insn)))
+    {
+        return -1;
+    }
+
+    return _x86_64_patch_instruction(handle, patch, insn);
+}
+
 /**
  * @brief Generate swap code and jump to original function
- * @return  If return size if smaller than `num_opcode`, it is failure
+ *
+ * Instructions are scanned in minimal mode, only branches are decoded
+ * again with operands.
+ *
+ * @param[out] relocs   Offsets of instructions that depend on where the code
+ *   is, can be NULL.
+ * @return  0 if success, -1 if failure.
  */
-static int _x86_64_generate_trampoline_opcode(x86_64_trampoline_t* handle)
+static int _x86_64_generate_trampoline_opcode(x86_64_trampoline_t* handle, uhook_plan_reloc_list_t* relocs)
 {
-    ZydisDecoder decoder;
-    ZydisDecoderInit(&decoder, _x86_64_get_machine_mode(), _x86_64_get_address_width());
+    x86_64_decoder_ctx_t* decoder = _x86_64_get_decoder();
     ZydisDecodedInstruction instruction;
 
     x86_64_patch_ctx_t patch = X86_64_PATCH_CTX_INIT;
     for (patch.pos_insn = 0;
-        ZYAN_SUCCESS(ZydisDecoderDecodeBuffer(&decoder, handle->trampoline + patch.pos_insn, handle->size_target - patch.pos_insn, &instruction));
+        ZYAN_SUCCESS(ZydisDecoderDecodeBuffer(&decoder->minimal, handle->trampoline + patch.pos_insn, handle->size_target - patch.pos_insn, &instruction));
         patch.pos_insn += instruction.length)
     {
-        switch (_x86_64_patch_instruction(handle, &patch, &instruction))
+        int ret = _x86_64_relocate_instruction(handle, &patch, &instruction);
+        if (ret < 0)
+        {
+            return -1;
+        }
+
+        if (relocs != NULL && ret > 0
+            && uhook_plan_reloc_push(relocs, patch.pos_insn) != UHOOK_SUCCESS)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Relocate trampoline by cached plan, only listed instructions are
+ *   decoded.
+ * @return  0 if success, -1 if failure.
+ */
+static int _x86_64_replay_trampoline_opcode(x86_64_trampoline_t* handle, const uhook_plan_cache_entry_t* plan)
+{
+    x86_64_decoder_ctx_t* decoder = _x86_64_get_decoder();
+    ZydisDecodedInstruction instruction;
+
+    x86_64_patch_ctx_t patch = X86_64_PATCH_CTX_INIT;
+    size_t i;
+    for (i = 0; i < plan->reloc_num; i++)
+    {
+        patch.pos_insn = plan->relocs[i];
+        if (patch.pos_insn >= handle->size_target
+            || !ZYAN_SUCCESS(ZydisDecoderDecodeBuffer(&decoder->minimal, handle->trampoline + patch.pos_insn,
+                handle->size_target - patch.pos_insn, &instruction))
+            || _x86_64_relocate_instruction(handle, &patch, &instruction) < 0)
         {
-        case 0:     break;
-        case 1:     break;
-        default:    return -1;
+            return -1;
         }
     }
 
@@ -435,15 +817,14 @@ static int _x86_64_is_jump_insn(ZydisMnemonic insn)
 
 static size_t _x86_64_calc_trampoline_size(const void* func, size_t func_size)
 {
-    ZydisDecoder decoder;
-    ZydisDecoderInit(&decoder, _x86_64_get_machine_mode(), _x86_64_get_address_width());
+    x86_64_decoder_ctx_t* decoder = _x86_64_get_decoder();
     ZydisDecodedInstruction instruction;
 
-    /* calculate `jmp` number */
+    /* calculate `jmp` number, mnemonic is available in minimal mode */
     size_t pos;
     size_t jmp_cnt = 0;
     for (pos = 0;
-        ZYAN_SUCCESS(ZydisDecoderDecodeBuffer(&decoder, (uint8_t*)func + pos, func_size - pos, &instruction));
+        ZYAN_SUCCESS(ZydisDecoderDecodeBuffer(&decoder->minimal, (uint8_t*)func + pos, func_size - pos, &instruction));
         pos += instruction.length)
     {
         if (_x86_64_is_jump_insn(instruction.mnemonic))
@@ -458,77 +839,1370 @@ static size_t _x86_64_calc_trampoline_size(const void* func, size_t func_size)
     return func_size + jmp_far_size;
 }
 
-int uhook_x86_64_inject(void** token, void** fn_call, void* target, void* detour)
+/**
+ * @brief Get length of NOP instruction.
+ * @param[in] code  Instruction
+ * @return          Instruction length, or 0 if it is not a NOP.
+ */
+static size_t _x86_64_nop_length(const uint8_t* code)
 {
-    int ret;
-    size_t target_func_size = elf_get_function_size(target);
-    if (target_func_size == (size_t)-1)
+    size_t pos = 0;
+    if (code[0] == 0x90)
     {
-        return UHOOK_NOFUNCSIZE;
+        return 1;
     }
 
-    size_t trampoline_size = _x86_64_calc_trampoline_size(target, target_func_size);
-    size_t malloc_size = ALIGN_SIZE(sizeof(x86_64_trampoline_t) + trampoline_size, _get_page_size());
+    /* Multi-byte NOP may have operand size and segment prefixes */
+    while ((code[pos] == 0x66 || code[pos] == 0x2e) && pos < X86_64_MAX_INSTRUCTION_SIZE - 3)
+    {
+        pos++;
+    }
+    if (pos != 0 && code[pos] == 0x90)
+    {
+        return pos + 1;
+    }
+    if (code[pos] != 0x0f || code[pos + 1] != 0x1f || (code[pos + 2] & 0x38) != 0)
+    {
+        return 0;
+    }
 
-    x86_64_trampoline_t* handle = _alloc_execute_memory(malloc_size);
-    if (handle == NULL)
+    uint8_t modrm = code[pos + 2];
+    uint8_t mod = modrm >> 6;
+    uint8_t rm = modrm & 0x07;
+    pos += 3;
+
+    if (mod == 3)
     {
-        LOG("alloc execute memory with size(%zu) failed", malloc_size);
-        return UHOOK_NOMEM;
+        return pos;
+    }
+    if (rm == 4)
+    {
+        pos++;
+    }
+    if (mod == 1)
+    {
+        pos += 1;
+    }
+    else if (mod == 2 || rm == 5 || (rm == 4 && (code[pos - 1] & 0x07) == 5))
+    {
+        pos += 4;
     }
-    memset(handle, X86_64_OPCODE_INT3, malloc_size);
 
+    return pos;
+}
+
+/**
+ * @brief Get length of padding instruction.
+ * @see uhook_cave_filler_fn
+ */
+static size_t _x86_64_filler_length(const uint8_t* code)
+{
+    return code[0] == X86_64_OPCODE_INT3 ? 1 : _x86_64_nop_length(code);
+}
+
+/**
+ * @brief Redirect target through a code cave.
+ *
+ * A short jump at target goes to a cave in padding nearby, which holds the
+ * longer jump to detour. It makes functions shorter than a near jump
+ * hookable, and avoids stealing 14 bytes for a far jump.
+ *
+ * @return  Size of redirect code, or -1 if no cave is available.
+ */
+static int _x86_64_init_cave(x86_64_trampoline_t* handle, size_t target_func_size)
+{
+    if (target_func_size < X86_64_OPCODE_SIZE_JUMP_SHORT)
+    {
+        return -1;
+    }
+
+    /* Every address a short jump at target can reach */
+    uint8_t* lo = handle->addr_target + X86_64_OPCODE_SIZE_JUMP_SHORT - 128;
+    uint8_t* hi = handle->addr_target + X86_64_OPCODE_SIZE_JUMP_SHORT + 128;
+
+    /* Distance to detour barely changes within reach, so guess size of jump in cave from target */
+    size_t cave_size = _x86_64_is_32bit_size(handle->addr_detour - handle->addr_target) ?
+        X86_64_OPCODE_SIZE_JUMP_NEAR : X86_64_OPCODE_SIZE_JUMP_FAR;
+
+    uint8_t* cave = uhook_cave_alloc(handle->addr_target, lo, hi, cave_size, _x86_64_filler_length);
+    if (cave == NULL)
+    {
+        return -1;
+    }
+
+    int ret = _x86_64_fill_jump_code(handle->cave_opcode, sizeof(handle->cave_opcode), cave, handle->addr_detour);
+    if (ret < 0 || (size_t)ret > cave_size)
+    {
+        uhook_cave_free(cave, cave_size);
+        return -1;
+    }
+
+    handle->cave = cave;
+    handle->cave_size = cave_size;
+    handle->cave_opcode_size = ret;
+    memcpy(handle->cave_backup, cave, cave_size);
+
+    return _x86_64_fill_jump_code_short(handle->redirect_opcode, sizeof(handle->redirect_opcode),
+        cave - handle->addr_target);
+}
+
+/**
+ * @brief Fill redirect and backup opcode of \p handle.
+ * @return  #uhook_errno
+ */
+static int _x86_64_init_handle(x86_64_trampoline_t* handle, void* target, void* detour, size_t target_func_size)
+{
     handle->addr_target = target;
     handle->addr_detour = detour;
     handle->size_target = target_func_size;
-    handle->trampoline_cap = malloc_size - sizeof(x86_64_trampoline_t);
+    handle->cave = NULL;
+    handle->is_trap = 0;
 
-    if ((ret = _x86_64_fill_jump_code(handle->redirect_opcode,
-        sizeof(handle->redirect_opcode), target, detour)) < 0)
+    int ret = _x86_64_fill_jump_code(handle->redirect_opcode, sizeof(handle->redirect_opcode), target, detour);
+    if (ret < 0)
     {
         LOG("generate redirect opcode failed");
-        _free_execute_memory(handle);
         return UHOOK_UNKNOWN;
     }
+    if (ret > X86_64_OPCODE_SIZE_JUMP_NEAR || (size_t)ret > target_func_size)
+    {
+        int cave_ret = _x86_64_init_cave(handle, target_func_size);
+        ret = cave_ret > 0 ? cave_ret : ret;
+    }
     if ((size_t)ret > target_func_size)
     {
         LOG("target(%p) size is too small, need(%zu) actual(%zu)", target, (size_t)ret, target_func_size);
-        _free_execute_memory(handle);
         return UHOOK_SMALLFUNC;
     }
 
     handle->redirect_size = ret;
-    memcpy(handle->backup_opcode, target, ret);
-    memcpy(handle->trampoline, target, target_func_size);
-    handle->trampoline_size = target_func_size;
+    handle->patch_size = ret;
+    memcpy(handle->backup_opcode, target, target_func_size < sizeof(handle->backup_opcode) ?
+        target_func_size : sizeof(handle->backup_opcode));
+
+    return UHOOK_SUCCESS;
+}
+
+/**
+ * @brief Copy target function into \p buffer and relocate it.
+ *
+ * Entry of target may be redirected already, so original opcode is taken
+ * from backup.
+ *
+ * @param[in] plan     Cached plan, NULL to decode the whole function.
+ * @param[out] relocs   Offsets of relocated instructions, can be NULL.
+ * @return  0 if success, -1 if failure.
+ */
+static int _x86_64_build_trampoline(x86_64_trampoline_t* handle, uint8_t* buffer, size_t cap,
+    const uhook_plan_cache_entry_t* plan, uhook_plan_reloc_list_t* relocs)
+{
+    size_t backup_size = handle->size_target < sizeof(handle->backup_opcode) ?
+        handle->size_target : sizeof(handle->backup_opcode);
+
+    handle->trampoline = buffer;
+    handle->trampoline_cap = cap;
+    handle->trampoline_size = handle->size_target;
+
+    memcpy(buffer, handle->addr_target, handle->size_target);
+    memcpy(buffer, handle->backup_opcode, backup_size);
+
+    return plan != NULL ? _x86_64_replay_trampoline_opcode(handle, plan)
+        : _x86_64_generate_trampoline_opcode(handle, relocs);
+}
+
+static int _x86_64_commit_inject(x86_64_trampoline_t* handle, void** token, void** fn_call, void* origin)
+{
+    uint8_t* addr; size_t size;
+    _x86_64_get_patch_range(handle, handle->redirect_size, &addr, &size);
 
-    if (_x86_64_generate_trampoline_opcode(handle) < 0)
+    if (_system_modify_opcode(addr, size, _x86_64_do_inject, handle) < 0)
     {
-        _free_execute_memory(handle);
         return UHOOK_UNKNOWN;
     }
 
-    if (_system_modify_opcode(target, handle->redirect_size, _x86_64_do_inject, handle) < 0)
+    _flush_instruction_cache(addr, size);
+    *token = handle;
+    *fn_call = origin;
+
+    return UHOOK_SUCCESS;
+}
+
+/**
+ * @brief Find NOP sled reserved by compiler at entry of \p target.
+ *
+ * Only a near jump is written into sled, so it must not cross a 16 bytes
+ * block to be replaced by one atomic store.
+ *
+ * @param[in] target    Target function
+ * @param[out] site     Sled address
+ * @return              Size of NOPs covered by a near jump, or 0 if no usable sled.
+ */
+static size_t _x86_64_get_sled(void* target, uint8_t** site)
+{
+    int type;
+    if ((*site = elf_find_patch_site(target, &type)) == NULL
+        || ((uintptr_t)*site & 0x0f) + X86_64_OPCODE_SIZE_JUMP_NEAR > sizeof(uint64_t) * 2)
     {
-        _free_execute_memory(handle);
-        return -1;
+        return 0;
     }
 
-    _flush_instruction_cache(target, handle->redirect_size);
-    *token = handle;
-    *fn_call = handle->trampoline;
+    if (type == ELF_PATCH_SITE_MCOUNT)
+    {
+        return _x86_64_nop_length(*site) == X86_64_OPCODE_SIZE_JUMP_NEAR ? X86_64_OPCODE_SIZE_JUMP_NEAR : 0;
+    }
 
-    return UHOOK_SUCCESS;
+    /* Sled length is not recorded, take NOPs until a near jump fits */
+    size_t size = 0, len;
+    while (size < X86_64_OPCODE_SIZE_JUMP_NEAR && (len = _x86_64_nop_length(*site + size)) != 0)
+    {
+        size += len;
+    }
+    return size >= X86_64_OPCODE_SIZE_JUMP_NEAR ? size : 0;
 }
 
-void uhook_x86_64_uninject(void* token)
+/**
+ * @brief Redirect NOP sled to detour.
+ *
+ * The sled does nothing, so the original function is simply the code after
+ * it. There is no need to decode or copy target function.
+ *
+ * A detour out of reach of near jump goes through a code cave instead of a
+ * far jump, so the sled is always patched by one atomic store.
+ *
+ * @return  #uhook_errno, #UHOOK_SMALLFUNC if detour cannot be reached from sled.
+ */
+static int _x86_64_inject_sled(void** token, void** fn_call, uint8_t* site, size_t sled_size, void* detour)
 {
-    x86_64_trampoline_t* handle = token;
+    int ret;
+    x86_64_trampoline_t* handle = _alloc_execute_block(sizeof(x86_64_trampoline_t));
+    if (handle == NULL)
+    {
+        return UHOOK_NOMEM;
+    }
+    memset(handle, 0, sizeof(x86_64_trampoline_t));
+    handle->in_block = 1;
 
-    if (_system_modify_opcode(handle->addr_target, handle->redirect_size, _x86_64_undo_inject, handle) > 0)
+    if ((ret = _x86_64_init_handle(handle, site, detour, X86_64_OPCODE_SIZE_JUMP_NEAR)) != UHOOK_SUCCESS)
     {
-        assert(!"modify opcode failed");
+        _free_execute_block(handle, sizeof(x86_64_trampoline_t));
+        return ret;
+    }
+
+    if ((ret = _x86_64_commit_inject(handle, token, fn_call, site + sled_size)) != UHOOK_SUCCESS)
+    {
+        uhook_x86_64_release(handle);
+        return ret;
+    }
+
+    return UHOOK_SUCCESS;
+}
+
+/**
+ * @brief Get destination of unconditional jump at \p code.
+ *
+ * `endbr64` and `bnd` prefix used by PLT stubs are skipped.
+ *
+ * @param[in] code          Instruction
+ * @param[in] follow_mem    Whether to follow `jmp [rip + disp32]` by reading its slot
+ * @return                  Destination, or NULL if not a jump.
+ */
+static uint8_t* _x86_64_jump_destination(uint8_t* code, int follow_mem)
+{
+    static const uint8_t endbr64[] = { 0xf3, 0x0f, 0x1e, 0xfa };
+    if (memcmp(code, endbr64, sizeof(endbr64)) == 0)
+    {
+        code += sizeof(endbr64);
+    }
+    if (code[0] == 0xf2)
+    {
+        code++;
     }
-    _flush_instruction_cache(handle->addr_target, handle->redirect_size);
-    _free_execute_memory(handle);
+
+    int32_t rel;
+    switch (code[0])
+    {
+    case 0xeb:
+        return code + 2 + (int8_t)code[1];
+
+    case 0xe9:
+        memcpy(&rel, code + 1, sizeof(rel));
+        return code + 5 + rel;
+
+    case 0xff:
+        if (!follow_mem || code[1] != 0x25 || sizeof(void*) != 8)
+        {
+            return NULL;
+        }
+        memcpy(&rel, code + 2, sizeof(rel));
+        uint8_t* dst = *(uint8_t**)(code + 6 + rel);
+
+        /* Slot of lazy binding PLT points to the next instruction, it is not resolved yet */
+        return (dst > code && dst <= code + 16) ? NULL : dst;
+
+    default:
+        return NULL;
+    }
+}
+
+/**
+ * @brief Follow chain of jumps start from \p target.
+ * @param[in] target        Start address
+ * @param[in] follow_mem    Whether to follow `jmp [rip + disp32]`
+ * @return                  The first address that is not a jump. If the chain
+ *                          has a cycle or is too long, \p target itself.
+ */
+static uint8_t* _x86_64_follow_jump(uint8_t* target, int follow_mem)
+{
+    uint8_t* visited[X86_64_JUMP_CHAIN_MAX_DEPTH + 1];
+    size_t depth, i;
+
+    visited[0] = target;
+    for (depth = 0; depth < X86_64_JUMP_CHAIN_MAX_DEPTH; depth++)
+    {
+        uint8_t* dst = _x86_64_jump_destination(visited[depth], follow_mem);
+        if (dst == NULL)
+        {
+            return visited[depth];
+        }
+
+        for (i = 0; i <= depth; i++)
+        {
+            if (visited[i] == dst)
+            {
+                LOG("jump chain from %p has a cycle", (void*)target);
+                return target;
+            }
+        }
+        visited[depth + 1] = dst;
+    }
+
+    if (_x86_64_jump_destination(visited[depth], follow_mem) != NULL)
+    {
+        LOG("jump chain from %p is too long", (void*)target);
+        return target;
+    }
+    return visited[depth];
+}
+
+/**
+ * @brief Inject target that starts with a jump to another function.
+ *
+ * The original function is the end of jump chain, so `fcall` goes there
+ * directly instead of through a relocated copy of the jump.
+ *
+ * @return  #uhook_errno, #UHOOK_NOFUNCSIZE if target is not such a thunk.
+ */
+static int _x86_64_try_inject_thunk(void** token, void** fn_call, void* target, void* detour)
+{
+    uint8_t* first = _x86_64_jump_destination(target, 0);
+    if (first == NULL)
+    {
+        return UHOOK_NOFUNCSIZE;
+    }
+
+    /* A jump inside function body, such as loop entry, is not a thunk */
+    size_t target_func_size = elf_get_function_size(target);
+    if (target_func_size == (size_t)-1
+        || (first >= (uint8_t*)target && first < (uint8_t*)target + target_func_size))
+    {
+        return UHOOK_NOFUNCSIZE;
+    }
+
+    uint8_t* origin = _x86_64_follow_jump(target, 0);
+    if (origin == target)
+    {
+        return UHOOK_NOFUNCSIZE;
+    }
+
+    int ret;
+    x86_64_trampoline_t* handle = _alloc_execute_block(sizeof(x86_64_trampoline_t));
+    if (handle == NULL)
+    {
+        return UHOOK_NOMEM;
+    }
+    memset(handle, 0, sizeof(x86_64_trampoline_t));
+    handle->in_block = 1;
+
+    if ((ret = _x86_64_init_handle(handle, target, detour, target_func_size)) != UHOOK_SUCCESS)
+    {
+        _free_execute_block(handle, sizeof(x86_64_trampoline_t));
+        return ret;
+    }
+
+    if ((ret = _x86_64_commit_inject(handle, token, fn_call, origin)) != UHOOK_SUCCESS)
+    {
+        uhook_x86_64_release(handle);
+        return ret;
+    }
+
+    return UHOOK_SUCCESS;
+}
+
+void* uhook_x86_64_follow_jump(void* target)
+{
+    return _x86_64_follow_jump(target, 1);
+}
+
+/**
+ * @brief Try to inject \p target through its NOP sled.
+ * @return  #uhook_errno, #UHOOK_NOFUNCSIZE if there is no usable sled.
+ */
+static int _x86_64_try_inject_sled(void** token, void** fn_call, void* target, void* detour)
+{
+    uint8_t* site;
+    size_t sled_size = _x86_64_get_sled(target, &site);
+    if (sled_size == 0)
+    {
+        return UHOOK_NOFUNCSIZE;
+    }
+
+    int ret = _x86_64_inject_sled(token, fn_call, site, sled_size, detour);
+    return ret == UHOOK_SMALLFUNC ? UHOOK_NOFUNCSIZE : ret;
+}
+
+int uhook_x86_64_inject(void** token, void** fn_call, void* target, void* detour)
+{
+    int ret;
+    uhook_plan_cache_entry_t plan;
+    uhook_plan_reloc_list_t relocs = { NULL, 0, 0 };
+
+    /* A cached plan means sled and thunk were not usable last time */
+    int cached = uhook_plan_cache_lookup(target, &plan);
+    if (!cached && ((ret = _x86_64_try_inject_sled(token, fn_call, target, detour)) != UHOOK_NOFUNCSIZE
+        || (ret = _x86_64_try_inject_thunk(token, fn_call, target, detour)) != UHOOK_NOFUNCSIZE))
+    {
+        return ret;
+    }
+
+    size_t target_func_size = cached ? plan.func_size : elf_get_function_size(target);
+    if (target_func_size == (size_t)-1)
+    {
+        return UHOOK_NOFUNCSIZE;
+    }
+
+    /* Only branches in plan may need a forward jump */
+    size_t trampoline_size = cached ? target_func_size + X86_64_OPCODE_SIZE_JUMP_FAR * plan.reloc_num
+        : _x86_64_calc_trampoline_size(target, target_func_size);
+    size_t malloc_size = ALIGN_SIZE(sizeof(x86_64_trampoline_t) + trampoline_size, _get_page_size());
+
+    x86_64_trampoline_t* handle = _alloc_execute_memory(malloc_size);
+    if (handle == NULL)
+    {
+        LOG("alloc execute memory with size(%zu) failed", malloc_size);
+        return UHOOK_NOMEM;
+    }
+    memset(handle, X86_64_OPCODE_INT3, malloc_size);
+    handle->in_block = 0;
+
+    if ((ret = _x86_64_init_handle(handle, target, detour, target_func_size)) != UHOOK_SUCCESS)
+    {
+        _free_execute_memory(handle);
+        return ret;
+    }
+
+    if (_x86_64_build_trampoline(handle, handle->storage, malloc_size - sizeof(x86_64_trampoline_t),
+        cached ? &plan : NULL, cached ? NULL : &relocs) < 0)
+    {
+        ret = UHOOK_UNKNOWN;
+        goto err;
+    }
+
+    /* Target is still untouched, so the plan can be verified by its bytes next time */
+    if (!cached)
+    {
+        plan.func_size = target_func_size;
+        plan.relocs = relocs.data;
+        plan.reloc_num = relocs.num;
+        uhook_plan_cache_record(target, &plan);
+    }
+
+    if ((ret = _x86_64_commit_inject(handle, token, fn_call, handle->trampoline)) != UHOOK_SUCCESS)
+    {
+        goto err;
+    }
+
+    free(relocs.data);
+    return UHOOK_SUCCESS;
+
+err:
+    free(relocs.data);
+    uhook_x86_64_release(handle);
+    return ret;
+}
+
+/**
+ * @brief Build trampoline that executes the instruction replaced by `int3`
+ *   and jumps back to the next one.
+ * @return  0 if success, -1 if failure.
+ */
+static int _x86_64_build_trap_trampoline(x86_64_trampoline_t* handle, size_t cap)
+{
+    handle->trampoline = handle->storage;
+    handle->trampoline_cap = cap;
+    memcpy(handle->trampoline, handle->backup_opcode, handle->size_target);
+
+    /* Branches to the end of copied instruction take this jump too */
+    int ret = _x86_64_fill_jump_code_far(handle->trampoline + handle->size_target,
+        cap - handle->size_target, handle->addr_target + handle->size_target);
+    if (ret < 0)
+    {
+        return -1;
+    }
+    handle->trampoline_size = handle->size_target + ret;
+
+    return _x86_64_generate_trampoline_opcode(handle, NULL);
+}
+
+int uhook_x86_64_inject_trap(void** token, void** fn_call, void* target, void* detour)
+{
+    int ret;
+    ZydisDecodedInstruction instruction;
+    if (!ZYAN_SUCCESS(ZydisDecoderDecodeBuffer(&_x86_64_get_decoder()->minimal, target,
+        X86_64_MAX_INSTRUCTION_SIZE, &instruction)))
+    {
+        LOG("decode first instruction of target(%p) failed", target);
+        return UHOOK_UNKNOWN;
+    }
+
+    /* Copied instruction, jump back and forward jump of a branch */
+    size_t cap = instruction.length + X86_64_OPCODE_SIZE_JUMP_FAR * 2;
+    size_t malloc_size = ALIGN_SIZE(sizeof(x86_64_trampoline_t) + cap, _get_page_size());
+
+    x86_64_trampoline_t* handle = _alloc_execute_memory(malloc_size);
+    if (handle == NULL)
+    {
+        return UHOOK_NOMEM;
+    }
+    memset(handle, X86_64_OPCODE_INT3, malloc_size);
+    handle->in_block = 0;
+
+    handle->addr_target = target;
+    handle->addr_detour = detour;
+    handle->size_target = instruction.length;
+    handle->cave = NULL;
+    handle->is_trap = 1;
+    handle->redirect_opcode[0] = X86_64_OPCODE_INT3;
+    handle->redirect_size = 1;
+    handle->patch_size = 1;
+    memcpy(handle->backup_opcode, target, instruction.length);
+
+    if (_x86_64_build_trap_trampoline(handle, cap) < 0)
+    {
+        _free_execute_memory(handle);
+        return UHOOK_UNKNOWN;
+    }
+
+    if ((ret = uhook_trap_register(target, detour)) != UHOOK_SUCCESS)
+    {
+        _free_execute_memory(handle);
+        return ret;
+    }
+
+    if ((ret = _x86_64_commit_inject(handle, token, fn_call, handle->trampoline)) != UHOOK_SUCCESS)
+    {
+        uhook_x86_64_release(handle);
+        return ret;
+    }
+
+    return UHOOK_SUCCESS;
+}
+
+/**
+ * @brief Walk instructions like #_x86_64_generate_trampoline_opcode() does,
+ *   without writing anything.
+ * @param[in] target        Target function, not redirected yet.
+ * @param[in] base          Where trampoline will be built
+ * @param[in,out] report    `func_size` and `patch_size` are read, the rest
+ *                          of trampoline fields are written.
+ * @return  #uhook_errno
+ */
+static int _x86_64_plan_trampoline(const uint8_t* target, const uint8_t* base, uhook_plan_t* report)
+{
+    x86_64_decoder_ctx_t* decoder = _x86_64_get_decoder();
+    ZydisDecodedInstruction instruction;
+    size_t func_size = report->func_size;
+    size_t trampoline_size = func_size;
+
+    size_t pos;
+    for (pos = 0;
+        ZYAN_SUCCESS(ZydisDecoderDecodeBuffer(&decoder->minimal, target + pos, func_size - pos, &instruction));
+        pos += instruction.length)
+    {
+        int32_t disp;
+        if (_x86_64_is_rip_relative(&instruction))
+        {
+            report->rip_relative++;
+            if (!_x86_64_rebase_rip_relative(&instruction, target + pos, base + pos, &disp))
+            {
+                report->reloc_fail++;
+            }
+            continue;
+        }
+
+        if (!_x86_64_is_jump_insn(instruction.mnemonic))
+        {
+            continue;
+        }
+
+        ZyanU64 dst_addr;
+        if (!ZYAN_SUCCESS(ZydisDecoderDecodeBuffer(&decoder->full, target + pos, func_size - pos, &instruction)))
+        {
+            report->reloc_fail++;
+            break;
+        }
+        if (instruction.operands[0].type != ZYDIS_OPERAND_TYPE_IMMEDIATE)
+        {
+            continue;
+        }
+        if (!ZYAN_SUCCESS(ZydisCalcAbsoluteAddress(&instruction, &instruction.operands[0],
+            (ZyanU64)(uintptr_t)(target + pos), &dst_addr)))
+        {
+            report->reloc_fail++;
+            break;
+        }
+
+        if ((uintptr_t)target <= dst_addr && dst_addr <= (uintptr_t)target + func_size)
+        {
+            if (dst_addr > (uintptr_t)target && dst_addr < (uintptr_t)target + report->patch_size)
+            {
+                report->branch_in++;
+            }
+            continue;
+        }
+
+        /* Same choices as #_x86_64_fix_jcc() */
+        report->reloc_num++;
+        if (_x86_64_calc_mini_addr_width(dst_addr - (uintptr_t)(base + pos + instruction.length))
+            <= instruction.operands[0].size)
+        {
+            continue;
+        }
+        if (_x86_64_calc_mini_addr_width(trampoline_size - pos - instruction.length) > instruction.operands[0].size)
+        {
+            report->reloc_fail++;
+            continue;
+        }
+        trampoline_size += X86_64_OPCODE_SIZE_JUMP_FAR;
+    }
+
+    report->trampoline_size = trampoline_size;
+    return report->reloc_fail != 0 ? UHOOK_UNKNOWN : UHOOK_SUCCESS;
+}
+
+#if defined(__x86_64__)
+
+static void _x86_64_init_lazy(void)
+{
+    uhook_mutex_init(&s_x86_64_lazy_mutex);
+}
+
+static void _x86_64_fill_lazy_cell(x86_64_trampoline_t* handle)
+{
+    static const uint8_t code[] = {
+        0x4c, 0x8d, 0x1d, 0x11, 0x00, 0x00, 0x00,   /* lea r11, [rip + 0x11] */
+        0xff, 0x25, 0x03, 0x00, 0x00, 0x00,         /* jmp qword ptr [rip + 0x03] */
+    };
+
+    memset(handle->lazy.code, X86_64_OPCODE_INT3, sizeof(handle->lazy.code));
+    memcpy(handle->lazy.code, code, sizeof(code));
+    handle->lazy.jmp_slot = (uint64_t)(uintptr_t)uhook_x86_64_lazy_resolver;
+    handle->lazy.handle = (uint64_t)(uintptr_t)handle;
+}
+
+void* uhook_x86_64_lazy_resolve(x86_64_trampoline_t* handle)
+{
+    pthread_once(&s_x86_64_lazy_once, _x86_64_init_lazy);
+    uhook_mutex_lock(&s_x86_64_lazy_mutex);
+
+    /* Inject checked the trampoline at its reserved memory, so it is always built */
+    if (handle->trampoline == NULL)
+    {
+        _x86_64_build_trampoline(handle, handle->lazy_buffer, handle->trampoline_cap, NULL, NULL);
+        __atomic_store_n(&handle->lazy.jmp_slot, (uint64_t)(uintptr_t)handle->trampoline, __ATOMIC_RELEASE);
+    }
+
+    uhook_mutex_unlock(&s_x86_64_lazy_mutex);
+    return handle->trampoline;
+}
+
+int uhook_x86_64_inject_lazy(void** token, void** fn_call, void* target, void* detour)
+{
+    int ret;
+    if ((ret = _x86_64_try_inject_sled(token, fn_call, target, detour)) != UHOOK_NOFUNCSIZE
+        || (ret = _x86_64_try_inject_thunk(token, fn_call, target, detour)) != UHOOK_NOFUNCSIZE)
+    {
+        return ret;
+    }
+
+    size_t target_func_size = elf_get_function_size(target);
+    if (target_func_size == (size_t)-1)
+    {
+        return UHOOK_NOFUNCSIZE;
+    }
+
+    x86_64_trampoline_t* handle = _alloc_execute_block(sizeof(x86_64_trampoline_t));
+    if (handle == NULL)
+    {
+        return UHOOK_NOMEM;
+    }
+    memset(handle, 0, sizeof(x86_64_trampoline_t));
+    handle->in_block = 1;
+
+    if ((ret = _x86_64_init_handle(handle, target, detour, target_func_size)) != UHOOK_SUCCESS)
+    {
+        _free_execute_block(handle, sizeof(x86_64_trampoline_t));
+        return ret;
+    }
+
+    /* Only building is deferred, first call to fcall has no way to report failure */
+    handle->trampoline_cap = ALIGN_SIZE(_x86_64_calc_trampoline_size(target, target_func_size), _get_page_size());
+    if ((handle->lazy_buffer = _alloc_execute_memory(handle->trampoline_cap)) == NULL)
+    {
+        uhook_x86_64_release(handle);
+        return UHOOK_NOMEM;
+    }
+    memset(handle->lazy_buffer, X86_64_OPCODE_INT3, handle->trampoline_cap);
+
+    uhook_plan_t plan;
+    memset(&plan, 0, sizeof(plan));
+    plan.func_size = target_func_size;
+    if ((ret = _x86_64_plan_trampoline(target, handle->lazy_buffer, &plan)) != UHOOK_SUCCESS)
+    {
+        LOG("trampoline of target(%p) cannot be relocated", target);
+        uhook_x86_64_release(handle);
+        return ret;
+    }
+    _x86_64_fill_lazy_cell(handle);
+
+    if ((ret = _x86_64_commit_inject(handle, token, fn_call, handle->lazy.code)) != UHOOK_SUCCESS)
+    {
+        uhook_x86_64_release(handle);
+        return ret;
+    }
+
+    return UHOOK_SUCCESS;
+}
+
+#else
+
+int uhook_x86_64_inject_lazy(void** token, void** fn_call, void* target, void* detour)
+{
+    return uhook_x86_64_inject(token, fn_call, target, detour);
+}
+
+#endif
+
+void uhook_x86_64_uninject(void* token)
+{
+    x86_64_trampoline_t* handle = token;
+
+    uint8_t* addr; size_t size;
+    _x86_64_get_patch_range(handle, handle->patch_size, &addr, &size);
+
+    if (_system_modify_opcode(addr, size, _x86_64_undo_inject, handle) > 0)
+    {
+        assert(!"modify opcode failed");
+    }
+    _flush_instruction_cache(addr, size);
+    uhook_x86_64_release(handle);
+}
+
+void uhook_x86_64_release(void* token)
+{
+    x86_64_trampoline_t* handle = token;
+    if (handle->cave != NULL)
+    {
+        uhook_cave_free(handle->cave, handle->cave_size);
+    }
+    if (handle->is_trap)
+    {
+        uhook_trap_unregister(handle->addr_target);
+    }
+
+    if (!handle->in_block)
+    {
+        _free_execute_memory(handle);
+        return;
+    }
+
+    if (handle->lazy_buffer != NULL)
+    {
+        _free_execute_memory(handle->lazy_buffer);
+    }
+    _free_execute_block(handle, sizeof(x86_64_trampoline_t));
+}
+
+void uhook_x86_64_patch_range(void* token, void** addr, size_t* size)
+{
+    x86_64_trampoline_t* handle = token;
+    _x86_64_get_patch_range(handle, handle->patch_size, (uint8_t**)addr, size);
+}
+
+void uhook_x86_64_toggle(void* token, int enable)
+{
+    x86_64_trampoline_t* handle = token;
+
+    if (enable)
+    {
+        _x86_64_do_inject(handle);
+    }
+    else
+    {
+        _x86_64_undo_inject(handle);
+    }
+
+    uint8_t* addr; size_t size;
+    _x86_64_get_patch_range(handle, handle->patch_size, &addr, &size);
+    _flush_instruction_cache(addr, size);
+}
+
+int uhook_x86_64_retarget(void* token, void* detour)
+{
+    x86_64_trampoline_t* handle = token;
+
+    uint8_t redirect_opcode[X86_64_OPCODE_SIZE_JUMP_FAR];
+    if (handle->is_trap)
+    {
+        uhook_trap_update(handle->addr_target, detour);
+        handle->addr_detour = detour;
+        return UHOOK_SUCCESS;
+    }
+    if (handle->cave != NULL)
+    {
+        /* Target keeps jumping into code cave, only the cave changes */
+        int ret = _x86_64_fill_jump_code(redirect_opcode, sizeof(redirect_opcode), handle->cave, detour);
+        if (ret < 0 || (size_t)ret > handle->cave_size)
+        {
+            LOG("code cave(%p) size is too small, need(%d) actual(%zu)", handle->cave, ret, handle->cave_size);
+            return UHOOK_SMALLFUNC;
+        }
+        memcpy(handle->cave_opcode, redirect_opcode, ret);
+        handle->cave_opcode_size = ret;
+        handle->addr_detour = detour;
+        return UHOOK_SUCCESS;
+    }
+
+    int ret = _x86_64_fill_jump_code(redirect_opcode, sizeof(redirect_opcode), handle->addr_target, detour);
+    if (ret < 0)
+    {
+        return UHOOK_UNKNOWN;
+    }
+    if ((size_t)ret > handle->size_target)
+    {
+        LOG("target(%p) size is too small, need(%zu) actual(%zu)", handle->addr_target, (size_t)ret, handle->size_target);
+        return UHOOK_SMALLFUNC;
+    }
+
+    /* Trampoline is a full copy of target, so redirect size does not affect it */
+    memcpy(handle->redirect_opcode, redirect_opcode, ret);
+    handle->addr_detour = detour;
+    handle->redirect_size = ret;
+    if (handle->patch_size < (size_t)ret)
+    {
+        handle->patch_size = ret;
+    }
+
+    return UHOOK_SUCCESS;
+}
+
+void* uhook_x86_64_forward_create(void* dst)
+{
+    uint8_t* block = _alloc_execute_block(X86_64_FORWARD_BLOCK_SIZE);
+    if (block == NULL)
+    {
+        return NULL;
+    }
+    memset(block, X86_64_OPCODE_INT3, X86_64_FORWARD_BLOCK_SIZE);
+
+    uint8_t* stub = block + X86_64_FORWARD_OFFSET;
+    _x86_64_fill_jump_code_far(stub, X86_64_OPCODE_SIZE_JUMP_FAR, dst);
+
+    return stub;
+}
+
+void uhook_x86_64_forward_update(void* stub, void* dst)
+{
+    uint64_t* addr = (uint64_t*)((uint8_t*)stub + X86_64_OPCODE_SIZE_JUMP_FAR - sizeof(uint64_t));
+    __atomic_store_n(addr, (uint64_t)dst, __ATOMIC_RELEASE);
+}
+
+void uhook_x86_64_forward_destroy(void* stub)
+{
+    _free_execute_block((uint8_t*)stub - X86_64_FORWARD_OFFSET, X86_64_FORWARD_BLOCK_SIZE);
+}
+
+/**
+ * @brief Plan redirect at entry.
+ * @return  #uhook_errno
+ */
+static int _x86_64_plan_redirect(uint8_t* target, size_t func_size, uhook_plan_t* report)
+{
+    if (func_size >= X86_64_OPCODE_SIZE_JUMP_NEAR)
+    {
+        report->patch_size = X86_64_OPCODE_SIZE_JUMP_NEAR;
+        return UHOOK_SUCCESS;
+    }
+
+    /* Same range as #_x86_64_init_cave() */
+    uint8_t* lo = target + X86_64_OPCODE_SIZE_JUMP_SHORT - 128;
+    uint8_t* hi = target + X86_64_OPCODE_SIZE_JUMP_SHORT + 128;
+    if (func_size >= X86_64_OPCODE_SIZE_JUMP_SHORT
+        && uhook_cave_probe(target, lo, hi, X86_64_OPCODE_SIZE_JUMP_NEAR, _x86_64_filler_length))
+    {
+        report->cave = 1;
+        report->patch_size = X86_64_OPCODE_SIZE_JUMP_SHORT;
+        return UHOOK_SUCCESS;
+    }
+
+    return UHOOK_SMALLFUNC;
+}
+
+/**
+ * @brief Check target the same way as #uhook_x86_64_inject().
+ * @return  #uhook_errno, #UHOOK_NOFUNCSIZE if not applicable.
+ */
+static int _x86_64_plan_sled(uint8_t* target, uhook_plan_t* report)
+{
+    uint8_t* site;
+    size_t sled_size = _x86_64_get_sled(target, &site);
+    if (sled_size < X86_64_OPCODE_SIZE_JUMP_NEAR)
+    {
+        return UHOOK_NOFUNCSIZE;
+    }
+
+    report->method = UHOOK_PLAN_SLED;
+    report->patch_size = X86_64_OPCODE_SIZE_JUMP_NEAR;
+    return UHOOK_SUCCESS;
+}
+
+/**
+ * @see _x86_64_try_inject_thunk()
+ * @return  #uhook_errno, #UHOOK_NOFUNCSIZE if not applicable.
+ */
+static int _x86_64_plan_thunk(uint8_t* target, uhook_plan_t* report)
+{
+    uint8_t* first = _x86_64_jump_destination(target, 0);
+    if (first == NULL || report->func_size == 0
+        || (first >= target && first < target + report->func_size)
+        || _x86_64_follow_jump(target, 0) == target)
+    {
+        return UHOOK_NOFUNCSIZE;
+    }
+
+    report->method = UHOOK_PLAN_THUNK;
+    return _x86_64_plan_redirect(target, report->func_size, report);
+}
+
+int uhook_x86_64_plan(void* target, uhook_plan_t* report)
+{
+    memset(report, 0, sizeof(*report));
+
+    size_t func_size = elf_get_function_size(target);
+    report->func_size = func_size == (size_t)-1 ? 0 : func_size;
+
+    int ret;
+    if ((ret = _x86_64_plan_sled(target, report)) != UHOOK_NOFUNCSIZE
+        || (ret = _x86_64_plan_thunk(target, report)) != UHOOK_NOFUNCSIZE)
+    {
+        goto fin;
+    }
+
+    report->method = UHOOK_PLAN_TRAMPOLINE;
+    if (report->func_size == 0)
+    {
+        ret = UHOOK_NOFUNCSIZE;
+        goto fin;
+    }
+    if ((ret = _x86_64_plan_redirect(target, report->func_size, report)) != UHOOK_SUCCESS)
+    {
+        goto fin;
+    }
+
+    /* Eager trampoline lives in heap, so probe where it would be */
+    uint8_t* probe = _alloc_execute_memory(_get_page_size());
+    if (probe == NULL)
+    {
+        ret = UHOOK_NOMEM;
+        goto fin;
+    }
+    ret = _x86_64_plan_trampoline(target, probe, report);
+    _free_execute_memory(probe);
+
+fin:
+    report->result = ret;
+    return ret;
+}
+
+/**
+ * @brief Decode branch that may reference another function.
+ * @param[in] code  Instruction
+ * @param[in] size  Available bytes
+ * @param[out] dest Destination, or address of slot for indirect branch
+ * @param[out] type Bit-OR of #uhook_xref_type
+ * @return          Instruction length, or 0 if not a branch.
+ */
+static size_t _x86_64_xref_decode(const uint8_t* code, size_t size, uintptr_t* dest, unsigned* type)
+{
+    int32_t rel;
+
+    if (size >= 5 && (code[0] == 0xe8 || code[0] == 0xe9))
+    {
+        memcpy(&rel, code + 1, sizeof(rel));
+        *dest = (uintptr_t)(code + 5 + rel);
+        *type = code[0] == 0xe8 ? UHOOK_XREF_CALL : UHOOK_XREF_JMP;
+        return 5;
+    }
+
+    /* `call [rip + disp32]` and `jmp [rip + disp32]`, only 64-bit mode is rip relative */
+    if (size >= 6 && sizeof(void*) == 8 && code[0] == 0xff && (code[1] == 0x15 || code[1] == 0x25))
+    {
+        memcpy(&rel, code + 2, sizeof(rel));
+        *dest = (uintptr_t)(code + 6 + rel);
+        *type = UHOOK_XREF_INDIRECT | (code[1] == 0x15 ? UHOOK_XREF_CALL : UHOOK_XREF_JMP);
+        return 6;
+    }
+
+    return 0;
+}
+
+static int _x86_64_xref_add(const uint8_t* code, size_t size, uhook_xref_list_t* list)
+{
+    uintptr_t dest; unsigned type;
+    if (_x86_64_xref_decode(code, size, &dest, &type) == 0)
+    {
+        return UHOOK_SUCCESS;
+    }
+    return uhook_xref_list_push(list, (uintptr_t)code, dest, type);
+}
+
+int uhook_x86_64_xref_scan(const uint8_t* code, size_t size, uhook_xref_list_t* list)
+{
+    int ret;
+    size_t pos = 0;
+
+#if defined(__SSE2__)
+    /* Most bytes are not a branch opcode, so look at 16 bytes at once */
+    const __m128i op_call = _mm_set1_epi8((char)0xe8);
+    const __m128i op_jmp = _mm_set1_epi8((char)0xe9);
+    const __m128i op_ff = _mm_set1_epi8((char)0xff);
+
+    for (; pos + 16 <= size; pos += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(code + pos));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, op_call),
+            _mm_cmpeq_epi8(chunk, op_jmp)), _mm_cmpeq_epi8(chunk, op_ff));
+
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+        while (mask != 0)
+        {
+            size_t off = pos + (size_t)__builtin_ctz(mask);
+            mask &= mask - 1;
+
+            if ((ret = _x86_64_xref_add(code + off, size - off, list)) != UHOOK_SUCCESS)
+            {
+                return ret;
+            }
+        }
+    }
+#endif
+
+    for (; pos < size; pos++)
+    {
+        if ((ret = _x86_64_xref_add(code + pos, size - pos, list)) != UHOOK_SUCCESS)
+        {
+            return ret;
+        }
+    }
+
+    return UHOOK_SUCCESS;
+}
+
+int uhook_x86_64_xref_confirm(const uhook_xref_site_t* xref)
+{
+    uint8_t* site = (uint8_t*)xref->site;
+    void* start; size_t func_size;
+    if (elf_find_function(site, &start, &func_size) != 0)
+    {
+        return 0;
+    }
+
+    size_t offset = site - (uint8_t*)start;
+    uintptr_t dest; unsigned type;
+    size_t size = _x86_64_xref_decode(site, func_size - offset, &dest, &type);
+    if (size == 0 || dest != xref->dest || type != xref->type)
+    {
+        return 0;
+    }
+
+    /* Make sure it is not bytes in the middle of another instruction */
+    x86_64_decoder_ctx_t* decoder = _x86_64_get_decoder();
+    ZydisDecodedInstruction instruction;
+
+    size_t pos = 0;
+    while (pos < offset)
+    {
+        if (!ZYAN_SUCCESS(ZydisDecoderDecodeBuffer(&decoder->minimal, (uint8_t*)start + pos,
+            func_size - pos, &instruction)))
+        {
+            return 0;
+        }
+        pos += instruction.length;
+    }
+
+    ZydisMnemonic mnemonic = (type & UHOOK_XREF_CALL) ? ZYDIS_MNEMONIC_CALL : ZYDIS_MNEMONIC_JMP;
+    return pos == offset
+        && ZYAN_SUCCESS(ZydisDecoderDecodeBuffer(&decoder->minimal, site, func_size - pos, &instruction))
+        && instruction.length == size && instruction.mnemonic == mnemonic;
+}
+
+/**
+ * @brief A call instruction rewritten to call detour.
+ */
+typedef struct x86_64_callsite
+{
+    uint8_t*    addr;                   /**< Address of call */
+    size_t      size;                   /**< Instruction size, 5 for `call rel32`, 6 for `call [rip + disp32]` */
+    uint8_t     backup[6];              /**< Original instruction */
+    uint8_t     patch[6];               /**< `call detour`, with `cs` prefix if size is 6 */
+}x86_64_callsite_t;
+
+typedef struct x86_64_callsite_set
+{
+    int                 enable;         /**< Which opcode to write */
+    size_t              num;            /**< Amount of call sites */
+    x86_64_callsite_t*  sites;          /**< Call sites */
+}x86_64_callsite_set_t;
+
+/**
+ * @return bool, whether call site is added.
+ */
+static int _x86_64_add_callsite(x86_64_callsite_set_t* set, const uhook_xref_t* xref, uint8_t* detour)
+{
+    uint8_t* site = xref->site;
+    size_t size = (xref->type & UHOOK_XREF_INDIRECT) ? 6 : 5;
+    ptrdiff_t addr_diff = detour - (site + size);
+
+    if (!(xref->type & UHOOK_XREF_CALL))
+    {
+        return 0;
+    }
+    if (!_x86_64_is_32bit_size(addr_diff))
+    {
+        LOG("detour(%p) is too far away from call site(%p)", (void*)detour, (void*)site);
+        return 0;
+    }
+
+    x86_64_callsite_t* callsite = &set->sites[set->num++];
+    callsite->addr = site;
+    callsite->size = size;
+    memcpy(callsite->backup, site, size);
+
+    /*
+     * `call [rip + disp32]` is one byte longer. Pad it with an ignored `cs`
+     * prefix, so detour still returns to the original next instruction
+     * after the call site is restored.
+     */
+    int32_t rel = (int32_t)addr_diff;
+    uint8_t* patch = callsite->patch;
+    if (size == 6)
+    {
+        *patch++ = 0x2e;
+    }
+    patch[0] = 0xe8;
+    memcpy(&patch[1], &rel, sizeof(rel));
+
+    return 1;
+}
+
+static int _x86_64_callsite_range(void* data, size_t idx, void** addr, size_t* size)
+{
+    x86_64_callsite_set_t* set = data;
+    *addr = set->sites[idx].addr;
+    *size = set->sites[idx].size;
+    return 0;
+}
+
+static void _x86_64_callsite_write(void* data, size_t idx)
+{
+    x86_64_callsite_set_t* set = data;
+    x86_64_callsite_t* callsite = &set->sites[idx];
+
+    _x86_64_write_opcode(callsite->addr, set->enable ? callsite->patch : callsite->backup, callsite->size);
+    _flush_instruction_cache(callsite->addr, callsite->size);
+}
+
+static void _x86_64_callsite_free(x86_64_callsite_set_t* set)
+{
+    free(set->sites);
+    free(set);
+}
+
+size_t uhook_x86_64_find_callers(const void* target, uhook_xref_t* xrefs, size_t cap)
+{
+    return uhook_xref_find(target, xrefs, cap, uhook_x86_64_xref_scan, uhook_x86_64_xref_confirm);
+}
+
+int uhook_x86_64_callsite_inject(void** token, void* target, void* detour)
+{
+    int ret = UHOOK_SUCCESS;
+    uhook_xref_t* xrefs = NULL;
+    x86_64_callsite_set_t* set = calloc(1, sizeof(x86_64_callsite_set_t));
+    if (set == NULL)
+    {
+        return UHOOK_NOMEM;
+    }
+
+    size_t cap = uhook_x86_64_find_callers(target, NULL, 0);
+    if (cap == 0)
+    {
+        ret = UHOOK_NOCALLSITE;
+        goto err;
+    }
+
+    xrefs = malloc(sizeof(uhook_xref_t) * cap);
+    set->sites = malloc(sizeof(x86_64_callsite_t) * cap);
+    if (xrefs == NULL || set->sites == NULL)
+    {
+        ret = UHOOK_NOMEM;
+        goto err;
+    }
+
+    size_t i, num = uhook_x86_64_find_callers(target, xrefs, cap);
+    for (i = 0; i < num && i < cap; i++)
+    {
+        _x86_64_add_callsite(set, &xrefs[i], detour);
+    }
+    free(xrefs);
+    xrefs = NULL;
+
+    if (set->num == 0)
+    {
+        ret = UHOOK_NOCALLSITE;
+        goto err;
+    }
+
+    if ((ret = uhook_x86_64_callsite_toggle(set, 1)) != UHOOK_SUCCESS)
+    {
+        goto err;
+    }
+
+    *token = set;
+    return UHOOK_SUCCESS;
+
+err:
+    free(xrefs);
+    _x86_64_callsite_free(set);
+    return ret;
+}
+
+int uhook_x86_64_callsite_toggle(void* token, int enable)
+{
+    x86_64_callsite_set_t* set = token;
+    set->enable = enable;
+
+    if (_system_modify_opcode_batch(set->num, _x86_64_callsite_range, _x86_64_callsite_write, set) < 0)
+    {
+        return UHOOK_UNKNOWN;
+    }
+    return UHOOK_SUCCESS;
+}
+
+void uhook_x86_64_callsite_uninject(void* token)
+{
+    x86_64_callsite_set_t* set = token;
+
+    if (uhook_x86_64_callsite_toggle(set, 0) != UHOOK_SUCCESS)
+    {
+        assert(!"modify opcode failed");
+    }
+    _x86_64_callsite_free(set);
+}
+
+/**
+ * @brief Rewrite a relative branch of snippet that leaves it.
+ * @return  bool
+ */
+static int _x86_64_snippet_fix_branch(uint8_t* dst, const uhook_snippet_t* snippet, size_t pos,
+    const ZydisDecodedInstruction* insn)
+{
+    ZyanU64 dst_addr;
+    if (!ZYAN_SUCCESS(ZydisCalcAbsoluteAddress(insn, &insn->operands[0],
+        (ZyanU64)((uintptr_t)snippet->origin + pos), &dst_addr)))
+    {
+        return 0;
+    }
+
+    /* Branch inside snippet, or to its end which continues to original function */
+    if ((uintptr_t)snippet->origin <= dst_addr && dst_addr <= (uintptr_t)snippet->origin + snippet->size)
+    {
+        return 1;
+    }
+
+    /* Position independent snippet cannot leave itself */
+    if (snippet->origin == NULL || insn->raw.imm[0].size != 32)
+    {
+        return 0;
+    }
+
+    ptrdiff_t rel = (ptrdiff_t)(dst_addr - ((uintptr_t)dst + pos + insn->length));
+    if (!_x86_64_is_32bit_size(rel))
+    {
+        return 0;
+    }
+
+    int32_t rel32 = (int32_t)rel;
+    memcpy(dst + pos + insn->raw.imm[0].offset, &rel32, sizeof(rel32));
+    return 1;
+}
+
+int uhook_x86_64_snippet_relocate(uint8_t* dst, const uhook_snippet_t* snippet)
+{
+    x86_64_decoder_ctx_t* decoder = _x86_64_get_decoder();
+    ZydisDecodedInstruction instruction;
+
+    if (snippet->size == 0 || snippet->size > UHOOK_SNIPPET_MAX)
+    {
+        return UHOOK_INVALID;
+    }
+    memcpy(dst, snippet->code, snippet->size);
+
+    /* Decode from the copy, so an instruction never reads past snippet */
+    size_t pos;
+    for (pos = 0; pos < snippet->size; pos += instruction.length)
+    {
+        if (!ZYAN_SUCCESS(ZydisDecoderDecodeBuffer(&decoder->minimal, dst + pos,
+            snippet->size - pos, &instruction)))
+        {
+            LOG("snippet has invalid instruction at offset %zu", pos);
+            return UHOOK_INVALID;
+        }
+
+        if (_x86_64_is_rip_relative(&instruction))
+        {
+            int64_t disp = instruction.raw.disp.value + ((intptr_t)snippet->origin - (intptr_t)dst);
+            if (snippet->origin == NULL || instruction.raw.disp.size != 32 || !_x86_64_is_32bit_size(disp))
+            {
+                LOG("cannot relocate rip relative address at offset %zu", pos);
+                return UHOOK_INVALID;
+            }
+
+            int32_t disp32 = (int32_t)disp;
+            memcpy(dst + pos + instruction.raw.disp.offset, &disp32, sizeof(disp32));
+            continue;
+        }
+
+        if (!_x86_64_is_jump_insn(instruction.mnemonic))
+        {
+            continue;
+        }
+
+        if (!ZYAN_SUCCESS(ZydisDecoderDecodeBuffer(&decoder->full, dst + pos, snippet->size - pos, &instruction))
+            || !_x86_64_snippet_fix_branch(dst, snippet, pos, &instruction))
+        {
+            LOG("cannot relocate branch at offset %zu", pos);
+            return UHOOK_INVALID;
+        }
+    }
+
+    return UHOOK_SUCCESS;
 }
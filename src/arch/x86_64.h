@@ -5,10 +5,172 @@ extern "C" {
 #endif
 
 #include "defs.h"
+#include "xref.h"
+#include <stddef.h>
 
 API_LOCAL int uhook_x86_64_inject(void** token, void** fn_call, void* target, void* detour);
+
+/**
+ * @brief Inject without building trampoline.
+ *
+ * Only the redirect opcode is written. \p fn_call points to a small entry
+ * that builds the trampoline on first call and then jumps to it.
+ *
+ * @see uhook_x86_64_inject()
+ */
+API_LOCAL int uhook_x86_64_inject_lazy(void** token, void** fn_call, void* target, void* detour);
+
+/**
+ * @brief Inject by `int3` breakpoint.
+ *
+ * Only one byte of target is written, so it works for any target that has a
+ * decodable first instruction. Every call to target raises SIGTRAP, which is
+ * routed to \p detour, so it is much slower than a jump.
+ *
+ * @see uhook_x86_64_inject()
+ */
+API_LOCAL int uhook_x86_64_inject_trap(void** token, void** fn_call, void* target, void* detour);
+
 API_LOCAL void uhook_x86_64_uninject(void* token);
 
+/**
+ * @brief Follow jumps from \p target to the function that does the work.
+ *
+ * Direct jumps and `jmp [rip + disp32]` are followed, at most 8 of them.
+ *
+ * @param[in] target    Function address
+ * @return              Final destination, or \p target if it does not start
+ *                      with jump, or the chain has a cycle or is too long.
+ */
+API_LOCAL void* uhook_x86_64_follow_jump(void* target);
+
+/**
+ * @brief Release inject token without touching target.
+ *
+ * Use it after original opcode is written back by #uhook_x86_64_toggle().
+ *
+ * @param[in] token     Inject token
+ */
+API_LOCAL void uhook_x86_64_release(void* token);
+
+/**
+ * @brief Get the code region that #uhook_x86_64_toggle() writes.
+ * @param[in] token     Inject token
+ * @param[out] addr     Start address of patched region
+ * @param[out] size     Size of patched region
+ */
+API_LOCAL void uhook_x86_64_patch_range(void* token, void** addr, size_t* size);
+
+/**
+ * @brief Write redirect opcode or original opcode back to target.
+ *
+ * Nothing is allocated or decoded, the planned trampoline stays untouched.
+ * The caller must make the patch range writable.
+ *
+ * @param[in] token     Inject token
+ * @param[in] enable    Non-zero to write redirect opcode, zero to restore
+ */
+API_LOCAL void uhook_x86_64_toggle(void* token, int enable);
+
+/**
+ * @brief Change the detour function that target is redirected to.
+ *
+ * Only the redirect opcode is rebuilt, call #uhook_x86_64_toggle() to write it.
+ *
+ * @param[in] token     Inject token
+ * @param[in] detour    New detour function
+ * @return              #uhook_errno
+ */
+API_LOCAL int uhook_x86_64_retarget(void* token, void* detour);
+
+/**
+ * @brief Create a stub that jumps to \p dst.
+ * @param[in] dst   Destination address
+ * @return          Stub address, or NULL if failure.
+ */
+API_LOCAL void* uhook_x86_64_forward_create(void* dst);
+
+/**
+ * @brief Atomically change destination of forward stub.
+ * @param[in] stub  Stub created by #uhook_x86_64_forward_create()
+ * @param[in] dst   New destination address
+ */
+API_LOCAL void uhook_x86_64_forward_update(void* stub, void* dst);
+
+/**
+ * @brief Destroy stub created by #uhook_x86_64_forward_create()
+ * @param[in] stub  Stub address
+ */
+API_LOCAL void uhook_x86_64_forward_destroy(void* stub);
+
+/**
+ * @brief Analyze inject of \p target without side effect.
+ * @see uhook_plan()
+ * @param[in] target    Target function
+ * @param[out] report   Analyze result
+ * @return              #uhook_errno
+ */
+API_LOCAL int uhook_x86_64_plan(void* target, uhook_plan_t* report);
+
+/**
+ * @brief Find branch candidates in code.
+ * @see uhook_xref_scan_fn
+ */
+API_LOCAL int uhook_x86_64_xref_scan(const uint8_t* code, size_t size, uhook_xref_list_t* list);
+
+/**
+ * @brief Confirm candidate by decoding its function from the beginning.
+ * @see uhook_xref_confirm_fn
+ */
+API_LOCAL int uhook_x86_64_xref_confirm(const uhook_xref_site_t* xref);
+
+/**
+ * @brief Find `call`/`jmp` to \p target in loaded modules.
+ * @see uhook_find_callers()
+ */
+API_LOCAL size_t uhook_x86_64_find_callers(const void* target, uhook_xref_t* xrefs, size_t cap);
+
+/**
+ * @brief Rewrite calls to \p target into calls to \p detour.
+ *
+ * Calls found by #uhook_x86_64_find_callers() are rewritten, tail calls are
+ * left as is.
+ *
+ * @param[out] token    Inject token
+ * @param[in] target    Target function
+ * @param[in] detour    Detour function
+ * @return              #uhook_errno, #UHOOK_NOCALLSITE if no call is found.
+ */
+API_LOCAL int uhook_x86_64_callsite_inject(void** token, void* target, void* detour);
+
+/**
+ * @brief Write rewritten or original calls.
+ * @param[in] token     Inject token
+ * @param[in] enable    Non-zero to call detour
+ * @return              #uhook_errno
+ */
+API_LOCAL int uhook_x86_64_callsite_toggle(void* token, int enable);
+
+/**
+ * @brief Restore original calls and release token.
+ * @param[in] token     Inject token
+ */
+API_LOCAL void uhook_x86_64_callsite_uninject(void* token);
+
+/**
+ * @brief Copy \p snippet to \p dst and verify it.
+ *
+ * Every byte must decode as instructions. `rip` relative operands, and
+ * branches that leave snippet, are relocated from `origin` to \p dst like
+ * stolen instructions in trampoline.
+ *
+ * @param[out] dst      Where snippet runs, at least `size` bytes.
+ * @param[in] snippet   Snippet
+ * @return              #uhook_errno, #UHOOK_INVALID if snippet cannot be
+ *                      decoded or relocated.
+ */
+API_LOCAL int uhook_x86_64_snippet_relocate(uint8_t* dst, const uhook_snippet_t* snippet);
+
 #ifdef __cplusplus
 }
 #endif
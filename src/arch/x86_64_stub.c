@@ -0,0 +1,1370 @@
+#include "arch/x86_64_stub.h"
+#include "arch/x86_64.h"
+#include "os/os.h"
+#include "once.h"
+#include "mutex.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#   include <cpuid.h>
+#   include <sys/mman.h>
+#endif
+
+#define INLINE_HOOK_DEBUG
+#include "log.h"
+
+/**
+ * @brief Bytes before stub code that remember the block size and per thread
+ *   slots owned by stub.
+ * @see x86_64_stub_header_t
+ */
+#define X86_64_STUB_HEADER_SIZE     16
+
+/**
+ * @brief Max size of generated stub.
+ */
+#define X86_64_STUB_MAX_SIZE        256
+
+#define X86_64_STUB_OPCODE_INT3     (0xcc)
+
+/**
+ * @brief Max depth of hooked calls that wait for leave handler, per thread.
+ * Deeper calls still run enter handler but are not seen by leave handler.
+ */
+#define X86_64_RET_STACK_DEPTH      1024
+
+/**
+ * @brief Instructions to save vector state.
+ * @see x86_64_xsave_t
+ */
+#define X86_64_XSAVE_NONE           0
+#define X86_64_XSAVE_FXSAVE         1
+#define X86_64_XSAVE_XSAVE          2
+#define X86_64_XSAVE_XSAVEC         3
+
+/**
+ * @brief XCR0 features saved by handler stub: SSE, AVX, opmask, ZMM_Hi256
+ *   and Hi16_ZMM. x87 is left alone.
+ */
+#define X86_64_XSAVE_FEATURES       0xe6
+
+/**
+ * @brief Bit of per thread guard word that skips all guarded and bypassable
+ *   hooks. Other bits are recursion guards of hooks.
+ */
+#define X86_64_GUARD_BYPASS         0x01u
+
+/**
+ * @brief Size of code part of handler stubs, record follows.
+ */
+#define X86_64_STUB_CODE_SIZE       64
+
+/**
+ * @brief Size of code part of guard stubs, so filters fit in and all jumps
+ *   to original function are short.
+ */
+#define X86_64_GUARD_CODE_SIZE      128
+
+/**
+ * @brief Size of `movabs r11, &fcall; jmp qword ptr [r11]` after snippet.
+ */
+#define X86_64_STUB_TAIL_SIZE       13
+
+/**
+ * @brief Amount of per thread sampler counters.
+ */
+#define X86_64_SAMPLE_SLOTS         64
+
+/**
+ * @brief Condition codes of `jcc`.
+ */
+#define X86_64_CC_B                 0x2
+#define X86_64_CC_AE                0x3
+#define X86_64_CC_E                 0x4
+#define X86_64_CC_NE                0x5
+
+typedef struct x86_64_stub_header
+{
+    size_t      block_size; /**< Size of whole block */
+    uint32_t    guard;      /**< Guard bit owned by stub, 0 if none */
+    uint32_t    sample;     /**< Sampler slot owned by stub plus one, 0 if none */
+}x86_64_stub_header_t;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+/**
+ * @brief Machine code writer.
+ *
+ * Writes past capacity are dropped and remembered, so a sequence of emits
+ * only needs one check at the end.
+ */
+typedef struct x86_64_emit
+{
+    uint8_t*    code;       /**< Output */
+    size_t      size;       /**< Bytes written */
+    size_t      cap;        /**< Capacity of output */
+    int         overflow;   /**< Whether any write is dropped */
+}x86_64_emit_t;
+
+/**
+ * @brief Context of the hook whose thunk ran last on this thread.
+ *
+ * Initial-exec model keeps it at a fixed offset to `fs` base, so the thunk
+ * writes it with a single instruction.
+ */
+static __thread const uhook_ctx_t* s_x86_64_ctx __attribute__((tls_model("initial-exec")));
+
+/**
+ * @brief #X86_64_GUARD_BYPASS and recursion guards of current thread.
+ *
+ * Guard stubs test it with a single `fs` relative instruction.
+ */
+static __thread uint32_t s_x86_64_guard __attribute__((tls_model("initial-exec")));
+
+/**
+ * @brief Sampler countdowns of current thread, one slot per sampled hook.
+ */
+static __thread uint32_t s_x86_64_sample[X86_64_SAMPLE_SLOTS] __attribute__((tls_model("initial-exec")));
+
+static void _x86_64_emit_init(x86_64_emit_t* emit, uint8_t* code, size_t cap)
+{
+    emit->code = code;
+    emit->size = 0;
+    emit->cap = cap;
+    emit->overflow = 0;
+}
+
+static void _x86_64_emit(x86_64_emit_t* emit, const void* data, size_t size)
+{
+    if (size > emit->cap - emit->size)
+    {
+        emit->overflow = 1;
+        return;
+    }
+
+    memcpy(emit->code + emit->size, data, size);
+    emit->size += size;
+}
+
+static void _x86_64_emit_u32(x86_64_emit_t* emit, uint32_t value)
+{
+    _x86_64_emit(emit, &value, sizeof(value));
+}
+
+static void _x86_64_emit_u64(x86_64_emit_t* emit, uint64_t value)
+{
+    _x86_64_emit(emit, &value, sizeof(value));
+}
+
+/**
+ * @brief `movabs r11, imm64`
+ */
+static void _x86_64_emit_mov_r11_imm(x86_64_emit_t* emit, uint64_t imm)
+{
+    static const uint8_t opcode[] = { 0x49, 0xbb };
+    _x86_64_emit(emit, opcode, sizeof(opcode));
+    _x86_64_emit_u64(emit, imm);
+}
+
+/**
+ * @brief `mov qword ptr fs:[offset], r11`
+ */
+static void _x86_64_emit_store_r11_tls(x86_64_emit_t* emit, int32_t offset)
+{
+    static const uint8_t opcode[] = { 0x64, 0x4c, 0x89, 0x1c, 0x25 };
+    _x86_64_emit(emit, opcode, sizeof(opcode));
+    _x86_64_emit_u32(emit, (uint32_t)offset);
+}
+
+/**
+ * @brief `test dword ptr fs:[offset], mask`
+ */
+static void _x86_64_emit_test_tls(x86_64_emit_t* emit, int32_t offset, uint32_t mask)
+{
+    static const uint8_t opcode[] = { 0x64, 0xf7, 0x04, 0x25 };
+    _x86_64_emit(emit, opcode, sizeof(opcode));
+    _x86_64_emit_u32(emit, (uint32_t)offset);
+    _x86_64_emit_u32(emit, mask);
+}
+
+/**
+ * @brief Instruction whose last field is a `rip` relative disp32 to \p target.
+ */
+static void _x86_64_emit_rip_insn(x86_64_emit_t* emit, const uint8_t* opcode, size_t size, const void* target)
+{
+    _x86_64_emit(emit, opcode, size);
+    uintptr_t next = (uintptr_t)emit->code + emit->size + sizeof(uint32_t);
+    _x86_64_emit_u32(emit, (uint32_t)((uintptr_t)target - next));
+}
+
+/**
+ * @brief `jcc rel8` to a label that is not emitted yet.
+ * @param[out] fixup    Position to patch by _x86_64_emit_bind().
+ */
+static void _x86_64_emit_jcc_fwd(x86_64_emit_t* emit, uint8_t cc, size_t* fixup)
+{
+    uint8_t opcode[] = { (uint8_t)(0x70 | cc), 0x00 };
+    _x86_64_emit(emit, opcode, sizeof(opcode));
+    *fixup = emit->size;
+}
+
+/**
+ * @brief Point jumps in \p fixups to current position.
+ */
+static void _x86_64_emit_bind(x86_64_emit_t* emit, const size_t* fixups, size_t num)
+{
+    size_t i;
+    if (emit->overflow)
+    {
+        return;
+    }
+    for (i = 0; i < num; i++)
+    {
+        emit->code[fixups[i] - 1] = (uint8_t)(emit->size - fixups[i]);
+    }
+}
+
+/**
+ * @brief `jmp qword ptr [r11]`
+ */
+static void _x86_64_emit_jmp_r11_mem(x86_64_emit_t* emit)
+{
+    static const uint8_t opcode[] = { 0x41, 0xff, 0x23 };
+    _x86_64_emit(emit, opcode, sizeof(opcode));
+}
+
+/**
+ * @brief `jmp qword ptr [rip]` followed by destination.
+ */
+static void _x86_64_emit_jmp_abs(x86_64_emit_t* emit, const void* dst)
+{
+    static const uint8_t opcode[] = { 0xff, 0x25, 0x00, 0x00, 0x00, 0x00 };
+    _x86_64_emit(emit, opcode, sizeof(opcode));
+    _x86_64_emit_u64(emit, (uintptr_t)dst);
+}
+
+/**
+ * @brief Allocate executable memory for stub.
+ * @return  Stub address, or NULL if failure.
+ */
+static uint8_t* _x86_64_stub_alloc(size_t size)
+{
+    size_t block_size = X86_64_STUB_HEADER_SIZE + size;
+    uint8_t* block = _alloc_execute_block(block_size);
+    if (block == NULL)
+    {
+        return NULL;
+    }
+
+    x86_64_stub_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.block_size = block_size;
+
+    memset(block, X86_64_STUB_OPCODE_INT3, block_size);
+    memcpy(block, &header, sizeof(header));
+    return block + X86_64_STUB_HEADER_SIZE;
+}
+
+/**
+ * @brief Copy emitted code into executable memory.
+ * @return  Stub address, or NULL if failure.
+ */
+static void* _x86_64_stub_commit(const x86_64_emit_t* emit)
+{
+    if (emit->overflow)
+    {
+        LOG("stub is larger than %zu bytes", emit->cap);
+        return NULL;
+    }
+
+    uint8_t* stub = _x86_64_stub_alloc(emit->size);
+    if (stub == NULL)
+    {
+        return NULL;
+    }
+
+    memcpy(stub, emit->code, emit->size);
+    _flush_instruction_cache(stub, emit->size);
+    return stub;
+}
+
+/**
+ * @brief Get offset of initial-exec TLS variable to `fs` base.
+ *
+ * The offset is the same for all threads. `fs:0` holds the thread pointer
+ * itself on both glibc and musl.
+ *
+ * @return  bool
+ */
+static int _x86_64_tls_offset(const void* var, int32_t* offset)
+{
+    uintptr_t tp;
+    __asm__ ("movq %%fs:0, %0" : "=r"(tp));
+
+    intptr_t diff = (intptr_t)((uintptr_t)var - tp);
+    if (diff < INT32_MIN || diff > INT32_MAX)
+    {
+        return 0;
+    }
+
+    *offset = (int32_t)diff;
+    return 1;
+}
+
+void* uhook_x86_64_ctx_thunk_create(const uhook_ctx_t* record, void* detour)
+{
+    int32_t offset;
+    if (!_x86_64_tls_offset(&s_x86_64_ctx, &offset))
+    {
+        LOG("thread local context is not addressable by fs");
+        return NULL;
+    }
+
+    uint8_t code[X86_64_STUB_MAX_SIZE];
+    x86_64_emit_t emit;
+    _x86_64_emit_init(&emit, code, sizeof(code));
+
+    _x86_64_emit_mov_r11_imm(&emit, (uintptr_t)record);
+    _x86_64_emit_store_r11_tls(&emit, offset);
+    _x86_64_emit_jmp_abs(&emit, detour);
+
+    return _x86_64_stub_commit(&emit);
+}
+
+const uhook_ctx_t* uhook_x86_64_get_ctx(void)
+{
+    return s_x86_64_ctx;
+}
+
+/**
+ * @brief Handler record, stored right after code of its stub.
+ */
+typedef struct x86_64_handler
+{
+    const uhook_ctx_t*  hook;       /**< Hook context, `fcall` is where to continue */
+    uhook_handler_fn    enter;      /**< Enter handler */
+    uhook_handler_fn    leave;      /**< Leave handler */
+}x86_64_handler_t;
+
+/**
+ * @brief Where handler entry continues.
+ *
+ * Returned in `rax` and `rdx` by System V AMD64 calling convention.
+ */
+typedef struct x86_64_handler_next
+{
+    void*       addr;       /**< Original function or detour */
+    uintptr_t   call;       /**< Non-zero if original function is called by entry, zero to jump */
+}x86_64_handler_next_t;
+
+/**
+ * @brief Hooked call that waits for leave handler.
+ */
+typedef struct x86_64_ret_frame
+{
+    void*                   ret;        /**< Real return address */
+    const x86_64_handler_t* handler;    /**< Handler record */
+    uintptr_t               sp;         /**< Address of return address at function entry */
+    uint32_t                guard;      /**< Guard bit to clear on leave, 0 if none */
+    uint64_t                data;       /**< Word of handlers, see uhook_x86_64_handler_data() */
+}x86_64_ret_frame_t;
+
+typedef struct x86_64_ret_stack
+{
+    size_t                  depth;      /**< Amount of frames */
+    x86_64_ret_frame_t      frames[X86_64_RET_STACK_DEPTH];
+}x86_64_ret_stack_t;
+
+/**
+ * @brief How vector state is saved, read by the shared entries.
+ */
+typedef struct x86_64_xsave
+{
+    uint32_t    kind;       /**< #X86_64_XSAVE_FXSAVE, #X86_64_XSAVE_XSAVE or #X86_64_XSAVE_XSAVEC */
+    uint32_t    mask;       /**< Requested feature bitmap, loaded into `eax` */
+    uint64_t    size;       /**< Size of save area */
+}x86_64_xsave_t;
+
+API_LOCAL x86_64_xsave_t uhook_x86_64_xsave = { X86_64_XSAVE_NONE, 0, 0 };
+
+/**
+ * @brief Return stack of current thread, allocated on first use.
+ */
+static __thread x86_64_ret_stack_t* s_x86_64_ret_stack;
+
+static pthread_key_t s_x86_64_ret_key;
+static pthread_once_t s_x86_64_handler_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Guard bits and sampler slots that are owned by stubs.
+ */
+static uint32_t s_x86_64_guard_used = X86_64_GUARD_BYPASS;
+static uint64_t s_x86_64_sample_used = 0;
+static uhook_mutex_t s_x86_64_guard_mutex;
+
+/**
+ * @brief Guard record, stored right after code of its stub. Filter operands
+ *   are read by stub `rip` relative.
+ */
+typedef struct x86_64_guard
+{
+    const uhook_ctx_t*  hook;           /**< Hook context */
+    void*               detour;         /**< Detour function */
+    uint32_t            mask;           /**< Guard bit of this hook */
+    uint64_t            arg_value;      /**< Value compared with argument */
+    uintptr_t           caller_begin;   /**< Start of caller range */
+    uintptr_t           caller_size;    /**< Size of caller range */
+}x86_64_guard_t;
+
+/**
+ * @brief Shared entries of handler stubs, `r11` points to #x86_64_handler_t.
+ *
+ * The `_vector` variant saves vector state below #uhook_regs_t. Frame of
+ * entry is #uhook_regs_t followed by handler record and continue address.
+ * The plain one still keeps `xmm0` to `xmm7` for original function and
+ * `xmm0`, `xmm1` for caller, as code of library may use them at any
+ * optimization level.
+ *
+ * If leave handler is set, real return address is moved to return stack of
+ * current thread and original function is called by entry, instead of
+ * replacing return address in place. Each `ret` of original function and
+ * entry still pairs with a `call`, so return stack buffer of CPU predicts
+ * them.
+ */
+API_LOCAL void uhook_x86_64_handler_entry(void);
+API_LOCAL void uhook_x86_64_handler_entry_vector(void);
+
+/**
+ * @brief Call enter handler and save return address for leave handler.
+ * @return  Where to continue
+ */
+API_LOCAL x86_64_handler_next_t uhook_x86_64_handler_enter(uhook_regs_t* regs, const x86_64_handler_t* handler);
+
+/**
+ * @brief Call leave handler and put real return address back to stack.
+ *
+ * Guard bit of the call is cleared too, so it also serves guard entry.
+ */
+API_LOCAL void uhook_x86_64_handler_leave(uhook_regs_t* regs);
+
+/**
+ * @brief Shared entry of guard stubs, `r11` points to #x86_64_guard_t.
+ *
+ * Detour is called the same way entry of leave handler calls original
+ * function, so guard bit is cleared after detour returns. `xmm0` to `xmm7`
+ * are kept for detour, and `xmm0`, `xmm1` for caller.
+ */
+API_LOCAL void uhook_x86_64_guard_entry(void);
+
+/**
+ * @brief Set guard bit and save return address.
+ * @return  Where to continue
+ */
+API_LOCAL x86_64_handler_next_t uhook_x86_64_guard_enter(uhook_regs_t* regs, const x86_64_guard_t* guard);
+
+#define X86_64_ASM_SAVE_ARGS        \
+    "    movq %rdi, 0(%rsp)\n"      \
+    "    movq %rsi, 8(%rsp)\n"      \
+    "    movq %rdx, 16(%rsp)\n"     \
+    "    movq %rcx, 24(%rsp)\n"     \
+    "    movq %r8, 32(%rsp)\n"      \
+    "    movq %r9, 40(%rsp)\n"      \
+    "    movq %rax, 48(%rsp)\n"     \
+    "    movq %r10, 56(%rsp)\n"
+
+#define X86_64_ASM_LOAD_ARGS        \
+    "    movq 0(%rsp), %rdi\n"      \
+    "    movq 8(%rsp), %rsi\n"      \
+    "    movq 16(%rsp), %rdx\n"     \
+    "    movq 24(%rsp), %rcx\n"     \
+    "    movq 32(%rsp), %r8\n"      \
+    "    movq 40(%rsp), %r9\n"      \
+    "    movq 48(%rsp), %rax\n"     \
+    "    movq 56(%rsp), %r10\n"
+
+/* Save area is at rsp, XRSTOR faults unless reserved bytes of header are zero */
+#define X86_64_ASM_VECTOR_SAVE                          \
+    "    subq uhook_x86_64_xsave+8(%rip), %rsp\n"       \
+    "    andq $-64, %rsp\n"                             \
+    "    movq %rsp, -24(%rbp)\n"                        \
+    "    movl uhook_x86_64_xsave+4(%rip), %eax\n"       \
+    "    xorl %edx, %edx\n"                             \
+    "    cmpl $2, uhook_x86_64_xsave(%rip)\n"           \
+    "    jb 2f\n"                                       \
+    "    movq $0, 512(%rsp)\n"                          \
+    "    movq $0, 520(%rsp)\n"                          \
+    "    movq $0, 528(%rsp)\n"                          \
+    "    movq $0, 536(%rsp)\n"                          \
+    "    movq $0, 544(%rsp)\n"                          \
+    "    movq $0, 552(%rsp)\n"                          \
+    "    movq $0, 560(%rsp)\n"                          \
+    "    movq $0, 568(%rsp)\n"                          \
+    "    cmpl $3, uhook_x86_64_xsave(%rip)\n"           \
+    "    jne 1f\n"                                      \
+    "    xsavec64 (%rsp)\n"                             \
+    "    jmp 3f\n"                                      \
+    "1:\n"                                              \
+    "    xsave64 (%rsp)\n"                              \
+    "    jmp 3f\n"                                      \
+    "2:\n"                                              \
+    "    fxsave64 (%rsp)\n"                             \
+    "3:\n"
+
+#define X86_64_ASM_VECTOR_LOAD                          \
+    "    movl uhook_x86_64_xsave+4(%rip), %eax\n"       \
+    "    xorl %edx, %edx\n"                             \
+    "    cmpl $2, uhook_x86_64_xsave(%rip)\n"           \
+    "    jb 1f\n"                                       \
+    "    xrstor64 (%rsp)\n"                             \
+    "    jmp 2f\n"                                      \
+    "1:\n"                                              \
+    "    fxrstor64 (%rsp)\n"                            \
+    "2:\n"
+
+/*
+ * When entry calls original function, the real return address is popped,
+ * so stack arguments stay where original function expects them. Exit part
+ * makes a slot for it again.
+ */
+__asm__(
+    ".text\n"
+    ".p2align 4\n"
+    ".globl uhook_x86_64_handler_entry\n"
+    ".hidden uhook_x86_64_handler_entry\n"
+    ".type uhook_x86_64_handler_entry, @function\n"
+    "uhook_x86_64_handler_entry:\n"
+    "    pushq %rbp\n"
+    "    movq %rsp, %rbp\n"
+    "    subq $224, %rsp\n"
+    X86_64_ASM_SAVE_ARGS
+    "    leaq 8(%rbp), %rax\n"
+    "    movq %rax, 64(%rsp)\n"
+    "    movq $0, 72(%rsp)\n"
+    "    movaps %xmm0, 96(%rsp)\n"
+    "    movaps %xmm1, 112(%rsp)\n"
+    "    movaps %xmm2, 128(%rsp)\n"
+    "    movaps %xmm3, 144(%rsp)\n"
+    "    movaps %xmm4, 160(%rsp)\n"
+    "    movaps %xmm5, 176(%rsp)\n"
+    "    movaps %xmm6, 192(%rsp)\n"
+    "    movaps %xmm7, 208(%rsp)\n"
+    "    movq %rsp, %rdi\n"
+    "    movq %r11, %rsi\n"
+    "    call uhook_x86_64_handler_enter\n"
+    "    movq %rax, %r11\n"
+    "    movq %rdx, 72(%rsp)\n"
+    "    movaps 96(%rsp), %xmm0\n"
+    "    movaps 112(%rsp), %xmm1\n"
+    "    movaps 128(%rsp), %xmm2\n"
+    "    movaps 144(%rsp), %xmm3\n"
+    "    movaps 160(%rsp), %xmm4\n"
+    "    movaps 176(%rsp), %xmm5\n"
+    "    movaps 192(%rsp), %xmm6\n"
+    "    movaps 208(%rsp), %xmm7\n"
+    X86_64_ASM_LOAD_ARGS
+    "    cmpq $0, 72(%rsp)\n"
+    "    leave\n"
+    "    jne 1f\n"
+    "    jmp *%r11\n"
+    "1:\n"
+    "    addq $8, %rsp\n"
+    "    call *%r11\n"
+    "    subq $8, %rsp\n"
+    "    pushq %rbp\n"
+    "    movq %rsp, %rbp\n"
+    "    subq $112, %rsp\n"
+    "    movq %rax, 48(%rsp)\n"
+    "    movq %rdx, 16(%rsp)\n"
+    "    movaps %xmm0, 80(%rsp)\n"
+    "    movaps %xmm1, 96(%rsp)\n"
+    "    leaq 8(%rbp), %rax\n"
+    "    movq %rax, 64(%rsp)\n"
+    "    movq $0, 72(%rsp)\n"
+    "    movq %rsp, %rdi\n"
+    "    call uhook_x86_64_handler_leave\n"
+    "    movaps 80(%rsp), %xmm0\n"
+    "    movaps 96(%rsp), %xmm1\n"
+    "    movq 48(%rsp), %rax\n"
+    "    movq 16(%rsp), %rdx\n"
+    "    leave\n"
+    "    ret\n"
+    ".size uhook_x86_64_handler_entry, .-uhook_x86_64_handler_entry\n"
+
+    ".p2align 4\n"
+    ".globl uhook_x86_64_handler_entry_vector\n"
+    ".hidden uhook_x86_64_handler_entry_vector\n"
+    ".type uhook_x86_64_handler_entry_vector, @function\n"
+    "uhook_x86_64_handler_entry_vector:\n"
+    "    pushq %rbp\n"
+    "    movq %rsp, %rbp\n"
+    "    subq $96, %rsp\n"
+    X86_64_ASM_SAVE_ARGS
+    "    leaq 8(%rbp), %rax\n"
+    "    movq %rax, 64(%rsp)\n"
+    "    movq %r11, 80(%rsp)\n"
+    X86_64_ASM_VECTOR_SAVE
+    "    leaq -96(%rbp), %rdi\n"
+    "    movq -16(%rbp), %rsi\n"
+    "    call uhook_x86_64_handler_enter\n"
+    "    movq %rax, -8(%rbp)\n"
+    "    movq %rdx, -24(%rbp)\n"
+    X86_64_ASM_VECTOR_LOAD
+    "    leaq -96(%rbp), %rsp\n"
+    X86_64_ASM_LOAD_ARGS
+    "    movq 88(%rsp), %r11\n"
+    "    cmpq $0, 72(%rsp)\n"
+    "    leave\n"
+    "    jne 4f\n"
+    "    jmp *%r11\n"
+    "4:\n"
+    "    addq $8, %rsp\n"
+    "    call *%r11\n"
+    "    subq $8, %rsp\n"
+    "    pushq %rbp\n"
+    "    movq %rsp, %rbp\n"
+    "    subq $96, %rsp\n"
+    "    movq %rax, 48(%rsp)\n"
+    "    movq %rdx, 16(%rsp)\n"
+    "    leaq 8(%rbp), %rax\n"
+    "    movq %rax, 64(%rsp)\n"
+    X86_64_ASM_VECTOR_SAVE
+    "    leaq -96(%rbp), %rdi\n"
+    "    call uhook_x86_64_handler_leave\n"
+    X86_64_ASM_VECTOR_LOAD
+    "    movq -48(%rbp), %rax\n"
+    "    movq -80(%rbp), %rdx\n"
+    "    leave\n"
+    "    ret\n"
+    ".size uhook_x86_64_handler_entry_vector, .-uhook_x86_64_handler_entry_vector\n"
+
+    ".p2align 4\n"
+    ".globl uhook_x86_64_guard_entry\n"
+    ".hidden uhook_x86_64_guard_entry\n"
+    ".type uhook_x86_64_guard_entry, @function\n"
+    "uhook_x86_64_guard_entry:\n"
+    "    pushq %rbp\n"
+    "    movq %rsp, %rbp\n"
+    "    subq $224, %rsp\n"
+    X86_64_ASM_SAVE_ARGS
+    "    leaq 8(%rbp), %rax\n"
+    "    movq %rax, 64(%rsp)\n"
+    "    movq $0, 72(%rsp)\n"
+    "    movaps %xmm0, 96(%rsp)\n"
+    "    movaps %xmm1, 112(%rsp)\n"
+    "    movaps %xmm2, 128(%rsp)\n"
+    "    movaps %xmm3, 144(%rsp)\n"
+    "    movaps %xmm4, 160(%rsp)\n"
+    "    movaps %xmm5, 176(%rsp)\n"
+    "    movaps %xmm6, 192(%rsp)\n"
+    "    movaps %xmm7, 208(%rsp)\n"
+    "    movq %rsp, %rdi\n"
+    "    movq %r11, %rsi\n"
+    "    call uhook_x86_64_guard_enter\n"
+    "    movq %rax, %r11\n"
+    "    movq %rdx, 72(%rsp)\n"
+    "    movaps 96(%rsp), %xmm0\n"
+    "    movaps 112(%rsp), %xmm1\n"
+    "    movaps 128(%rsp), %xmm2\n"
+    "    movaps 144(%rsp), %xmm3\n"
+    "    movaps 160(%rsp), %xmm4\n"
+    "    movaps 176(%rsp), %xmm5\n"
+    "    movaps 192(%rsp), %xmm6\n"
+    "    movaps 208(%rsp), %xmm7\n"
+    X86_64_ASM_LOAD_ARGS
+    "    cmpq $0, 72(%rsp)\n"
+    "    leave\n"
+    "    jne 1f\n"
+    "    jmp *%r11\n"
+    "1:\n"
+    "    addq $8, %rsp\n"
+    "    call *%r11\n"
+    "    subq $8, %rsp\n"
+    "    pushq %rbp\n"
+    "    movq %rsp, %rbp\n"
+    "    subq $112, %rsp\n"
+    "    movq %rax, 48(%rsp)\n"
+    "    movq %rdx, 16(%rsp)\n"
+    "    movaps %xmm0, 80(%rsp)\n"
+    "    movaps %xmm1, 96(%rsp)\n"
+    "    leaq 8(%rbp), %rax\n"
+    "    movq %rax, 64(%rsp)\n"
+    "    movq $0, 72(%rsp)\n"
+    "    movq %rsp, %rdi\n"
+    "    call uhook_x86_64_handler_leave\n"
+    "    movaps 80(%rsp), %xmm0\n"
+    "    movaps 96(%rsp), %xmm1\n"
+    "    movq 48(%rsp), %rax\n"
+    "    movq 16(%rsp), %rdx\n"
+    "    leave\n"
+    "    ret\n"
+    ".size uhook_x86_64_guard_entry, .-uhook_x86_64_guard_entry\n"
+);
+
+static void _x86_64_ret_stack_release(void* arg)
+{
+    s_x86_64_ret_stack = NULL;
+    munmap(arg, sizeof(x86_64_ret_stack_t));
+}
+
+/**
+ * @brief Get return stack of current thread.
+ *
+ * It is mapped directly, so hooks on allocator do not recurse into here.
+ *
+ * @return  Return stack, or NULL if failure.
+ */
+static x86_64_ret_stack_t* _x86_64_ret_stack(void)
+{
+    x86_64_ret_stack_t* stack = s_x86_64_ret_stack;
+    if (stack != NULL)
+    {
+        return stack;
+    }
+
+    void* addr = mmap(NULL, sizeof(x86_64_ret_stack_t), PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    stack = addr;
+    s_x86_64_ret_stack = stack;
+    pthread_setspecific(s_x86_64_ret_key, stack);
+    return stack;
+}
+
+/**
+ * @brief Pick the cheapest way to save vector state enabled by OS.
+ */
+static void _x86_64_init_xsave(void)
+{
+    unsigned eax, ebx, ecx, edx;
+    uhook_x86_64_xsave.kind = X86_64_XSAVE_FXSAVE;
+    uhook_x86_64_xsave.mask = 0;
+    uhook_x86_64_xsave.size = 512;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE))
+    {
+        return;
+    }
+
+    uint32_t xcr0_lo, xcr0_hi;
+    __asm__ volatile ("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    uint32_t mask = xcr0_lo & X86_64_XSAVE_FEATURES;
+
+    if (!__get_cpuid_count(0xd, 1, &eax, &ebx, &ecx, &edx) || !(eax & (1u << 1)))
+    {
+        /* Standard format, size of all features enabled in XCR0 */
+        __get_cpuid_count(0xd, 0, &eax, &ebx, &ecx, &edx);
+        uhook_x86_64_xsave.kind = X86_64_XSAVE_XSAVE;
+        uhook_x86_64_xsave.mask = mask;
+        uhook_x86_64_xsave.size = ebx;
+        return;
+    }
+
+    /* Compacted format, legacy region and header followed by requested features */
+    uint64_t size = 576;
+    unsigned i;
+    for (i = 2; i < 32; i++)
+    {
+        if (!(mask & (1u << i)))
+        {
+            continue;
+        }
+        __get_cpuid_count(0xd, i, &eax, &ebx, &ecx, &edx);
+        if (ecx & (1u << 1))
+        {
+            size = ALIGN_SIZE(size, 64);
+        }
+        size += eax;
+    }
+
+    uhook_x86_64_xsave.kind = X86_64_XSAVE_XSAVEC;
+    uhook_x86_64_xsave.mask = mask;
+    uhook_x86_64_xsave.size = size;
+}
+
+static void _x86_64_init_handler(void)
+{
+    pthread_key_create(&s_x86_64_ret_key, _x86_64_ret_stack_release);
+    uhook_mutex_init(&s_x86_64_guard_mutex);
+    _x86_64_init_xsave();
+}
+
+/**
+ * @brief Drop frames whose stack is gone.
+ *
+ * Calls skipped by `longjmp()` or exception never reach leave handler. Their
+ * frames are below \p sp, while frames of calls still running are above.
+ */
+static void _x86_64_ret_stack_trim(x86_64_ret_stack_t* stack, uintptr_t sp)
+{
+    while (stack->depth > 0 && stack->frames[stack->depth - 1].sp < sp)
+    {
+        s_x86_64_guard &= ~stack->frames[--stack->depth].guard;
+    }
+}
+
+/**
+ * @brief Save return address of the call at `regs->sp`.
+ * @return  Frame, or NULL if the call is not seen by leave handler.
+ */
+static x86_64_ret_frame_t* _x86_64_ret_stack_push(uhook_regs_t* regs, const x86_64_handler_t* handler, uint32_t guard)
+{
+    x86_64_ret_stack_t* stack = _x86_64_ret_stack();
+    if (stack == NULL)
+    {
+        return NULL;
+    }
+
+    /* A frame at the same address is also dead */
+    _x86_64_ret_stack_trim(stack, (uintptr_t)regs->sp + 1);
+
+    /* Too deep, this call is not seen by leave handler */
+    if (stack->depth == X86_64_RET_STACK_DEPTH)
+    {
+        return NULL;
+    }
+
+    x86_64_ret_frame_t* frame = &stack->frames[stack->depth++];
+    frame->ret = *(void**)(uintptr_t)regs->sp;
+    frame->handler = handler;
+    frame->sp = (uintptr_t)regs->sp;
+    frame->guard = guard;
+    frame->data = 0;
+    return frame;
+}
+
+x86_64_handler_next_t uhook_x86_64_handler_enter(uhook_regs_t* regs, const x86_64_handler_t* handler)
+{
+    x86_64_handler_next_t next = { handler->hook->fcall, 0 };
+
+    /* Pushed before enter handler, so it can keep a word for leave handler */
+    if (handler->leave != NULL && _x86_64_ret_stack_push(regs, handler, 0) != NULL)
+    {
+        next.call = 1;
+    }
+
+    if (handler->enter != NULL)
+    {
+        handler->enter(regs, handler->hook->ctx);
+    }
+
+    return next;
+}
+
+void uhook_x86_64_handler_leave(uhook_regs_t* regs)
+{
+    x86_64_ret_stack_t* stack = s_x86_64_ret_stack;
+    _x86_64_ret_stack_trim(stack, (uintptr_t)regs->sp);
+
+    x86_64_ret_frame_t* frame = &stack->frames[stack->depth - 1];
+    *(void**)(uintptr_t)regs->sp = frame->ret;
+    s_x86_64_guard &= ~frame->guard;
+
+    /* Popped after leave handler, which may still read the word */
+    if (frame->handler != NULL)
+    {
+        frame->handler->leave(regs, frame->handler->hook->ctx);
+    }
+    stack->depth = (size_t)(frame - stack->frames);
+}
+
+uint64_t* uhook_x86_64_handler_data(const uhook_regs_t* regs)
+{
+    x86_64_ret_stack_t* stack = s_x86_64_ret_stack;
+    if (stack == NULL || stack->depth == 0 || stack->frames[stack->depth - 1].sp != (uintptr_t)regs->sp)
+    {
+        return NULL;
+    }
+    return &stack->frames[stack->depth - 1].data;
+}
+
+x86_64_handler_next_t uhook_x86_64_guard_enter(uhook_regs_t* regs, const x86_64_guard_t* guard)
+{
+    x86_64_handler_next_t next = { guard->detour, 0 };
+
+    /* Set first, so hooked functions used below go to original function */
+    s_x86_64_guard |= guard->mask;
+
+    /* Guard bit cannot be cleared without a frame, detour runs unguarded */
+    if (_x86_64_ret_stack_push(regs, NULL, guard->mask) == NULL)
+    {
+        s_x86_64_guard &= ~guard->mask;
+        return next;
+    }
+
+    /* Trimming may clear bit of a dead frame of the same hook */
+    s_x86_64_guard |= guard->mask;
+
+    next.call = 1;
+    return next;
+}
+
+void* uhook_x86_64_handler_create(const uhook_ctx_t* hook, const uhook_handler_t* handler)
+{
+    pthread_once(&s_x86_64_handler_once, _x86_64_init_handler);
+
+    int vector = handler->flags & UHOOK_HANDLER_VECTOR;
+    size_t code_size = X86_64_STUB_CODE_SIZE;
+
+    uint8_t* stub = _x86_64_stub_alloc(code_size + sizeof(x86_64_handler_t));
+    if (stub == NULL)
+    {
+        return NULL;
+    }
+
+    x86_64_handler_t* record = (x86_64_handler_t*)(stub + code_size);
+    record->hook = hook;
+    record->enter = handler->enter;
+    record->leave = handler->leave;
+
+    x86_64_emit_t emit;
+    _x86_64_emit_init(&emit, stub, code_size);
+    _x86_64_emit_mov_r11_imm(&emit, (uintptr_t)record);
+    _x86_64_emit_jmp_abs(&emit, vector ?
+        (void*)uhook_x86_64_handler_entry_vector : (void*)uhook_x86_64_handler_entry);
+    if (emit.overflow)
+    {
+        uhook_x86_64_stub_destroy(stub);
+        return NULL;
+    }
+
+    _flush_instruction_cache(stub, code_size + sizeof(x86_64_handler_t));
+    return stub;
+}
+
+/**
+ * @brief Take a free guard bit.
+ * @return  Guard bit, or 0 if all are in use.
+ */
+static uint32_t _x86_64_guard_alloc(void)
+{
+    uint32_t mask = 0;
+
+    uhook_mutex_lock(&s_x86_64_guard_mutex);
+    if (~s_x86_64_guard_used != 0)
+    {
+        mask = ~s_x86_64_guard_used & (s_x86_64_guard_used + 1);
+        s_x86_64_guard_used |= mask;
+    }
+    uhook_mutex_unlock(&s_x86_64_guard_mutex);
+
+    return mask;
+}
+
+static void _x86_64_guard_free(uint32_t mask)
+{
+    uhook_mutex_lock(&s_x86_64_guard_mutex);
+    s_x86_64_guard_used &= ~mask;
+    uhook_mutex_unlock(&s_x86_64_guard_mutex);
+}
+
+/**
+ * @brief Take a free sampler slot.
+ * @return  Slot plus one, or 0 if all are in use.
+ */
+static uint32_t _x86_64_sample_alloc(void)
+{
+    uint32_t slot = 0;
+
+    uhook_mutex_lock(&s_x86_64_guard_mutex);
+    if (~s_x86_64_sample_used != 0)
+    {
+        uint64_t bit = ~s_x86_64_sample_used & (s_x86_64_sample_used + 1);
+        s_x86_64_sample_used |= bit;
+        slot = (uint32_t)__builtin_ctzll(bit) + 1;
+    }
+    uhook_mutex_unlock(&s_x86_64_guard_mutex);
+
+    return slot;
+}
+
+static void _x86_64_sample_free(uint32_t slot)
+{
+    uhook_mutex_lock(&s_x86_64_guard_mutex);
+    s_x86_64_sample_used &= ~((uint64_t)1 << (slot - 1));
+    uhook_mutex_unlock(&s_x86_64_guard_mutex);
+}
+
+/**
+ * @brief Take guard bit and sampler slot, and remember them in stub header.
+ * @return  bool
+ */
+static int _x86_64_guard_take_slots(uint8_t* stub, x86_64_guard_t* record, unsigned flags,
+    const uhook_filter_t* filter, uint32_t* sample)
+{
+    x86_64_stub_header_t* header = (x86_64_stub_header_t*)(stub - X86_64_STUB_HEADER_SIZE);
+
+    if (flags & UHOOK_INJECT_GUARD)
+    {
+        if ((record->mask = _x86_64_guard_alloc()) == 0)
+        {
+            LOG("too many guarded hooks");
+            return 0;
+        }
+        header->guard = record->mask;
+    }
+
+    if (filter != NULL && (filter->flags & UHOOK_FILTER_SAMPLE))
+    {
+        if ((*sample = _x86_64_sample_alloc()) == 0)
+        {
+            LOG("too many sampled hooks");
+            return 0;
+        }
+        header->sample = *sample;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Emit filters, jumps to original function are added to \p fixups.
+ * @return  Amount of jumps added.
+ */
+static size_t _x86_64_emit_filter(x86_64_emit_t* emit, const x86_64_guard_t* record,
+    const uhook_filter_t* filter, int32_t sample_offset, size_t* fixups)
+{
+    /* rdi, rsi, rdx, rcx, r8, r9 */
+    static const uint8_t arg_regs[] = { 7, 6, 2, 1, 8, 9 };
+    /* Jump to original function if not matched, by #uhook_filter_cmp */
+    static const uint8_t arg_skip[] = { X86_64_CC_NE, X86_64_CC_E, X86_64_CC_AE, X86_64_CC_B };
+    size_t num = 0;
+
+    if (filter->flags & UHOOK_FILTER_ARG)
+    {
+        /* cmp reg, qword ptr [rip + arg_value] */
+        uint8_t reg = arg_regs[filter->arg];
+        uint8_t opcode[] = { (uint8_t)(0x48 | ((reg >> 3) << 2)), 0x3b, (uint8_t)(((reg & 7) << 3) | 0x05) };
+        _x86_64_emit_rip_insn(emit, opcode, sizeof(opcode), &record->arg_value);
+        _x86_64_emit_jcc_fwd(emit, arg_skip[filter->cmp], &fixups[num++]);
+    }
+
+    if (filter->flags & UHOOK_FILTER_CALLER)
+    {
+        /* Unsigned (ret - begin) < size */
+        static const uint8_t mov_ret[] = { 0x4c, 0x8b, 0x1c, 0x24 };
+        static const uint8_t sub_begin[] = { 0x4c, 0x2b, 0x1d };
+        static const uint8_t cmp_size[] = { 0x4c, 0x3b, 0x1d };
+        _x86_64_emit(emit, mov_ret, sizeof(mov_ret));
+        _x86_64_emit_rip_insn(emit, sub_begin, sizeof(sub_begin), &record->caller_begin);
+        _x86_64_emit_rip_insn(emit, cmp_size, sizeof(cmp_size), &record->caller_size);
+        _x86_64_emit_jcc_fwd(emit, X86_64_CC_AE, &fixups[num++]);
+    }
+
+    if (filter->flags & UHOOK_FILTER_SAMPLE)
+    {
+        /* Countdown borrows once in `sample` calls, starting from the first */
+        static const uint8_t sub_one[] = { 0x64, 0x83, 0x2c, 0x25 };
+        static const uint8_t reload[] = { 0x64, 0xc7, 0x04, 0x25 };
+        _x86_64_emit(emit, sub_one, sizeof(sub_one));
+        _x86_64_emit_u32(emit, (uint32_t)sample_offset);
+        _x86_64_emit(emit, "\x01", 1);
+        _x86_64_emit_jcc_fwd(emit, X86_64_CC_AE, &fixups[num++]);
+        _x86_64_emit(emit, reload, sizeof(reload));
+        _x86_64_emit_u32(emit, (uint32_t)sample_offset);
+        _x86_64_emit_u32(emit, filter->sample - 1);
+    }
+
+    return num;
+}
+
+void* uhook_x86_64_guard_create(const uhook_ctx_t* hook, void* detour, unsigned flags,
+    const uhook_filter_t* filter)
+{
+    pthread_once(&s_x86_64_handler_once, _x86_64_init_handler);
+
+    int32_t offset, sample_offset = 0;
+    if (!_x86_64_tls_offset(&s_x86_64_guard, &offset))
+    {
+        LOG("thread local guard is not addressable by fs");
+        return NULL;
+    }
+
+    size_t code_size = X86_64_GUARD_CODE_SIZE;
+    uint8_t* stub = _x86_64_stub_alloc(code_size + sizeof(x86_64_guard_t));
+    if (stub == NULL)
+    {
+        return NULL;
+    }
+
+    x86_64_guard_t* record = (x86_64_guard_t*)(stub + code_size);
+    memset(record, 0, sizeof(*record));
+    record->hook = hook;
+    record->detour = detour;
+
+    uint32_t sample = 0;
+    if (!_x86_64_guard_take_slots(stub, record, flags, filter, &sample))
+    {
+        goto err;
+    }
+    if (sample != 0 && !_x86_64_tls_offset(&s_x86_64_sample[sample - 1], &sample_offset))
+    {
+        goto err;
+    }
+
+    if (filter != NULL)
+    {
+        record->arg_value = filter->arg_value;
+        record->caller_begin = (uintptr_t)filter->caller_begin;
+        record->caller_size = (uintptr_t)filter->caller_end - (uintptr_t)filter->caller_begin;
+    }
+
+    x86_64_emit_t emit;
+    _x86_64_emit_init(&emit, stub, code_size);
+
+    /* All jumps to original function */
+    size_t fixups[4];
+    size_t fixup_num = 0;
+
+    if (flags & (UHOOK_INJECT_GUARD | UHOOK_INJECT_BYPASS))
+    {
+        _x86_64_emit_test_tls(&emit, offset, X86_64_GUARD_BYPASS | record->mask);
+        _x86_64_emit_jcc_fwd(&emit, X86_64_CC_NE, &fixups[fixup_num++]);
+    }
+    if (filter != NULL)
+    {
+        fixup_num += _x86_64_emit_filter(&emit, record, filter, sample_offset, &fixups[fixup_num]);
+    }
+
+    if (flags & UHOOK_INJECT_GUARD)
+    {
+        _x86_64_emit_mov_r11_imm(&emit, (uintptr_t)record);
+        _x86_64_emit_jmp_abs(&emit, (void*)uhook_x86_64_guard_entry);
+    }
+    else
+    {
+        _x86_64_emit_jmp_abs(&emit, detour);
+    }
+    _x86_64_emit_bind(&emit, fixups, fixup_num);
+
+    /* `fcall` is not created yet, so it is read at run time */
+    _x86_64_emit_mov_r11_imm(&emit, (uintptr_t)&hook->fcall);
+    _x86_64_emit_jmp_r11_mem(&emit);
+
+    if (emit.overflow)
+    {
+        goto err;
+    }
+
+    _flush_instruction_cache(stub, code_size + sizeof(x86_64_guard_t));
+    return stub;
+
+err:
+    uhook_x86_64_stub_destroy(stub);
+    return NULL;
+}
+
+int uhook_x86_64_bypass(int enable)
+{
+    int prev = !!(s_x86_64_guard & X86_64_GUARD_BYPASS);
+    if (enable)
+    {
+        s_x86_64_guard |= X86_64_GUARD_BYPASS;
+    }
+    else
+    {
+        s_x86_64_guard &= ~X86_64_GUARD_BYPASS;
+    }
+    return prev;
+}
+
+int uhook_x86_64_snippet_create(void** stub, const uhook_ctx_t* hook, const uhook_snippet_t* snippet)
+{
+    int ret;
+    size_t code_size = snippet->size + X86_64_STUB_TAIL_SIZE;
+
+    uint8_t* code = _x86_64_stub_alloc(code_size);
+    if (code == NULL)
+    {
+        return UHOOK_NOMEM;
+    }
+
+    if ((ret = uhook_x86_64_snippet_relocate(code, snippet)) != UHOOK_SUCCESS)
+    {
+        uhook_x86_64_stub_destroy(code);
+        return ret;
+    }
+
+    /* `fcall` is not created yet, so it is read at run time */
+    x86_64_emit_t emit;
+    _x86_64_emit_init(&emit, code + snippet->size, X86_64_STUB_TAIL_SIZE);
+    _x86_64_emit_mov_r11_imm(&emit, (uintptr_t)&hook->fcall);
+    _x86_64_emit_jmp_r11_mem(&emit);
+
+    _flush_instruction_cache(code, code_size);
+    *stub = code;
+    return UHOOK_SUCCESS;
+}
+
+/**
+ * @brief Finish building snippet.
+ * @return  #uhook_errno
+ */
+static int _x86_64_snippet_commit(uhook_snippet_t* snippet, const x86_64_emit_t* emit)
+{
+    if (emit->overflow)
+    {
+        return UHOOK_NOMEM;
+    }
+    snippet->size = emit->size;
+    snippet->origin = NULL;
+    return UHOOK_SUCCESS;
+}
+
+int uhook_x86_64_snippet_return(uhook_snippet_t* snippet, unsigned long long value)
+{
+    /* movabs rax, value; ret */
+    static const uint8_t mov_rax[] = { 0x48, 0xb8 };
+    static const uint8_t ret[] = { 0xc3 };
+
+    x86_64_emit_t emit;
+    _x86_64_emit_init(&emit, snippet->code, sizeof(snippet->code));
+    _x86_64_emit(&emit, mov_rax, sizeof(mov_rax));
+    _x86_64_emit_u64(&emit, value);
+    _x86_64_emit(&emit, ret, sizeof(ret));
+
+    return _x86_64_snippet_commit(snippet, &emit);
+}
+
+int uhook_x86_64_snippet_skip(uhook_snippet_t* snippet)
+{
+    static const uint8_t ret[] = { 0xc3 };
+
+    x86_64_emit_t emit;
+    _x86_64_emit_init(&emit, snippet->code, sizeof(snippet->code));
+    _x86_64_emit(&emit, ret, sizeof(ret));
+
+    return _x86_64_snippet_commit(snippet, &emit);
+}
+
+/**
+ * @return  bool
+ */
+static int _x86_64_has_rdpid(void)
+{
+    unsigned eax, ebx, ecx, edx;
+    return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ecx & (1u << 22));
+}
+
+int uhook_x86_64_snippet_count(uhook_snippet_t* snippet, uhook_counter_t* counter)
+{
+    /* push rax; movabs rax, counter */
+    static const uint8_t load_counter[] = { 0x50, 0x48, 0xb8 };
+    /* rdpid r11 */
+    static const uint8_t rdpid[] = { 0xf3, 0x41, 0x0f, 0xc7, 0xfb };
+    /* mov r11d, __PER_CPU_SEG; lsl r11d, r11d, the way vgetcpu does without RDPID */
+    static const uint8_t lsl[] = { 0x41, 0xbb, 0x7b, 0x00, 0x00, 0x00, 0x45, 0x0f, 0x03, 0xdb };
+    /* and r11d, UHOOK_COUNTER_CPUS - 1; shl r11, 6 */
+    static const uint8_t slot[] = { 0x41, 0x81, 0xe3 };
+    static const uint8_t shl[] = { 0x49, 0xc1, 0xe3, 0x06 };
+    /* lock inc qword ptr [rax + r11]; pop rax */
+    static const uint8_t inc[] = { 0xf0, 0x4a, 0xff, 0x04, 0x18, 0x58 };
+
+    x86_64_emit_t emit;
+    _x86_64_emit_init(&emit, snippet->code, sizeof(snippet->code));
+    _x86_64_emit(&emit, load_counter, sizeof(load_counter));
+    _x86_64_emit_u64(&emit, (uintptr_t)counter->cpus);
+    if (_x86_64_has_rdpid())
+    {
+        _x86_64_emit(&emit, rdpid, sizeof(rdpid));
+    }
+    else
+    {
+        _x86_64_emit(&emit, lsl, sizeof(lsl));
+    }
+    _x86_64_emit(&emit, slot, sizeof(slot));
+    _x86_64_emit_u32(&emit, UHOOK_COUNTER_CPUS - 1);
+    _x86_64_emit(&emit, shl, sizeof(shl));
+    _x86_64_emit(&emit, inc, sizeof(inc));
+
+    return _x86_64_snippet_commit(snippet, &emit);
+}
+
+#else
+
+void* uhook_x86_64_ctx_thunk_create(const uhook_ctx_t* record, void* detour)
+{
+    (void)record; (void)detour;
+    return NULL;
+}
+
+const uhook_ctx_t* uhook_x86_64_get_ctx(void)
+{
+    return NULL;
+}
+
+uint64_t* uhook_x86_64_handler_data(const uhook_regs_t* regs)
+{
+    (void)regs;
+    return NULL;
+}
+
+void* uhook_x86_64_handler_create(const uhook_ctx_t* hook, const uhook_handler_t* handler)
+{
+    (void)hook; (void)handler;
+    return NULL;
+}
+
+void* uhook_x86_64_guard_create(const uhook_ctx_t* hook, void* detour, unsigned flags,
+    const uhook_filter_t* filter)
+{
+    (void)hook; (void)detour; (void)flags; (void)filter;
+    return NULL;
+}
+
+int uhook_x86_64_bypass(int enable)
+{
+    (void)enable;
+    return 0;
+}
+
+int uhook_x86_64_snippet_create(void** stub, const uhook_ctx_t* hook, const uhook_snippet_t* snippet)
+{
+    (void)stub; (void)hook; (void)snippet;
+    return UHOOK_UNKNOWN;
+}
+
+int uhook_x86_64_snippet_return(uhook_snippet_t* snippet, unsigned long long value)
+{
+    (void)snippet; (void)value;
+    return UHOOK_UNKNOWN;
+}
+
+int uhook_x86_64_snippet_skip(uhook_snippet_t* snippet)
+{
+    (void)snippet;
+    return UHOOK_UNKNOWN;
+}
+
+int uhook_x86_64_snippet_count(uhook_snippet_t* snippet, uhook_counter_t* counter)
+{
+    (void)snippet; (void)counter;
+    return UHOOK_UNKNOWN;
+}
+
+#endif
+
+void uhook_x86_64_stub_destroy(void* stub)
+{
+    uint8_t* block = (uint8_t*)stub - X86_64_STUB_HEADER_SIZE;
+
+    x86_64_stub_header_t header;
+    memcpy(&header, block, sizeof(header));
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    if (header.guard != 0)
+    {
+        _x86_64_guard_free(header.guard);
+    }
+    if (header.sample != 0)
+    {
+        _x86_64_sample_free(header.sample);
+    }
+#endif
+
+    _free_execute_block(block, header.block_size);
+}
@@ -0,0 +1,134 @@
+#ifndef __UHOOK_ARCH_X86_64_STUB_H__
+#define __UHOOK_ARCH_X86_64_STUB_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uhook.h"
+#include "defs.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Create a thunk that publishes \p record to the current thread and
+ *   jumps to \p detour.
+ *
+ * ```
+ * 49 bb <record>              movabs r11, record
+ * 64 4c 89 1c 25 <offset>     mov qword ptr fs:[offset], r11
+ * ff 25 00 00 00 00 <detour>  jmp qword ptr [rip]
+ * ```
+ *
+ * @param[in] record    Hook context, must live longer than thunk.
+ * @param[in] detour    Shared detour function
+ * @return              Thunk address, or NULL if failure.
+ */
+API_LOCAL void* uhook_x86_64_ctx_thunk_create(const uhook_ctx_t* record, void* detour);
+
+/**
+ * @brief Create a stub that calls generic handlers.
+ *
+ * The stub loads its handler record into `r11` and jumps to a shared entry,
+ * which saves registers and calls handlers.
+ *
+ * @param[in] hook      Hook context, `fcall` is where to continue.
+ * @param[in] handler   Handlers, copied into stub.
+ * @return              Stub address, or NULL if failure.
+ */
+API_LOCAL void* uhook_x86_64_handler_create(const uhook_ctx_t* hook, const uhook_handler_t* handler);
+
+/**
+ * @brief Word of the call at `regs->sp`, kept in its return stack frame.
+ *
+ * Frame is pushed before enter handler and popped after leave handler, so
+ * both see the same word. It starts at zero.
+ *
+ * @param[in] regs      Registers passed to handler
+ * @return              Word, or NULL if the call has no frame.
+ */
+API_LOCAL uint64_t* uhook_x86_64_handler_data(const uhook_regs_t* regs);
+
+/**
+ * @brief Create a stub that skips \p detour when current thread bypasses
+ *   hooks, when \p detour of this hook is already running on it, or when
+ *   \p filter does not match.
+ *
+ * ```
+ * 64 f7 04 25 <offset> <mask> test dword ptr fs:[offset], mask
+ * 75 <rel8>                   jnz original
+ * ...                         filters, each ends with jcc original
+ * 49 bb <record>              movabs r11, record      ; guard only
+ * ff 25 00 00 00 00 <entry>   jmp qword ptr [rip]     ; detour if no guard
+ * original:
+ * 49 bb <&fcall>              movabs r11, &hook->fcall
+ * 41 ff 23                    jmp qword ptr [r11]
+ * ```
+ *
+ * @param[in] hook      Hook context, `fcall` is where skipped calls go.
+ * @param[in] detour    Detour function
+ * @param[in] flags     #UHOOK_INJECT_GUARD and #UHOOK_INJECT_BYPASS, other
+ *                      bits are ignored.
+ * @param[in] filter    Filter, already validated. NULL if none.
+ * @return              Stub address, or NULL if failure.
+ */
+API_LOCAL void* uhook_x86_64_guard_create(const uhook_ctx_t* hook, void* detour, unsigned flags,
+    const uhook_filter_t* filter);
+
+/**
+ * @see uhook_bypass()
+ */
+API_LOCAL int uhook_x86_64_bypass(int enable);
+
+/**
+ * @brief Create a stub that runs \p snippet and continues to `fcall`.
+ *
+ * ```
+ * <snippet>                   relocated by uhook_x86_64_snippet_relocate()
+ * 49 bb <&fcall>              movabs r11, &hook->fcall
+ * 41 ff 23                    jmp qword ptr [r11]
+ * ```
+ *
+ * @param[out] stub     Stub address
+ * @param[in] hook      Hook context
+ * @param[in] snippet   Snippet
+ * @return              #uhook_errno
+ */
+API_LOCAL int uhook_x86_64_snippet_create(void** stub, const uhook_ctx_t* hook, const uhook_snippet_t* snippet);
+
+/**
+ * @see uhook_snippet_return()
+ */
+API_LOCAL int uhook_x86_64_snippet_return(uhook_snippet_t* snippet, unsigned long long value);
+
+/**
+ * @see uhook_snippet_skip()
+ */
+API_LOCAL int uhook_x86_64_snippet_skip(uhook_snippet_t* snippet);
+
+/**
+ * @brief Build counter snippet.
+ *
+ * CPU number comes from `rdpid`, or from segment limit of per CPU GDT entry
+ * if `rdpid` is not supported, as vDSO `getcpu` does on Linux. Only `r11`
+ * is clobbered, `rax` is saved on stack.
+ *
+ * @see uhook_snippet_count()
+ */
+API_LOCAL int uhook_x86_64_snippet_count(uhook_snippet_t* snippet, uhook_counter_t* counter);
+
+/**
+ * @brief Destroy stub created by this module.
+ * @param[in] stub      Stub address
+ */
+API_LOCAL void uhook_x86_64_stub_destroy(void* stub);
+
+/**
+ * @brief Get context published by the last thunk run by current thread.
+ * @see uhook_get_ctx()
+ */
+API_LOCAL const uhook_ctx_t* uhook_x86_64_get_ctx(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
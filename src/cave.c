@@ -0,0 +1,165 @@
+#include "uhook.h"
+#include "cave.h"
+#include "mutex.h"
+#include "once.h"
+#include "os/elf.h"
+#include <stdlib.h>
+
+/**
+ * @brief Max amount of gaps to look at for one allocation.
+ */
+#define UHOOK_CAVE_MAX_GAPS     16
+
+typedef struct uhook_cave
+{
+    uintptr_t       addr;       /**< Cave address */
+    size_t          size;       /**< Cave size */
+}uhook_cave_t;
+
+/**
+ * @brief Caves in use, gaps themselves are cached by module.
+ */
+typedef struct uhook_cave_ctx
+{
+    uhook_mutex_t   mutex;      /**< Protect cave list */
+    uhook_cave_t*   caves;      /**< Caves in use */
+    size_t          num;        /**< Amount of caves in use */
+    size_t          cap;        /**< Capacity of cave list */
+}uhook_cave_ctx_t;
+
+static uhook_cave_ctx_t s_cave;
+static pthread_once_t s_cave_once = PTHREAD_ONCE_INIT;
+
+static void _uhook_cave_init(void)
+{
+    uhook_mutex_init(&s_cave.mutex);
+}
+
+/**
+ * @brief Get length of padding at start of \p gap.
+ *
+ * A gap that starts with something else may be code without symbol, so only
+ * the leading filler instructions are trusted.
+ */
+static size_t _uhook_cave_padding_size(const elf_code_gap_t* gap, uhook_cave_filler_fn filler)
+{
+    const uint8_t* code = (const uint8_t*)gap->addr;
+    size_t pos = 0, len;
+
+    while (pos < gap->size && (len = filler(code + pos)) != 0 && pos + len <= gap->size)
+    {
+        pos += len;
+    }
+    return pos;
+}
+
+/**
+ * @brief Move \p addr after every cave in use that overlaps [addr, addr + size).
+ */
+static uintptr_t _uhook_cave_skip_used(uintptr_t addr, size_t size)
+{
+    size_t i;
+    for (i = 0; i < s_cave.num; i++)
+    {
+        const uhook_cave_t* cave = &s_cave.caves[i];
+        if (addr < cave->addr + cave->size && cave->addr < addr + size)
+        {
+            addr = cave->addr + cave->size;
+            i = (size_t)-1;
+        }
+    }
+    return addr;
+}
+
+static int _uhook_cave_mark_used(uintptr_t addr, size_t size)
+{
+    if (s_cave.num == s_cave.cap)
+    {
+        size_t cap = s_cave.cap == 0 ? 16 : s_cave.cap * 2;
+        uhook_cave_t* caves = realloc(s_cave.caves, sizeof(uhook_cave_t) * cap);
+        if (caves == NULL)
+        {
+            return UHOOK_NOMEM;
+        }
+        s_cave.caves = caves;
+        s_cave.cap = cap;
+    }
+
+    s_cave.caves[s_cave.num].addr = addr;
+    s_cave.caves[s_cave.num].size = size;
+    s_cave.num++;
+
+    return UHOOK_SUCCESS;
+}
+
+/**
+ * @brief Find free cave.
+ * @note Cave list must be locked.
+ * @return  Cave address, or 0 if not found.
+ */
+static uintptr_t _uhook_cave_find(void* symbol, void* lo, void* hi, size_t size, uhook_cave_filler_fn filler)
+{
+    elf_code_gap_t gaps[UHOOK_CAVE_MAX_GAPS];
+    size_t gap_num = elf_find_code_gaps(symbol, lo, hi, gaps, UHOOK_CAVE_MAX_GAPS);
+
+    size_t i;
+    for (i = 0; i < gap_num; i++)
+    {
+        uintptr_t end = gaps[i].addr + _uhook_cave_padding_size(&gaps[i], filler);
+        uintptr_t addr = gaps[i].addr < (uintptr_t)lo ? (uintptr_t)lo : gaps[i].addr;
+
+        addr = _uhook_cave_skip_used(addr, size);
+        if (addr < (uintptr_t)hi && addr + size <= end)
+        {
+            return addr;
+        }
+    }
+
+    return 0;
+}
+
+void* uhook_cave_alloc(void* symbol, void* lo, void* hi, size_t size, uhook_cave_filler_fn filler)
+{
+    void* ret = NULL;
+
+    pthread_once(&s_cave_once, _uhook_cave_init);
+    uhook_mutex_lock(&s_cave.mutex);
+
+    uintptr_t addr = _uhook_cave_find(symbol, lo, hi, size, filler);
+    if (addr != 0 && _uhook_cave_mark_used(addr, size) == UHOOK_SUCCESS)
+    {
+        ret = (void*)addr;
+    }
+
+    uhook_mutex_unlock(&s_cave.mutex);
+    return ret;
+}
+
+int uhook_cave_probe(void* symbol, void* lo, void* hi, size_t size, uhook_cave_filler_fn filler)
+{
+    pthread_once(&s_cave_once, _uhook_cave_init);
+    uhook_mutex_lock(&s_cave.mutex);
+
+    int ret = _uhook_cave_find(symbol, lo, hi, size, filler) != 0;
+
+    uhook_mutex_unlock(&s_cave.mutex);
+    return ret;
+}
+
+void uhook_cave_free(void* cave, size_t size)
+{
+    uhook_mutex_lock(&s_cave.mutex);
+
+    size_t i;
+    for (i = 0; i < s_cave.num; i++)
+    {
+        if (s_cave.caves[i].addr == (uintptr_t)cave && s_cave.caves[i].size == size)
+        {
+            s_cave.caves[i] = s_cave.caves[s_cave.num - 1];
+            s_cave.num--;
+            break;
+        }
+    }
+
+    uhook_mutex_unlock(&s_cave.mutex);
+}
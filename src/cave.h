@@ -0,0 +1,56 @@
+#ifndef __UHOOK_CAVE_H__
+#define __UHOOK_CAVE_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "defs.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Get length of filler instruction.
+ *
+ * Filler instructions are what compiler and linker put into alignment
+ * padding, such as `nop` and `int3`.
+ *
+ * @param[in] code  Instruction
+ * @return          Instruction length, or 0 if it is not filler.
+ */
+typedef size_t (*uhook_cave_filler_fn)(const uint8_t* code);
+
+/**
+ * @brief Allocate a code cave from padding between functions.
+ *
+ * Padding is never executed, so a cave can be placed at any byte of it. A
+ * cave is owned by caller until #uhook_cave_free(), its content is not
+ * changed by this function.
+ *
+ * @param[in] symbol    Any address in the module to search
+ * @param[in] lo        Lowest acceptable cave address
+ * @param[in] hi        Cave address must be less than it
+ * @param[in] size      Cave size
+ * @param[in] filler    Check content of padding
+ * @return              Cave address, or NULL if not found.
+ */
+API_LOCAL void* uhook_cave_alloc(void* symbol, void* lo, void* hi, size_t size, uhook_cave_filler_fn filler);
+
+/**
+ * @brief Check whether #uhook_cave_alloc() would succeed, without taking
+ *   the cave.
+ * @see uhook_cave_alloc()
+ * @return              bool
+ */
+API_LOCAL int uhook_cave_probe(void* symbol, void* lo, void* hi, size_t size, uhook_cave_filler_fn filler);
+
+/**
+ * @brief Release cave allocated by #uhook_cave_alloc().
+ * @param[in] cave  Cave address
+ * @param[in] size  The same value passed to #uhook_cave_alloc()
+ */
+API_LOCAL void uhook_cave_free(void* cave, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
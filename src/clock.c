@@ -0,0 +1,64 @@
+#define _GNU_SOURCE
+#include "clock.h"
+#include "once.h"
+#include <time.h>
+
+/**
+ * @brief Nanoseconds per tick, 32.32 fixed point.
+ */
+static uint64_t s_clock_mult = (uint64_t)1 << 32;
+static pthread_once_t s_clock_once = PTHREAD_ONCE_INIT;
+
+static uint64_t _clock_monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Measure time stamp counter against monotonic clock.
+ */
+static void _clock_calibrate(void)
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+    uint64_t ns = _clock_monotonic_ns();
+    uint64_t ticks = uhook_clock_ticks();
+
+    struct timespec ts = { 0, 10000000 };
+    nanosleep(&ts, NULL);
+
+    ns = _clock_monotonic_ns() - ns;
+    ticks = uhook_clock_ticks() - ticks;
+    if (ticks != 0)
+    {
+        s_clock_mult = (ns << 32) / ticks;
+    }
+#endif
+}
+
+uint64_t uhook_clock_ticks(void)
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    return _clock_monotonic_ns();
+#endif
+}
+
+uint64_t uhook_clock_ns(uint64_t ticks)
+{
+    uhook_clock_init();
+#if defined(__x86_64__) && defined(__GNUC__)
+    return (uint64_t)(((unsigned __int128)ticks * s_clock_mult) >> 32);
+#else
+    return ticks;
+#endif
+}
+
+void uhook_clock_init(void)
+{
+    pthread_once(&s_clock_once, _clock_calibrate);
+}
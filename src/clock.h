@@ -0,0 +1,36 @@
+#ifndef __UHOOK_CLOCK_H__
+#define __UHOOK_CLOCK_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "defs.h"
+#include <stdint.h>
+
+/**
+ * @brief Read time stamp counter, or monotonic clock in nanoseconds if
+ *   there is none.
+ * @return              Ticks
+ */
+API_LOCAL uint64_t uhook_clock_ticks(void);
+
+/**
+ * @brief Convert ticks to nanoseconds.
+ *
+ * Counter is measured against monotonic clock on first call, which takes
+ * about 10 milliseconds.
+ *
+ * @param[in] ticks     Ticks, or difference of ticks
+ * @return              Nanoseconds
+ */
+API_LOCAL uint64_t uhook_clock_ns(uint64_t ticks);
+
+/**
+ * @brief Measure counter now, so uhook_clock_ns() does not stall later.
+ */
+API_LOCAL void uhook_clock_init(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
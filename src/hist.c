@@ -0,0 +1,393 @@
+#define _GNU_SOURCE
+#include "uhook.h"
+#include "hist.h"
+#include "clock.h"
+#include "mutex.h"
+#include "tstate.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Each power of 2 is split into `1 << UHOOK_HIST_SUB_BITS` buckets,
+ *   so a bucket is at most 1/32 of its value wide.
+ */
+#define UHOOK_HIST_SUB_BITS     5
+
+/**
+ * @brief Values below `1 << (UHOOK_HIST_SUB_BITS + 1)` ticks have a bucket
+ *   each.
+ */
+#define UHOOK_HIST_LINEAR       (1 << (UHOOK_HIST_SUB_BITS + 1))
+
+/**
+ * @brief Largest bucket width is `1 << UHOOK_HIST_SHIFT_MAX` ticks, longer
+ *   calls are put into last bucket. It covers 2^40 ticks, minutes on any
+ *   CPU.
+ */
+#define UHOOK_HIST_SHIFT_MAX    34
+
+/**
+ * @brief Amount of buckets of a histogram.
+ */
+#define UHOOK_HIST_BUCKETS      (((UHOOK_HIST_SHIFT_MAX + 1) << UHOOK_HIST_SUB_BITS) + (UHOOK_HIST_LINEAR >> 1))
+
+/**
+ * @brief Histogram of one hook on one thread.
+ */
+typedef struct uhook_hist_slot
+{
+    uint64_t            ticks;      /**< Time spent in recorded calls */
+    uint64_t            counts[UHOOK_HIST_BUCKETS];
+}uhook_hist_slot_t;
+
+/**
+ * @brief State of a thread, pages of unused slots are never touched.
+ */
+typedef struct uhook_hist_thread
+{
+    uhook_tstate_t      state;      /**< Header */
+    uhook_hist_slot_t   slots[UHOOK_HIST_MAX];
+}uhook_hist_thread_t;
+
+typedef struct uhook_hist_ctx
+{
+    uhook_mutex_t       mutex;      /**< Protect #uhook_hist_ctx::bases */
+    uhook_hist_slot_t*  bases[UHOOK_HIST_MAX];  /**< Merged counts at last reset, NULL if slot is free */
+    uhook_tstate_list_t threads;    /**< Thread states */
+    uint64_t            overhead;   /**< Ticks taken off each call */
+}uhook_hist_ctx_t;
+
+static uhook_hist_ctx_t s_hist;
+static pthread_once_t s_hist_once = PTHREAD_ONCE_INIT;
+
+static __thread uhook_hist_thread_t* s_hist_thread;
+
+#if defined(UHOOK_HIST_IDLE)
+
+/**
+ * @brief Returns at once, with room to patch.
+ */
+__asm__(
+    ".text\n"
+    ".p2align 4\n"
+    ".globl uhook_hist_idle\n"
+    ".hidden uhook_hist_idle\n"
+    ".type uhook_hist_idle, @function\n"
+    "uhook_hist_idle:\n"
+    "    xorl %eax, %eax\n"
+    "    nop\n"
+    "    nop\n"
+    "    nop\n"
+    "    nop\n"
+    "    nop\n"
+    "    nop\n"
+    "    ret\n"
+    ".size uhook_hist_idle, .-uhook_hist_idle\n"
+);
+
+#endif
+
+static void _hist_init(void)
+{
+    uhook_mutex_init(&s_hist.mutex);
+    uhook_tstate_init(&s_hist.threads);
+    uhook_clock_init();
+}
+
+/**
+ * @brief Get state of current thread.
+ * @return  Thread state, or NULL if failure.
+ */
+static uhook_hist_thread_t* _hist_thread(void)
+{
+    uhook_hist_thread_t* thread = s_hist_thread;
+    if (thread == NULL)
+    {
+        thread = (uhook_hist_thread_t*)uhook_tstate_get(&s_hist.threads, sizeof(uhook_hist_thread_t),
+            (void**)&s_hist_thread, NULL);
+    }
+    return thread;
+}
+
+/**
+ * @brief Bucket of \p ticks.
+ */
+static size_t _hist_index(uint64_t ticks)
+{
+    if (ticks < UHOOK_HIST_LINEAR)
+    {
+        return (size_t)ticks;
+    }
+
+    unsigned shift = 63 - __builtin_clzll(ticks) - UHOOK_HIST_SUB_BITS;
+    if (shift > UHOOK_HIST_SHIFT_MAX)
+    {
+        return UHOOK_HIST_BUCKETS - 1;
+    }
+    return ((size_t)shift << UHOOK_HIST_SUB_BITS) + (size_t)(ticks >> shift);
+}
+
+/**
+ * @brief Smallest value of bucket \p idx.
+ */
+static uint64_t _hist_lower(size_t idx)
+{
+    if (idx < UHOOK_HIST_LINEAR)
+    {
+        return idx;
+    }
+
+    unsigned shift = (unsigned)(idx >> UHOOK_HIST_SUB_BITS) - 1;
+    uint64_t sub = (idx & ((1 << UHOOK_HIST_SUB_BITS) - 1)) | (1 << UHOOK_HIST_SUB_BITS);
+    return sub << shift;
+}
+
+/**
+ * @brief Width of bucket \p idx.
+ */
+static uint64_t _hist_width(size_t idx)
+{
+    if (idx < UHOOK_HIST_LINEAR)
+    {
+        return 1;
+    }
+    return (uint64_t)1 << ((idx >> UHOOK_HIST_SUB_BITS) - 1);
+}
+
+/**
+ * @brief Add counts of \p slot on all threads into \p dst.
+ */
+static void _hist_sum(size_t slot, uhook_hist_slot_t* dst)
+{
+    memset(dst, 0, sizeof(*dst));
+
+    const uhook_tstate_t* state;
+    for (state = uhook_tstate_first(&s_hist.threads); state != NULL; state = state->next)
+    {
+        const uhook_hist_slot_t* src = &((const uhook_hist_thread_t*)state)->slots[slot];
+        dst->ticks += __atomic_load_n(&src->ticks, __ATOMIC_RELAXED);
+
+        size_t i;
+        for (i = 0; i < UHOOK_HIST_BUCKETS; i++)
+        {
+            dst->counts[i] += __atomic_load_n(&src->counts[i], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * @brief Value at \p rank of \p sum, in ticks.
+ *
+ * The middle of the bucket is used, so it is off by at most 1/64.
+ */
+static uint64_t _hist_value_at(const uhook_hist_slot_t* sum, uint64_t rank)
+{
+    uint64_t seen = 0;
+    size_t i;
+    for (i = 0; i < UHOOK_HIST_BUCKETS; i++)
+    {
+        seen += sum->counts[i];
+        if (seen >= rank)
+        {
+            break;
+        }
+    }
+    if (i == UHOOK_HIST_BUCKETS)
+    {
+        i--;
+    }
+    return _hist_lower(i) + (_hist_width(i) - 1) / 2;
+}
+
+/**
+ * @brief Value below which \p num / \p den of \p count calls are.
+ */
+static unsigned long long _hist_percentile(const uhook_hist_slot_t* sum, uint64_t count,
+    uint64_t num, uint64_t den)
+{
+    uint64_t rank = (count * num + den - 1) / den;
+    return uhook_clock_ns(_hist_value_at(sum, rank > 0 ? rank : 1));
+}
+
+static void _hist_summary(const uhook_hist_slot_t* sum, uhook_hist_t* hist)
+{
+    memset(hist, 0, sizeof(*hist));
+    hist->overhead = uhook_clock_ns(__atomic_load_n(&s_hist.overhead, __ATOMIC_RELAXED));
+
+    size_t first = UHOOK_HIST_BUCKETS, last = 0, i;
+    for (i = 0; i < UHOOK_HIST_BUCKETS; i++)
+    {
+        if (sum->counts[i] == 0)
+        {
+            continue;
+        }
+        if (first == UHOOK_HIST_BUCKETS)
+        {
+            first = i;
+        }
+        last = i;
+        hist->count += sum->counts[i];
+    }
+    if (hist->count == 0)
+    {
+        return;
+    }
+
+    hist->min = uhook_clock_ns(_hist_lower(first));
+    hist->max = uhook_clock_ns(_hist_lower(last) + _hist_width(last) - 1);
+    hist->mean = uhook_clock_ns(sum->ticks / hist->count);
+    hist->p50 = _hist_percentile(sum, hist->count, 50, 100);
+    hist->p90 = _hist_percentile(sum, hist->count, 90, 100);
+    hist->p99 = _hist_percentile(sum, hist->count, 99, 100);
+    hist->p999 = _hist_percentile(sum, hist->count, 999, 1000);
+}
+
+int uhook_hist_alloc(size_t* slot)
+{
+    pthread_once(&s_hist_once, _hist_init);
+
+    int ret = UHOOK_NOMEM;
+    size_t i;
+
+    uhook_mutex_lock(&s_hist.mutex);
+    for (i = 0; i < UHOOK_HIST_MAX; i++)
+    {
+        if (s_hist.bases[i] == NULL)
+        {
+            break;
+        }
+    }
+    if (i == UHOOK_HIST_MAX)
+    {
+        goto fin;
+    }
+
+    /* Calls left by a previous hook are hidden, threads may still write */
+    uhook_hist_slot_t* base = malloc(sizeof(uhook_hist_slot_t));
+    if (base == NULL)
+    {
+        goto fin;
+    }
+    _hist_sum(i, base);
+    s_hist.bases[i] = base;
+
+    *slot = i;
+    ret = UHOOK_SUCCESS;
+
+fin:
+    uhook_mutex_unlock(&s_hist.mutex);
+    return ret;
+}
+
+void uhook_hist_free(size_t slot)
+{
+    uhook_mutex_lock(&s_hist.mutex);
+    free(s_hist.bases[slot]);
+    s_hist.bases[slot] = NULL;
+    uhook_mutex_unlock(&s_hist.mutex);
+}
+
+void uhook_hist_enter(uhook_regs_t* regs, void* ctx)
+{
+    (void)ctx;
+
+    uint64_t* start = uhook_tstate_call(regs);
+    if (start != NULL)
+    {
+        *start = uhook_clock_ticks();
+    }
+}
+
+void uhook_hist_leave(uhook_regs_t* regs, void* ctx)
+{
+    uint64_t now = uhook_clock_ticks();
+    size_t slot = (uintptr_t)ctx;
+
+    const uint64_t* start = uhook_tstate_call(regs);
+    uhook_hist_thread_t* thread = _hist_thread();
+    if (start == NULL || thread == NULL)
+    {
+        return;
+    }
+
+    uint64_t ticks = now - *start;
+    uint64_t overhead = __atomic_load_n(&s_hist.overhead, __ATOMIC_RELAXED);
+    ticks = ticks > overhead ? ticks - overhead : 0;
+
+    uhook_hist_slot_t* dst = &thread->slots[slot];
+    uhook_tstate_add(&dst->counts[_hist_index(ticks)], 1);
+    uhook_tstate_add(&dst->ticks, ticks);
+}
+
+void uhook_hist_calibrate(size_t slot)
+{
+    uhook_hist_slot_t* sum = malloc(sizeof(uhook_hist_slot_t));
+    if (sum == NULL)
+    {
+        return;
+    }
+
+    uhook_mutex_lock(&s_hist.mutex);
+    _hist_sum(slot, sum);
+
+    uint64_t count = 0;
+    size_t i;
+    for (i = 0; i < UHOOK_HIST_BUCKETS; i++)
+    {
+        sum->counts[i] -= s_hist.bases[slot]->counts[i];
+        count += sum->counts[i];
+    }
+
+    /* Median, so an empty function is centered at zero */
+    if (count != 0)
+    {
+        __atomic_store_n(&s_hist.overhead, _hist_value_at(sum, (count + 1) / 2), __ATOMIC_RELAXED);
+    }
+    uhook_mutex_unlock(&s_hist.mutex);
+
+    free(sum);
+}
+
+void uhook_hist_merge(size_t slot, uhook_hist_t* hist, int reset)
+{
+    uhook_hist_slot_t* sum = malloc(sizeof(uhook_hist_slot_t));
+    if (sum == NULL)
+    {
+        if (hist != NULL)
+        {
+            memset(hist, 0, sizeof(*hist));
+        }
+        return;
+    }
+
+    uhook_mutex_lock(&s_hist.mutex);
+    _hist_sum(slot, sum);
+
+    /* Counters only grow, so sum is never below base */
+    uhook_hist_slot_t* base = s_hist.bases[slot];
+    uint64_t now = sum->ticks;
+    sum->ticks = now - base->ticks;
+    if (reset)
+    {
+        base->ticks = now;
+    }
+
+    size_t i;
+    for (i = 0; i < UHOOK_HIST_BUCKETS; i++)
+    {
+        now = sum->counts[i];
+        sum->counts[i] = now - base->counts[i];
+        if (reset)
+        {
+            base->counts[i] = now;
+        }
+    }
+    uhook_mutex_unlock(&s_hist.mutex);
+
+    if (hist != NULL)
+    {
+        _hist_summary(sum, hist);
+    }
+    free(sum);
+}
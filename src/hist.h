@@ -0,0 +1,77 @@
+#ifndef __UHOOK_HIST_H__
+#define __UHOOK_HIST_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uhook.h"
+#include "defs.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Calls of uhook_hist_idle() to measure overhead.
+ */
+#define UHOOK_HIST_CALIBRATE    1000
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+/**
+ * @brief uhook_hist_idle() is available.
+ */
+#define UHOOK_HIST_IDLE     1
+
+/**
+ * @brief A function that returns at once, hooked to measure overhead of
+ *   histogram hooks.
+ * @return              Zero
+ */
+API_LOCAL int uhook_hist_idle(void);
+
+#endif
+
+/**
+ * @brief Reserve a histogram slot, it is empty on every thread.
+ * @param[out] slot     Slot index
+ * @return              #uhook_errno
+ */
+API_LOCAL int uhook_hist_alloc(size_t* slot);
+
+/**
+ * @brief Release a slot from uhook_hist_alloc().
+ * @param[in] slot      Slot index
+ */
+API_LOCAL void uhook_hist_free(size_t slot);
+
+/**
+ * @brief Enter handler, remembers start time.
+ * @param[in] regs      Registers
+ * @param[in] ctx       Slot index
+ */
+API_LOCAL void uhook_hist_enter(uhook_regs_t* regs, void* ctx);
+
+/**
+ * @brief Leave handler, records time spent since enter minus overhead.
+ * @param[in] regs      Registers
+ * @param[in] ctx       Slot index
+ */
+API_LOCAL void uhook_hist_leave(uhook_regs_t* regs, void* ctx);
+
+/**
+ * @brief Take median call recorded in \p slot as overhead of every hook.
+ * @param[in] slot      Slot of a hook on uhook_hist_idle()
+ */
+API_LOCAL void uhook_hist_calibrate(size_t slot);
+
+/**
+ * @brief Merge \p slot over all threads.
+ * @param[in] slot      Slot index
+ * @param[out] hist     Summary, NULL to skip.
+ * @param[in] reset     Calls merged here are left out of later merges.
+ */
+API_LOCAL void uhook_hist_merge(size_t slot, uhook_hist_t* hist, int reset);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,37 @@
+#include "mutex.h"
+
+#if defined(_WIN32)
+
+void uhook_mutex_init(uhook_mutex_t* mutex)
+{
+    InitializeSRWLock(mutex);
+}
+
+void uhook_mutex_lock(uhook_mutex_t* mutex)
+{
+    AcquireSRWLockExclusive(mutex);
+}
+
+void uhook_mutex_unlock(uhook_mutex_t* mutex)
+{
+    ReleaseSRWLockExclusive(mutex);
+}
+
+#else
+
+void uhook_mutex_init(uhook_mutex_t* mutex)
+{
+    pthread_mutex_init(mutex, NULL);
+}
+
+void uhook_mutex_lock(uhook_mutex_t* mutex)
+{
+    pthread_mutex_lock(mutex);
+}
+
+void uhook_mutex_unlock(uhook_mutex_t* mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef __UHOOK_MUTEX_H__
+#define __UHOOK_MUTEX_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "defs.h"
+
+#if defined(_WIN32)
+#   include <windows.h>
+typedef SRWLOCK uhook_mutex_t;
+#else
+#   include <pthread.h>
+typedef pthread_mutex_t uhook_mutex_t;
+#endif
+
+/**
+ * @brief Initialize mutex.
+ * @param[out] mutex    Mutex
+ */
+API_LOCAL void uhook_mutex_init(uhook_mutex_t* mutex);
+
+/**
+ * @brief Lock mutex.
+ * @param[in] mutex     Mutex
+ */
+API_LOCAL void uhook_mutex_lock(uhook_mutex_t* mutex);
+
+/**
+ * @brief Unlock mutex.
+ * @param[in] mutex     Mutex
+ */
+API_LOCAL void uhook_mutex_unlock(uhook_mutex_t* mutex);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -49,8 +49,40 @@ typedef struct relocation_helper
     int             ret;
     void*           loc_addr;
     void*           symbol_addr;
+    const void*     phdr;           /**< Program headers of found module */
 }relocation_helper_t;
 
+/**
+ * @brief Function address and size, address is not relocated.
+ */
+typedef struct elf_func_range
+{
+    uintptr_t       addr;           /**< Symbol value */
+    size_t          size;           /**< Symbol size */
+    size_t          order;          /**< Order in file, the first one wins */
+}elf_func_range_t;
+
+/**
+ * @brief Sorted symbols of a loaded module.
+ *
+ * A cache is immutable once published to #s_elf_module_cache, so readers
+ * walk the list without lock.
+ */
+typedef struct elf_module_cache
+{
+    struct elf_module_cache*    next;       /**< Next module */
+    uintptr_t                   relocation; /**< Load address */
+    const void*                 phdr;       /**< Program headers, identify module together with relocation */
+    size_t                      num;        /**< Amount of functions */
+    elf_func_range_t*           funcs;      /**< Functions sorted by address */
+    size_t                      site_num;   /**< Amount of patch sites */
+    elf_patch_site_t*           sites;      /**< Patch sites sorted by address, not relocated */
+    size_t                      gap_num;    /**< Amount of code gaps */
+    elf_code_gap_t*             gaps;       /**< Code gaps sorted by address, not relocated */
+}elf_module_cache_t;
+
+static elf_module_cache_t* s_elf_module_cache = NULL;
+
 typedef struct dynamic_phdr
 {
     ElfW(Dyn)*      dyn_phdr;       /**< Dynamic section address */
@@ -671,6 +703,7 @@ static int _elf_dl_iterate_phdr_callback(struct dl_phdr_info* info, size_t size,
 
     relocation_helper_t* helper = data;
     helper->loc_addr = (void*)info->dlpi_addr;
+    helper->phdr = info->dlpi_phdr;
 
     size_t i;
     for (i = 0; i < info->dlpi_phnum; i++)
@@ -689,6 +722,100 @@ static int _elf_dl_iterate_phdr_callback(struct dl_phdr_info* info, size_t size,
     return 0;
 }
 
+typedef struct elf_segment_helper
+{
+    elf_segment_t*  segs;           /**< Segment list */
+    size_t          cap;            /**< Capacity of segment list */
+    size_t          num;            /**< Amount of segments found */
+}elf_segment_helper_t;
+
+static int _elf_dl_iterate_segment_callback(struct dl_phdr_info* info, size_t size, void* data)
+{
+    (void)size;
+    elf_segment_helper_t* helper = data;
+
+    size_t i;
+    for (i = 0; i < info->dlpi_phnum; i++)
+    {
+        if (info->dlpi_phdr[i].p_type != PT_LOAD || info->dlpi_phdr[i].p_memsz == 0)
+        {
+            continue;
+        }
+
+        if (helper->num < helper->cap)
+        {
+            elf_segment_t* seg = &helper->segs[helper->num];
+            seg->path = info->dlpi_name != NULL ? info->dlpi_name : "";
+            seg->base = info->dlpi_addr;
+            seg->addr = info->dlpi_addr + info->dlpi_phdr[i].p_vaddr;
+            seg->size = info->dlpi_phdr[i].p_memsz;
+            seg->flags = info->dlpi_phdr[i].p_flags;
+        }
+        helper->num++;
+    }
+
+    return 0;
+}
+
+typedef struct elf_build_id_helper
+{
+    uintptr_t       base;           /**< Load address of module */
+    uint8_t*        id;             /**< Build-id */
+    size_t          cap;            /**< Capacity of build-id */
+    size_t          size;           /**< Length of build-id */
+}elf_build_id_helper_t;
+
+static size_t _elf_parse_build_id(const uint8_t* note, size_t size, elf_build_id_helper_t* helper)
+{
+    size_t pos = 0;
+    while (pos + sizeof(ElfW(Nhdr)) <= size)
+    {
+        const ElfW(Nhdr)* nhdr = (const ElfW(Nhdr)*)(note + pos);
+        size_t name_pos = pos + sizeof(ElfW(Nhdr));
+        size_t desc_pos = name_pos + ALIGN_SIZE(nhdr->n_namesz, 4);
+        pos = desc_pos + ALIGN_SIZE(nhdr->n_descsz, 4);
+        if (pos > size)
+        {
+            break;
+        }
+
+        if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4
+            && memcmp(note + name_pos, "GNU", 4) == 0)
+        {
+            if (nhdr->n_descsz > helper->cap)
+            {
+                return 0;
+            }
+            memcpy(helper->id, note + desc_pos, nhdr->n_descsz);
+            return nhdr->n_descsz;
+        }
+    }
+
+    return 0;
+}
+
+static int _elf_dl_iterate_build_id_callback(struct dl_phdr_info* info, size_t size, void* data)
+{
+    (void)size;
+    elf_build_id_helper_t* helper = data;
+    if (info->dlpi_addr != helper->base)
+    {
+        return 0;
+    }
+
+    size_t i;
+    for (i = 0; i < info->dlpi_phnum && helper->size == 0; i++)
+    {
+        if (info->dlpi_phdr[i].p_type == PT_NOTE)
+        {
+            helper->size = _elf_parse_build_id((const uint8_t*)(info->dlpi_addr + info->dlpi_phdr[i].p_vaddr),
+                info->dlpi_phdr[i].p_memsz, helper);
+        }
+    }
+
+    return helper->size != 0;
+}
+
 static const char* _elf_get_phdy_name(ElfW(Word) type)
 {
     switch (type)
@@ -887,66 +1014,372 @@ fin:
     return ret;
 }
 
-static size_t _elf_get_function_size_from_object(const char* path, void* symbol)
+static int _elf_func_range_cmp(const void* a, const void* b)
 {
-    size_t ret = (size_t)-1;
-    elf_symbol_t* symbol_list = NULL;
-    FILE* f_exe = fopen(path, "rb");
+    const elf_func_range_t* func_a = a;
+    const elf_func_range_t* func_b = b;
 
-    uintptr_t relocation = (uintptr_t)elf_get_relocation_by_addr(symbol);
-    if (relocation == 0)
+    if (func_a->addr != func_b->addr)
     {
-        LOG("get relocation for symbol(%p) failed", symbol);
-        ret = (size_t)-1;
-        goto fin;
+        return func_a->addr < func_b->addr ? -1 : 1;
     }
+    return func_a->order < func_b->order ? -1 : (func_a->order > func_b->order ? 1 : 0);
+}
 
-    uintptr_t target_addr = (uintptr_t)symbol - relocation;
+/**
+ * @brief Append all symbols in \p info to \p cache.
+ * @return  0 if success, otherwise failure.
+ */
+static int _elf_module_cache_fill(elf_module_cache_t* cache, const elf_info_t* info)
+{
+    size_t idx;
+    for (idx = 0; idx < info->ehdr.e_shnum; idx++)
+    {
+        if (info->shdr[idx].sh_type != 0x02 && info->shdr[idx].sh_type != 0x0b)
+        {
+            continue;
+        }
 
-    elf_info_t* info = NULL;
-    if (elf_parser_file(&info, f_exe) != 0)
+        elf_symbol_t* symbol_list = NULL;
+        int num = elf_parser_symbol(&symbol_list, info, idx);
+        if (num <= 0)
+        {
+            continue;
+        }
+
+        elf_func_range_t* funcs = realloc(cache->funcs, sizeof(elf_func_range_t) * (cache->num + num));
+        if (funcs == NULL)
+        {
+            elf_release_symbol(symbol_list);
+            return -1;
+        }
+        cache->funcs = funcs;
+
+        int i;
+        for (i = 0; i < num; i++)
+        {
+            if (symbol_list[i].st_value == 0)
+            {
+                continue;
+            }
+            funcs[cache->num].addr = (uintptr_t)symbol_list[i].st_value;
+            funcs[cache->num].size = (size_t)symbol_list[i].st_size;
+            funcs[cache->num].order = cache->num;
+            cache->num++;
+        }
+
+        elf_release_symbol(symbol_list);
+    }
+
+    if (cache->num == 0)
     {
-        LOG("parser file(%s) failed", path);
-        ret = (size_t)-1;
-        goto fin;
+        return 0;
     }
 
+    /* Sort and only keep the first symbol of each address */
+    qsort(cache->funcs, cache->num, sizeof(elf_func_range_t), _elf_func_range_cmp);
+
+    size_t i, uniq = 1;
+    for (i = 1; i < cache->num; i++)
+    {
+        if (cache->funcs[i].addr != cache->funcs[uniq - 1].addr)
+        {
+            cache->funcs[uniq++] = cache->funcs[i];
+        }
+    }
+    cache->num = uniq;
+
+    return 0;
+}
+
+static int _elf_patch_site_cmp(const void* a, const void* b)
+{
+    const elf_patch_site_t* site_a = a;
+    const elf_patch_site_t* site_b = b;
+
+    if (site_a->addr != site_b->addr)
+    {
+        return site_a->addr < site_b->addr ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Append entries of a patch site section to \p cache.
+ *
+ * Both `__patchable_function_entries` and `__mcount_loc` are arrays of
+ * pointers. They are read from memory instead of file so that dynamic
+ * relocations are already applied.
+ */
+static int _elf_module_cache_add_sites(elf_module_cache_t* cache, const elf_shdr_t* shdr, int type)
+{
+    if (shdr->sh_addr == 0)
+    {
+        return 0;
+    }
+
+    size_t num = shdr->sh_size / sizeof(uintptr_t);
+    elf_patch_site_t* sites = realloc(cache->sites, sizeof(elf_patch_site_t) * (cache->site_num + num));
+    if (sites == NULL)
+    {
+        return -1;
+    }
+    cache->sites = sites;
+
+    const uintptr_t* entries = (const uintptr_t*)(cache->relocation + shdr->sh_addr);
+
+    size_t i;
+    for (i = 0; i < num; i++)
+    {
+        if (entries[i] == 0)
+        {
+            continue;
+        }
+        sites[cache->site_num].addr = entries[i] - cache->relocation;
+        sites[cache->site_num].type = type;
+        cache->site_num++;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Collect NOP sleds reserved by compiler.
+ * @return  0 if success, otherwise failure.
+ */
+static int _elf_module_cache_fill_sites(elf_module_cache_t* cache, const elf_info_t* info)
+{
     size_t idx;
     for (idx = 0; idx < info->ehdr.e_shnum; idx++)
     {
-        if (info->shdr[idx].sh_type == 0x02 || info->shdr[idx].sh_type == 0x0b)
+        char name[32];
+        if (elf_parser_section_name(name, sizeof(name), info, idx) < 0)
         {
-            int num = elf_parser_symbol(&symbol_list, info, idx);
+            continue;
+        }
 
-            int i;
-            for (i = 0; i < num; i++)
+        int ret = 0;
+        if (strcmp(name, "__patchable_function_entries") == 0)
+        {
+            ret = _elf_module_cache_add_sites(cache, &info->shdr[idx], ELF_PATCH_SITE_NOP_SLED);
+        }
+        else if (strcmp(name, "__mcount_loc") == 0)
+        {
+            ret = _elf_module_cache_add_sites(cache, &info->shdr[idx], ELF_PATCH_SITE_MCOUNT);
+        }
+        if (ret != 0)
+        {
+            return ret;
+        }
+    }
+
+    if (cache->site_num != 0)
+    {
+        qsort(cache->sites, cache->site_num, sizeof(elf_patch_site_t), _elf_patch_site_cmp);
+    }
+
+    return 0;
+}
+
+static int _elf_module_cache_add_gap(elf_module_cache_t* cache, uintptr_t addr, uintptr_t end)
+{
+    elf_code_gap_t* gaps = realloc(cache->gaps, sizeof(elf_code_gap_t) * (cache->gap_num + 1));
+    if (gaps == NULL)
+    {
+        return -1;
+    }
+    cache->gaps = gaps;
+
+    gaps[cache->gap_num].addr = addr;
+    gaps[cache->gap_num].size = end - addr;
+    cache->gap_num++;
+
+    return 0;
+}
+
+/**
+ * @brief Collect bytes in executable sections that no function covers.
+ *
+ * A symbol without size may own the code after it, so a gap is only
+ * recorded if it follows a sized symbol.
+ *
+ * @note Functions in \p cache must be sorted.
+ * @return  0 if success, otherwise failure.
+ */
+static int _elf_module_cache_fill_gaps(elf_module_cache_t* cache, const elf_info_t* info)
+{
+    size_t idx;
+    for (idx = 0; idx < info->ehdr.e_shnum; idx++)
+    {
+        const elf_shdr_t* shdr = &info->shdr[idx];
+        if (!(shdr->sh_flags & 0x04) || shdr->sh_addr == 0 || shdr->sh_type != 0x01)
+        {
+            continue;
+        }
+
+        uintptr_t sec_end = shdr->sh_addr + shdr->sh_size;
+        uintptr_t end = shdr->sh_addr;
+        int known = 0;
+
+        size_t i;
+        for (i = 0; i < cache->num && cache->funcs[i].addr < sec_end; i++)
+        {
+            const elf_func_range_t* func = &cache->funcs[i];
+            if (func->addr < shdr->sh_addr)
             {
-                if (symbol_list[i].st_value == target_addr)
-                {
-                    ret = symbol_list[i].st_size;
-                    goto fin;
-                }
+                continue;
             }
 
-            elf_release_symbol(symbol_list);
-            symbol_list = NULL;
+            if (known && func->addr > end && _elf_module_cache_add_gap(cache, end, func->addr) != 0)
+            {
+                return -1;
+            }
+
+            if (func->size == 0)
+            {
+                known = 0;
+            }
+            else if (!known || func->addr + func->size > end)
+            {
+                end = func->addr + func->size;
+                known = 1;
+            }
+        }
+
+        if (known && sec_end > end && _elf_module_cache_add_gap(cache, end, sec_end) != 0)
+        {
+            return -1;
         }
     }
 
-fin:
-    if (symbol_list != NULL)
+    return 0;
+}
+
+static void _elf_module_cache_release(elf_module_cache_t* cache)
+{
+    free(cache->gaps);
+    free(cache->sites);
+    free(cache->funcs);
+    free(cache);
+}
+
+/**
+ * @brief Parse module file that contains \p symbol.
+ */
+static elf_module_cache_t* _elf_module_cache_create(void* symbol, uintptr_t relocation, const void* phdr)
+{
+    char path_buffer[256];
+    if (_elf_find_path((uintptr_t)symbol, path_buffer, sizeof(path_buffer)) < 0)
     {
-        elf_release_symbol(symbol_list);
-        symbol_list = NULL;
+        LOG("cannot find path for symbol(%p)", symbol);
+        return NULL;
+    }
+
+    FILE* f_exe = fopen(path_buffer, "rb");
+    if (f_exe == NULL)
+    {
+        LOG("open file(%s) failed", path_buffer);
+        return NULL;
+    }
+
+    elf_module_cache_t* cache = calloc(1, sizeof(elf_module_cache_t));
+    elf_info_t* info = NULL;
+    if (cache == NULL)
+    {
+        goto err;
+    }
+    cache->relocation = relocation;
+    cache->phdr = phdr;
+
+    if (elf_parser_file(&info, f_exe) != 0)
+    {
+        LOG("parser file(%s) failed", path_buffer);
+        goto err;
+    }
+
+    if (_elf_module_cache_fill(cache, info) != 0
+        || _elf_module_cache_fill_sites(cache, info) != 0
+        || _elf_module_cache_fill_gaps(cache, info) != 0)
+    {
+        goto err;
     }
+
+    elf_release_info(info);
+    fclose(f_exe);
+    return cache;
+
+err:
     if (info != NULL)
     {
         elf_release_info(info);
-        info = NULL;
+    }
+    if (cache != NULL)
+    {
+        _elf_module_cache_release(cache);
     }
     fclose(f_exe);
+    return NULL;
+}
 
-    return ret;
+static elf_module_cache_t* _elf_module_cache_find(elf_module_cache_t* list, uintptr_t relocation, const void* phdr)
+{
+    for (; list != NULL; list = list->next)
+    {
+        if (list->relocation == relocation && list->phdr == phdr)
+        {
+            return list;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Get symbol cache of module that contains \p symbol.
+ *
+ * A module file is parsed only once. If two threads parse the same module
+ * at the same time, only one of them publish the result.
+ */
+static elf_module_cache_t* _elf_module_cache_get(void* symbol, uintptr_t* relocation)
+{
+    relocation_helper_t helper;
+    helper.ret = -1;
+    helper.loc_addr = 0;
+    helper.symbol_addr = symbol;
+    helper.phdr = NULL;
+
+    dl_iterate_phdr(_elf_dl_iterate_phdr_callback, &helper);
+    if (helper.ret < 0)
+    {
+        LOG("get relocation for symbol(%p) failed", symbol);
+        return NULL;
+    }
+    *relocation = (uintptr_t)helper.loc_addr;
+
+    elf_module_cache_t* head = __atomic_load_n(&s_elf_module_cache, __ATOMIC_ACQUIRE);
+    elf_module_cache_t* cache = _elf_module_cache_find(head, *relocation, helper.phdr);
+    if (cache != NULL)
+    {
+        return cache;
+    }
+
+    if ((cache = _elf_module_cache_create(symbol, *relocation, helper.phdr)) == NULL)
+    {
+        return NULL;
+    }
+
+    do
+    {
+        elf_module_cache_t* exist = _elf_module_cache_find(head, *relocation, helper.phdr);
+        if (exist != NULL)
+        {
+            _elf_module_cache_release(cache);
+            return exist;
+        }
+        cache->next = head;
+    } while (!__atomic_compare_exchange_n(&s_elf_module_cache, &head, cache,
+        0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+
+    return cache;
 }
 
 int elf_inject_got_patch(void** token, void** fn_call, const char* name, void* detour)
@@ -990,6 +1423,33 @@ void elf_inject_got_unpatch(void* token)
     free(helper);
 }
 
+int elf_inject_got_toggle(void* token, int enable)
+{
+    inject_got_ctx_t* helper = token;
+    void* func = enable ? helper->detour : helper->origin;
+
+    if (helper->inject_info.addr_relplt != 0
+        && _elf_replace_function(helper, helper->inject_info.addr_relplt, func, NULL) != 0)
+    {
+        return UHOOK_UNKNOWN;
+    }
+    if (helper->inject_info.addr_reldyn != 0
+        && _elf_replace_function(helper, helper->inject_info.addr_reldyn, func, NULL) != 0)
+    {
+        return UHOOK_UNKNOWN;
+    }
+
+    return UHOOK_SUCCESS;
+}
+
+void elf_inject_got_slots(void* token, void** relplt, void** reldyn)
+{
+    inject_got_ctx_t* helper = token;
+
+    *relplt = (void*)helper->inject_info.addr_relplt;
+    *reldyn = (void*)helper->inject_info.addr_reldyn;
+}
+
 void* elf_get_relocation_by_addr(void* symbol)
 {
     relocation_helper_t helper;
@@ -1012,14 +1472,194 @@ void* elf_get_relocation_by_addr(void* symbol)
  */
 size_t elf_get_function_size(void* symbol)
 {
-    char path_buffer[256];
-    if (_elf_find_path((uintptr_t)symbol, path_buffer, sizeof(path_buffer)) < 0)
+    uintptr_t relocation;
+    elf_module_cache_t* cache = _elf_module_cache_get(symbol, &relocation);
+    if (cache == NULL)
     {
-        LOG("cannot find path for symbol(%p)", symbol);
         return (size_t)-1;
     }
 
-    return _elf_get_function_size_from_object(path_buffer, symbol);
+    uintptr_t target_addr = (uintptr_t)symbol - relocation;
+
+    size_t low = 0, high = cache->num;
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (cache->funcs[mid].addr < target_addr)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    if (low < cache->num && cache->funcs[low].addr == target_addr)
+    {
+        return cache->funcs[low].size;
+    }
+    return (size_t)-1;
+}
+
+void* elf_find_patch_site(void* symbol, int* type)
+{
+    uintptr_t relocation;
+    elf_module_cache_t* cache = _elf_module_cache_get(symbol, &relocation);
+    if (cache == NULL || cache->site_num == 0)
+    {
+        return NULL;
+    }
+
+    /* CET enabled code starts with `endbr64` and the sled follows it */
+    static const uint8_t endbr64[] = { 0xf3, 0x0f, 0x1e, 0xfa };
+    uintptr_t target_addr = (uintptr_t)symbol - relocation;
+    if (memcmp(symbol, endbr64, sizeof(endbr64)) == 0)
+    {
+        target_addr += sizeof(endbr64);
+    }
+
+    size_t low = 0, high = cache->site_num;
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (cache->sites[mid].addr < target_addr)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    if (low < cache->site_num && cache->sites[low].addr == target_addr)
+    {
+        *type = cache->sites[low].type;
+        return (void*)(target_addr + relocation);
+    }
+    return NULL;
+}
+
+size_t elf_find_code_gaps(void* symbol, void* lo, void* hi, elf_code_gap_t* gaps, size_t cap)
+{
+    uintptr_t relocation;
+    elf_module_cache_t* cache = _elf_module_cache_get(symbol, &relocation);
+    if (cache == NULL)
+    {
+        return 0;
+    }
+
+    size_t i, num = 0;
+    for (i = 0; i < cache->gap_num && num < cap; i++)
+    {
+        uintptr_t addr = cache->gaps[i].addr + relocation;
+        if (addr + cache->gaps[i].size <= (uintptr_t)lo || addr >= (uintptr_t)hi)
+        {
+            continue;
+        }
+        gaps[num].addr = addr;
+        gaps[num].size = cache->gaps[i].size;
+        num++;
+    }
+
+    return num;
+}
+
+size_t elf_get_load_segments(elf_segment_t* segs, size_t cap)
+{
+    elf_segment_helper_t helper;
+    helper.segs = segs;
+    helper.cap = cap;
+    helper.num = 0;
+
+    dl_iterate_phdr(_elf_dl_iterate_segment_callback, &helper);
+    return helper.num;
+}
+
+size_t elf_get_functions(void* symbol, elf_function_t* funcs, size_t cap)
+{
+    uintptr_t relocation;
+    elf_module_cache_t* cache = _elf_module_cache_get(symbol, &relocation);
+    if (cache == NULL)
+    {
+        return 0;
+    }
+
+    size_t i, num = 0;
+    for (i = 0; i < cache->num; i++)
+    {
+        if (cache->funcs[i].size == 0)
+        {
+            continue;
+        }
+        if (num < cap)
+        {
+            funcs[num].addr = cache->funcs[i].addr + relocation;
+            funcs[num].size = cache->funcs[i].size;
+        }
+        num++;
+    }
+
+    return num;
+}
+
+size_t elf_get_build_id(uintptr_t base, uint8_t* id, size_t cap)
+{
+    elf_build_id_helper_t helper;
+    helper.base = base;
+    helper.id = id;
+    helper.cap = cap;
+    helper.size = 0;
+
+    dl_iterate_phdr(_elf_dl_iterate_build_id_callback, &helper);
+    return helper.size;
+}
+
+int elf_find_function(void* addr, void** start, size_t* size)
+{
+    uintptr_t relocation;
+    elf_module_cache_t* cache = _elf_module_cache_get(addr, &relocation);
+    if (cache == NULL || cache->num == 0)
+    {
+        return -1;
+    }
+
+    /* The last function that starts at or before addr */
+    uintptr_t target_addr = (uintptr_t)addr - relocation;
+    size_t low = 0, high = cache->num;
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (cache->funcs[mid].addr <= target_addr)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    /* Local labels have no size, skip them */
+    for (; low > 0; low--)
+    {
+        const elf_func_range_t* func = &cache->funcs[low - 1];
+        if (func->size == 0)
+        {
+            continue;
+        }
+        if (target_addr >= func->addr + func->size)
+        {
+            return -1;
+        }
+
+        *start = (void*)(func->addr + relocation);
+        *size = func->size;
+        return 0;
+    }
+
+    return -1;
 }
 
 void uhook_dump_phdr(void)
@@ -12,10 +12,138 @@ API_LOCAL int elf_inject_got_patch(void** token, void** fn_call, const char* nam
 
 API_LOCAL void elf_inject_got_unpatch(void* token);
 
+/**
+ * @brief Point GOT/PLT slots to detour function or back to original function.
+ * @param[in] token     Inject token
+ * @param[in] enable    Non-zero to use detour function
+ * @return              0 if success, otherwise failure
+ */
+API_LOCAL int elf_inject_got_toggle(void* token, int enable);
+
+/**
+ * @brief Get GOT/PLT slots that are patched.
+ * @param[in] token     Inject token
+ * @param[out] relplt   Slot address in .rel(a).plt, NULL if not patched
+ * @param[out] reldyn   Slot address in .rel(a).dyn, NULL if not patched
+ */
+API_LOCAL void elf_inject_got_slots(void* token, void** relplt, void** reldyn);
+
 API_LOCAL void* elf_get_relocation_by_addr(void* symbol);
 
 API_LOCAL size_t elf_get_function_size(void* symbol);
 
+/**
+ * @brief Kind of NOP sled reserved by compiler.
+ */
+typedef enum elf_patch_site_type
+{
+    ELF_PATCH_SITE_NOP_SLED,    /**< `-fpatchable-function-entry`, one or more NOPs */
+    ELF_PATCH_SITE_MCOUNT,      /**< `-mfentry -mnop-mcount -mrecord-mcount`, one 5-byte NOP */
+}elf_patch_site_type_t;
+
+typedef struct elf_patch_site
+{
+    uintptr_t       addr;           /**< Site address */
+    int             type;           /**< #elf_patch_site_type_t */
+}elf_patch_site_t;
+
+/**
+ * @brief Find NOP sled at entry of function.
+ *
+ * Only sleds recorded in `__patchable_function_entries` or `__mcount_loc`
+ * are reported, the sled may follow an `endbr64`.
+ *
+ * @param[in] symbol    Function address
+ * @param[out] type     #elf_patch_site_type_t
+ * @return              Sled address, or NULL if not found.
+ */
+API_LOCAL void* elf_find_patch_site(void* symbol, int* type);
+
+/**
+ * @brief Bytes in executable section that no function covers.
+ */
+typedef struct elf_code_gap
+{
+    uintptr_t       addr;           /**< Gap address */
+    size_t          size;           /**< Gap size */
+}elf_code_gap_t;
+
+/**
+ * @brief Find code gaps near \p symbol.
+ *
+ * Gaps are usually alignment padding between functions, but it is up to the
+ * caller to check their content.
+ *
+ * @param[in] symbol    Any address in the module
+ * @param[in] lo        Gaps must end after it
+ * @param[in] hi        Gaps must start before it
+ * @param[out] gaps     Relocated gaps sorted by address
+ * @param[in] cap       Capacity of \p gaps
+ * @return              Amount of gaps found
+ */
+API_LOCAL size_t elf_find_code_gaps(void* symbol, void* lo, void* hi, elf_code_gap_t* gaps, size_t cap);
+
+#define ELF_SEGMENT_EXEC    0x1     /**< Same as `PF_X` */
+#define ELF_SEGMENT_WRITE   0x2     /**< Same as `PF_W` */
+#define ELF_SEGMENT_READ    0x4     /**< Same as `PF_R` */
+
+/**
+ * @brief Loadable segment of a module.
+ */
+typedef struct elf_segment
+{
+    const char*     path;           /**< Module path, empty for main program */
+    uintptr_t       base;           /**< Load address of module */
+    uintptr_t       addr;           /**< Relocated address */
+    size_t          size;           /**< Size in memory */
+    unsigned        flags;          /**< #ELF_SEGMENT_EXEC, #ELF_SEGMENT_WRITE and #ELF_SEGMENT_READ */
+}elf_segment_t;
+
+/**
+ * @brief Get loadable segments of all loaded modules.
+ * @param[out] segs     Segment list
+ * @param[in] cap       Capacity of \p segs
+ * @return              Amount of segments, may be larger than \p cap.
+ */
+API_LOCAL size_t elf_get_load_segments(elf_segment_t* segs, size_t cap);
+
+/**
+ * @brief A sized function.
+ */
+typedef struct elf_function
+{
+    uintptr_t       addr;           /**< Relocated address */
+    size_t          size;           /**< Function size */
+}elf_function_t;
+
+/**
+ * @brief Get sized functions of module.
+ * @param[in] symbol    Any address in the module
+ * @param[out] funcs    Functions sorted by address
+ * @param[in] cap       Capacity of \p funcs
+ * @return              Amount of functions, may be larger than \p cap.
+ */
+API_LOCAL size_t elf_get_functions(void* symbol, elf_function_t* funcs, size_t cap);
+
+/**
+ * @brief Get GNU build-id of module.
+ * @param[in] base      Load address of module, see #elf_segment_t::base
+ * @param[out] id       Build-id
+ * @param[in] cap       Capacity of \p id
+ * @return              Length of build-id, 0 if module has no build-id or
+ *                      \p cap is too small.
+ */
+API_LOCAL size_t elf_get_build_id(uintptr_t base, uint8_t* id, size_t cap);
+
+/**
+ * @brief Find function that contains \p addr.
+ * @param[in] addr      Any address
+ * @param[out] start    Function address
+ * @param[out] size     Function size
+ * @return              0 if found, -1 if \p addr is not covered by any sized function.
+ */
+API_LOCAL int elf_find_function(void* addr, void** start, size_t* size);
+
 API_LOCAL void uhook_dump_phdr(void);
 
 #ifdef __cplusplus
@@ -1023,6 +1023,34 @@ int elf_parser_symbol(elf_symbol_t** dst, const elf_info_t* info, size_t idx)
     return num;
 }
 
+int elf_parser_section_name(char* dst, size_t size, const elf_info_t* info, size_t idx)
+{
+    size_t shstrndx = info->ehdr.e_shstrndx;
+    if (size == 0 || idx >= info->ehdr.e_shnum || shstrndx >= info->ehdr.e_shnum)
+    {
+        return -1;
+    }
+
+    const elf_shdr_t* strtab = &info->shdr[shstrndx];
+    if (info->shdr[idx].sh_name >= strtab->sh_size)
+    {
+        return -1;
+    }
+
+    long offset = (long)(strtab->sh_offset + info->shdr[idx].sh_name);
+    if (fseek(info->data.source.as_file, offset, SEEK_SET) != 0)
+    {
+        return -1;
+    }
+
+    size_t avail = strtab->sh_size - info->shdr[idx].sh_name;
+    size_t read_size = size - 1 < avail ? size - 1 : avail;
+    read_size = fread(dst, 1, read_size, info->data.source.as_file);
+    dst[read_size] = '\0';
+
+    return (int)strlen(dst);
+}
+
 int elf_dump_symbol(FILE* io, const elf_symbol_t* symbols, size_t size)
 {
     int ret;
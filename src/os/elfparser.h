@@ -399,6 +399,16 @@ int elf_parser_file(elf_info_t** dst, FILE* file);
  */
 int elf_parser_symbol(elf_symbol_t** dst, const elf_info_t* info, size_t idx);
 
+/**
+ * @brief Read name of section
+ * @param[out] dst  Buffer to store name, always NUL terminated.
+ * @param[in] size  Buffer size
+ * @param[in] info  ELF information
+ * @param[in] idx   Section index
+ * @return          Name length, or -1 if failed.
+ */
+int elf_parser_section_name(char* dst, size_t size, const elf_info_t* info, size_t idx);
+
 /**
  * @brief Destroy #elf_info_t
  * @param[in] info  Object to destroy
@@ -1,4 +1,6 @@
 #include "os/os.h"
+#include "mutex.h"
+#include "once.h"
 #include <stdlib.h>
 #include <stdint.h>
 #include <assert.h>
@@ -10,6 +12,65 @@
 #   include <sys/mman.h>
 #endif
 
+/**
+ * @brief Smallest block size of executable pool.
+ */
+#define SYSTEM_EXEC_BLOCK_MIN       16
+
+/**
+ * @brief Amount of block size classes: 16, 32, ..., 2048.
+ */
+#define SYSTEM_EXEC_BLOCK_CLASSES   8
+
+/**
+ * @brief Size of memory the pool requires from system at a time.
+ */
+#define SYSTEM_EXEC_CHUNK_SIZE      (64 * 1024)
+
+typedef struct system_exec_free
+{
+    struct system_exec_free*    next;       /**< Next free block of same class */
+}system_exec_free_t;
+
+typedef struct system_exec_pool
+{
+    uhook_mutex_t               mutex;      /**< Protect pool */
+    system_exec_free_t*         free_list[SYSTEM_EXEC_BLOCK_CLASSES];   /**< Released blocks */
+    uint8_t*                    bump_pos;   /**< Unused space of current chunk */
+    size_t                      bump_left;  /**< Unused size of current chunk */
+}system_exec_pool_t;
+
+/**
+ * @brief Amount of page lock shards.
+ */
+#define SYSTEM_PAGE_SHARDS          16
+
+/**
+ * @brief A page that is made writable, and how many writers are using it.
+ */
+typedef struct system_page_ref
+{
+    struct system_page_ref*     next;       /**< Next page in same shard */
+    uint8_t*                    page;       /**< Page address */
+    size_t                      refcnt;     /**< Amount of writers */
+}system_page_ref_t;
+
+typedef struct system_page_shard
+{
+    uhook_mutex_t               mutex;      /**< Protect this shard */
+    system_page_ref_t*          list;       /**< Writable pages */
+}system_page_shard_t;
+
+typedef struct system_ctx
+{
+    size_t                      page_size;  /**< Cached page size */
+    system_exec_pool_t          exec_pool;  /**< Executable block pool */
+    system_page_shard_t         page_shards[SYSTEM_PAGE_SHARDS];    /**< Writable pages */
+}system_ctx_t;
+
+static system_ctx_t s_system;
+static pthread_once_t s_system_once = PTHREAD_ONCE_INIT;
+
 /**
  * @brief Set memory protect mode as READ/WRITE/EXEC
  */
@@ -44,6 +105,39 @@ static int _system_protect_as_RE(void* addr, size_t size)
     return flag_failure ? -1 : 0;
 }
 
+static size_t _system_query_page_size(void)
+{
+#if defined(_WIN32)
+    SYSTEM_INFO sys_info;
+    GetSystemInfo(&sys_info);
+    unsigned long page_size = sys_info.dwPageSize;
+#elif defined(__linux__)
+    long page_size = sysconf(_SC_PAGE_SIZE);
+#else
+    long page_size = 0;
+#endif
+
+    return page_size <= 0 ? 4096 : page_size;
+}
+
+static void _system_init(void)
+{
+    s_system.page_size = _system_query_page_size();
+    uhook_mutex_init(&s_system.exec_pool.mutex);
+
+    size_t i;
+    for (i = 0; i < SYSTEM_PAGE_SHARDS; i++)
+    {
+        uhook_mutex_init(&s_system.page_shards[i].mutex);
+    }
+}
+
+static system_ctx_t* _system_ctx(void)
+{
+    pthread_once(&s_system_once, _system_init);
+    return &s_system;
+}
+
 void* _alloc_execute_memory(size_t size)
 {
 #if defined(_WIN32)
@@ -64,19 +158,173 @@ void* _alloc_execute_memory(size_t size)
 #endif
 }
 
+/**
+ * @return  Class index of \p size, or -1 if too large for pool.
+ */
+static int _system_exec_block_class(size_t size)
+{
+    int idx;
+    size_t class_size = SYSTEM_EXEC_BLOCK_MIN;
+    for (idx = 0; idx < SYSTEM_EXEC_BLOCK_CLASSES; idx++, class_size <<= 1)
+    {
+        if (size <= class_size)
+        {
+            return idx;
+        }
+    }
+    return -1;
+}
+
+void* _alloc_execute_block(size_t size)
+{
+    int idx = _system_exec_block_class(size);
+    if (idx < 0)
+    {
+        return _alloc_execute_memory(size);
+    }
+
+    system_exec_pool_t* pool = &_system_ctx()->exec_pool;
+    size_t class_size = (size_t)SYSTEM_EXEC_BLOCK_MIN << idx;
+    void* addr = NULL;
+
+    uhook_mutex_lock(&pool->mutex);
+
+    system_exec_free_t* block = pool->free_list[idx];
+    if (block != NULL)
+    {
+        pool->free_list[idx] = block->next;
+        addr = block;
+        goto fin;
+    }
+
+    if (pool->bump_left < class_size)
+    {
+        uint8_t* chunk = _alloc_execute_memory(SYSTEM_EXEC_CHUNK_SIZE);
+        if (chunk == NULL)
+        {
+            goto fin;
+        }
+        pool->bump_pos = chunk;
+        pool->bump_left = SYSTEM_EXEC_CHUNK_SIZE;
+    }
+
+    addr = pool->bump_pos;
+    pool->bump_pos += class_size;
+    pool->bump_left -= class_size;
+
+fin:
+    uhook_mutex_unlock(&pool->mutex);
+    return addr;
+}
+
+void _free_execute_block(void* ptr, size_t size)
+{
+    int idx = _system_exec_block_class(size);
+    if (idx < 0)
+    {
+        _free_execute_memory(ptr);
+        return;
+    }
+
+    system_exec_pool_t* pool = &_system_ctx()->exec_pool;
+    system_exec_free_t* block = ptr;
+
+    uhook_mutex_lock(&pool->mutex);
+    block->next = pool->free_list[idx];
+    pool->free_list[idx] = block;
+    uhook_mutex_unlock(&pool->mutex);
+}
+
 size_t _get_page_size(void)
 {
-#if defined(_WIN32)
-    SYSTEM_INFO sys_info;
-    GetSystemInfo(&sys_info);
-    unsigned long page_size = sys_info.dwPageSize;
-#elif defined(__linux__)
-    long page_size = sysconf(_SC_PAGE_SIZE);
-#else
-    long page_size = 0;
-#endif
+    return _system_ctx()->page_size;
+}
 
-    return page_size <= 0 ? 4096 : page_size;
+static system_page_shard_t* _system_page_shard(const uint8_t* page, size_t page_size)
+{
+    size_t idx = ((uintptr_t)page / page_size) % SYSTEM_PAGE_SHARDS;
+    return &_system_ctx()->page_shards[idx];
+}
+
+/**
+ * @brief Make \p page writable.
+ *
+ * A page is only protected again after the last writer release it, so
+ * threads that patch the same page do not remove WRITE attribute under
+ * each other.
+ *
+ * @return  0 if success, -1 if failure.
+ */
+static int _system_unprotect_page(uint8_t* page, size_t page_size)
+{
+    int ret = 0;
+    system_page_shard_t* shard = _system_page_shard(page, page_size);
+
+    uhook_mutex_lock(&shard->mutex);
+
+    system_page_ref_t* ref;
+    for (ref = shard->list; ref != NULL; ref = ref->next)
+    {
+        if (ref->page == page)
+        {
+            ref->refcnt++;
+            goto fin;
+        }
+    }
+
+    if ((ref = malloc(sizeof(system_page_ref_t))) == NULL)
+    {
+        ret = -1;
+        goto fin;
+    }
+
+    if (_system_protect_as_RWE(page, page_size) < 0)
+    {
+        free(ref);
+        ret = -1;
+        goto fin;
+    }
+
+    ref->page = page;
+    ref->refcnt = 1;
+    ref->next = shard->list;
+    shard->list = ref;
+
+fin:
+    uhook_mutex_unlock(&shard->mutex);
+    return ret;
+}
+
+/**
+ * @brief Release \p page made writable by #_system_unprotect_page().
+ */
+static void _system_protect_page(uint8_t* page, size_t page_size)
+{
+    system_page_shard_t* shard = _system_page_shard(page, page_size);
+
+    uhook_mutex_lock(&shard->mutex);
+
+    system_page_ref_t** pos;
+    for (pos = &shard->list; *pos != NULL; pos = &(*pos)->next)
+    {
+        system_page_ref_t* ref = *pos;
+        if (ref->page != page)
+        {
+            continue;
+        }
+
+        if (--ref->refcnt == 0)
+        {
+            int ret = _system_protect_as_RE(page, page_size);
+            assert(ret == 0); (void)ret;
+
+            *pos = ref->next;
+            free(ref);
+        }
+        break;
+    }
+
+    uhook_mutex_unlock(&shard->mutex);
 }
 
 int _system_modify_opcode(void* addr, size_t size, void (*callback)(void*), void* data)
@@ -86,25 +334,114 @@ int _system_modify_opcode(void* addr, size_t size, void (*callback)(void*), void
     uint8_t* start_addr = (uint8_t*)_page_of(addr, page_size);
     uint8_t* end_addr = (uint8_t*)addr + size;
 
-    const size_t n_page = ((end_addr - start_addr - 1) / page_size) + 1;
-    const size_t protect_size = page_size * n_page;
-
     /* Remove write protect */
-    if (_system_protect_as_RWE(start_addr, protect_size) < 0)
+    uint8_t* page;
+    for (page = start_addr; page < end_addr; page += page_size)
     {
-        return -1;
+        if (_system_unprotect_page(page, page_size) < 0)
+        {
+            while (page > start_addr)
+            {
+                page -= page_size;
+                _system_protect_page(page, page_size);
+            }
+            return -1;
+        }
     }
 
     /* call callback */
     callback(data);
 
     /* Add write protect */
-    int ret = _system_protect_as_RE(start_addr, protect_size);
-    assert(ret == 0); (void)ret;
+    for (page = start_addr; page < end_addr; page += page_size)
+    {
+        _system_protect_page(page, page_size);
+    }
 
     return 0;
 }
 
+/**
+ * @brief How many pages are kept writable at the same time by
+ *   #_system_modify_opcode_batch().
+ */
+#define SYSTEM_UNPROTECT_PAGE_MAX   32
+
+static void _system_protect_pages(uint8_t** pages, size_t* num, size_t page_size)
+{
+    size_t i;
+    for (i = 0; i < *num; i++)
+    {
+        _system_protect_page(pages[i], page_size);
+    }
+    *num = 0;
+}
+
+int _system_modify_opcode_batch(size_t num,
+    int (*range)(void* data, size_t idx, void** addr, size_t* size),
+    void (*callback)(void* data, size_t idx), void* data)
+{
+    const size_t page_size = _get_page_size();
+
+    int ret = 0;
+    size_t page_num = 0;
+    uint8_t* pages[SYSTEM_UNPROTECT_PAGE_MAX];
+
+    size_t idx;
+    for (idx = 0; idx < num; idx++)
+    {
+        void* addr; size_t size;
+        if (range(data, idx, &addr, &size) != 0)
+        {
+            continue;
+        }
+
+        uint8_t* start_addr = (uint8_t*)_page_of(addr, page_size);
+        uint8_t* end_addr = (uint8_t*)_page_of((uint8_t*)addr + size - 1, page_size) + page_size;
+
+        /* All pages of a location must stay writable until callback returns */
+        if (page_num + (end_addr - start_addr) / page_size > SYSTEM_UNPROTECT_PAGE_MAX)
+        {
+            _system_protect_pages(pages, &page_num, page_size);
+        }
+
+        uint8_t* page;
+        for (page = start_addr; page < end_addr; page += page_size)
+        {
+            size_t i;
+            for (i = 0; i < page_num; i++)
+            {
+                if (pages[i] == page)
+                {
+                    break;
+                }
+            }
+
+            if (i < page_num)
+            {
+                continue;
+            }
+            if (page_num == SYSTEM_UNPROTECT_PAGE_MAX || _system_unprotect_page(page, page_size) < 0)
+            {
+                break;
+            }
+            pages[page_num++] = page;
+        }
+
+        if (page < end_addr)
+        {
+            ret = -1;
+            continue;
+        }
+
+        callback(data, idx);
+    }
+
+    _system_protect_pages(pages, &page_num, page_size);
+
+    return ret;
+}
+
 void _flush_instruction_cache(void* addr, size_t size)
 {
 #if defined(_WIN32)
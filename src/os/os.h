@@ -19,10 +19,56 @@ API_LOCAL void* _alloc_execute_memory(size_t size);
  */
 API_LOCAL void _free_execute_memory(void* ptr);
 
+/**
+ * @brief Alloc a small block of memory that has EXEC attribute.
+ *
+ * Blocks are carved from shared pages, so a few bytes of generated code do
+ * not cost a whole page. The returned address is 16 bytes aligned.
+ *
+ * @param[in] size  Block size
+ * @return          Address
+ */
+API_LOCAL void* _alloc_execute_block(size_t size);
+
+/**
+ * @brief Release memory alloc by #_alloc_execute_block()
+ * @param[in] ptr   Block address
+ * @param[in] size  The same value passed to #_alloc_execute_block()
+ */
+API_LOCAL void _free_execute_block(void* ptr, size_t size);
+
 API_LOCAL size_t _get_page_size(void);
 
+/**
+ * @brief Make code writable and call \p callback to modify it.
+ *
+ * It is safe to modify code in the same page from several threads, the
+ * page is only protected again after all of them finish.
+ *
+ * @param[in] addr      Start address
+ * @param[in] size      Length of code to modify
+ * @param[in] callback  Called once code is writable
+ * @param[in] data      User defined argument
+ * @return              0 if success, -1 if failure.
+ */
 API_LOCAL int _system_modify_opcode(void* addr, size_t size, void (*callback)(void*), void* data);
 
+/**
+ * @brief Modify opcode at several locations.
+ *
+ * Pages shared by several locations are only unprotected once, so patching
+ * a lot of functions in the same module cost a handful of system calls.
+ *
+ * @param[in] num       Amount of locations
+ * @param[in] range     Get location of \p idx. Return non-zero to skip it.
+ * @param[in] callback  Called for location \p idx once it is writable.
+ * @param[in] data      User defined argument
+ * @return              0 if success, -1 if any location cannot be unprotected.
+ */
+API_LOCAL int _system_modify_opcode_batch(size_t num,
+    int (*range)(void* data, size_t idx, void** addr, size_t* size),
+    void (*callback)(void* data, size_t idx), void* data);
+
 /**
  * @brief Flush the processor's instruction cache for the region of memory.
  *
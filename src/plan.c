@@ -0,0 +1,149 @@
+#include "plan.h"
+#include "os/elf.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * @brief Amount of functions a worker takes at once.
+ */
+#define UHOOK_PLAN_BATCH        64
+
+/**
+ * @brief Max amount of worker threads.
+ */
+#define UHOOK_PLAN_MAX_THREADS  64
+
+typedef struct uhook_plan_ctx
+{
+    elf_function_t*         funcs;      /**< Functions to analyze */
+    size_t                  num;        /**< Amount of functions */
+    size_t                  next;       /**< Next function to take, atomic */
+    uhook_plan_fn           plan;       /**< Analyze function */
+    pthread_mutex_t         mutex;      /**< Protect summary */
+    uhook_plan_summary_t*   summary;    /**< Merged summary */
+}uhook_plan_ctx_t;
+
+static void _uhook_plan_count(uhook_plan_summary_t* summary, const uhook_plan_t* report)
+{
+    summary->func_num++;
+    summary->small_func += report->result == UHOOK_SMALLFUNC;
+    summary->reloc_fail += report->reloc_fail != 0;
+    summary->rip_relative += report->rip_relative != 0;
+    summary->branch_in += report->branch_in != 0;
+
+    if (report->result != UHOOK_SUCCESS)
+    {
+        return;
+    }
+
+    summary->hookable++;
+    summary->method[report->method]++;
+    summary->cave += report->cave != 0;
+    summary->patch_bytes += report->patch_size;
+}
+
+static void _uhook_plan_merge(uhook_plan_summary_t* dst, const uhook_plan_summary_t* src)
+{
+    dst->func_num += src->func_num;
+    dst->hookable += src->hookable;
+    dst->cave += src->cave;
+    dst->small_func += src->small_func;
+    dst->reloc_fail += src->reloc_fail;
+    dst->rip_relative += src->rip_relative;
+    dst->branch_in += src->branch_in;
+    dst->patch_bytes += src->patch_bytes;
+
+    size_t i;
+    for (i = 0; i < sizeof(dst->method) / sizeof(dst->method[0]); i++)
+    {
+        dst->method[i] += src->method[i];
+    }
+}
+
+static void* _uhook_plan_worker(void* arg)
+{
+    uhook_plan_ctx_t* ctx = arg;
+    uhook_plan_summary_t summary;
+    uhook_plan_t report;
+    memset(&summary, 0, sizeof(summary));
+
+    for (;;)
+    {
+        size_t start = __atomic_fetch_add(&ctx->next, UHOOK_PLAN_BATCH, __ATOMIC_RELAXED);
+        if (start >= ctx->num)
+        {
+            break;
+        }
+
+        size_t i, end = start + UHOOK_PLAN_BATCH < ctx->num ? start + UHOOK_PLAN_BATCH : ctx->num;
+        for (i = start; i < end; i++)
+        {
+            ctx->plan((void*)ctx->funcs[i].addr, &report);
+            _uhook_plan_count(&summary, &report);
+        }
+    }
+
+    pthread_mutex_lock(&ctx->mutex);
+    _uhook_plan_merge(ctx->summary, &summary);
+    pthread_mutex_unlock(&ctx->mutex);
+
+    return NULL;
+}
+
+static unsigned _uhook_plan_threads(unsigned threads)
+{
+    if (threads == 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (unsigned)cpus : 1;
+    }
+    return threads < UHOOK_PLAN_MAX_THREADS ? threads : UHOOK_PLAN_MAX_THREADS;
+}
+
+int uhook_plan_module_run(void* symbol, unsigned threads, uhook_plan_summary_t* summary, uhook_plan_fn plan)
+{
+    memset(summary, 0, sizeof(*summary));
+
+    uhook_plan_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.plan = plan;
+    ctx.summary = summary;
+
+    size_t cap = elf_get_functions(symbol, NULL, 0);
+    if (cap == 0)
+    {
+        return UHOOK_NOFUNCSIZE;
+    }
+    if ((ctx.funcs = malloc(sizeof(elf_function_t) * cap)) == NULL)
+    {
+        return UHOOK_NOMEM;
+    }
+    ctx.num = elf_get_functions(symbol, ctx.funcs, cap);
+    ctx.num = ctx.num < cap ? ctx.num : cap;
+    pthread_mutex_init(&ctx.mutex, NULL);
+
+    /* The calling thread is one of the workers */
+    pthread_t tids[UHOOK_PLAN_MAX_THREADS];
+    unsigned i, started = 0;
+    for (i = 1; i < _uhook_plan_threads(threads); i++)
+    {
+        if (pthread_create(&tids[started], NULL, _uhook_plan_worker, &ctx) != 0)
+        {
+            break;
+        }
+        started++;
+    }
+
+    _uhook_plan_worker(&ctx);
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(tids[i], NULL);
+    }
+
+    pthread_mutex_destroy(&ctx.mutex);
+    free(ctx.funcs);
+
+    return UHOOK_SUCCESS;
+}
@@ -0,0 +1,27 @@
+#ifndef __UHOOK_PLAN_H__
+#define __UHOOK_PLAN_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uhook.h"
+#include "defs.h"
+
+/**
+ * @brief Analyze one function.
+ * @see uhook_plan()
+ */
+typedef int (*uhook_plan_fn)(void* target, uhook_plan_t* report);
+
+/**
+ * @brief Analyze every function of a module on a pool of threads.
+ * @see uhook_plan_module()
+ * @param[in] plan  Analyze function
+ */
+API_LOCAL int uhook_plan_module_run(void* symbol, unsigned threads, uhook_plan_summary_t* summary,
+    uhook_plan_fn plan);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,516 @@
+#include "plancache.h"
+#include "mutex.h"
+#include "once.h"
+#include "os/elf.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define INLINE_HOOK_DEBUG
+#include "log.h"
+
+/**
+ * @brief Max build-id length, SHA-1 is 20 bytes.
+ */
+#define UHOOK_PLAN_CACHE_MAX_BUILD_ID   32
+
+#define UHOOK_PLAN_CACHE_MAGIC          0x43504855  /* "UHPC" */
+#define UHOOK_PLAN_CACHE_VERSION        1
+
+/**
+ * @brief Cache file header.
+ *
+ * The file is a header, records sorted by build-id and offset, then all
+ * relocation offsets. Everything is naturally aligned, so the file is used
+ * in place after mapped.
+ */
+typedef struct uhook_plan_cache_header
+{
+    uint32_t        magic;      /**< #UHOOK_PLAN_CACHE_MAGIC */
+    uint32_t        version;    /**< #UHOOK_PLAN_CACHE_VERSION */
+    uint64_t        num;        /**< Amount of records */
+    uint64_t        reloc_num;  /**< Amount of relocation offsets */
+}uhook_plan_cache_header_t;
+
+typedef struct uhook_plan_cache_record
+{
+    uint8_t         id[UHOOK_PLAN_CACHE_MAX_BUILD_ID];      /**< Build-id of module */
+    uint32_t        id_size;    /**< Length of build-id */
+    uint32_t        reloc_num;  /**< Amount of relocation offsets */
+    uint64_t        offset;     /**< Offset of function to load address */
+    uint64_t        func_size;  /**< Function size */
+    uint64_t        hash;       /**< Hash of function body */
+    uint64_t        reloc_first;/**< Index of first relocation offset */
+    uint8_t         prologue[UHOOK_PLAN_CACHE_PROLOGUE];    /**< Function entry */
+}uhook_plan_cache_record_t;
+
+/**
+ * @brief Plan recorded in this process.
+ */
+typedef struct uhook_plan_cache_item
+{
+    uhook_plan_cache_record_t   record;     /**< Record, `reloc_first` is unused */
+    uint32_t*                   relocs;     /**< Relocation offsets */
+}uhook_plan_cache_item_t;
+
+typedef struct uhook_plan_cache_ctx
+{
+    uhook_mutex_t                       mutex;      /**< Protect everything below */
+    int                                 enabled;    /**< Whether plans are recorded */
+
+    const uhook_plan_cache_record_t*    records;    /**< Records in mapped file */
+    size_t                              num;        /**< Amount of records */
+    const uint32_t*                     relocs;     /**< Relocation offsets in mapped file */
+    size_t                              reloc_num;  /**< Amount of relocation offsets */
+
+    uhook_plan_cache_item_t*            items;      /**< Recorded plans */
+    size_t                              item_num;   /**< Amount of recorded plans */
+    size_t                              item_cap;   /**< Capacity of recorded plans */
+
+    uintptr_t                           last_base;  /**< Module of last query */
+    uint8_t                             last_id[UHOOK_PLAN_CACHE_MAX_BUILD_ID];
+    size_t                              last_id_size;
+}uhook_plan_cache_ctx_t;
+
+/**
+ * @brief Record of a cache file to write, from mapped file or recorded plan.
+ */
+typedef struct uhook_plan_cache_ref
+{
+    const uhook_plan_cache_record_t*    record;     /**< Record */
+    const uint32_t*                     relocs;     /**< Relocation offsets */
+    size_t                              order;      /**< Later one wins if key is the same */
+}uhook_plan_cache_ref_t;
+
+static uhook_plan_cache_ctx_t s_plan_cache;
+static pthread_once_t s_plan_cache_once = PTHREAD_ONCE_INIT;
+
+static void _uhook_plan_cache_init(void)
+{
+    uhook_mutex_init(&s_plan_cache.mutex);
+}
+
+/**
+ * @brief FNV-1a
+ */
+static uint64_t _uhook_plan_cache_hash(const uint8_t* code, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i;
+    for (i = 0; i < size; i++)
+    {
+        hash = (hash ^ code[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static int _uhook_plan_cache_key_cmp(const uhook_plan_cache_record_t* a, const uhook_plan_cache_record_t* b)
+{
+    if (a->id_size != b->id_size)
+    {
+        return a->id_size < b->id_size ? -1 : 1;
+    }
+    int ret = memcmp(a->id, b->id, a->id_size);
+    if (ret != 0)
+    {
+        return ret;
+    }
+    return a->offset < b->offset ? -1 : (a->offset > b->offset ? 1 : 0);
+}
+
+static int _uhook_plan_cache_ref_cmp(const void* a, const void* b)
+{
+    const uhook_plan_cache_ref_t* ref_a = a;
+    const uhook_plan_cache_ref_t* ref_b = b;
+    int ret = _uhook_plan_cache_key_cmp(ref_a->record, ref_b->record);
+    if (ret != 0)
+    {
+        return ret;
+    }
+    return ref_a->order < ref_b->order ? -1 : (ref_a->order > ref_b->order ? 1 : 0);
+}
+
+/**
+ * @brief Fill build-id and offset of \p target into \p key.
+ * @note Must be called with lock held.
+ * @return  bool
+ */
+static int _uhook_plan_cache_key(const void* target, uhook_plan_cache_record_t* key)
+{
+    /* Load address of non-PIE executable is 0, so NULL is not an error here */
+    uintptr_t base = (uintptr_t)elf_get_relocation_by_addr((void*)target);
+
+    if (s_plan_cache.last_id_size == 0 || s_plan_cache.last_base != base)
+    {
+        s_plan_cache.last_id_size = elf_get_build_id(base, s_plan_cache.last_id, sizeof(s_plan_cache.last_id));
+        s_plan_cache.last_base = base;
+    }
+    if (s_plan_cache.last_id_size == 0 || s_plan_cache.last_id_size > sizeof(key->id))
+    {
+        return 0;
+    }
+
+    memset(key, 0, sizeof(*key));
+    memcpy(key->id, s_plan_cache.last_id, s_plan_cache.last_id_size);
+    key->id_size = (uint32_t)s_plan_cache.last_id_size;
+    key->offset = (uintptr_t)target - base;
+    return 1;
+}
+
+int uhook_plan_reloc_push(uhook_plan_reloc_list_t* list, size_t pos)
+{
+    if (list->num == list->cap)
+    {
+        size_t new_cap = list->cap == 0 ? 16 : list->cap * 2;
+        uint32_t* new_data = realloc(list->data, sizeof(uint32_t) * new_cap);
+        if (new_data == NULL)
+        {
+            return UHOOK_NOMEM;
+        }
+        list->data = new_data;
+        list->cap = new_cap;
+    }
+
+    list->data[list->num++] = (uint32_t)pos;
+    return UHOOK_SUCCESS;
+}
+
+int uhook_plan_cache_lookup(const void* target, uhook_plan_cache_entry_t* entry)
+{
+    pthread_once(&s_plan_cache_once, _uhook_plan_cache_init);
+
+    int found = 0;
+    uhook_plan_cache_record_t key;
+    uhook_mutex_lock(&s_plan_cache.mutex);
+
+    if (s_plan_cache.num == 0 || !_uhook_plan_cache_key(target, &key))
+    {
+        goto fin;
+    }
+
+    size_t low = 0, high = s_plan_cache.num;
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        int ret = _uhook_plan_cache_key_cmp(&s_plan_cache.records[mid], &key);
+        if (ret == 0)
+        {
+            low = mid;
+            break;
+        }
+        if (ret < 0)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    if (low >= s_plan_cache.num || _uhook_plan_cache_key_cmp(&s_plan_cache.records[low], &key) != 0)
+    {
+        goto fin;
+    }
+
+    /* Cheap check first, then make sure relocation offsets still hit instruction boundaries */
+    const uhook_plan_cache_record_t* record = &s_plan_cache.records[low];
+    size_t prologue_size = record->func_size < sizeof(record->prologue) ?
+        (size_t)record->func_size : sizeof(record->prologue);
+    if (memcmp(target, record->prologue, prologue_size) != 0
+        || _uhook_plan_cache_hash(target, (size_t)record->func_size) != record->hash)
+    {
+        LOG("plan of %p is outdated", target);
+        goto fin;
+    }
+
+    entry->func_size = (size_t)record->func_size;
+    entry->relocs = s_plan_cache.relocs + record->reloc_first;
+    entry->reloc_num = record->reloc_num;
+    found = 1;
+
+fin:
+    uhook_mutex_unlock(&s_plan_cache.mutex);
+    return found;
+}
+
+void uhook_plan_cache_record(const void* target, const uhook_plan_cache_entry_t* entry)
+{
+    pthread_once(&s_plan_cache_once, _uhook_plan_cache_init);
+
+    uhook_mutex_lock(&s_plan_cache.mutex);
+    if (!s_plan_cache.enabled)
+    {
+        goto fin;
+    }
+
+    uhook_plan_cache_record_t key;
+    if (!_uhook_plan_cache_key(target, &key))
+    {
+        goto fin;
+    }
+
+    uint32_t* relocs = malloc(sizeof(uint32_t) * (entry->reloc_num + 1));
+    if (relocs == NULL)
+    {
+        goto fin;
+    }
+    memcpy(relocs, entry->relocs, sizeof(uint32_t) * entry->reloc_num);
+
+    /* Plan of a function injected again replaces the old one, so inject cycles do not grow memory */
+    size_t i;
+    for (i = 0; i < s_plan_cache.item_num; i++)
+    {
+        if (_uhook_plan_cache_key_cmp(&s_plan_cache.items[i].record, &key) == 0)
+        {
+            break;
+        }
+    }
+
+    if (i < s_plan_cache.item_num)
+    {
+        free(s_plan_cache.items[i].relocs);
+    }
+    else if (s_plan_cache.item_num == s_plan_cache.item_cap)
+    {
+        size_t new_cap = s_plan_cache.item_cap == 0 ? 64 : s_plan_cache.item_cap * 2;
+        uhook_plan_cache_item_t* new_items = realloc(s_plan_cache.items, sizeof(uhook_plan_cache_item_t) * new_cap);
+        if (new_items == NULL)
+        {
+            free(relocs);
+            goto fin;
+        }
+        s_plan_cache.items = new_items;
+        s_plan_cache.item_cap = new_cap;
+    }
+
+    uhook_plan_cache_item_t* item = &s_plan_cache.items[i];
+    item->record = key;
+    item->relocs = relocs;
+
+    size_t prologue_size = entry->func_size < sizeof(item->record.prologue) ?
+        entry->func_size : sizeof(item->record.prologue);
+    memcpy(item->record.prologue, target, prologue_size);
+    item->record.func_size = entry->func_size;
+    item->record.reloc_num = (uint32_t)entry->reloc_num;
+    item->record.hash = _uhook_plan_cache_hash(target, entry->func_size);
+    if (i == s_plan_cache.item_num)
+    {
+        s_plan_cache.item_num++;
+    }
+
+fin:
+    uhook_mutex_unlock(&s_plan_cache.mutex);
+}
+
+/**
+ * @brief Check mapped cache file.
+ * @return  bool
+ */
+static int _uhook_plan_cache_verify(const uint8_t* map, size_t size)
+{
+    const uhook_plan_cache_header_t* header = (const uhook_plan_cache_header_t*)map;
+    if (size < sizeof(*header) || header->magic != UHOOK_PLAN_CACHE_MAGIC
+        || header->version != UHOOK_PLAN_CACHE_VERSION)
+    {
+        return 0;
+    }
+
+    size_t avail = size - sizeof(*header);
+    if (header->num > avail / sizeof(uhook_plan_cache_record_t))
+    {
+        return 0;
+    }
+    avail -= (size_t)header->num * sizeof(uhook_plan_cache_record_t);
+    if (header->reloc_num > avail / sizeof(uint32_t))
+    {
+        return 0;
+    }
+
+    const uhook_plan_cache_record_t* records = (const uhook_plan_cache_record_t*)(header + 1);
+    uint64_t i;
+    for (i = 0; i < header->num; i++)
+    {
+        if (records[i].id_size > sizeof(records[i].id) || records[i].reloc_first > header->reloc_num
+            || records[i].reloc_num > header->reloc_num - records[i].reloc_first)
+        {
+            return 0;
+        }
+        if (i != 0 && _uhook_plan_cache_key_cmp(&records[i - 1], &records[i]) >= 0)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int uhook_plan_cache_open(const char* path)
+{
+    pthread_once(&s_plan_cache_once, _uhook_plan_cache_init);
+
+    int ret = UHOOK_INVALID;
+    uhook_mutex_lock(&s_plan_cache.mutex);
+    s_plan_cache.enabled = 1;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        goto fin;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size <= 0)
+    {
+        close(fd);
+        goto fin;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        goto fin;
+    }
+
+    if (!_uhook_plan_cache_verify(map, size))
+    {
+        LOG("`%s` is not a valid plan cache", path);
+        munmap(map, size);
+        goto fin;
+    }
+
+    /*
+     * Entries returned by lookup point into the mapping, so a replaced file
+     * is kept mapped.
+     */
+    const uhook_plan_cache_header_t* header = map;
+    s_plan_cache.records = (const uhook_plan_cache_record_t*)(header + 1);
+    s_plan_cache.num = (size_t)header->num;
+    s_plan_cache.relocs = (const uint32_t*)(s_plan_cache.records + header->num);
+    s_plan_cache.reloc_num = (size_t)header->reloc_num;
+    ret = UHOOK_SUCCESS;
+
+fin:
+    uhook_mutex_unlock(&s_plan_cache.mutex);
+    return ret;
+}
+
+static int _uhook_plan_cache_write_file(FILE* file, uhook_plan_cache_ref_t* refs, size_t num)
+{
+    uhook_plan_cache_header_t header;
+    header.magic = UHOOK_PLAN_CACHE_MAGIC;
+    header.version = UHOOK_PLAN_CACHE_VERSION;
+    header.num = num;
+    header.reloc_num = 0;
+
+    size_t i;
+    for (i = 0; i < num; i++)
+    {
+        header.reloc_num += refs[i].record->reloc_num;
+    }
+    if (fwrite(&header, sizeof(header), 1, file) != 1)
+    {
+        return -1;
+    }
+
+    uint64_t reloc_first = 0;
+    for (i = 0; i < num; i++)
+    {
+        uhook_plan_cache_record_t record = *refs[i].record;
+        record.reloc_first = reloc_first;
+        reloc_first += record.reloc_num;
+        if (fwrite(&record, sizeof(record), 1, file) != 1)
+        {
+            return -1;
+        }
+    }
+
+    for (i = 0; i < num; i++)
+    {
+        size_t reloc_num = refs[i].record->reloc_num;
+        if (reloc_num != 0 && fwrite(refs[i].relocs, sizeof(uint32_t), reloc_num, file) != reloc_num)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int uhook_plan_cache_write(const char* path)
+{
+    pthread_once(&s_plan_cache_once, _uhook_plan_cache_init);
+
+    int ret = UHOOK_NOMEM;
+    char* tmp_path = NULL;
+    uhook_mutex_lock(&s_plan_cache.mutex);
+
+    size_t i, num = 0, total = s_plan_cache.num + s_plan_cache.item_num;
+    uhook_plan_cache_ref_t* refs = malloc(sizeof(uhook_plan_cache_ref_t) * (total + 1));
+    if (refs == NULL)
+    {
+        goto fin;
+    }
+
+    for (i = 0; i < s_plan_cache.num; i++, num++)
+    {
+        refs[num].record = &s_plan_cache.records[i];
+        refs[num].relocs = s_plan_cache.relocs + s_plan_cache.records[i].reloc_first;
+        refs[num].order = num;
+    }
+    for (i = 0; i < s_plan_cache.item_num; i++, num++)
+    {
+        refs[num].record = &s_plan_cache.items[i].record;
+        refs[num].relocs = s_plan_cache.items[i].relocs;
+        refs[num].order = num;
+    }
+    qsort(refs, num, sizeof(uhook_plan_cache_ref_t), _uhook_plan_cache_ref_cmp);
+
+    /* Keep the latest plan of each function */
+    size_t uniq = 0;
+    for (i = 0; i < num; i++)
+    {
+        if (i + 1 < num && _uhook_plan_cache_key_cmp(refs[i].record, refs[i + 1].record) == 0)
+        {
+            continue;
+        }
+        refs[uniq++] = refs[i];
+    }
+
+    /* Write to a temporary file and rename, so readers never see a partial file */
+    size_t path_len = strlen(path);
+    if ((tmp_path = malloc(path_len + 5)) == NULL)
+    {
+        goto fin;
+    }
+    memcpy(tmp_path, path, path_len);
+    memcpy(tmp_path + path_len, ".tmp", 5);
+
+    ret = UHOOK_UNKNOWN;
+    FILE* file = fopen(tmp_path, "wb");
+    if (file == NULL)
+    {
+        LOG("open `%s` failed", tmp_path);
+        goto fin;
+    }
+
+    int write_ret = _uhook_plan_cache_write_file(file, refs, uniq);
+    if (fclose(file) != 0 || write_ret != 0 || rename(tmp_path, path) != 0)
+    {
+        LOG("write `%s` failed", path);
+        remove(tmp_path);
+        goto fin;
+    }
+    ret = UHOOK_SUCCESS;
+
+fin:
+    uhook_mutex_unlock(&s_plan_cache.mutex);
+    free(tmp_path);
+    free(refs);
+    return ret;
+}
@@ -0,0 +1,77 @@
+#ifndef __UHOOK_PLANCACHE_H__
+#define __UHOOK_PLANCACHE_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uhook.h"
+#include "defs.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Bytes at function entry that must match before a plan is reused.
+ */
+#define UHOOK_PLAN_CACHE_PROLOGUE   16
+
+/**
+ * @brief Offsets of instructions that need relocation in trampoline.
+ */
+typedef struct uhook_plan_reloc_list
+{
+    uint32_t*       data;       /**< Offsets to function start */
+    size_t          num;        /**< Amount of offsets */
+    size_t          cap;        /**< Capacity of offset list */
+}uhook_plan_reloc_list_t;
+
+/**
+ * @brief How a function was injected, indexed by build-id and offset to
+ *   load address of module.
+ */
+typedef struct uhook_plan_cache_entry
+{
+    size_t          func_size;  /**< Function size */
+    const uint32_t* relocs;     /**< Offsets of instructions to relocate */
+    size_t          reloc_num;  /**< Amount of offsets */
+}uhook_plan_cache_entry_t;
+
+/**
+ * @brief Append offset to list.
+ * @return          #uhook_errno
+ */
+API_LOCAL int uhook_plan_reloc_push(uhook_plan_reloc_list_t* list, size_t pos);
+
+/**
+ * @brief Find plan of \p target in loaded cache file.
+ *
+ * Plan is only returned if prologue and body of \p target are the same as
+ * the time it is recorded. No file is touched.
+ *
+ * @param[in] target    Function address
+ * @param[out] entry    Plan, valid until process exits.
+ * @return              bool
+ */
+API_LOCAL int uhook_plan_cache_lookup(const void* target, uhook_plan_cache_entry_t* entry);
+
+/**
+ * @brief Remember plan of \p target, it is written by uhook_plan_cache_save().
+ * @note Does nothing if uhook_plan_cache_load() is never called.
+ * @param[in] target    Function address, must not be patched yet.
+ * @param[in] entry     Plan
+ */
+API_LOCAL void uhook_plan_cache_record(const void* target, const uhook_plan_cache_entry_t* entry);
+
+/**
+ * @see uhook_plan_cache_load()
+ */
+API_LOCAL int uhook_plan_cache_open(const char* path);
+
+/**
+ * @see uhook_plan_cache_save()
+ */
+API_LOCAL int uhook_plan_cache_write(const char* path);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,272 @@
+#include "uhook.h"
+#include "registry.h"
+#include "mutex.h"
+#include "once.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#   include <windows.h>
+#else
+#   include <sched.h>
+#endif
+
+/**
+ * @brief Initial amount of buckets, must be power of 2.
+ */
+#define UHOOK_REGISTRY_INIT_SIZE    64
+
+typedef struct uhook_registry_table
+{
+    size_t                  bucket_cnt; /**< Amount of buckets, power of 2 */
+    uhook_registry_node_t*  buckets[];  /**< Bucket list */
+}uhook_registry_table_t;
+
+/**
+ * @brief Hash table of nodes.
+ *
+ * Lookups take no lock. Writers are serialized by mutex and publish table,
+ * bucket heads and `next` links by release store, so readers only need
+ * acquire loads.
+ *
+ * Resize moves nodes to other buckets, so a lookup that misses while
+ * #uhook_registry_t::resize_seq changed is tried again. Memory that
+ * writers unlink is only reused after every reader that may still see it
+ * has left, by waiting #uhook_registry_t::readers of previous epoch drain.
+ */
+typedef struct uhook_registry
+{
+    uhook_mutex_t           mutex;      /**< Serialize writers */
+    uhook_registry_table_t* table;      /**< Buckets, NULL if no node ever inserted */
+    size_t                  node_cnt;   /**< Amount of nodes */
+    unsigned                resize_seq; /**< Odd while nodes are moved */
+    unsigned                epoch;      /**< Readers enter `readers[epoch & 1]` */
+    size_t                  readers[2]; /**< Amount of readers in each epoch */
+}uhook_registry_t;
+
+static uhook_registry_t s_registry;
+static pthread_once_t s_registry_once = PTHREAD_ONCE_INIT;
+
+static void _uhook_registry_init(void)
+{
+    uhook_mutex_init(&s_registry.mutex);
+}
+
+static void _uhook_registry_lock(void)
+{
+    pthread_once(&s_registry_once, _uhook_registry_init);
+    uhook_mutex_lock(&s_registry.mutex);
+}
+
+static void _uhook_registry_unlock(void)
+{
+    uhook_mutex_unlock(&s_registry.mutex);
+}
+
+/**
+ * @brief Fibonacci hashing, code addresses are 16 bytes aligned in most case
+ *   so the low bits are useless.
+ */
+static size_t _uhook_registry_hash(const void* key, size_t bucket_cnt)
+{
+    uint64_t hash = ((uint64_t)(uintptr_t)key >> 4) * (uint64_t)0x9E3779B97F4A7C15;
+    return (size_t)(hash >> 32) & (bucket_cnt - 1);
+}
+
+/**
+ * @return  Epoch to pass to #_uhook_registry_read_leave().
+ */
+static unsigned _uhook_registry_read_enter(void)
+{
+    unsigned idx = __atomic_load_n(&s_registry.epoch, __ATOMIC_ACQUIRE) & 1;
+    __atomic_fetch_add(&s_registry.readers[idx], 1, __ATOMIC_RELAXED);
+
+    /* Either writer sees this reader, or this reader sees what writer unlinked */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return idx;
+}
+
+static void _uhook_registry_read_leave(unsigned idx)
+{
+    __atomic_fetch_sub(&s_registry.readers[idx], 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Wait for readers that may still see unlinked memory.
+ * @note Must be called with mutex held.
+ */
+static void _uhook_registry_synchronize(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    unsigned idx = __atomic_fetch_add(&s_registry.epoch, 1, __ATOMIC_SEQ_CST) & 1;
+
+    while (__atomic_load_n(&s_registry.readers[idx], __ATOMIC_ACQUIRE) != 0)
+    {
+#if defined(_WIN32)
+        SwitchToThread();
+#else
+        sched_yield();
+#endif
+    }
+}
+
+static int _uhook_registry_resize(size_t bucket_cnt)
+{
+    uhook_registry_table_t* table = calloc(1, sizeof(uhook_registry_table_t) + bucket_cnt * sizeof(uhook_registry_node_t*));
+    if (table == NULL)
+    {
+        return UHOOK_NOMEM;
+    }
+    table->bucket_cnt = bucket_cnt;
+
+    uhook_registry_table_t* old = s_registry.table;
+    if (old == NULL)
+    {
+        __atomic_store_n(&s_registry.table, table, __ATOMIC_RELEASE);
+        return UHOOK_SUCCESS;
+    }
+
+    __atomic_store_n(&s_registry.resize_seq, s_registry.resize_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    size_t i;
+    for (i = 0; i < old->bucket_cnt; i++)
+    {
+        uhook_registry_node_t* node = old->buckets[i];
+        while (node != NULL)
+        {
+            uhook_registry_node_t* next = node->next;
+            size_t pos = _uhook_registry_hash(node->key, bucket_cnt);
+
+            __atomic_store_n(&node->next, table->buckets[pos], __ATOMIC_RELEASE);
+            table->buckets[pos] = node;
+            node = next;
+        }
+    }
+
+    __atomic_store_n(&s_registry.table, table, __ATOMIC_RELEASE);
+    __atomic_store_n(&s_registry.resize_seq, s_registry.resize_seq + 1, __ATOMIC_RELEASE);
+
+    _uhook_registry_synchronize();
+    free(old);
+
+    return UHOOK_SUCCESS;
+}
+
+uhook_registry_node_t* uhook_registry_find(const void* key)
+{
+    uhook_registry_node_t* node;
+    unsigned seq;
+    unsigned idx = _uhook_registry_read_enter();
+
+    do
+    {
+        node = NULL;
+        seq = __atomic_load_n(&s_registry.resize_seq, __ATOMIC_ACQUIRE);
+
+        uhook_registry_table_t* table = __atomic_load_n(&s_registry.table, __ATOMIC_ACQUIRE);
+        if (table == NULL)
+        {
+            break;
+        }
+
+        node = __atomic_load_n(&table->buckets[_uhook_registry_hash(key, table->bucket_cnt)], __ATOMIC_ACQUIRE);
+        for (; node != NULL; node = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE))
+        {
+            if (node->key == key)
+            {
+                break;
+            }
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (node == NULL && ((seq & 1) || __atomic_load_n(&s_registry.resize_seq, __ATOMIC_RELAXED) != seq));
+
+    _uhook_registry_read_leave(idx);
+    return node;
+}
+
+int uhook_registry_insert(uhook_registry_node_t* node)
+{
+    int ret = UHOOK_SUCCESS;
+    _uhook_registry_lock();
+
+    if (s_registry.table == NULL)
+    {
+        if ((ret = _uhook_registry_resize(UHOOK_REGISTRY_INIT_SIZE)) != UHOOK_SUCCESS)
+        {
+            goto fin;
+        }
+    }
+
+    /* Keep load factor under 0.75 */
+    if ((s_registry.node_cnt + 1) * 4 > s_registry.table->bucket_cnt * 3)
+    {
+        if ((ret = _uhook_registry_resize(s_registry.table->bucket_cnt * 2)) != UHOOK_SUCCESS)
+        {
+            goto fin;
+        }
+    }
+
+    uhook_registry_node_t** head = &s_registry.table->buckets[_uhook_registry_hash(node->key, s_registry.table->bucket_cnt)];
+    __atomic_store_n(&node->next, *head, __ATOMIC_RELAXED);
+    __atomic_store_n(head, node, __ATOMIC_RELEASE);
+    s_registry.node_cnt++;
+
+fin:
+    _uhook_registry_unlock();
+    return ret;
+}
+
+void uhook_registry_remove(uhook_registry_node_t* node)
+{
+    _uhook_registry_lock();
+
+    uhook_registry_table_t* table = s_registry.table;
+    uhook_registry_node_t** pos = &table->buckets[_uhook_registry_hash(node->key, table->bucket_cnt)];
+    for (; *pos != NULL; pos = &(*pos)->next)
+    {
+        if (*pos == node)
+        {
+            /* Keep `next` of node, readers on it still walk to the rest */
+            __atomic_store_n(pos, node->next, __ATOMIC_RELEASE);
+            s_registry.node_cnt--;
+            _uhook_registry_synchronize();
+            break;
+        }
+    }
+
+    _uhook_registry_unlock();
+}
+
+size_t uhook_registry_size(void)
+{
+    _uhook_registry_lock();
+    size_t node_cnt = s_registry.node_cnt;
+    _uhook_registry_unlock();
+
+    return node_cnt;
+}
+
+void uhook_registry_foreach(int (*cb)(uhook_registry_node_t* node, void* arg), void* arg)
+{
+    _uhook_registry_lock();
+
+    size_t i;
+    for (i = 0; s_registry.table != NULL && i < s_registry.table->bucket_cnt; i++)
+    {
+        uhook_registry_node_t* node = s_registry.table->buckets[i];
+        while (node != NULL)
+        {
+            uhook_registry_node_t* next = node->next;
+            if (cb(node, arg) != 0)
+            {
+                goto fin;
+            }
+            node = next;
+        }
+    }
+
+fin:
+    _uhook_registry_unlock();
+}
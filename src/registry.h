@@ -0,0 +1,79 @@
+#ifndef __UHOOK_REGISTRY_H__
+#define __UHOOK_REGISTRY_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "defs.h"
+#include <stddef.h>
+
+enum uhook_registry_type
+{
+    UHOOK_REGISTRY_INLINE,      /**< Key is address of inline hooked function */
+    UHOOK_REGISTRY_RELPLT,      /**< Key is address of GOT/PLT slot in .rel(a).plt */
+    UHOOK_REGISTRY_RELDYN,      /**< Key is address of GOT/PLT slot in .rel(a).dyn */
+};
+
+/**
+ * @brief Registry node, embed it into the structure to be registered.
+ *
+ * Use #container_of() to get the structure back.
+ *
+ * The registry has its own lock for writers, lookups take no lock. A
+ * returned node is only valid as long as the caller prevents it from being
+ * removed.
+ */
+typedef struct uhook_registry_node
+{
+    struct uhook_registry_node* next;   /**< Next node in same bucket */
+    const void*                 key;    /**< Address */
+    int                         type;   /**< #uhook_registry_type */
+}uhook_registry_node_t;
+
+/**
+ * @brief Find node by address.
+ * @note Lock free, it can run along with insert and remove.
+ * @param[in] key   Address
+ * @return          Node, or NULL if not found.
+ */
+API_LOCAL uhook_registry_node_t* uhook_registry_find(const void* key);
+
+/**
+ * @brief Insert node.
+ * @note The key must not exist.
+ * @param[in] node  Node with key filled
+ * @return          #uhook_errno
+ */
+API_LOCAL int uhook_registry_insert(uhook_registry_node_t* node);
+
+/**
+ * @brief Remove node.
+ *
+ * It returns after every lookup that may still see \p node has left, so
+ * \p node can be released at once.
+ *
+ * @param[in] node  Node inserted by #uhook_registry_insert()
+ */
+API_LOCAL void uhook_registry_remove(uhook_registry_node_t* node);
+
+/**
+ * @brief Get amount of nodes.
+ * @return          Amount of nodes
+ */
+API_LOCAL size_t uhook_registry_size(void);
+
+/**
+ * @brief Walk through all nodes.
+ *
+ * The registry is locked during the walk, so \p cb must not call any
+ * registry function.
+ *
+ * @param[in] cb    Callback. Return non-zero to stop.
+ * @param[in] arg   User defined argument
+ */
+API_LOCAL void uhook_registry_foreach(int (*cb)(uhook_registry_node_t* node, void* arg), void* arg);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
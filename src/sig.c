@@ -0,0 +1,541 @@
+#include "sig.h"
+#include "os/elf.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#if defined(__SSE2__)
+#   include <emmintrin.h>
+#endif
+
+#define INLINE_HOOK_DEBUG
+#include "log.h"
+
+/**
+ * @brief Max signature length.
+ */
+#define UHOOK_SIG_MAX_SIZE      256
+
+/**
+ * @brief Max build-id length, SHA-1 is 20 bytes.
+ */
+#define UHOOK_SIG_MAX_BUILD_ID  64
+
+#define UHOOK_SIG_CACHE_MAGIC   0x47495355  /* "USIG" */
+
+typedef struct uhook_sig_pattern
+{
+    uint8_t         bytes[UHOOK_SIG_MAX_SIZE];  /**< Bytes to match */
+    uint8_t         mask[UHOOK_SIG_MAX_SIZE];   /**< 0xff if byte must match, 0 for wildcard */
+    size_t          size;       /**< Pattern length */
+    size_t          anchor;     /**< First fixed byte, searched with SIMD */
+    int             pair;       /**< Whether byte after anchor is fixed too */
+}uhook_sig_pattern_t;
+
+/**
+ * @brief Matches of one module, as offset to load address.
+ */
+typedef struct uhook_sig_match
+{
+    uint64_t*       offsets;    /**< Offset list */
+    size_t          num;        /**< Amount of offsets */
+    size_t          cap;        /**< Capacity of offset list */
+}uhook_sig_match_t;
+
+/**
+ * @brief Record header in cache file, followed by build-id and offsets.
+ */
+typedef struct uhook_sig_record
+{
+    uint32_t        magic;      /**< #UHOOK_SIG_CACHE_MAGIC */
+    uint32_t        id_size;    /**< Length of build-id */
+    uint64_t        key;        /**< Hash of pattern */
+    uint64_t        num;        /**< Amount of offsets */
+}uhook_sig_record_t;
+
+static int _uhook_sig_hex(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/**
+ * @return  #uhook_errno
+ */
+static int _uhook_sig_compile(uhook_sig_pattern_t* pat, const char* str)
+{
+    memset(pat, 0, sizeof(*pat));
+
+    while (*str != '\0')
+    {
+        if (*str == ' ')
+        {
+            str++;
+            continue;
+        }
+        if (pat->size == UHOOK_SIG_MAX_SIZE)
+        {
+            return UHOOK_INVALID;
+        }
+
+        if (*str == '?')
+        {
+            str += str[1] == '?' ? 2 : 1;
+            pat->size++;
+            continue;
+        }
+
+        int hi = _uhook_sig_hex(str[0]);
+        int lo = hi < 0 ? -1 : _uhook_sig_hex(str[1]);
+        if (lo < 0)
+        {
+            return UHOOK_INVALID;
+        }
+        pat->bytes[pat->size] = (uint8_t)(hi << 4 | lo);
+        pat->mask[pat->size] = 0xff;
+        pat->size++;
+        str += 2;
+    }
+
+    /* Prefer two fixed bytes in a row, a single byte matches too often */
+    size_t i;
+    int found = 0;
+    for (i = 0; i < pat->size; i++)
+    {
+        if (pat->mask[i] == 0)
+        {
+            continue;
+        }
+        if (!found)
+        {
+            pat->anchor = i;
+            found = 1;
+        }
+        if (i + 1 < pat->size && pat->mask[i + 1] != 0)
+        {
+            pat->anchor = i;
+            pat->pair = 1;
+            break;
+        }
+    }
+
+    return found ? UHOOK_SUCCESS : UHOOK_INVALID;
+}
+
+static int _uhook_sig_match(const uhook_sig_pattern_t* pat, const uint8_t* code)
+{
+    size_t i;
+    for (i = 0; i < pat->size; i++)
+    {
+        if ((code[i] & pat->mask[i]) != pat->bytes[i])
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int _uhook_sig_match_push(uhook_sig_match_t* match, uint64_t offset)
+{
+    if (match->num == match->cap)
+    {
+        size_t cap = match->cap == 0 ? 16 : match->cap * 2;
+        uint64_t* offsets = realloc(match->offsets, sizeof(uint64_t) * cap);
+        if (offsets == NULL)
+        {
+            return UHOOK_NOMEM;
+        }
+        match->offsets = offsets;
+        match->cap = cap;
+    }
+
+    match->offsets[match->num++] = offset;
+    return UHOOK_SUCCESS;
+}
+
+/**
+ * @return  #uhook_errno
+ */
+static int _uhook_sig_scan_segment(const uhook_sig_pattern_t* pat, const elf_segment_t* seg,
+    uhook_sig_match_t* match)
+{
+    const uint8_t* code = (const uint8_t*)seg->addr;
+    const uint8_t* anchor = code + pat->anchor;
+    int ret = UHOOK_SUCCESS;
+
+    if (seg->size < pat->size)
+    {
+        return UHOOK_SUCCESS;
+    }
+    size_t last = seg->size - pat->size;
+    size_t pos = 0;
+
+#if defined(__SSE2__)
+    /* Compare anchor at 16 positions at once, both loads stay in pattern range */
+    const __m128i first = _mm_set1_epi8((char)pat->bytes[pat->anchor]);
+    const __m128i second = _mm_set1_epi8((char)pat->bytes[pat->anchor + pat->pair]);
+
+    for (; pos + 16 <= last + 1; pos += 16)
+    {
+        __m128i hit = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(anchor + pos)), first);
+        if (pat->pair)
+        {
+            hit = _mm_and_si128(hit,
+                _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(anchor + pos + 1)), second));
+        }
+
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+        while (mask != 0)
+        {
+            size_t off = pos + (size_t)__builtin_ctz(mask);
+            mask &= mask - 1;
+
+            if (_uhook_sig_match(pat, code + off)
+                && (ret = _uhook_sig_match_push(match, seg->addr + off - seg->base)) != UHOOK_SUCCESS)
+            {
+                return ret;
+            }
+        }
+    }
+#endif
+
+    for (; pos <= last; pos++)
+    {
+        if (anchor[pos] == pat->bytes[pat->anchor] && _uhook_sig_match(pat, code + pos)
+            && (ret = _uhook_sig_match_push(match, seg->addr + pos - seg->base)) != UHOOK_SUCCESS)
+        {
+            return ret;
+        }
+    }
+
+    return UHOOK_SUCCESS;
+}
+
+/**
+ * @brief FNV-1a hash of everything that affects matches.
+ */
+static uint64_t _uhook_sig_key(const uhook_sig_pattern_t* pat)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    size_t i;
+    for (i = 0; i < pat->size; i++)
+    {
+        hash = (hash ^ pat->bytes[i]) * 0x100000001b3ULL;
+        hash = (hash ^ pat->mask[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Check offset is in executable segment of module and still matches.
+ * @param[in] segs  Segments of the module
+ * @return          bool
+ */
+static int _uhook_sig_verify(const uhook_sig_pattern_t* pat, const elf_segment_t* segs, size_t seg_num,
+    uint64_t offset)
+{
+    size_t i;
+    for (i = 0; i < seg_num; i++)
+    {
+        const elf_segment_t* seg = &segs[i];
+        uintptr_t addr = seg->base + (uintptr_t)offset;
+
+        if ((seg->flags & ELF_SEGMENT_EXEC) && addr >= seg->addr && addr + pat->size <= seg->addr + seg->size)
+        {
+            return _uhook_sig_match(pat, (const uint8_t*)addr);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Load record of module and pattern from cache file.
+ * @return  bool
+ */
+static int _uhook_sig_cache_load(const char* path, const uint8_t* id, size_t id_size, uint64_t key,
+    uhook_sig_match_t* match)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return 0;
+    }
+
+    int found = 0;
+    uhook_sig_record_t record;
+    uint8_t record_id[UHOOK_SIG_MAX_BUILD_ID];
+
+    while (fread(&record, sizeof(record), 1, file) == 1)
+    {
+        if (record.magic != UHOOK_SIG_CACHE_MAGIC || record.id_size > sizeof(record_id)
+            || fread(record_id, record.id_size, 1, file) != 1)
+        {
+            break;
+        }
+
+        if (record.key != key || record.id_size != id_size || memcmp(record_id, id, id_size) != 0)
+        {
+            if (fseek(file, (long)(sizeof(uint64_t) * record.num), SEEK_CUR) != 0)
+            {
+                break;
+            }
+            continue;
+        }
+
+        match->num = 0;
+        found = 1;
+
+        uint64_t i, offset;
+        for (i = 0; i < record.num && found; i++)
+        {
+            found = fread(&offset, sizeof(offset), 1, file) == 1
+                && _uhook_sig_match_push(match, offset) == UHOOK_SUCCESS;
+        }
+        if (!found)
+        {
+            break;
+        }
+    }
+
+    fclose(file);
+    return found;
+}
+
+/**
+ * @brief Copy records of \p src into \p dst, except the one of module and
+ *   pattern. Copy stops at the first malformed record.
+ * @return  bool, false if write failed.
+ */
+static int _uhook_sig_cache_copy(FILE* src, FILE* dst, const uint8_t* id, size_t id_size, uint64_t key)
+{
+    uhook_sig_record_t record;
+    uint8_t record_id[UHOOK_SIG_MAX_BUILD_ID];
+    uint64_t offsets[64];
+
+    while (fread(&record, sizeof(record), 1, src) == 1)
+    {
+        if (record.magic != UHOOK_SIG_CACHE_MAGIC || record.id_size > sizeof(record_id)
+            || fread(record_id, record.id_size, 1, src) != 1)
+        {
+            break;
+        }
+
+        int skip = record.key == key && record.id_size == id_size && memcmp(record_id, id, id_size) == 0;
+        if (!skip && (fwrite(&record, sizeof(record), 1, dst) != 1
+            || (record.id_size != 0 && fwrite(record_id, record.id_size, 1, dst) != 1)))
+        {
+            return 0;
+        }
+
+        /* Offsets are moved in blocks, record may be truncated */
+        uint64_t left = record.num;
+        while (left > 0)
+        {
+            size_t step = left < 64 ? (size_t)left : 64;
+            if (fread(offsets, sizeof(uint64_t), step, src) != step)
+            {
+                return skip;
+            }
+            if (!skip && fwrite(offsets, sizeof(uint64_t), step, dst) != step)
+            {
+                return 0;
+            }
+            left -= step;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Replace record of module and pattern in cache file.
+ *
+ * Other records are kept, so the file holds one record for each module and
+ * pattern however many times it is scanned.
+ */
+static void _uhook_sig_cache_store(const char* path, const uint8_t* id, size_t id_size, uint64_t key,
+    const uhook_sig_match_t* match)
+{
+    /* Write to a temporary file and rename, so readers never see a partial file */
+    size_t path_len = strlen(path);
+    char* tmp_path = malloc(path_len + 5);
+    if (tmp_path == NULL)
+    {
+        return;
+    }
+    memcpy(tmp_path, path, path_len);
+    memcpy(tmp_path + path_len, ".tmp", 5);
+
+    FILE* file = fopen(tmp_path, "wb");
+    if (file == NULL)
+    {
+        LOG("open `%s` failed", tmp_path);
+        goto fin;
+    }
+
+    int ok = 1;
+    FILE* old = fopen(path, "rb");
+    if (old != NULL)
+    {
+        ok = _uhook_sig_cache_copy(old, file, id, id_size, key);
+        fclose(old);
+    }
+
+    uhook_sig_record_t record;
+    record.magic = UHOOK_SIG_CACHE_MAGIC;
+    record.id_size = (uint32_t)id_size;
+    record.key = key;
+    record.num = match->num;
+
+    ok = ok && fwrite(&record, sizeof(record), 1, file) == 1
+        && fwrite(id, id_size, 1, file) == 1
+        && (match->num == 0 || fwrite(match->offsets, sizeof(uint64_t) * match->num, 1, file) == 1);
+
+    if (fclose(file) != 0 || !ok || rename(tmp_path, path) != 0)
+    {
+        LOG("write `%s` failed", path);
+        remove(tmp_path);
+    }
+
+fin:
+    free(tmp_path);
+}
+
+/**
+ * @brief Find matches in one module.
+ * @param[in] segs  Segments of the module
+ * @return          #uhook_errno
+ */
+static int _uhook_sig_find_module(const uhook_sig_pattern_t* pat, const uhook_sig_opt_t* opt,
+    const elf_segment_t* segs, size_t seg_num, uhook_sig_match_t* match)
+{
+    uint8_t id[UHOOK_SIG_MAX_BUILD_ID];
+    size_t id_size = opt->cache != NULL ? elf_get_build_id(segs[0].base, id, sizeof(id)) : 0;
+    uint64_t key = _uhook_sig_key(pat);
+    int ret = UHOOK_SUCCESS;
+
+    match->num = 0;
+    if (id_size != 0 && _uhook_sig_cache_load(opt->cache, id, id_size, key, match))
+    {
+        size_t i = 0;
+        while (i < match->num && _uhook_sig_verify(pat, segs, seg_num, match->offsets[i]))
+        {
+            i++;
+        }
+        if (i == match->num)
+        {
+            return UHOOK_SUCCESS;
+        }
+        match->num = 0;
+    }
+
+    size_t i;
+    for (i = 0; i < seg_num && ret == UHOOK_SUCCESS; i++)
+    {
+        if (segs[i].flags & ELF_SEGMENT_EXEC)
+        {
+            ret = _uhook_sig_scan_segment(pat, &segs[i], match);
+        }
+    }
+
+    if (ret == UHOOK_SUCCESS && id_size != 0)
+    {
+        _uhook_sig_cache_store(opt->cache, id, id_size, key, match);
+    }
+    return ret;
+}
+
+static void _uhook_sig_emit(const uhook_sig_opt_t* opt, uintptr_t addr, void** addrs, size_t cap, size_t* num)
+{
+    if (opt->rel_pos != 0)
+    {
+        int32_t rel;
+        memcpy(&rel, (const uint8_t*)addr + opt->rel_pos, sizeof(rel));
+        addr = addr + opt->rel_end + rel;
+    }
+    addr += opt->offset;
+
+    if (*num < cap)
+    {
+        addrs[*num] = (void*)addr;
+    }
+    *num += 1;
+}
+
+int uhook_sig_find(const char* pattern, const uhook_sig_opt_t* opt, void** addrs, size_t cap, size_t* num)
+{
+    static const uhook_sig_opt_t default_opt = { NULL, NULL, 0, 0, 0 };
+    opt = opt != NULL ? opt : &default_opt;
+    *num = 0;
+
+    int ret;
+    uhook_sig_pattern_t* pat = malloc(sizeof(uhook_sig_pattern_t));
+    if (pat == NULL)
+    {
+        return UHOOK_NOMEM;
+    }
+    if ((ret = _uhook_sig_compile(pat, pattern)) != UHOOK_SUCCESS)
+    {
+        goto fin_pat;
+    }
+    if (opt->rel_pos != 0 && opt->rel_pos + sizeof(int32_t) > pat->size)
+    {
+        ret = UHOOK_INVALID;
+        goto fin_pat;
+    }
+
+    size_t seg_cap = elf_get_load_segments(NULL, 0);
+    elf_segment_t* segs = malloc(sizeof(elf_segment_t) * (seg_cap + 1));
+    if (segs == NULL)
+    {
+        ret = UHOOK_NOMEM;
+        goto fin_pat;
+    }
+    size_t seg_num = elf_get_load_segments(segs, seg_cap + 1);
+    seg_num = seg_num < seg_cap + 1 ? seg_num : seg_cap + 1;
+
+    /* Segments of a module are next to each other */
+    uhook_sig_match_t match = { NULL, 0, 0 };
+    size_t start, end;
+    for (start = 0; start < seg_num && ret == UHOOK_SUCCESS; start = end)
+    {
+        end = start + 1;
+        while (end < seg_num && segs[end].base == segs[start].base)
+        {
+            end++;
+        }
+        if (opt->module != NULL && strstr(segs[start].path, opt->module) == NULL)
+        {
+            continue;
+        }
+
+        if ((ret = _uhook_sig_find_module(pat, opt, &segs[start], end - start, &match)) != UHOOK_SUCCESS)
+        {
+            break;
+        }
+
+        size_t i;
+        for (i = 0; i < match.num; i++)
+        {
+            _uhook_sig_emit(opt, segs[start].base + (uintptr_t)match.offsets[i], addrs, cap, num);
+        }
+    }
+
+    free(match.offsets);
+    free(segs);
+fin_pat:
+    free(pat);
+    return ret;
+}
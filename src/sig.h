@@ -0,0 +1,20 @@
+#ifndef __UHOOK_SIG_H__
+#define __UHOOK_SIG_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uhook.h"
+#include "defs.h"
+
+/**
+ * @brief Find code by byte signature.
+ * @see uhook_find_signature()
+ */
+API_LOCAL int uhook_sig_find(const char* pattern, const uhook_sig_opt_t* opt,
+    void** addrs, size_t cap, size_t* num);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
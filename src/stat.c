@@ -0,0 +1,350 @@
+#define _GNU_SOURCE
+#include "uhook.h"
+#include "stat.h"
+#include "clock.h"
+#include "mutex.h"
+#include "tstate.h"
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__x86_64__) && defined(__GNUC__)
+#   include <sys/syscall.h>
+#   if defined(SYS_rseq)
+#       define UHOOK_STAT_RSEQ  1
+#   endif
+#endif
+
+/**
+ * @brief Slots of a CPU take `1 << UHOOK_STAT_CPU_SHIFT` bytes, so CPUs
+ *   never share a cache line.
+ */
+#define UHOOK_STAT_CPU_SHIFT    15
+
+/**
+ * @brief Signature before abort handler, the same as glibc uses on x86.
+ */
+#define UHOOK_STAT_RSEQ_SIG     0x53053053
+
+#define UHOOK_STAT_STR2(x)      #x
+#define UHOOK_STAT_STR(x)       UHOOK_STAT_STR2(x)
+
+/**
+ * @brief Counters of one hook.
+ */
+typedef struct uhook_stat_slot
+{
+    uint64_t            calls;      /**< Calls entered */
+    uint64_t            returns;    /**< Calls returned */
+    uint64_t            ticks;      /**< Time spent in returned calls */
+    uint64_t            pad;        /**< Keep size power of 2 */
+}uhook_stat_slot_t;
+
+/**
+ * @brief State of a thread.
+ */
+typedef struct uhook_stat_thread
+{
+    uhook_tstate_t      state;      /**< Header */
+    uhook_stat_slot_t   slots[UHOOK_STAT_MAX];  /**< Counters used if rseq is unavailable */
+}uhook_stat_thread_t;
+
+#if defined(UHOOK_STAT_RSEQ)
+
+/**
+ * @brief `struct rseq` of Linux, only fields used here.
+ */
+typedef struct uhook_rseq
+{
+    uint32_t            cpu_id_start;
+    uint32_t            cpu_id;     /**< Current CPU, negative if not registered */
+    uint64_t            rseq_cs;    /**< Critical section descriptor */
+    uint32_t            flags;
+    uint32_t            pad[3];
+}__attribute__((aligned(32))) uhook_rseq_t;
+
+/**
+ * @brief Registration of glibc 2.35 and later, weak so older glibc works.
+ */
+extern const ptrdiff_t __rseq_offset __attribute__((weak));
+extern const unsigned int __rseq_size __attribute__((weak));
+
+/**
+ * @brief Our own registration, used if glibc does not register.
+ */
+static __thread uhook_rseq_t s_stat_rseq_area;
+
+/**
+ * @brief Registration of current thread, NULL if rseq is unavailable.
+ */
+static __thread uhook_rseq_t* s_stat_rseq;
+static __thread int s_stat_rseq_checked;
+
+#endif
+
+typedef struct uhook_stat_ctx
+{
+    uhook_mutex_t       mutex;      /**< Protect #uhook_stat_ctx::used */
+    uint64_t            used[UHOOK_STAT_MAX / 64];  /**< Allocated slots */
+    uhook_tstate_list_t threads;    /**< Thread states */
+    uint8_t*            cpus;       /**< Per CPU slots, NULL if unavailable */
+    uint32_t            cpu_num;    /**< Amount of CPUs in #uhook_stat_ctx::cpus */
+}uhook_stat_ctx_t;
+
+static uhook_stat_ctx_t s_stat;
+static pthread_once_t s_stat_once = PTHREAD_ONCE_INIT;
+
+static __thread uhook_stat_thread_t* s_stat_thread;
+
+static void _stat_init(void)
+{
+    uhook_mutex_init(&s_stat.mutex);
+    uhook_tstate_init(&s_stat.threads);
+    uhook_clock_init();
+
+#if defined(UHOOK_STAT_RSEQ)
+    long num = sysconf(_SC_NPROCESSORS_CONF);
+    s_stat.cpu_num = num > 0 ? (uint32_t)num : 1;
+
+    void* addr = mmap(NULL, (size_t)s_stat.cpu_num << UHOOK_STAT_CPU_SHIFT, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    s_stat.cpus = addr != MAP_FAILED ? addr : NULL;
+#endif
+}
+
+/**
+ * @brief Get state of current thread.
+ * @return  Thread state, or NULL if failure.
+ */
+static uhook_stat_thread_t* _stat_thread(void)
+{
+    uhook_stat_thread_t* thread = s_stat_thread;
+    if (thread == NULL)
+    {
+        thread = (uhook_stat_thread_t*)uhook_tstate_get(&s_stat.threads, sizeof(uhook_stat_thread_t),
+            (void**)&s_stat_thread, NULL);
+    }
+    return thread;
+}
+
+#if defined(UHOOK_STAT_RSEQ)
+
+/**
+ * @brief Get rseq registration of current thread, register if glibc does
+ *   not.
+ * @return  Registration, or NULL if rseq is unavailable.
+ */
+static uhook_rseq_t* _stat_rseq(void)
+{
+    if (s_stat_rseq_checked)
+    {
+        return s_stat_rseq;
+    }
+    s_stat_rseq_checked = 1;
+
+    if (s_stat.cpus == NULL)
+    {
+        return NULL;
+    }
+
+    if (&__rseq_size != NULL && __rseq_size != 0)
+    {
+        uintptr_t tp;
+        __asm__ ("movq %%fs:0, %0" : "=r"(tp));
+        uhook_rseq_t* rseq = (uhook_rseq_t*)(tp + __rseq_offset);
+        if ((int32_t)__atomic_load_n(&rseq->cpu_id, __ATOMIC_RELAXED) >= 0)
+        {
+            s_stat_rseq = rseq;
+        }
+    }
+    else if (syscall(SYS_rseq, &s_stat_rseq_area, sizeof(s_stat_rseq_area), 0, UHOOK_STAT_RSEQ_SIG) == 0)
+    {
+        s_stat_rseq = &s_stat_rseq_area;
+    }
+
+    return s_stat_rseq;
+}
+
+/**
+ * @brief Add \p value to counter at \p addr of current CPU.
+ *
+ * The `add` is the commit of a restartable sequence. If thread is preempted
+ * or migrated between reading CPU number and the `add`, kernel moves it to
+ * abort handler and the sequence starts over.
+ *
+ * @param[in] rseq      Registration of current thread
+ * @param[in] addr      Counter on CPU 0
+ * @param[in] value     Value to add
+ * @return              bool, false if CPU number is out of range.
+ */
+static int _stat_rseq_add(uhook_rseq_t* rseq, uint8_t* addr, uint64_t value)
+{
+retry:
+    __asm__ goto (
+        ".pushsection __rseq_cs, \"aw\"\n"
+        ".balign 32\n"
+        "3:\n"
+        ".long 0, 0\n"
+        ".quad 1f, 2f - 1f, 4f\n"
+        ".popsection\n"
+        "leaq 3b(%%rip), %%rax\n"
+        "movq %%rax, 8(%[rseq])\n"
+        "1:\n"
+        "movl 4(%[rseq]), %%eax\n"
+        "cmpl %[num], %%eax\n"
+        "jae %l[out_of_range]\n"
+        "shlq $" UHOOK_STAT_STR(UHOOK_STAT_CPU_SHIFT) ", %%rax\n"
+        "addq %[value], (%[addr], %%rax)\n"
+        "2:\n"
+        ".pushsection __rseq_failure, \"ax\"\n"
+        ".byte 0x0f, 0xb9, 0x3d\n"
+        ".long " UHOOK_STAT_STR(UHOOK_STAT_RSEQ_SIG) "\n"
+        "4:\n"
+        "jmp %l[retry]\n"
+        ".popsection\n"
+        :
+        : [rseq] "r"(rseq), [num] "r"(s_stat.cpu_num), [addr] "r"(addr), [value] "r"(value)
+        : "rax", "memory", "cc"
+        : retry, out_of_range);
+    return 1;
+
+out_of_range:
+    return 0;
+}
+
+#endif
+
+/**
+ * @brief Add \p value to field at \p offset of \p slot.
+ */
+static void _stat_add(size_t slot, size_t offset, uint64_t value)
+{
+    size_t pos = slot * sizeof(uhook_stat_slot_t) + offset;
+
+#if defined(UHOOK_STAT_RSEQ)
+    uhook_rseq_t* rseq = _stat_rseq();
+    if (rseq != NULL && _stat_rseq_add(rseq, s_stat.cpus + pos, value))
+    {
+        return;
+    }
+#endif
+
+    uhook_stat_thread_t* thread = _stat_thread();
+    if (thread == NULL)
+    {
+        return;
+    }
+
+    uhook_tstate_add((uint64_t*)((uint8_t*)thread->slots + pos), value);
+}
+
+int uhook_stat_alloc(size_t* slot)
+{
+    pthread_once(&s_stat_once, _stat_init);
+
+    int ret = UHOOK_NOMEM;
+    size_t i;
+
+    uhook_mutex_lock(&s_stat.mutex);
+    for (i = 0; i < UHOOK_STAT_MAX; i++)
+    {
+        if (!(s_stat.used[i / 64] & ((uint64_t)1 << (i % 64))))
+        {
+            break;
+        }
+    }
+    if (i == UHOOK_STAT_MAX)
+    {
+        goto fin;
+    }
+    s_stat.used[i / 64] |= (uint64_t)1 << (i % 64);
+
+    /* Counts left by a previous hook */
+    uint32_t cpu;
+    for (cpu = 0; s_stat.cpus != NULL && cpu < s_stat.cpu_num; cpu++)
+    {
+        uhook_stat_slot_t* cnt = (uhook_stat_slot_t*)(s_stat.cpus + ((size_t)cpu << UHOOK_STAT_CPU_SHIFT)) + i;
+        __atomic_store_n(&cnt->calls, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&cnt->returns, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&cnt->ticks, 0, __ATOMIC_RELAXED);
+    }
+
+    uhook_tstate_t* state;
+    for (state = uhook_tstate_first(&s_stat.threads); state != NULL; state = state->next)
+    {
+        uhook_stat_thread_t* thread = (uhook_stat_thread_t*)state;
+        __atomic_store_n(&thread->slots[i].calls, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&thread->slots[i].returns, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&thread->slots[i].ticks, 0, __ATOMIC_RELAXED);
+    }
+
+    *slot = i;
+    ret = UHOOK_SUCCESS;
+
+fin:
+    uhook_mutex_unlock(&s_stat.mutex);
+    return ret;
+}
+
+void uhook_stat_free(size_t slot)
+{
+    uhook_mutex_lock(&s_stat.mutex);
+    s_stat.used[slot / 64] &= ~((uint64_t)1 << (slot % 64));
+    uhook_mutex_unlock(&s_stat.mutex);
+}
+
+void uhook_stat_enter(uhook_regs_t* regs, void* ctx)
+{
+    _stat_add((uintptr_t)ctx, offsetof(uhook_stat_slot_t, calls), 1);
+
+    uint64_t* start = uhook_tstate_call(regs);
+    if (start != NULL)
+    {
+        *start = uhook_clock_ticks();
+    }
+}
+
+void uhook_stat_leave(uhook_regs_t* regs, void* ctx)
+{
+    uint64_t now = uhook_clock_ticks();
+    size_t slot = (uintptr_t)ctx;
+
+    const uint64_t* start = uhook_tstate_call(regs);
+    if (start == NULL)
+    {
+        return;
+    }
+
+    _stat_add(slot, offsetof(uhook_stat_slot_t, returns), 1);
+    _stat_add(slot, offsetof(uhook_stat_slot_t, ticks), now - *start);
+}
+
+static void _stat_sum_slot(const uhook_stat_slot_t* cnt, uint64_t* calls, uint64_t* returns, uint64_t* ticks)
+{
+    *calls += __atomic_load_n(&cnt->calls, __ATOMIC_RELAXED);
+    *returns += __atomic_load_n(&cnt->returns, __ATOMIC_RELAXED);
+    *ticks += __atomic_load_n(&cnt->ticks, __ATOMIC_RELAXED);
+}
+
+void uhook_stat_sum(size_t slot, uhook_stat_t* stat)
+{
+    uint64_t calls = 0, returns = 0, ticks = 0;
+
+    uint32_t cpu;
+    for (cpu = 0; s_stat.cpus != NULL && cpu < s_stat.cpu_num; cpu++)
+    {
+        const uhook_stat_slot_t* cnt = (uhook_stat_slot_t*)(s_stat.cpus + ((size_t)cpu << UHOOK_STAT_CPU_SHIFT));
+        _stat_sum_slot(&cnt[slot], &calls, &returns, &ticks);
+    }
+
+    const uhook_tstate_t* state;
+    for (state = uhook_tstate_first(&s_stat.threads); state != NULL; state = state->next)
+    {
+        _stat_sum_slot(&((const uhook_stat_thread_t*)state)->slots[slot], &calls, &returns, &ticks);
+    }
+
+    stat->calls = calls;
+    stat->returns = returns;
+    stat->ns = uhook_clock_ns(ticks);
+}
@@ -0,0 +1,49 @@
+#ifndef __UHOOK_STAT_H__
+#define __UHOOK_STAT_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uhook.h"
+#include "defs.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Reserve a counter slot, zeroed on every CPU and thread.
+ * @param[out] slot     Slot index
+ * @return              #uhook_errno
+ */
+API_LOCAL int uhook_stat_alloc(size_t* slot);
+
+/**
+ * @brief Release a slot from uhook_stat_alloc().
+ * @param[in] slot      Slot index
+ */
+API_LOCAL void uhook_stat_free(size_t slot);
+
+/**
+ * @brief Enter handler, counts call and remembers start time.
+ * @param[in] regs      Registers
+ * @param[in] ctx       Slot index
+ */
+API_LOCAL void uhook_stat_enter(uhook_regs_t* regs, void* ctx);
+
+/**
+ * @brief Leave handler, adds time spent since enter.
+ * @param[in] regs      Registers
+ * @param[in] ctx       Slot index
+ */
+API_LOCAL void uhook_stat_leave(uhook_regs_t* regs, void* ctx);
+
+/**
+ * @brief Sum \p slot over all CPUs and threads.
+ * @param[in] slot      Slot index
+ * @param[out] stat     Statistics
+ */
+API_LOCAL void uhook_stat_sum(size_t slot, uhook_stat_t* stat);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
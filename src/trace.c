@@ -0,0 +1,294 @@
+#define _GNU_SOURCE
+#include "uhook.h"
+#include "trace.h"
+#include "clock.h"
+#include "mutex.h"
+#include "once.h"
+#include "tstate.h"
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#   include <sys/syscall.h>
+#endif
+
+/**
+ * @brief Layout of #uhook_trace_ctx::config.
+ */
+#define UHOOK_TRACE_CFG_POLICY      0x000000ffu     /**< #uhook_trace_policy */
+#define UHOOK_TRACE_CFG_SHIFT       8               /**< Log2 of ring capacity at bit 8 */
+#define UHOOK_TRACE_CFG_STARTED     0x80000000u     /**< A ring is created, options are fixed */
+
+/**
+ * @brief Log2 of #UHOOK_TRACE_RECORDS.
+ */
+#define UHOOK_TRACE_DEFAULT_SHIFT   12
+
+/**
+ * @brief Max log2 of ring capacity.
+ */
+#define UHOOK_TRACE_MAX_SHIFT       30
+
+/**
+ * @brief Ring of a thread.
+ *
+ * Owner thread is the only writer of records and `head`, reader is the only
+ * writer of `tail`, so neither side needs a locked instruction. They are on
+ * different cache lines.
+ */
+typedef struct uhook_trace_ring
+{
+    uhook_tstate_t      state;      /**< Header */
+    uint32_t            tid;        /**< Thread id of owner */
+    unsigned            policy;     /**< #uhook_trace_policy */
+    uint64_t            mask;       /**< Capacity minus one */
+
+    uint64_t            head __attribute__((aligned(64)));  /**< Amount of records written */
+    uint64_t            tail_cache; /**< Last `tail` seen by owner */
+    uint64_t            dropped;    /**< Records dropped by owner */
+
+    uint64_t            tail __attribute__((aligned(64)));  /**< Amount of records read */
+
+    uhook_trace_record_t records[] __attribute__((aligned(64)));
+}uhook_trace_ring_t;
+
+typedef struct uhook_trace_ctx
+{
+    uhook_mutex_t       mutex;      /**< Serialize readers */
+    uhook_tstate_list_t rings;      /**< Rings */
+
+    /**
+     * @brief Options packed in one word, so writers fix them without lock.
+     * @see UHOOK_TRACE_CFG_POLICY
+     */
+    uint32_t            config;
+    uint64_t            lost;       /**< Records overwritten before read */
+}uhook_trace_ctx_t;
+
+static uhook_trace_ctx_t s_trace = {
+    .config = (UHOOK_TRACE_DEFAULT_SHIFT << UHOOK_TRACE_CFG_SHIFT) | UHOOK_TRACE_OVERWRITE,
+};
+static pthread_once_t s_trace_once = PTHREAD_ONCE_INIT;
+
+static __thread uhook_trace_ring_t* s_trace_ring;
+static __thread int s_trace_ignored;
+
+static void _trace_init(void)
+{
+    uhook_mutex_init(&s_trace.mutex);
+    uhook_tstate_init(&s_trace.rings);
+}
+
+static uint32_t _trace_tid(void)
+{
+#if defined(__linux__)
+    return (uint32_t)syscall(SYS_gettid);
+#else
+    return (uint32_t)(uintptr_t)pthread_self();
+#endif
+}
+
+/**
+ * @brief Set options of a new ring from #uhook_trace_ctx::config.
+ */
+static void _trace_ring_init(uhook_tstate_t* state)
+{
+    uhook_trace_ring_t* ring = (uhook_trace_ring_t*)state;
+    uint32_t config = __atomic_load_n(&s_trace.config, __ATOMIC_ACQUIRE);
+    ring->policy = config & UHOOK_TRACE_CFG_POLICY;
+    ring->mask = ((uint64_t)1 << (config >> UHOOK_TRACE_CFG_SHIFT & 0xff)) - 1;
+}
+
+/**
+ * @brief Get ring of current thread.
+ * @return  Ring, or NULL if failure.
+ */
+static uhook_trace_ring_t* _trace_ring(void)
+{
+    uhook_trace_ring_t* ring = s_trace_ring;
+    if (ring != NULL)
+    {
+        return ring;
+    }
+
+    /* Options cannot change once a ring exists */
+    uint32_t config = __atomic_fetch_or(&s_trace.config, UHOOK_TRACE_CFG_STARTED, __ATOMIC_ACQ_REL);
+    size_t records = (size_t)1 << (config >> UHOOK_TRACE_CFG_SHIFT & 0xff);
+
+    ring = (uhook_trace_ring_t*)uhook_tstate_get(&s_trace.rings,
+        sizeof(uhook_trace_ring_t) + records * sizeof(uhook_trace_record_t), (void**)&s_trace_ring, _trace_ring_init);
+    if (ring != NULL)
+    {
+        ring->tid = _trace_tid();
+    }
+    return ring;
+}
+
+static void _trace_write(uhook_regs_t* regs, void* ctx, uint32_t type)
+{
+    if (s_trace_ignored)
+    {
+        return;
+    }
+
+    uint64_t ticks = uhook_clock_ticks();
+    uhook_trace_ring_t* ring = _trace_ring();
+    if (ring == NULL)
+    {
+        return;
+    }
+
+    uint64_t head = ring->head;
+    if (ring->policy == UHOOK_TRACE_DROP && head - ring->tail_cache > ring->mask)
+    {
+        ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head - ring->tail_cache > ring->mask)
+        {
+            __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    uhook_trace_record_t* record = &ring->records[head & ring->mask];
+    record->ticks = ticks;
+    record->caller = *(uint64_t*)(uintptr_t)regs->sp;
+    record->tid = ring->tid;
+    record->id = (uint32_t)(uintptr_t)ctx;
+    record->type = type;
+    record->reserved = 0;
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Copy unread records of \p ring.
+ * @return  Amount of records copied
+ */
+static size_t _trace_collect_ring(uhook_trace_ring_t* ring, uhook_trace_record_t* records, size_t cap)
+{
+    uint64_t size = ring->mask + 1;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = ring->tail;
+
+    /* Overwritten before this read */
+    if (head - tail > size)
+    {
+        s_trace.lost += head - tail - size;
+        tail = head - size;
+    }
+
+    uint64_t num = head - tail;
+    num = num < cap ? num : cap;
+
+    uint64_t i;
+    for (i = 0; i < num; i++)
+    {
+        records[i] = ring->records[(tail + i) & ring->mask];
+    }
+
+    /*
+     * Owner may overwrite records while they are copied. Record at
+     * `head - size` is being written if owner is writing `head`, so only
+     * records after it are intact.
+     */
+    uint64_t skip = 0;
+    if (ring->policy == UHOOK_TRACE_OVERWRITE)
+    {
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        if (head >= size && tail <= head - size)
+        {
+            skip = head - size - tail + 1;
+            skip = skip < num ? skip : num;
+            memmove(records, records + skip, (size_t)(num - skip) * sizeof(uhook_trace_record_t));
+            s_trace.lost += skip;
+        }
+    }
+
+    __atomic_store_n(&ring->tail, tail + num, __ATOMIC_RELEASE);
+    return (size_t)(num - skip);
+}
+
+void uhook_trace_init(void)
+{
+    pthread_once(&s_trace_once, _trace_init);
+}
+
+int uhook_trace_setup(const uhook_trace_opt_t* opt)
+{
+    if (opt->policy > UHOOK_TRACE_DROP)
+    {
+        return UHOOK_INVALID;
+    }
+
+    uint32_t shift = 0;
+    size_t records = opt->records != 0 ? opt->records : UHOOK_TRACE_RECORDS;
+    while (((size_t)1 << shift) < records)
+    {
+        if (++shift > UHOOK_TRACE_MAX_SHIFT)
+        {
+            return UHOOK_INVALID;
+        }
+    }
+
+    uint32_t config = __atomic_load_n(&s_trace.config, __ATOMIC_RELAXED);
+    do
+    {
+        if (config & UHOOK_TRACE_CFG_STARTED)
+        {
+            return UHOOK_INVALID;
+        }
+    } while (!__atomic_compare_exchange_n(&s_trace.config, &config, (shift << UHOOK_TRACE_CFG_SHIFT) | opt->policy,
+        1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    return UHOOK_SUCCESS;
+}
+
+void uhook_trace_enter(uhook_regs_t* regs, void* ctx)
+{
+    _trace_write(regs, ctx, UHOOK_TRACE_ENTER);
+}
+
+void uhook_trace_leave(uhook_regs_t* regs, void* ctx)
+{
+    _trace_write(regs, ctx, UHOOK_TRACE_LEAVE);
+}
+
+void uhook_trace_ignore(void)
+{
+    s_trace_ignored = 1;
+}
+
+size_t uhook_trace_collect(uhook_trace_record_t* records, size_t cap)
+{
+    uhook_trace_init();
+
+    size_t num = 0;
+    uhook_tstate_t* state;
+
+    uhook_mutex_lock(&s_trace.mutex);
+    for (state = uhook_tstate_first(&s_trace.rings); state != NULL && num < cap; state = state->next)
+    {
+        num += _trace_collect_ring((uhook_trace_ring_t*)state, records + num, cap - num);
+    }
+    uhook_mutex_unlock(&s_trace.mutex);
+
+    return num;
+}
+
+uint64_t uhook_trace_loss(void)
+{
+    uhook_trace_init();
+
+    uhook_mutex_lock(&s_trace.mutex);
+    uint64_t lost = s_trace.lost;
+
+    const uhook_tstate_t* state;
+    for (state = uhook_tstate_first(&s_trace.rings); state != NULL; state = state->next)
+    {
+        lost += __atomic_load_n(&((const uhook_trace_ring_t*)state)->dropped, __ATOMIC_RELAXED);
+    }
+    uhook_mutex_unlock(&s_trace.mutex);
+
+    return lost;
+}
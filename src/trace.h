@@ -0,0 +1,54 @@
+#ifndef __UHOOK_TRACE_H__
+#define __UHOOK_TRACE_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uhook.h"
+#include "defs.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Initialize state shared by trace hooks.
+ */
+API_LOCAL void uhook_trace_init(void);
+
+/**
+ * @see uhook_trace_config()
+ */
+API_LOCAL int uhook_trace_setup(const uhook_trace_opt_t* opt);
+
+/**
+ * @brief Enter handler, records #UHOOK_TRACE_ENTER.
+ * @param[in] regs      Registers
+ * @param[in] ctx       Hook id
+ */
+API_LOCAL void uhook_trace_enter(uhook_regs_t* regs, void* ctx);
+
+/**
+ * @brief Leave handler, records #UHOOK_TRACE_LEAVE.
+ * @param[in] regs      Registers
+ * @param[in] ctx       Hook id
+ */
+API_LOCAL void uhook_trace_leave(uhook_regs_t* regs, void* ctx);
+
+/**
+ * @brief Never record calls made by current thread.
+ */
+API_LOCAL void uhook_trace_ignore(void);
+
+/**
+ * @see uhook_trace_drain()
+ */
+API_LOCAL size_t uhook_trace_collect(uhook_trace_record_t* records, size_t cap);
+
+/**
+ * @see uhook_trace_lost()
+ */
+API_LOCAL uint64_t uhook_trace_loss(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,758 @@
+#define _GNU_SOURCE
+#include "tracefile.h"
+#include "trace.h"
+#include "clock.h"
+#include "mutex.h"
+#include "once.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define INLINE_HOOK_DEBUG
+#include "log.h"
+
+#define UHOOK_TRACEFILE_MAGIC       0x46544855  /* "UHTF" */
+#define UHOOK_TRACEFILE_VERSION     1
+
+#define UHOOK_TRACEFILE_STRING      1   /**< Chunk of a hook name */
+#define UHOOK_TRACEFILE_EVENTS      2   /**< Chunk of records of a thread */
+
+/**
+ * @brief Records drained at once.
+ */
+#define UHOOK_TRACEFILE_BATCH       4096
+
+/**
+ * @brief Max encoded size of a record, three varints.
+ */
+#define UHOOK_TRACEFILE_RECORD_MAX  30
+
+/**
+ * @brief Max encoded size of a chunk without records.
+ */
+#define UHOOK_TRACEFILE_CHUNK_MAX   40
+
+/**
+ * @brief Names longer than it are truncated.
+ */
+#define UHOOK_TRACEFILE_NAME_MAX    1024
+
+/**
+ * @brief Buffer is written once it is larger than it, so file is written in
+ *   large sequential pieces.
+ */
+#define UHOOK_TRACEFILE_FLUSH       (1024 * 1024)
+#define UHOOK_TRACEFILE_BUF_SIZE    (UHOOK_TRACEFILE_FLUSH * 2)
+
+/**
+ * @brief How long writer sleeps if rings are drained.
+ */
+#define UHOOK_TRACEFILE_INTERVAL_NS 10000000
+
+/**
+ * @brief File header.
+ *
+ * The file is this header followed by chunks. Each chunk is a
+ * #uhook_tracefile_chunk_t and its payload, padded to 8 bytes, so chunks
+ * are walked in place after the file is mapped. A truncated chunk at the
+ * end is ignored, so the file is usable even if process dies.
+ *
+ * Payload of #UHOOK_TRACEFILE_STRING is varint id, varint length and the
+ * name. It is written once for each name, before records that use it.
+ *
+ * Payload of #UHOOK_TRACEFILE_EVENTS is varint thread id and varint amount
+ * of records, then for each record:
+ * + zigzag varint of time stamp minus the previous one
+ * + varint of `id << 1 | type`
+ * + zigzag varint of caller minus the previous one
+ * The previous values start from 0 in each chunk.
+ */
+typedef struct uhook_tracefile_header
+{
+    uint32_t        magic;      /**< #UHOOK_TRACEFILE_MAGIC */
+    uint32_t        version;    /**< #UHOOK_TRACEFILE_VERSION */
+    uint64_t        mult;       /**< Nanoseconds per tick, 32.32 fixed point */
+}uhook_tracefile_header_t;
+
+typedef struct uhook_tracefile_chunk
+{
+    uint32_t        type;       /**< #UHOOK_TRACEFILE_STRING or #UHOOK_TRACEFILE_EVENTS */
+    uint32_t        size;       /**< Size of payload, without padding */
+}uhook_tracefile_chunk_t;
+
+typedef struct uhook_tracefile_name
+{
+    struct uhook_tracefile_name*    next;   /**< Next name */
+    unsigned        id;         /**< Hook id */
+    int             written;    /**< Whether it is in current file */
+    size_t          len;        /**< Length of name */
+    char            name[];     /**< Name */
+}uhook_tracefile_name_t;
+
+enum uhook_tracefile_state
+{
+    UHOOK_TRACEFILE_IDLE,       /**< No file */
+    UHOOK_TRACEFILE_RUNNING,    /**< Writer is running */
+    UHOOK_TRACEFILE_CLOSING,    /**< Writer is stopping */
+};
+
+typedef struct uhook_tracefile_ctx
+{
+    uhook_mutex_t           mutex;      /**< Protect names and state */
+    uhook_tracefile_name_t* names;      /**< Registered names, oldest first */
+    uhook_tracefile_name_t** names_tail;    /**< Where next name is linked */
+    int                     state;      /**< #uhook_tracefile_state */
+    pthread_t               thread;     /**< Writer */
+    int                     stop;       /**< Ask writer to drain and exit */
+
+    /* Owned by writer while it runs */
+    int                     fd;         /**< Trace file */
+    int                     error;      /**< Whether a write failed */
+    uint8_t*                buf;        /**< Encoded data not written yet */
+    size_t                  len;        /**< Size of encoded data */
+    uhook_trace_record_t*   records;    /**< Drained records */
+}uhook_tracefile_ctx_t;
+
+/**
+ * @brief Cursor over payload in mapped file.
+ */
+typedef struct uhook_tracefile_cursor
+{
+    const uint8_t*  pos;        /**< Next byte */
+    const uint8_t*  end;        /**< End of payload */
+}uhook_tracefile_cursor_t;
+
+/**
+ * @brief Decoder of #UHOOK_TRACEFILE_EVENTS payload.
+ */
+typedef struct uhook_tracefile_events
+{
+    uhook_tracefile_cursor_t    cur;    /**< Payload */
+    uint64_t        tid;        /**< Thread id */
+    uint64_t        left;       /**< Records not decoded */
+    uint64_t        ticks;      /**< Time stamp of previous record */
+    uint64_t        caller;     /**< Caller of previous record */
+}uhook_tracefile_events_t;
+
+typedef struct uhook_tracefile_symbol
+{
+    uint64_t        id;         /**< Hook id */
+    const char*     name;       /**< Name in mapped file */
+    size_t          len;        /**< Length of name */
+}uhook_tracefile_symbol_t;
+
+static uhook_tracefile_ctx_t s_tracefile;
+static pthread_once_t s_tracefile_once = PTHREAD_ONCE_INIT;
+
+static void _tracefile_init(void)
+{
+    uhook_mutex_init(&s_tracefile.mutex);
+    s_tracefile.names_tail = &s_tracefile.names;
+    s_tracefile.fd = -1;
+}
+
+static uint8_t* _tracefile_put_varint(uint8_t* pos, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        *pos++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *pos++ = (uint8_t)value;
+    return pos;
+}
+
+static uint64_t _tracefile_zigzag(uint64_t delta)
+{
+    return (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+}
+
+static uint64_t _tracefile_unzigzag(uint64_t value)
+{
+    return (value >> 1) ^ (uint64_t)-(int64_t)(value & 1);
+}
+
+/**
+ * @brief Write all buffered data to file.
+ */
+static void _tracefile_flush(void)
+{
+    size_t off = 0;
+    while (off < s_tracefile.len && !s_tracefile.error)
+    {
+        ssize_t ret = write(s_tracefile.fd, s_tracefile.buf + off, s_tracefile.len - off);
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            LOG("write trace file failed: %d", errno);
+            s_tracefile.error = 1;
+            break;
+        }
+        off += (size_t)ret;
+    }
+    s_tracefile.len = 0;
+}
+
+/**
+ * @brief Make room for \p size bytes in buffer.
+ * @return  Where to write
+ */
+static uint8_t* _tracefile_reserve(size_t size)
+{
+    if (s_tracefile.len + size > UHOOK_TRACEFILE_BUF_SIZE)
+    {
+        _tracefile_flush();
+    }
+    return s_tracefile.buf + s_tracefile.len;
+}
+
+/**
+ * @brief Finish chunk that starts at \p chunk and ends at \p end.
+ */
+static void _tracefile_commit(uint8_t* chunk, uint32_t type, uint8_t* end)
+{
+    uhook_tracefile_chunk_t header;
+    header.type = type;
+    header.size = (uint32_t)(end - chunk - sizeof(header));
+    memcpy(chunk, &header, sizeof(header));
+
+    while ((uintptr_t)(end - s_tracefile.buf) % 8 != 0)
+    {
+        *end++ = 0;
+    }
+    s_tracefile.len = (size_t)(end - s_tracefile.buf);
+}
+
+static void _tracefile_put_name(const uhook_tracefile_name_t* name)
+{
+    uint8_t* chunk = _tracefile_reserve(UHOOK_TRACEFILE_CHUNK_MAX + name->len);
+    uint8_t* pos = chunk + sizeof(uhook_tracefile_chunk_t);
+
+    pos = _tracefile_put_varint(pos, name->id);
+    pos = _tracefile_put_varint(pos, name->len);
+    memcpy(pos, name->name, name->len);
+
+    _tracefile_commit(chunk, UHOOK_TRACEFILE_STRING, pos + name->len);
+}
+
+/**
+ * @brief Encode \p num records of the same thread.
+ */
+static void _tracefile_put_events(const uhook_trace_record_t* records, size_t num)
+{
+    uint8_t* chunk = _tracefile_reserve(UHOOK_TRACEFILE_CHUNK_MAX + num * UHOOK_TRACEFILE_RECORD_MAX);
+    uint8_t* pos = chunk + sizeof(uhook_tracefile_chunk_t);
+
+    pos = _tracefile_put_varint(pos, records[0].tid);
+    pos = _tracefile_put_varint(pos, num);
+
+    uint64_t ticks = 0, caller = 0;
+    size_t i;
+    for (i = 0; i < num; i++)
+    {
+        pos = _tracefile_put_varint(pos, _tracefile_zigzag(records[i].ticks - ticks));
+        pos = _tracefile_put_varint(pos, ((uint64_t)records[i].id << 1) | (records[i].type & 1));
+        pos = _tracefile_put_varint(pos, _tracefile_zigzag(records[i].caller - caller));
+        ticks = records[i].ticks;
+        caller = records[i].caller;
+    }
+
+    _tracefile_commit(chunk, UHOOK_TRACEFILE_EVENTS, pos);
+}
+
+/**
+ * @brief Encode drained records, one chunk for each run of a thread.
+ */
+static void _tracefile_put_records(const uhook_trace_record_t* records, size_t num)
+{
+    size_t start = 0, i;
+    for (i = 1; i <= num; i++)
+    {
+        if (i == num || records[i].tid != records[start].tid)
+        {
+            _tracefile_put_events(records + start, i - start);
+            start = i;
+        }
+    }
+}
+
+static void _tracefile_put_new_names(void)
+{
+    uhook_tracefile_name_t* name;
+
+    uhook_mutex_lock(&s_tracefile.mutex);
+    for (name = s_tracefile.names; name != NULL; name = name->next)
+    {
+        if (!name->written)
+        {
+            _tracefile_put_name(name);
+            name->written = 1;
+        }
+    }
+    uhook_mutex_unlock(&s_tracefile.mutex);
+}
+
+static void* _tracefile_writer(void* arg)
+{
+    /* Writes of this thread must not feed the trace */
+    uhook_trace_ignore();
+
+    for (;;)
+    {
+        int stop = __atomic_load_n(&s_tracefile.stop, __ATOMIC_ACQUIRE);
+
+        _tracefile_put_new_names();
+        size_t num = uhook_trace_collect(s_tracefile.records, UHOOK_TRACEFILE_BATCH);
+        _tracefile_put_records(s_tracefile.records, num);
+
+        if (s_tracefile.len >= UHOOK_TRACEFILE_FLUSH)
+        {
+            _tracefile_flush();
+        }
+        if (num == UHOOK_TRACEFILE_BATCH)
+        {
+            continue;
+        }
+        if (stop)
+        {
+            break;
+        }
+
+        struct timespec ts = { 0, UHOOK_TRACEFILE_INTERVAL_NS };
+        nanosleep(&ts, NULL);
+    }
+
+    _tracefile_flush();
+    return arg;
+}
+
+static void _tracefile_release(void)
+{
+    if (s_tracefile.fd >= 0)
+    {
+        close(s_tracefile.fd);
+        s_tracefile.fd = -1;
+    }
+    free(s_tracefile.buf);
+    s_tracefile.buf = NULL;
+    free(s_tracefile.records);
+    s_tracefile.records = NULL;
+}
+
+int uhook_tracefile_name(unsigned id, const char* name)
+{
+    pthread_once(&s_tracefile_once, _tracefile_init);
+
+    size_t len = strlen(name);
+    len = len < UHOOK_TRACEFILE_NAME_MAX ? len : UHOOK_TRACEFILE_NAME_MAX;
+
+    uhook_tracefile_name_t* item = malloc(sizeof(uhook_tracefile_name_t) + len);
+    if (item == NULL)
+    {
+        return UHOOK_NOMEM;
+    }
+    item->id = id;
+    item->written = 0;
+    item->len = len;
+    memcpy(item->name, name, len);
+
+    /* Appended, so names are written oldest first and the later one wins when read */
+    item->next = NULL;
+    uhook_mutex_lock(&s_tracefile.mutex);
+    *s_tracefile.names_tail = item;
+    s_tracefile.names_tail = &item->next;
+    uhook_mutex_unlock(&s_tracefile.mutex);
+
+    return UHOOK_SUCCESS;
+}
+
+int uhook_tracefile_open(const char* path)
+{
+    pthread_once(&s_tracefile_once, _tracefile_init);
+    uhook_trace_init();
+
+    int ret = UHOOK_INVALID;
+    uhook_mutex_lock(&s_tracefile.mutex);
+
+    if (s_tracefile.state != UHOOK_TRACEFILE_IDLE)
+    {
+        goto fin;
+    }
+
+    if ((s_tracefile.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+    {
+        goto fin;
+    }
+
+    s_tracefile.buf = malloc(UHOOK_TRACEFILE_BUF_SIZE);
+    s_tracefile.records = malloc(sizeof(uhook_trace_record_t) * UHOOK_TRACEFILE_BATCH);
+    if (s_tracefile.buf == NULL || s_tracefile.records == NULL)
+    {
+        ret = UHOOK_NOMEM;
+        goto err;
+    }
+
+    uhook_tracefile_header_t header;
+    header.magic = UHOOK_TRACEFILE_MAGIC;
+    header.version = UHOOK_TRACEFILE_VERSION;
+    header.mult = uhook_clock_ns((uint64_t)1 << 32);
+    memcpy(s_tracefile.buf, &header, sizeof(header));
+    s_tracefile.len = sizeof(header);
+    s_tracefile.error = 0;
+    s_tracefile.stop = 0;
+
+    uhook_tracefile_name_t* name;
+    for (name = s_tracefile.names; name != NULL; name = name->next)
+    {
+        name->written = 0;
+    }
+
+    if (pthread_create(&s_tracefile.thread, NULL, _tracefile_writer, NULL) != 0)
+    {
+        ret = UHOOK_UNKNOWN;
+        goto err;
+    }
+
+    s_tracefile.state = UHOOK_TRACEFILE_RUNNING;
+    ret = UHOOK_SUCCESS;
+    goto fin;
+
+err:
+    _tracefile_release();
+fin:
+    uhook_mutex_unlock(&s_tracefile.mutex);
+    return ret;
+}
+
+int uhook_tracefile_close(void)
+{
+    pthread_once(&s_tracefile_once, _tracefile_init);
+
+    uhook_mutex_lock(&s_tracefile.mutex);
+    if (s_tracefile.state != UHOOK_TRACEFILE_RUNNING)
+    {
+        uhook_mutex_unlock(&s_tracefile.mutex);
+        return UHOOK_INVALID;
+    }
+    s_tracefile.state = UHOOK_TRACEFILE_CLOSING;
+    __atomic_store_n(&s_tracefile.stop, 1, __ATOMIC_RELEASE);
+    uhook_mutex_unlock(&s_tracefile.mutex);
+
+    /* Writer takes the lock to write names */
+    pthread_join(s_tracefile.thread, NULL);
+
+    uhook_mutex_lock(&s_tracefile.mutex);
+    int ret = s_tracefile.error ? UHOOK_UNKNOWN : UHOOK_SUCCESS;
+    if (close(s_tracefile.fd) != 0)
+    {
+        ret = UHOOK_UNKNOWN;
+    }
+    s_tracefile.fd = -1;
+    _tracefile_release();
+    s_tracefile.state = UHOOK_TRACEFILE_IDLE;
+    uhook_mutex_unlock(&s_tracefile.mutex);
+
+    return ret;
+}
+
+static int _tracefile_get_varint(uhook_tracefile_cursor_t* cur, uint64_t* value)
+{
+    uint64_t result = 0;
+    unsigned shift;
+    for (shift = 0; shift < 64 && cur->pos < cur->end; shift += 7)
+    {
+        uint8_t byte = *cur->pos++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            *value = result;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int _tracefile_events_init(uhook_tracefile_events_t* events, const uint8_t* payload, size_t size)
+{
+    events->cur.pos = payload;
+    events->cur.end = payload + size;
+    events->ticks = 0;
+    events->caller = 0;
+    return _tracefile_get_varint(&events->cur, &events->tid)
+        && _tracefile_get_varint(&events->cur, &events->left);
+}
+
+/**
+ * @return  1 if \p record is decoded, 0 if no more, -1 if payload is broken.
+ */
+static int _tracefile_events_next(uhook_tracefile_events_t* events, uhook_trace_record_t* record)
+{
+    if (events->left == 0)
+    {
+        return 0;
+    }
+
+    uint64_t ticks, id, caller;
+    if (!_tracefile_get_varint(&events->cur, &ticks)
+        || !_tracefile_get_varint(&events->cur, &id)
+        || !_tracefile_get_varint(&events->cur, &caller))
+    {
+        return -1;
+    }
+    events->left--;
+    events->ticks += _tracefile_unzigzag(ticks);
+    events->caller += _tracefile_unzigzag(caller);
+
+    record->ticks = events->ticks;
+    record->caller = events->caller;
+    record->tid = (unsigned)events->tid;
+    record->id = (unsigned)(id >> 1);
+    record->type = (unsigned)(id & 1);
+    record->reserved = 0;
+    return 1;
+}
+
+/**
+ * @brief Get next complete chunk of mapped file.
+ * @param[in,out] pos   Position of chunk, moved to the next one.
+ * @return              bool
+ */
+static int _tracefile_next_chunk(const uint8_t** pos, const uint8_t* end,
+    uhook_tracefile_chunk_t* chunk, const uint8_t** payload)
+{
+    if ((size_t)(end - *pos) < sizeof(*chunk))
+    {
+        return 0;
+    }
+    memcpy(chunk, *pos, sizeof(*chunk));
+    if (chunk->size > (size_t)(end - *pos) - sizeof(*chunk))
+    {
+        return 0;
+    }
+
+    *payload = *pos + sizeof(*chunk);
+    size_t size = ALIGN_SIZE(sizeof(*chunk) + chunk->size, 8);
+    *pos = size < (size_t)(end - *pos) ? *pos + size : end;
+    return 1;
+}
+
+static uint64_t _tracefile_ns(uint64_t ticks, uint64_t mult)
+{
+    return (ticks >> 32) * mult + (((ticks & 0xffffffff) * mult) >> 32);
+}
+
+static void _tracefile_json_string(FILE* file, const char* str, size_t len)
+{
+    size_t i;
+    fputc('"', file);
+    for (i = 0; i < len; i++)
+    {
+        unsigned char c = (unsigned char)str[i];
+        if (c == '"' || c == '\\')
+        {
+            fprintf(file, "\\%c", c);
+        }
+        else if (c < 0x20)
+        {
+            fprintf(file, "\\u%04x", c);
+        }
+        else
+        {
+            fputc(c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+/**
+ * @brief Collect names and the earliest time stamp.
+ * @return  #uhook_errno
+ */
+static int _tracefile_scan(const uint8_t* begin, const uint8_t* end, uhook_tracefile_symbol_t** symbols,
+    size_t* symbol_num, uint64_t* base)
+{
+    const uint8_t* pos = begin;
+    const uint8_t* payload;
+    uhook_tracefile_chunk_t chunk;
+    size_t cap = 0;
+
+    *base = UINT64_MAX;
+    while (_tracefile_next_chunk(&pos, end, &chunk, &payload))
+    {
+        if (chunk.type == UHOOK_TRACEFILE_EVENTS)
+        {
+            uhook_tracefile_events_t events;
+            uhook_trace_record_t record;
+            if (!_tracefile_events_init(&events, payload, chunk.size))
+            {
+                return UHOOK_INVALID;
+            }
+            int ret;
+            while ((ret = _tracefile_events_next(&events, &record)) > 0)
+            {
+                *base = record.ticks < *base ? record.ticks : *base;
+            }
+            if (ret < 0)
+            {
+                return UHOOK_INVALID;
+            }
+            continue;
+        }
+        if (chunk.type != UHOOK_TRACEFILE_STRING)
+        {
+            continue;
+        }
+
+        uhook_tracefile_cursor_t cur = { payload, payload + chunk.size };
+        uint64_t id, len;
+        if (!_tracefile_get_varint(&cur, &id) || !_tracefile_get_varint(&cur, &len)
+            || len > (uint64_t)(cur.end - cur.pos))
+        {
+            return UHOOK_INVALID;
+        }
+
+        if (*symbol_num == cap)
+        {
+            cap = cap != 0 ? cap * 2 : 64;
+            uhook_tracefile_symbol_t* tmp = realloc(*symbols, sizeof(uhook_tracefile_symbol_t) * cap);
+            if (tmp == NULL)
+            {
+                return UHOOK_NOMEM;
+            }
+            *symbols = tmp;
+        }
+        (*symbols)[*symbol_num].id = id;
+        (*symbols)[*symbol_num].name = (const char*)cur.pos;
+        (*symbols)[*symbol_num].len = (size_t)len;
+        (*symbol_num)++;
+    }
+
+    return UHOOK_SUCCESS;
+}
+
+static void _tracefile_json_event(FILE* file, const uhook_trace_record_t* record, uint64_t ns,
+    const uhook_tracefile_symbol_t* symbols, size_t symbol_num, int first)
+{
+    fputs(first ? "\n" : ",\n", file);
+    fputs("{\"name\":", file);
+
+    /* Later name of the same id wins */
+    size_t i = symbol_num;
+    while (i > 0 && symbols[i - 1].id != record->id)
+    {
+        i--;
+    }
+    if (i > 0)
+    {
+        _tracefile_json_string(file, symbols[i - 1].name, symbols[i - 1].len);
+    }
+    else
+    {
+        fprintf(file, "\"hook %u\"", record->id);
+    }
+
+    fprintf(file, ",\"ph\":\"%s\",\"ts\":%llu.%03llu,\"pid\":1,\"tid\":%u,\"args\":{\"caller\":\"0x%llx\"}}",
+        record->type == UHOOK_TRACE_ENTER ? "B" : "E",
+        (unsigned long long)(ns / 1000), (unsigned long long)(ns % 1000), record->tid,
+        (unsigned long long)record->caller);
+}
+
+static int _tracefile_write_json(FILE* file, const uint8_t* begin, const uint8_t* end, uint64_t mult)
+{
+    uhook_tracefile_symbol_t* symbols = NULL;
+    size_t symbol_num = 0;
+    uint64_t base;
+
+    int ret = _tracefile_scan(begin, end, &symbols, &symbol_num, &base);
+    if (ret != UHOOK_SUCCESS)
+    {
+        goto fin;
+    }
+
+    const uint8_t* pos = begin;
+    const uint8_t* payload;
+    uhook_tracefile_chunk_t chunk;
+    int first = 1;
+
+    fputs("{\"traceEvents\":[", file);
+    while (_tracefile_next_chunk(&pos, end, &chunk, &payload))
+    {
+        if (chunk.type != UHOOK_TRACEFILE_EVENTS)
+        {
+            continue;
+        }
+
+        /* Verified by scan */
+        uhook_tracefile_events_t events;
+        uhook_trace_record_t record;
+        _tracefile_events_init(&events, payload, chunk.size);
+        while (_tracefile_events_next(&events, &record) > 0)
+        {
+            _tracefile_json_event(file, &record, _tracefile_ns(record.ticks - base, mult),
+                symbols, symbol_num, first);
+            first = 0;
+        }
+    }
+    fputs("\n]}\n", file);
+
+fin:
+    free(symbols);
+    return ret;
+}
+
+int uhook_tracefile_to_json(const char* path, const char* json_path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return UHOOK_INVALID;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(uhook_tracefile_header_t))
+    {
+        close(fd);
+        return UHOOK_INVALID;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return UHOOK_NOMEM;
+    }
+
+    int ret = UHOOK_INVALID;
+    const uhook_tracefile_header_t* header = map;
+    if (header->magic != UHOOK_TRACEFILE_MAGIC || header->version != UHOOK_TRACEFILE_VERSION)
+    {
+        goto fin;
+    }
+
+    FILE* file = fopen(json_path, "w");
+    if (file == NULL)
+    {
+        goto fin;
+    }
+
+    ret = _tracefile_write_json(file, (const uint8_t*)(header + 1), (const uint8_t*)map + size, header->mult);
+    if (fclose(file) != 0 && ret == UHOOK_SUCCESS)
+    {
+        ret = UHOOK_UNKNOWN;
+    }
+
+fin:
+    munmap(map, size);
+    return ret;
+}
@@ -0,0 +1,33 @@
+#ifndef __UHOOK_TRACEFILE_H__
+#define __UHOOK_TRACEFILE_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uhook.h"
+#include "defs.h"
+
+/**
+ * @see uhook_trace_name()
+ */
+API_LOCAL int uhook_tracefile_name(unsigned id, const char* name);
+
+/**
+ * @see uhook_trace_open()
+ */
+API_LOCAL int uhook_tracefile_open(const char* path);
+
+/**
+ * @see uhook_trace_close()
+ */
+API_LOCAL int uhook_tracefile_close(void);
+
+/**
+ * @see uhook_trace_to_json()
+ */
+API_LOCAL int uhook_tracefile_to_json(const char* path, const char* json_path);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,236 @@
+#define _GNU_SOURCE
+#include "uhook.h"
+#include "trap.h"
+#include "mutex.h"
+#include "once.h"
+#include <signal.h>
+#include <string.h>
+#include <ucontext.h>
+
+/**
+ * @brief Capacity of breakpoint table, must be power of 2.
+ *
+ * The table never grows so the signal handler can read it without lock.
+ */
+#define UHOOK_TRAP_TABLE_SIZE   1024
+
+#define UHOOK_TRAP_KEY_EMPTY    ((uintptr_t)0)
+#define UHOOK_TRAP_KEY_DELETED  ((uintptr_t)1)
+
+typedef struct uhook_trap_entry
+{
+    uintptr_t       key;        /**< Address of `int3`, or #UHOOK_TRAP_KEY_EMPTY / #UHOOK_TRAP_KEY_DELETED */
+    uintptr_t       detour;     /**< Where to continue */
+    uint64_t        hits;       /**< Hit count */
+}uhook_trap_entry_t;
+
+/**
+ * @brief Open addressed table of breakpoints.
+ *
+ * Writers are serialized by mutex and publish entries with release store of
+ * the key, so the signal handler only needs acquire loads. Deleted entries
+ * are left as tombstones and reused by later insert.
+ */
+typedef struct uhook_trap_ctx
+{
+    uhook_mutex_t       mutex;                          /**< Serialize writers */
+    int                 installed;                      /**< Whether handler is installed */
+    struct sigaction    prev;                           /**< Previous SIGTRAP action */
+    uhook_trap_entry_t  table[UHOOK_TRAP_TABLE_SIZE];   /**< Breakpoints */
+}uhook_trap_ctx_t;
+
+static uhook_trap_ctx_t s_trap;
+static pthread_once_t s_trap_once = PTHREAD_ONCE_INIT;
+
+static void _uhook_trap_init(void)
+{
+    uhook_mutex_init(&s_trap.mutex);
+}
+
+static size_t _uhook_trap_hash(uintptr_t key)
+{
+    uint64_t hash = (uint64_t)key * (uint64_t)0x9E3779B97F4A7C15;
+    return (size_t)(hash >> 32) & (UHOOK_TRAP_TABLE_SIZE - 1);
+}
+
+/**
+ * @note Async signal safe.
+ */
+static uhook_trap_entry_t* _uhook_trap_find(uintptr_t key)
+{
+    size_t pos = _uhook_trap_hash(key);
+
+    size_t i;
+    for (i = 0; i < UHOOK_TRAP_TABLE_SIZE; i++)
+    {
+        uhook_trap_entry_t* entry = &s_trap.table[(pos + i) & (UHOOK_TRAP_TABLE_SIZE - 1)];
+        uintptr_t entry_key = __atomic_load_n(&entry->key, __ATOMIC_ACQUIRE);
+        if (entry_key == key)
+        {
+            return entry;
+        }
+        if (entry_key == UHOOK_TRAP_KEY_EMPTY)
+        {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+#if defined(__linux__) && defined(__x86_64__)
+
+static void _uhook_trap_chain(int sig, siginfo_t* info, void* ctx)
+{
+    if (s_trap.prev.sa_flags & SA_SIGINFO)
+    {
+        s_trap.prev.sa_sigaction(sig, info, ctx);
+        return;
+    }
+    if (s_trap.prev.sa_handler == SIG_IGN)
+    {
+        return;
+    }
+    if (s_trap.prev.sa_handler != SIG_DFL)
+    {
+        s_trap.prev.sa_handler(sig);
+        return;
+    }
+
+    /* Default action, delivered once this handler returns */
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void _uhook_trap_handler(int sig, siginfo_t* info, void* ctx)
+{
+    ucontext_t* uc = ctx;
+    uintptr_t addr = (uintptr_t)uc->uc_mcontext.gregs[REG_RIP] - 1;
+
+    uhook_trap_entry_t* entry = _uhook_trap_find(addr);
+    if (entry != NULL)
+    {
+        __atomic_fetch_add(&entry->hits, 1, __ATOMIC_RELAXED);
+        uc->uc_mcontext.gregs[REG_RIP] = (greg_t)__atomic_load_n(&entry->detour, __ATOMIC_ACQUIRE);
+        return;
+    }
+
+    /* Breakpoint is removed after it was hit, execute original code again */
+    if (info->si_code == SI_KERNEL && *(volatile uint8_t*)addr != 0xcc)
+    {
+        uc->uc_mcontext.gregs[REG_RIP] = (greg_t)addr;
+        return;
+    }
+
+    _uhook_trap_chain(sig, info, ctx);
+}
+
+static int _uhook_trap_install(void)
+{
+    if (s_trap.installed)
+    {
+        return UHOOK_SUCCESS;
+    }
+
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_sigaction = _uhook_trap_handler;
+    act.sa_flags = SA_SIGINFO | SA_RESTART | SA_ONSTACK;
+    sigemptyset(&act.sa_mask);
+
+    if (sigaction(SIGTRAP, &act, &s_trap.prev) != 0)
+    {
+        return UHOOK_UNKNOWN;
+    }
+    s_trap.installed = 1;
+
+    return UHOOK_SUCCESS;
+}
+
+#else
+
+static int _uhook_trap_install(void)
+{
+    return UHOOK_UNKNOWN;
+}
+
+#endif
+
+int uhook_trap_register(void* addr, void* detour)
+{
+    uintptr_t key = (uintptr_t)addr;
+    int ret;
+
+    pthread_once(&s_trap_once, _uhook_trap_init);
+    uhook_mutex_lock(&s_trap.mutex);
+
+    if ((ret = _uhook_trap_install()) != UHOOK_SUCCESS)
+    {
+        goto fin;
+    }
+    if (_uhook_trap_find(key) != NULL)
+    {
+        ret = UHOOK_DUPLICATE;
+        goto fin;
+    }
+
+    ret = UHOOK_NOMEM;
+    size_t pos = _uhook_trap_hash(key);
+
+    size_t i;
+    for (i = 0; i < UHOOK_TRAP_TABLE_SIZE; i++)
+    {
+        uhook_trap_entry_t* entry = &s_trap.table[(pos + i) & (UHOOK_TRAP_TABLE_SIZE - 1)];
+        if (entry->key != UHOOK_TRAP_KEY_EMPTY && entry->key != UHOOK_TRAP_KEY_DELETED)
+        {
+            continue;
+        }
+
+        __atomic_store_n(&entry->detour, (uintptr_t)detour, __ATOMIC_RELAXED);
+        __atomic_store_n(&entry->hits, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&entry->key, key, __ATOMIC_RELEASE);
+        ret = UHOOK_SUCCESS;
+        break;
+    }
+
+fin:
+    uhook_mutex_unlock(&s_trap.mutex);
+    return ret;
+}
+
+void uhook_trap_update(void* addr, void* detour)
+{
+    uhook_mutex_lock(&s_trap.mutex);
+
+    uhook_trap_entry_t* entry = _uhook_trap_find((uintptr_t)addr);
+    if (entry != NULL)
+    {
+        __atomic_store_n(&entry->detour, (uintptr_t)detour, __ATOMIC_RELEASE);
+    }
+
+    uhook_mutex_unlock(&s_trap.mutex);
+}
+
+void uhook_trap_unregister(void* addr)
+{
+    uhook_mutex_lock(&s_trap.mutex);
+
+    uhook_trap_entry_t* entry = _uhook_trap_find((uintptr_t)addr);
+    if (entry != NULL)
+    {
+        __atomic_store_n(&entry->key, UHOOK_TRAP_KEY_DELETED, __ATOMIC_RELEASE);
+    }
+
+    uhook_mutex_unlock(&s_trap.mutex);
+}
+
+int uhook_trap_hits(const void* addr, uint64_t* hits)
+{
+    uhook_trap_entry_t* entry = _uhook_trap_find((uintptr_t)addr);
+    if (entry == NULL)
+    {
+        return 0;
+    }
+
+    *hits = __atomic_load_n(&entry->hits, __ATOMIC_RELAXED);
+    return 1;
+}
@@ -0,0 +1,47 @@
+#ifndef __UHOOK_TRAP_H__
+#define __UHOOK_TRAP_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "defs.h"
+#include <stdint.h>
+
+/**
+ * @brief Route breakpoint at \p addr to \p detour.
+ *
+ * SIGTRAP handler is installed on first call, breakpoints that are not
+ * registered are passed to the previous handler.
+ *
+ * @param[in] addr      Address of `int3`
+ * @param[in] detour    Where to continue when breakpoint is hit
+ * @return              #uhook_errno
+ */
+API_LOCAL int uhook_trap_register(void* addr, void* detour);
+
+/**
+ * @brief Change detour of registered breakpoint.
+ * @param[in] addr      Address of `int3`
+ * @param[in] detour    New detour
+ */
+API_LOCAL void uhook_trap_update(void* addr, void* detour);
+
+/**
+ * @brief Stop routing breakpoint at \p addr.
+ * @note The `int3` must be removed from code before it.
+ * @param[in] addr      Address of `int3`
+ */
+API_LOCAL void uhook_trap_unregister(void* addr);
+
+/**
+ * @brief Get how many times breakpoint is hit.
+ * @param[in] addr      Address of `int3`
+ * @param[out] hits     Hit count
+ * @return              bool, whether \p addr is registered.
+ */
+API_LOCAL int uhook_trap_hits(const void* addr, uint64_t* hits);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,81 @@
+#define _GNU_SOURCE
+#include "uhook.h"
+#include "tstate.h"
+#include <sys/mman.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#   include "arch/x86_64_stub.h"
+#endif
+
+static void _uhook_tstate_release(void* arg)
+{
+    uhook_tstate_t* state = arg;
+    *state->cache = NULL;
+    __atomic_store_n(&state->busy, 0, __ATOMIC_RELEASE);
+}
+
+void uhook_tstate_init(uhook_tstate_list_t* list)
+{
+    list->head = NULL;
+    pthread_key_create(&list->key, _uhook_tstate_release);
+}
+
+uhook_tstate_t* uhook_tstate_get(uhook_tstate_list_t* list, size_t size, void** cache,
+    void (*init)(uhook_tstate_t* state))
+{
+    uhook_tstate_t* state;
+    for (state = uhook_tstate_first(list); state != NULL; state = state->next)
+    {
+        int expect = 0;
+        if (__atomic_compare_exchange_n(&state->busy, &expect, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            goto fin;
+        }
+    }
+
+    /* Large states are mostly never touched, so swap is not reserved */
+    void* addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    state = addr;
+    state->busy = 1;
+    if (init != NULL)
+    {
+        init(state);
+    }
+
+    state->next = __atomic_load_n(&list->head, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&list->head, &state->next, state, 1,
+        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    {
+    }
+
+fin:
+    state->cache = cache;
+    *cache = state;
+    pthread_setspecific(list->key, state);
+    return state;
+}
+
+uhook_tstate_t* uhook_tstate_first(uhook_tstate_list_t* list)
+{
+    return __atomic_load_n(&list->head, __ATOMIC_ACQUIRE);
+}
+
+void uhook_tstate_add(uint64_t* counter, uint64_t value)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+uint64_t* uhook_tstate_call(const uhook_regs_t* regs)
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+    return uhook_x86_64_handler_data(regs);
+#else
+    (void)regs;
+    return NULL;
+#endif
+}
@@ -0,0 +1,88 @@
+#ifndef __UHOOK_TSTATE_H__
+#define __UHOOK_TSTATE_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uhook.h"
+#include "defs.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Header of a per thread state, must be the first field of it.
+ *
+ * States are mapped directly, so hooks on allocator do not recurse into
+ * here. They are never unmapped, a new thread takes over the one left by an
+ * exited thread, so what exited threads recorded is kept.
+ */
+typedef struct uhook_tstate
+{
+    struct uhook_tstate*    next;   /**< Next state */
+    int                     busy;   /**< Owned by a live thread */
+    void**                  cache;  /**< Thread local pointer of owner, cleared on release */
+}uhook_tstate_t;
+
+/**
+ * @brief States of one module.
+ */
+typedef struct uhook_tstate_list
+{
+    uhook_tstate_t*         head;   /**< States, only pushed */
+    pthread_key_t           key;    /**< Release state on exit */
+}uhook_tstate_list_t;
+
+/**
+ * @brief Initialize \p list.
+ * @param[out] list     State list
+ */
+API_LOCAL void uhook_tstate_init(uhook_tstate_list_t* list);
+
+/**
+ * @brief Get a state for current thread, take over a released one if any.
+ * @note Lock free, so it is safe from any hooked function.
+ * @param[in] list      State list
+ * @param[in] size      Size of a new state, states of a list must be the same size.
+ * @param[in] cache     Thread local pointer of caller, set to the state.
+ * @param[in] init     Called on a new state before it is published, NULL to
+ *                      skip. The state is zeroed besides header.
+ * @return              State, or NULL if failure.
+ */
+API_LOCAL uhook_tstate_t* uhook_tstate_get(uhook_tstate_list_t* list, size_t size, void** cache,
+    void (*init)(uhook_tstate_t* state));
+
+/**
+ * @brief First state of \p list, walk the rest by `next`.
+ * @param[in] list      State list
+ * @return              State, or NULL if none.
+ */
+API_LOCAL uhook_tstate_t* uhook_tstate_first(uhook_tstate_list_t* list);
+
+/**
+ * @brief Add \p value to a counter of a state owned by current thread.
+ *
+ * Only owner writes, reader needs no tearing only, so no locked instruction
+ * is used.
+ *
+ * @param[in,out] counter   Counter
+ * @param[in] value         Value to add
+ */
+API_LOCAL void uhook_tstate_add(uint64_t* counter, uint64_t value);
+
+/**
+ * @brief Word of hooked call at `regs->sp`, kept from enter handler to
+ *   leave handler.
+ *
+ * It lives in the frame that handler stub keeps for leave handler, so calls
+ * skipped by `longjmp()` or exception are dropped with it.
+ *
+ * @param[in] regs      Registers passed to handler
+ * @return              Word, or NULL if the call is not seen by leave handler.
+ */
+API_LOCAL uint64_t* uhook_tstate_call(const uhook_regs_t* regs);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
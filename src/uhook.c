@@ -1,93 +1,1795 @@
 #include "uhook.h"
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include "clock.h"
+#include "hist.h"
+#include "mutex.h"
 #include "once.h"
+#include "plan.h"
+#include "plancache.h"
+#include "registry.h"
+#include "sig.h"
+#include "stat.h"
+#include "trace.h"
+#include "tracefile.h"
+#include "trap.h"
 
+#include "os/os.h"
 #include "os/elf.h"
 
 #include "arch/arm.h"
 #include "arch/x86_64.h"
+#include "arch/x86_64_stub.h"
 
 #define INLINE_HOOK_DEBUG
 #include "log.h"
 
 #define UHOOK_ATTR_INLINE   1
 #define UHOOK_ATTR_GOTPLT   2
+#define UHOOK_ATTR_DISABLED 4
+#define UHOOK_ATTR_CALLSITE 8
 
-typedef int (*uhook_inject_fn)(void** token, void** fcall, void* target, void* detour);
-typedef void (*uhook_uninject_fn)(void* token);
+/**
+ * @brief Amount of target lock shards.
+ *
+ * At most 64, so a set of shards fits in an uint64_t.
+ */
+#define UHOOK_LOCK_SHARDS   64
 
-int uhook_inject(uhook_token_t* token, void* target, void* detour)
-{
-    void* inject_token = NULL;
-    void* inject_call = NULL;
-
-    uhook_inject_fn fn_inject =
 #if defined(__i386__) || defined(__amd64__) || defined(_M_IX86) || defined(_M_AMD64)
-        uhook_x86_64_inject
+#   define UHOOK_ARCH_INJECT            uhook_x86_64_inject
+#   define UHOOK_ARCH_INJECT_LAZY       uhook_x86_64_inject_lazy
+#   define UHOOK_ARCH_INJECT_TRAP       uhook_x86_64_inject_trap
+#   define UHOOK_ARCH_FOLLOW_JUMP       uhook_x86_64_follow_jump
+#   define UHOOK_ARCH_UNINJECT          uhook_x86_64_uninject
+#   define UHOOK_ARCH_RELEASE           uhook_x86_64_release
+#   define UHOOK_ARCH_PATCH_RANGE       uhook_x86_64_patch_range
+#   define UHOOK_ARCH_TOGGLE            uhook_x86_64_toggle
+#   define UHOOK_ARCH_RETARGET          uhook_x86_64_retarget
+#   define UHOOK_ARCH_FORWARD_CREATE    uhook_x86_64_forward_create
+#   define UHOOK_ARCH_FORWARD_UPDATE    uhook_x86_64_forward_update
+#   define UHOOK_ARCH_FORWARD_DESTROY   uhook_x86_64_forward_destroy
+#   define UHOOK_ARCH_CALLSITE_INJECT   uhook_x86_64_callsite_inject
+#   define UHOOK_ARCH_CALLSITE_TOGGLE   uhook_x86_64_callsite_toggle
+#   define UHOOK_ARCH_CALLSITE_UNINJECT uhook_x86_64_callsite_uninject
+#   define UHOOK_ARCH_FIND_CALLERS      uhook_x86_64_find_callers
+#   define UHOOK_ARCH_PLAN              uhook_x86_64_plan
+#   define UHOOK_ARCH_CTX_THUNK_CREATE  uhook_x86_64_ctx_thunk_create
+#   define UHOOK_ARCH_HANDLER_CREATE    uhook_x86_64_handler_create
+#   define UHOOK_ARCH_GUARD_CREATE      uhook_x86_64_guard_create
+#   define UHOOK_ARCH_BYPASS            uhook_x86_64_bypass
+#   define UHOOK_ARCH_SNIPPET_CREATE    uhook_x86_64_snippet_create
+#   define UHOOK_ARCH_SNIPPET_RETURN    uhook_x86_64_snippet_return
+#   define UHOOK_ARCH_SNIPPET_SKIP      uhook_x86_64_snippet_skip
+#   define UHOOK_ARCH_SNIPPET_COUNT     uhook_x86_64_snippet_count
+#   define UHOOK_ARCH_STUB_DESTROY      uhook_x86_64_stub_destroy
+#   define UHOOK_ARCH_GET_CTX           uhook_x86_64_get_ctx
 #elif defined(__arm__)
-        uhook_arm_inject
+#   define UHOOK_ARCH_INJECT            uhook_arm_inject
+#   define UHOOK_ARCH_INJECT_LAZY       uhook_arm_inject
+#   define UHOOK_ARCH_UNINJECT          uhook_arm_uninject
+#   define UHOOK_ARCH_RELEASE           uhook_arm_release
+#   define UHOOK_ARCH_PATCH_RANGE       uhook_arm_patch_range
+#   define UHOOK_ARCH_TOGGLE            uhook_arm_toggle
+#   define UHOOK_ARCH_RETARGET          uhook_arm_retarget
+#   define UHOOK_ARCH_FORWARD_CREATE    uhook_arm_forward_create
+#   define UHOOK_ARCH_FORWARD_UPDATE    uhook_arm_forward_update
+#   define UHOOK_ARCH_FORWARD_DESTROY   uhook_arm_forward_destroy
 #else
 #   error "unsupport hardware platform"
-        NULL
 #endif
-    ;
 
-    int ret = fn_inject(&inject_token, &inject_call, target, detour);
-    if (ret != UHOOK_SUCCESS)
+typedef struct uhook_layer uhook_layer_t;
+typedef struct uhook_target uhook_target_t;
+typedef struct uhook_got uhook_got_t;
+typedef struct uhook_callsite uhook_callsite_t;
+
+/**
+ * @brief One inline hook on a target.
+ *
+ * The `fcall` of a layer is its forward stub, which jumps to the detour of
+ * next enabled layer, or to the trampoline if it is the last one.
+ */
+struct uhook_layer
+{
+    uhook_layer_t*      next;       /**< Next layer in dispatch order */
+    uhook_target_t*     owner;      /**< Target this layer belongs to */
+    uhook_token_t*      token;      /**< Token given by user */
+    void*               detour;     /**< Detour function */
+    void*               forward;    /**< Forward stub */
+    void*               stub;       /**< Generated stub that \p detour points to, NULL if none */
+    uhook_ctx_t         ctx;        /**< Context published by \p stub */
+    int                 priority;   /**< Dispatch priority */
+    int                 disabled;   /**< Whether this layer is skipped */
+    unsigned            group;      /**< Hook group */
+    size_t              stat;       /**< Stat slot plus one, 0 if none */
+    size_t              hist;       /**< Histogram slot plus one, 0 if none */
+};
+
+/**
+ * @brief A function that has inline hook.
+ */
+struct uhook_target
+{
+    uhook_registry_node_t node;     /**< Registry node, keyed by #uhook_target::addr */
+    void*               addr;       /**< Target function address */
+    void*               inject;     /**< Arch inject token */
+    void*               origin;     /**< Address to call original function */
+    void*               detour;     /**< Detour that entry is redirected to */
+    uhook_layer_t*      layers;     /**< Layers sorted by dispatch order */
+    int                 patched;    /**< Whether entry is redirected */
+};
+
+/**
+ * @brief A GOT/PLT hook.
+ */
+struct uhook_got
+{
+    uhook_registry_node_t relplt;   /**< Registry node of .rel(a).plt slot */
+    uhook_registry_node_t reldyn;   /**< Registry node of .rel(a).dyn slot */
+    uhook_token_t*      token;      /**< Token given by user */
+    void*               inject;     /**< ELF inject token */
+    unsigned            group;      /**< Hook group */
+};
+
+/**
+ * @brief A call-site hook.
+ *
+ * Call sites may be anywhere in text, so they are protected by all shards.
+ */
+struct uhook_callsite
+{
+    uhook_callsite_t*   next;       /**< Next call-site hook */
+    uhook_token_t*      token;      /**< Token given by user */
+    void*               inject;     /**< Arch inject token */
+    unsigned            group;      /**< Hook group */
+};
+
+typedef struct uhook_toggle_ctx
+{
+    uhook_target_t**    targets;    /**< Touched targets, sorted by address */
+    size_t              target_cnt; /**< Amount of touched targets */
+}uhook_toggle_ctx_t;
+
+typedef struct uhook_bulk_ctx
+{
+    int                 all;        /**< Ignore group */
+    unsigned            group;      /**< Group to uninject */
+    uhook_target_t**    targets;    /**< Touched targets */
+    size_t              target_cnt; /**< Amount of touched targets */
+    uhook_got_t**       gots;       /**< GOT/PLT hooks to uninject */
+    size_t              got_cnt;    /**< Amount of GOT/PLT hooks */
+    uhook_layer_t*      layers;     /**< Removed layers */
+    size_t              hook_cnt;   /**< Amount of uninjected hooks */
+}uhook_bulk_ctx_t;
+
+/**
+ * @brief Locks of hook state.
+ *
+ * A target is protected by the shard its page is hashed to, so hooking
+ * functions in different pages runs in parallel. When several locks are
+ * needed, shards are locked in ascending order, then #uhook_lock_ctx::got.
+ */
+typedef struct uhook_lock_ctx
+{
+    uhook_mutex_t       shards[UHOOK_LOCK_SHARDS];  /**< Protect targets */
+    uhook_mutex_t       got;        /**< Protect GOT/PLT hooks */
+}uhook_lock_ctx_t;
+
+static uhook_lock_ctx_t s_lock;
+static uhook_callsite_t* s_callsites = NULL;
+static pthread_once_t s_lock_once = PTHREAD_ONCE_INIT;
+
+static void _uhook_lock_init(void)
+{
+    size_t i;
+    for (i = 0; i < UHOOK_LOCK_SHARDS; i++)
+    {
+        uhook_mutex_init(&s_lock.shards[i]);
+    }
+    uhook_mutex_init(&s_lock.got);
+}
+
+static uint64_t _uhook_shard_of(const void* addr)
+{
+    size_t idx = ((uintptr_t)addr / _get_page_size()) % UHOOK_LOCK_SHARDS;
+    return (uint64_t)1 << idx;
+}
+
+/**
+ * @param[in] shards    Set of shards
+ * @param[in] got       Whether lock GOT/PLT hooks
+ */
+static void _uhook_lock(uint64_t shards, int got)
+{
+    pthread_once(&s_lock_once, _uhook_lock_init);
+
+    size_t i;
+    for (i = 0; i < UHOOK_LOCK_SHARDS; i++)
+    {
+        if (shards & ((uint64_t)1 << i))
+        {
+            uhook_mutex_lock(&s_lock.shards[i]);
+        }
+    }
+    if (got)
+    {
+        uhook_mutex_lock(&s_lock.got);
+    }
+}
+
+static void _uhook_unlock(uint64_t shards, int got)
+{
+    if (got)
+    {
+        uhook_mutex_unlock(&s_lock.got);
+    }
+
+    size_t i;
+    for (i = UHOOK_LOCK_SHARDS; i > 0; i--)
+    {
+        if (shards & ((uint64_t)1 << (i - 1)))
+        {
+            uhook_mutex_unlock(&s_lock.shards[i - 1]);
+        }
+    }
+}
+
+/**
+ * @brief Get locks needed to operate on \p token.
+ */
+static void _uhook_token_locks(const uhook_token_t* token, uint64_t* shards, int* got)
+{
+    if (token->attrs & UHOOK_ATTR_GOTPLT)
+    {
+        *got = 1;
+    }
+    else if (token->attrs & UHOOK_ATTR_CALLSITE)
+    {
+        *shards = ~(uint64_t)0;
+    }
+    else if (token->attrs & UHOOK_ATTR_INLINE)
+    {
+        const uhook_layer_t* layer = token->token;
+        *shards |= _uhook_shard_of(layer->owner->addr);
+    }
+}
+
+static uhook_target_t* _uhook_find_target(void* addr)
+{
+    uhook_registry_node_t* node = uhook_registry_find(addr);
+    if (node == NULL || node->type != UHOOK_REGISTRY_INLINE)
+    {
+        return NULL;
+    }
+    return container_of(node, uhook_target_t, node);
+}
+
+/**
+ * @brief Insert \p layer after all layers that have same or higher priority.
+ */
+static void _uhook_insert_layer(uhook_target_t* target, uhook_layer_t* layer)
+{
+    uhook_layer_t** pos = &target->layers;
+    while (*pos != NULL && (*pos)->priority >= layer->priority)
+    {
+        pos = &(*pos)->next;
+    }
+
+    layer->next = *pos;
+    *pos = layer;
+}
+
+static void _uhook_remove_layer(uhook_target_t* target, uhook_layer_t* layer)
+{
+    uhook_layer_t** pos;
+    for (pos = &target->layers; *pos != NULL; pos = &(*pos)->next)
+    {
+        if (*pos == layer)
+        {
+            *pos = layer->next;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Point forward stub of \p layer and all layers after it to the next
+ *   enabled layer.
+ *
+ * Stubs are updated from tail to head, so a new layer is fully linked
+ * before anything jumps into it.
+ *
+ * @param[in] layer     First layer to relink
+ * @param[in] origin    Address to call original function
+ * @param[out] head     The first enabled layer
+ * @return              Address that jumps into \p layer is supposed to go
+ */
+static void* _uhook_relink(uhook_layer_t* layer, void* origin, uhook_layer_t** head)
+{
+    if (layer == NULL)
+    {
+        return origin;
+    }
+
+    void* next_dst = _uhook_relink(layer->next, origin, head);
+    UHOOK_ARCH_FORWARD_UPDATE(layer->forward, next_dst);
+
+    if (layer->disabled)
+    {
+        return next_dst;
+    }
+
+    *head = layer;
+    return layer->detour;
+}
+
+/**
+ * @brief Relink dispatch chain and rebuild entry redirect code.
+ * @param[out] need_write   Whether target entry need to be rewritten
+ * @return                  #uhook_errno
+ */
+static int _uhook_target_prepare(uhook_target_t* target, int* need_write)
+{
+    uhook_layer_t* head = NULL;
+    _uhook_relink(target->layers, target->origin, &head);
+    *need_write = 0;
+
+    if (head == NULL)
+    {
+        *need_write = target->patched;
+        return UHOOK_SUCCESS;
+    }
+
+    if (head->detour != target->detour)
+    {
+        int ret = UHOOK_ARCH_RETARGET(target->inject, head->detour);
+        if (ret != UHOOK_SUCCESS)
+        {
+            return ret;
+        }
+        target->detour = head->detour;
+        *need_write = 1;
+    }
+
+    *need_write = *need_write || !target->patched;
+    return UHOOK_SUCCESS;
+}
+
+/**
+ * @brief Write entry code decided by #_uhook_target_prepare().
+ * @note Entry must be writable.
+ */
+static void _uhook_target_commit(uhook_target_t* target)
+{
+    int enable = 0;
+
+    uhook_layer_t* layer;
+    for (layer = target->layers; layer != NULL; layer = layer->next)
+    {
+        enable = enable || !layer->disabled;
+    }
+
+    UHOOK_ARCH_TOGGLE(target->inject, enable);
+    target->patched = enable;
+}
+
+static void _uhook_target_commit_cb(void* arg)
+{
+    _uhook_target_commit(arg);
+}
+
+static int _uhook_target_sync(uhook_target_t* target)
+{
+    int need_write;
+    int ret = _uhook_target_prepare(target, &need_write);
+    if (ret != UHOOK_SUCCESS || !need_write)
     {
         return ret;
     }
 
-    token->fcall = inject_call;
-    token->token = inject_token;
-    token->attrs = UHOOK_ATTR_INLINE;
+    void* addr; size_t size;
+    UHOOK_ARCH_PATCH_RANGE(target->inject, &addr, &size);
+
+    if (_system_modify_opcode(addr, size, _uhook_target_commit_cb, target) < 0)
+    {
+        return UHOOK_UNKNOWN;
+    }
 
     return UHOOK_SUCCESS;
 }
 
-int uhook_inject_got(uhook_token_t* token, const char* name, void* detour)
+static int _uhook_create_target(uhook_target_t** dst, void* addr, void* detour, unsigned flags)
 {
-    void* inject_token = NULL;
-    void* inject_call = NULL;
-    int ret = elf_inject_got_patch(&inject_token, &inject_call, name, detour);
+    uhook_target_t* target = calloc(1, sizeof(uhook_target_t));
+    if (target == NULL)
+    {
+        return UHOOK_NOMEM;
+    }
 
+    int ret = (flags & UHOOK_INJECT_LAZY) ?
+        UHOOK_ARCH_INJECT_LAZY(&target->inject, &target->origin, addr, detour) :
+        UHOOK_ARCH_INJECT(&target->inject, &target->origin, addr, detour);
+#if defined(UHOOK_ARCH_INJECT_TRAP)
+    if (ret != UHOOK_SUCCESS && (flags & UHOOK_INJECT_BREAKPOINT))
+    {
+        ret = UHOOK_ARCH_INJECT_TRAP(&target->inject, &target->origin, addr, detour);
+    }
+#endif
     if (ret != UHOOK_SUCCESS)
     {
+        free(target);
         return ret;
     }
 
-    token->fcall = inject_call;
-    token->attrs = UHOOK_ATTR_GOTPLT;
-    token->token = inject_token;
+    target->addr = addr;
+    target->detour = detour;
+    target->patched = 1;
+
+    target->node.key = addr;
+    target->node.type = UHOOK_REGISTRY_INLINE;
+    if ((ret = uhook_registry_insert(&target->node)) != UHOOK_SUCCESS)
+    {
+        UHOOK_ARCH_UNINJECT(target->inject);
+        free(target);
+        return ret;
+    }
 
+    *dst = target;
     return UHOOK_SUCCESS;
 }
 
-void uhook_uninject(uhook_token_t* token)
+static void _uhook_destroy_target(uhook_target_t* target)
 {
-    uhook_uninject_fn fn_uninject = 
-#if defined(__i386__) || defined(__amd64__) || defined(_M_IX86) || defined(_M_AMD64)
-        uhook_x86_64_uninject
-#elif defined(__arm__)
-        uhook_arm_uninject
+    uhook_registry_remove(&target->node);
+    UHOOK_ARCH_UNINJECT(target->inject);
+    free(target);
+}
+
+static void _uhook_destroy_layer(uhook_layer_t* layer)
+{
+    if (layer->forward != NULL)
+    {
+        UHOOK_ARCH_FORWARD_DESTROY(layer->forward);
+    }
+#if defined(UHOOK_ARCH_STUB_DESTROY)
+    if (layer->stub != NULL)
+    {
+        UHOOK_ARCH_STUB_DESTROY(layer->stub);
+    }
+#endif
+    if (layer->stat != 0)
+    {
+        uhook_stat_free(layer->stat - 1);
+    }
+    if (layer->hist != 0)
+    {
+        uhook_hist_free(layer->hist - 1);
+    }
+    free(layer);
+}
+
+/**
+ * @brief Add \p layer to dispatch chain of \p addr.
+ * @note \p layer is released if failure.
+ * @return  #uhook_errno
+ */
+static int _uhook_inject_layer(uhook_token_t* token, void* addr, uhook_layer_t* layer, const uhook_opt_t* opt)
+{
+    int ret;
+    layer->token = token;
+    layer->priority = opt->priority;
+    layer->group = opt->group;
+
+    uhook_target_t* target = _uhook_find_target(addr);
+    int is_new_target = target == NULL;
+
+    if (is_new_target && (ret = _uhook_create_target(&target, addr, layer->detour, opt->flags)) != UHOOK_SUCCESS)
+    {
+        _uhook_destroy_layer(layer);
+        return ret;
+    }
+
+    if ((layer->forward = UHOOK_ARCH_FORWARD_CREATE(target->origin)) == NULL)
+    {
+        ret = UHOOK_NOMEM;
+        goto err;
+    }
+
+    layer->ctx.fcall = layer->forward;
+    layer->owner = target;
+    _uhook_insert_layer(target, layer);
+
+    if ((ret = _uhook_target_sync(target)) != UHOOK_SUCCESS)
+    {
+        _uhook_remove_layer(target, layer);
+        _uhook_target_sync(target);
+        goto err;
+    }
+
+    token->fcall = layer->forward;
+    token->token = layer;
+    token->attrs = UHOOK_ATTR_INLINE;
+
+    return UHOOK_SUCCESS;
+
+err:
+    _uhook_destroy_layer(layer);
+    if (is_new_target)
+    {
+        _uhook_destroy_target(target);
+    }
+    return ret;
+}
+
+static int _uhook_inject_inline(uhook_token_t* token, void* addr, void* detour, const uhook_opt_t* opt)
+{
+    uhook_layer_t* layer = calloc(1, sizeof(uhook_layer_t));
+    if (layer == NULL)
+    {
+        return UHOOK_NOMEM;
+    }
+    layer->detour = detour;
+
+    return _uhook_inject_layer(token, addr, layer, opt);
+}
+
+static void _uhook_uninject_inline(uhook_layer_t* layer)
+{
+    uhook_target_t* target = layer->owner;
+    _uhook_remove_layer(target, layer);
+
+    if (target->layers == NULL)
+    {
+        _uhook_destroy_target(target);
+    }
+    else if (_uhook_target_sync(target) != UHOOK_SUCCESS)
+    {
+        LOG("relink target(%p) failed", target->addr);
+    }
+
+    _uhook_destroy_layer(layer);
+}
+
+int uhook_inject(uhook_token_t* token, void* target, void* detour)
+{
+    return uhook_inject_ex(token, target, detour, NULL);
+}
+
+static int _uhook_inject_guard(uhook_token_t* token, void* target, void* detour,
+    const uhook_filter_t* filter, const uhook_opt_t* opt);
+
+int uhook_inject_ex(uhook_token_t* token, void* target, void* detour, const uhook_opt_t* opt)
+{
+    static const uhook_opt_t default_opt = { 0, 0, 0 };
+    opt = opt != NULL ? opt : &default_opt;
+
+    if (opt->flags & (UHOOK_INJECT_GUARD | UHOOK_INJECT_BYPASS))
+    {
+        return _uhook_inject_guard(token, target, detour, NULL, opt);
+    }
+
+#if defined(UHOOK_ARCH_FOLLOW_JUMP)
+    if (opt->flags & UHOOK_INJECT_FOLLOW_JMP)
+    {
+        target = UHOOK_ARCH_FOLLOW_JUMP(target);
+    }
+#endif
+
+    uint64_t shards = _uhook_shard_of(target);
+
+    _uhook_lock(shards, 0);
+    int ret = _uhook_inject_inline(token, target, detour, opt);
+    _uhook_unlock(shards, 0);
+
+    return ret;
+}
+
+int uhook_inject_ctx(uhook_token_t* token, void* target, void* detour, void* ctx)
+{
+    return uhook_inject_ctx_ex(token, target, detour, ctx, NULL);
+}
+
+/**
+ * @brief Inject \p layer whose detour is a generated stub.
+ * @note \p layer is released if failure.
+ * @return  #uhook_errno
+ */
+static int _uhook_inject_stub(uhook_token_t* token, void* target, uhook_layer_t* layer, const uhook_opt_t* opt)
+{
+    static const uhook_opt_t default_opt = { 0, 0, 0 };
+    opt = opt != NULL ? opt : &default_opt;
+
+#if defined(UHOOK_ARCH_FOLLOW_JUMP)
+    if (opt->flags & UHOOK_INJECT_FOLLOW_JMP)
+    {
+        target = UHOOK_ARCH_FOLLOW_JUMP(target);
+    }
+#endif
+
+    layer->detour = layer->stub;
+    uint64_t shards = _uhook_shard_of(target);
+
+    _uhook_lock(shards, 0);
+    int ret = _uhook_inject_layer(token, target, layer, opt);
+    _uhook_unlock(shards, 0);
+
+    return ret;
+}
+
+/**
+ * @brief Inject \p detour behind a stub that checks guard, bypass and
+ *   \p filter.
+ * @param[in] filter    Validated filter, NULL if none.
+ * @return  #uhook_errno
+ */
+static int _uhook_inject_guard(uhook_token_t* token, void* target, void* detour,
+    const uhook_filter_t* filter, const uhook_opt_t* opt)
+{
+#if defined(UHOOK_ARCH_GUARD_CREATE)
+    uhook_layer_t* layer = calloc(1, sizeof(uhook_layer_t));
+    if (layer == NULL)
+    {
+        return UHOOK_NOMEM;
+    }
+
+    if ((layer->stub = UHOOK_ARCH_GUARD_CREATE(&layer->ctx, detour, opt->flags, filter)) == NULL)
+    {
+        free(layer);
+        return UHOOK_NOMEM;
+    }
+
+    return _uhook_inject_stub(token, target, layer, opt);
 #else
-#   error "unsupport hardware platform"
-        NULL
+    (void)token; (void)target; (void)detour; (void)filter; (void)opt;
+    return UHOOK_UNKNOWN;
 #endif
-        ;
+}
 
-    if (token->attrs & UHOOK_ATTR_GOTPLT)
+static int _uhook_filter_is_valid(const uhook_filter_t* filter)
+{
+    if ((filter->flags & UHOOK_FILTER_ARG) && (filter->arg > 5 || filter->cmp > UHOOK_FILTER_GE))
     {
-        elf_inject_got_unpatch(token->token);
-        goto fin;
+        return 0;
+    }
+    if ((filter->flags & UHOOK_FILTER_CALLER)
+        && (uintptr_t)filter->caller_end <= (uintptr_t)filter->caller_begin)
+    {
+        return 0;
     }
+    if ((filter->flags & UHOOK_FILTER_SAMPLE) && filter->sample == 0)
+    {
+        return 0;
+    }
+    return 1;
+}
 
-    if (token->attrs & UHOOK_ATTR_INLINE)
+int uhook_inject_filter(uhook_token_t* token, void* target, void* detour, const uhook_filter_t* filter)
+{
+    return uhook_inject_filter_ex(token, target, detour, filter, NULL);
+}
+
+int uhook_inject_filter_ex(uhook_token_t* token, void* target, void* detour,
+    const uhook_filter_t* filter, const uhook_opt_t* opt)
+{
+    static const uhook_opt_t default_opt = { 0, 0, 0 };
+    opt = opt != NULL ? opt : &default_opt;
+
+    if (!_uhook_filter_is_valid(filter))
     {
-        fn_uninject(token->token);
-        goto fin;
+        return UHOOK_INVALID;
     }
 
-fin:
-    memset(token, 0, sizeof(*token));
+    return _uhook_inject_guard(token, target, detour, filter, opt);
+}
+
+int uhook_inject_ctx_ex(uhook_token_t* token, void* target, void* detour, void* ctx,
+    const uhook_opt_t* opt)
+{
+#if defined(UHOOK_ARCH_CTX_THUNK_CREATE)
+    uhook_layer_t* layer = calloc(1, sizeof(uhook_layer_t));
+    if (layer == NULL)
+    {
+        return UHOOK_NOMEM;
+    }
+    layer->ctx.ctx = ctx;
+
+    if ((layer->stub = UHOOK_ARCH_CTX_THUNK_CREATE(&layer->ctx, detour)) == NULL)
+    {
+        free(layer);
+        return UHOOK_NOMEM;
+    }
+
+    return _uhook_inject_stub(token, target, layer, opt);
+#else
+    (void)token; (void)target; (void)detour; (void)ctx; (void)opt;
+    return UHOOK_UNKNOWN;
+#endif
+}
+
+int uhook_inject_handler(uhook_token_t* token, void* target, const uhook_handler_t* handler)
+{
+    return uhook_inject_handler_ex(token, target, handler, NULL);
+}
+
+int uhook_inject_handler_ex(uhook_token_t* token, void* target, const uhook_handler_t* handler,
+    const uhook_opt_t* opt)
+{
+#if defined(UHOOK_ARCH_HANDLER_CREATE)
+    uhook_layer_t* layer = calloc(1, sizeof(uhook_layer_t));
+    if (layer == NULL)
+    {
+        return UHOOK_NOMEM;
+    }
+    layer->ctx.ctx = handler->ctx;
+
+    if ((layer->stub = UHOOK_ARCH_HANDLER_CREATE(&layer->ctx, handler)) == NULL)
+    {
+        free(layer);
+        return UHOOK_NOMEM;
+    }
+
+    return _uhook_inject_stub(token, target, layer, opt);
+#else
+    (void)token; (void)target; (void)handler; (void)opt;
+    return UHOOK_UNKNOWN;
+#endif
+}
+
+#if defined(UHOOK_ARCH_HANDLER_CREATE)
+
+/**
+ * @brief Handlers that record calls into a slot.
+ */
+typedef struct uhook_recorder
+{
+    int                 (*alloc)(size_t* slot);     /**< Reserve a slot */
+    void                (*release)(size_t slot);    /**< Release a slot */
+    uhook_handler_fn    enter;      /**< Enter handler, slot is its context */
+    uhook_handler_fn    leave;      /**< Leave handler, slot is its context */
+    size_t              field;      /**< Offset of slot plus one in #uhook_layer_t */
+}uhook_recorder_t;
+
+static const uhook_recorder_t s_stat_recorder = {
+    uhook_stat_alloc, uhook_stat_free, uhook_stat_enter, uhook_stat_leave, offsetof(uhook_layer_t, stat),
+};
+
+static const uhook_recorder_t s_hist_recorder = {
+    uhook_hist_alloc, uhook_hist_free, uhook_hist_enter, uhook_hist_leave, offsetof(uhook_layer_t, hist),
+};
+
+/**
+ * @brief Inject handlers of \p recorder with a new slot.
+ * @return  #uhook_errno
+ */
+static int _uhook_inject_recorder(uhook_token_t* token, void* target, const uhook_recorder_t* recorder,
+    const uhook_opt_t* opt)
+{
+    int ret;
+    size_t slot;
+    if ((ret = recorder->alloc(&slot)) != UHOOK_SUCCESS)
+    {
+        return ret;
+    }
+
+    uhook_layer_t* layer = calloc(1, sizeof(uhook_layer_t));
+    if (layer == NULL)
+    {
+        recorder->release(slot);
+        return UHOOK_NOMEM;
+    }
+    layer->ctx.ctx = (void*)(uintptr_t)slot;
+
+    uhook_handler_t handler = { recorder->enter, recorder->leave, layer->ctx.ctx, 0 };
+    if ((layer->stub = UHOOK_ARCH_HANDLER_CREATE(&layer->ctx, &handler)) == NULL)
+    {
+        recorder->release(slot);
+        free(layer);
+        return UHOOK_NOMEM;
+    }
+    *(size_t*)((uint8_t*)layer + recorder->field) = slot + 1;
+
+    return _uhook_inject_stub(token, target, layer, opt);
+}
+
+#endif
+
+int uhook_inject_stat(uhook_token_t* token, void* target)
+{
+    return uhook_inject_stat_ex(token, target, NULL);
+}
+
+int uhook_inject_stat_ex(uhook_token_t* token, void* target, const uhook_opt_t* opt)
+{
+#if defined(UHOOK_ARCH_HANDLER_CREATE)
+    return _uhook_inject_recorder(token, target, &s_stat_recorder, opt);
+#else
+    (void)token; (void)target; (void)opt;
+    return UHOOK_UNKNOWN;
+#endif
+}
+
+int uhook_stat_read(const uhook_token_t* token, uhook_stat_t* stat)
+{
+    if (!(token->attrs & UHOOK_ATTR_INLINE))
+    {
+        return UHOOK_INVALID;
+    }
+
+    const uhook_layer_t* layer = token->token;
+    if (layer->stat == 0)
+    {
+        return UHOOK_INVALID;
+    }
+
+    uhook_stat_sum(layer->stat - 1, stat);
+    return UHOOK_SUCCESS;
+}
+
+#if defined(UHOOK_ARCH_HANDLER_CREATE)
+
+static pthread_once_t s_hist_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Measure overhead of histogram hooks on an empty function.
+ */
+static void _uhook_hist_calibrate(void)
+{
+#if defined(UHOOK_HIST_IDLE)
+    uhook_token_t token;
+    if (_uhook_inject_recorder(&token, (void*)uhook_hist_idle, &s_hist_recorder, NULL) != UHOOK_SUCCESS)
+    {
+        return;
+    }
+
+    int (*volatile fn)(void) = uhook_hist_idle;
+    size_t i;
+    for (i = 0; i < UHOOK_HIST_CALIBRATE; i++)
+    {
+        fn();
+    }
+    uhook_hist_calibrate(((uhook_layer_t*)token.token)->hist - 1);
+
+    uhook_uninject(&token);
+#endif
+}
+
+#endif
+
+int uhook_inject_hist(uhook_token_t* token, void* target)
+{
+    return uhook_inject_hist_ex(token, target, NULL);
+}
+
+int uhook_inject_hist_ex(uhook_token_t* token, void* target, const uhook_opt_t* opt)
+{
+#if defined(UHOOK_ARCH_HANDLER_CREATE)
+    pthread_once(&s_hist_once, _uhook_hist_calibrate);
+
+    return _uhook_inject_recorder(token, target, &s_hist_recorder, opt);
+#else
+    (void)token; (void)target; (void)opt;
+    return UHOOK_UNKNOWN;
+#endif
+}
+
+int uhook_hist_snapshot(const uhook_token_t* token, uhook_hist_t* hist, int reset)
+{
+    if (!(token->attrs & UHOOK_ATTR_INLINE))
+    {
+        return UHOOK_INVALID;
+    }
+
+    const uhook_layer_t* layer = token->token;
+    if (layer->hist == 0)
+    {
+        return UHOOK_INVALID;
+    }
+
+    uhook_hist_merge(layer->hist - 1, hist, reset);
+    return UHOOK_SUCCESS;
+}
+
+int uhook_trace_config(const uhook_trace_opt_t* opt)
+{
+    return uhook_trace_setup(opt);
+}
+
+int uhook_inject_trace(uhook_token_t* token, void* target, unsigned id)
+{
+    return uhook_inject_trace_ex(token, target, id, NULL);
+}
+
+int uhook_inject_trace_ex(uhook_token_t* token, void* target, unsigned id, const uhook_opt_t* opt)
+{
+    uhook_trace_init();
+    uhook_clock_init();
+
+    uhook_handler_t handler = { uhook_trace_enter, uhook_trace_leave, (void*)(uintptr_t)id, 0 };
+    return uhook_inject_handler_ex(token, target, &handler, opt);
+}
+
+size_t uhook_trace_drain(uhook_trace_record_t* records, size_t cap)
+{
+    return uhook_trace_collect(records, cap);
+}
+
+unsigned long long uhook_trace_lost(void)
+{
+    return uhook_trace_loss();
+}
+
+int uhook_trace_name(unsigned id, const char* name)
+{
+    return uhook_tracefile_name(id, name);
+}
+
+int uhook_trace_open(const char* path)
+{
+    return uhook_tracefile_open(path);
+}
+
+int uhook_trace_close(void)
+{
+    return uhook_tracefile_close();
+}
+
+int uhook_trace_to_json(const char* path, const char* json_path)
+{
+    return uhook_tracefile_to_json(path, json_path);
+}
+
+unsigned long long uhook_trace_ns(unsigned long long ticks)
+{
+    return uhook_clock_ns(ticks);
+}
+
+int uhook_inject_snippet(uhook_token_t* token, void* target, const uhook_snippet_t* snippet)
+{
+    return uhook_inject_snippet_ex(token, target, snippet, NULL);
+}
+
+int uhook_inject_snippet_ex(uhook_token_t* token, void* target, const uhook_snippet_t* snippet,
+    const uhook_opt_t* opt)
+{
+#if defined(UHOOK_ARCH_SNIPPET_CREATE)
+    int ret;
+    uhook_layer_t* layer = calloc(1, sizeof(uhook_layer_t));
+    if (layer == NULL)
+    {
+        return UHOOK_NOMEM;
+    }
+
+    if ((ret = UHOOK_ARCH_SNIPPET_CREATE(&layer->stub, &layer->ctx, snippet)) != UHOOK_SUCCESS)
+    {
+        free(layer);
+        return ret;
+    }
+
+    return _uhook_inject_stub(token, target, layer, opt);
+#else
+    (void)token; (void)target; (void)snippet; (void)opt;
+    return UHOOK_UNKNOWN;
+#endif
+}
+
+int uhook_snippet_return(uhook_snippet_t* snippet, unsigned long long value)
+{
+#if defined(UHOOK_ARCH_SNIPPET_RETURN)
+    return UHOOK_ARCH_SNIPPET_RETURN(snippet, value);
+#else
+    (void)snippet; (void)value;
+    return UHOOK_UNKNOWN;
+#endif
+}
+
+int uhook_snippet_skip(uhook_snippet_t* snippet)
+{
+#if defined(UHOOK_ARCH_SNIPPET_SKIP)
+    return UHOOK_ARCH_SNIPPET_SKIP(snippet);
+#else
+    (void)snippet;
+    return UHOOK_UNKNOWN;
+#endif
+}
+
+int uhook_snippet_count(uhook_snippet_t* snippet, uhook_counter_t* counter)
+{
+#if defined(UHOOK_ARCH_SNIPPET_COUNT)
+    return UHOOK_ARCH_SNIPPET_COUNT(snippet, counter);
+#else
+    (void)snippet; (void)counter;
+    return UHOOK_UNKNOWN;
+#endif
+}
+
+unsigned long long uhook_counter_read(const uhook_counter_t* counter)
+{
+    unsigned long long sum = 0;
+    size_t i;
+    for (i = 0; i < UHOOK_COUNTER_CPUS; i++)
+    {
+        sum += __atomic_load_n(&counter->cpus[i].value, __ATOMIC_RELAXED);
+    }
+    return sum;
+}
+
+const uhook_ctx_t* uhook_get_ctx(void)
+{
+#if defined(UHOOK_ARCH_GET_CTX)
+    return UHOOK_ARCH_GET_CTX();
+#else
+    return NULL;
+#endif
+}
+
+int uhook_bypass(int enable)
+{
+#if defined(UHOOK_ARCH_BYPASS)
+    return UHOOK_ARCH_BYPASS(enable);
+#else
+    (void)enable;
+    return 0;
+#endif
+}
+
+static void _uhook_got_unregister(uhook_got_t* got)
+{
+    if (got->relplt.key != NULL)
+    {
+        uhook_registry_remove(&got->relplt);
+    }
+    if (got->reldyn.key != NULL)
+    {
+        uhook_registry_remove(&got->reldyn);
+    }
+}
+
+/**
+ * @brief Register patched slots of \p got.
+ * @return  #uhook_errno
+ */
+static int _uhook_got_register(uhook_got_t* got)
+{
+    void* relplt; void* reldyn;
+    elf_inject_got_slots(got->inject, &relplt, &reldyn);
+
+    /* Slot is patched by a hook we already have */
+    if ((relplt != NULL && uhook_registry_find(relplt) != NULL)
+        || (reldyn != NULL && uhook_registry_find(reldyn) != NULL))
+    {
+        return UHOOK_DUPLICATE;
+    }
+
+    got->relplt.type = UHOOK_REGISTRY_RELPLT;
+    got->reldyn.type = UHOOK_REGISTRY_RELDYN;
+
+    if (relplt != NULL)
+    {
+        got->relplt.key = relplt;
+        if (uhook_registry_insert(&got->relplt) != UHOOK_SUCCESS)
+        {
+            got->relplt.key = NULL;
+            return UHOOK_NOMEM;
+        }
+    }
+
+    if (reldyn != NULL)
+    {
+        got->reldyn.key = reldyn;
+        if (uhook_registry_insert(&got->reldyn) != UHOOK_SUCCESS)
+        {
+            got->reldyn.key = NULL;
+            _uhook_got_unregister(got);
+            return UHOOK_NOMEM;
+        }
+    }
+
+    return UHOOK_SUCCESS;
+}
+
+static void _uhook_uninject_got(uhook_got_t* got)
+{
+    _uhook_got_unregister(got);
+    elf_inject_got_unpatch(got->inject);
+    free(got);
+}
+
+int uhook_inject_got(uhook_token_t* token, const char* name, void* detour)
+{
+    return uhook_inject_got_ex(token, name, detour, NULL);
+}
+
+static int _uhook_inject_got(uhook_token_t* token, const char* name, void* detour, const uhook_opt_t* opt)
+{
+    uhook_got_t* got = calloc(1, sizeof(uhook_got_t));
+    if (got == NULL)
+    {
+        return UHOOK_NOMEM;
+    }
+    got->token = token;
+    got->group = opt != NULL ? opt->group : 0;
+
+    void* inject_call = NULL;
+    int ret = elf_inject_got_patch(&got->inject, &inject_call, name, detour);
+    if (ret != UHOOK_SUCCESS)
+    {
+        free(got);
+        return ret;
+    }
+
+    /* Slot already points to detour, nothing is patched */
+    if (got->inject == NULL)
+    {
+        free(got);
+        return UHOOK_DUPLICATE;
+    }
+
+    /* On failure the previous value is written back, so an existing hook survives */
+    if ((ret = _uhook_got_register(got)) != UHOOK_SUCCESS)
+    {
+        elf_inject_got_unpatch(got->inject);
+        free(got);
+        return ret;
+    }
+
+    token->fcall = inject_call;
+    token->attrs = UHOOK_ATTR_GOTPLT;
+    token->token = got;
+
+    return UHOOK_SUCCESS;
+}
+
+int uhook_inject_got_ex(uhook_token_t* token, const char* name, void* detour, const uhook_opt_t* opt)
+{
+    _uhook_lock(0, 1);
+    int ret = _uhook_inject_got(token, name, detour, opt);
+    _uhook_unlock(0, 1);
+
+    return ret;
+}
+
+static void _uhook_uninject_callsite(uhook_callsite_t* callsite)
+{
+    uhook_callsite_t** pos = &s_callsites;
+    while (*pos != callsite)
+    {
+        pos = &(*pos)->next;
+    }
+    *pos = callsite->next;
+
+#if defined(UHOOK_ARCH_CALLSITE_UNINJECT)
+    UHOOK_ARCH_CALLSITE_UNINJECT(callsite->inject);
+#endif
+    free(callsite);
+}
+
+int uhook_inject_callsites(uhook_token_t* token, void* target, void* detour)
+{
+    return uhook_inject_callsites_ex(token, target, detour, NULL);
+}
+
+int uhook_inject_callsites_ex(uhook_token_t* token, void* target, void* detour, const uhook_opt_t* opt)
+{
+#if defined(UHOOK_ARCH_CALLSITE_INJECT)
+    uhook_callsite_t* callsite = calloc(1, sizeof(uhook_callsite_t));
+    if (callsite == NULL)
+    {
+        return UHOOK_NOMEM;
+    }
+    callsite->token = token;
+    callsite->group = opt != NULL ? opt->group : 0;
+
+    /* Scan takes a while, but any hook may touch a call site */
+    _uhook_lock(~(uint64_t)0, 0);
+
+    int ret = UHOOK_ARCH_CALLSITE_INJECT(&callsite->inject, target, detour);
+    if (ret != UHOOK_SUCCESS)
+    {
+        _uhook_unlock(~(uint64_t)0, 0);
+        free(callsite);
+        return ret;
+    }
+    callsite->next = s_callsites;
+    s_callsites = callsite;
+
+    token->fcall = target;
+    token->attrs = UHOOK_ATTR_CALLSITE;
+    token->token = callsite;
+
+    _uhook_unlock(~(uint64_t)0, 0);
+    return UHOOK_SUCCESS;
+#else
+    (void)token; (void)target; (void)detour; (void)opt;
+    return UHOOK_NOCALLSITE;
+#endif
+}
+
+static void _uhook_uninject(uhook_token_t* token)
+{
+    if (token->attrs & UHOOK_ATTR_GOTPLT)
+    {
+        _uhook_uninject_got(token->token);
+        goto fin;
+    }
+
+    if (token->attrs & UHOOK_ATTR_INLINE)
+    {
+        _uhook_uninject_inline(token->token);
+        goto fin;
+    }
+
+    if (token->attrs & UHOOK_ATTR_CALLSITE)
+    {
+        _uhook_uninject_callsite(token->token);
+        goto fin;
+    }
+
+fin:
+    memset(token, 0, sizeof(*token));
+}
+
+void uhook_uninject(uhook_token_t* token)
+{
+    uint64_t shards = 0; int got = 0;
+    _uhook_token_locks(token, &shards, &got);
+
+    _uhook_lock(shards, got);
+    _uhook_uninject(token);
+    _uhook_unlock(shards, got);
+}
+
+/**
+ * @return bool
+ */
+static int _uhook_need_toggle(const uhook_token_t* token, int enable)
+{
+    int is_disabled = !!(token->attrs & UHOOK_ATTR_DISABLED);
+    return is_disabled == !!enable;
+}
+
+static void _uhook_mark_toggle(uhook_token_t* token, int enable)
+{
+    if (enable)
+    {
+        token->attrs &= ~(unsigned long)UHOOK_ATTR_DISABLED;
+    }
+    else
+    {
+        token->attrs |= UHOOK_ATTR_DISABLED;
+    }
+
+    if (token->attrs & UHOOK_ATTR_INLINE)
+    {
+        uhook_layer_t* layer = token->token;
+        layer->disabled = !enable;
+    }
+}
+
+static int _uhook_toggle_batch_range(void* data, size_t idx, void** addr, size_t* size)
+{
+    uhook_toggle_ctx_t* ctx = data;
+    uhook_target_t* target = ctx->targets[idx];
+
+    int need_write;
+    if (_uhook_target_prepare(target, &need_write) != UHOOK_SUCCESS || !need_write)
+    {
+        return -1;
+    }
+
+    UHOOK_ARCH_PATCH_RANGE(target->inject, addr, size);
+    return 0;
+}
+
+static void _uhook_toggle_batch_cb(void* data, size_t idx)
+{
+    uhook_toggle_ctx_t* ctx = data;
+    _uhook_target_commit(ctx->targets[idx]);
+}
+
+static int _uhook_bulk_cmp_target(const void* a, const void* b);
+
+/**
+ * @brief Collect targets of inline \p tokens, sorted by address the same way
+ *   as #_uhook_bulk_uninject(), so targets in the same page are written
+ *   together.
+ * @return  #uhook_errno
+ */
+static int _uhook_toggle_collect(uhook_toggle_ctx_t* ctx, uhook_token_t* tokens[], size_t num)
+{
+    ctx->target_cnt = 0;
+    if ((ctx->targets = malloc(sizeof(uhook_target_t*) * (num != 0 ? num : 1))) == NULL)
+    {
+        return UHOOK_NOMEM;
+    }
+
+    size_t i;
+    for (i = 0; i < num; i++)
+    {
+        if (tokens[i]->attrs & UHOOK_ATTR_INLINE)
+        {
+            ctx->targets[ctx->target_cnt++] = ((uhook_layer_t*)tokens[i]->token)->owner;
+        }
+    }
+    qsort(ctx->targets, ctx->target_cnt, sizeof(uhook_target_t*), _uhook_bulk_cmp_target);
+
+    /* Layers of the same target are written once */
+    size_t cnt = 0;
+    for (i = 0; i < ctx->target_cnt; i++)
+    {
+        if (cnt == 0 || ctx->targets[cnt - 1] != ctx->targets[i])
+        {
+            ctx->targets[cnt++] = ctx->targets[i];
+        }
+    }
+    ctx->target_cnt = cnt;
+
+    return UHOOK_SUCCESS;
+}
+
+static int _uhook_toggle(uhook_token_t* token, int enable)
+{
+    int ret;
+    if (!_uhook_need_toggle(token, enable))
+    {
+        return UHOOK_SUCCESS;
+    }
+
+    if (token->attrs & UHOOK_ATTR_GOTPLT)
+    {
+        uhook_got_t* got = token->token;
+        if ((ret = elf_inject_got_toggle(got->inject, enable)) != UHOOK_SUCCESS)
+        {
+            return ret;
+        }
+        _uhook_mark_toggle(token, enable);
+        return UHOOK_SUCCESS;
+    }
+
+#if defined(UHOOK_ARCH_CALLSITE_TOGGLE)
+    if (token->attrs & UHOOK_ATTR_CALLSITE)
+    {
+        uhook_callsite_t* callsite = token->token;
+        if ((ret = UHOOK_ARCH_CALLSITE_TOGGLE(callsite->inject, enable)) != UHOOK_SUCCESS)
+        {
+            return ret;
+        }
+        _uhook_mark_toggle(token, enable);
+        return UHOOK_SUCCESS;
+    }
+#endif
+
+    if (token->attrs & UHOOK_ATTR_INLINE)
+    {
+        uhook_layer_t* layer = token->token;
+
+        _uhook_mark_toggle(token, enable);
+        if ((ret = _uhook_target_sync(layer->owner)) != UHOOK_SUCCESS)
+        {
+            _uhook_mark_toggle(token, !enable);
+            _uhook_target_sync(layer->owner);
+        }
+        return ret;
+    }
+
+    return UHOOK_UNKNOWN;
+}
+
+static int _uhook_toggle_batch(uhook_token_t* tokens[], size_t num, int enable)
+{
+    int ret = UHOOK_SUCCESS;
+
+    size_t i;
+    uint64_t shards = 0; int got = 0;
+    for (i = 0; i < num; i++)
+    {
+        _uhook_token_locks(tokens[i], &shards, &got);
+    }
+    _uhook_lock(shards, got);
+
+    for (i = 0; i < num; i++)
+    {
+        if (!_uhook_need_toggle(tokens[i], enable))
+        {
+            continue;
+        }
+
+        /* GOT/PLT slots live in data pages and call sites are spread over text, they keep their own protection */
+        if (tokens[i]->attrs & (UHOOK_ATTR_GOTPLT | UHOOK_ATTR_CALLSITE))
+        {
+            int got_ret = _uhook_toggle(tokens[i], enable);
+            ret = ret == UHOOK_SUCCESS ? got_ret : ret;
+            continue;
+        }
+
+        _uhook_mark_toggle(tokens[i], enable);
+    }
+
+    /* Entries of all touched targets are written with shared page unprotect */
+    uhook_toggle_ctx_t ctx;
+    if (_uhook_toggle_collect(&ctx, tokens, num) != UHOOK_SUCCESS)
+    {
+        for (i = 0; i < num; i++)
+        {
+            if ((tokens[i]->attrs & UHOOK_ATTR_INLINE)
+                && _uhook_target_sync(((uhook_layer_t*)tokens[i]->token)->owner) != UHOOK_SUCCESS)
+            {
+                ret = UHOOK_UNKNOWN;
+            }
+        }
+    }
+    else
+    {
+        if (_system_modify_opcode_batch(ctx.target_cnt, _uhook_toggle_batch_range, _uhook_toggle_batch_cb, &ctx) < 0)
+        {
+            ret = UHOOK_UNKNOWN;
+        }
+        free(ctx.targets);
+    }
+
+    _uhook_unlock(shards, got);
+    return ret;
+}
+
+static int _uhook_toggle_locked(uhook_token_t* token, int enable)
+{
+    uint64_t shards = 0; int got = 0;
+    _uhook_token_locks(token, &shards, &got);
+
+    _uhook_lock(shards, got);
+    int ret = _uhook_toggle(token, enable);
+    _uhook_unlock(shards, got);
+
+    return ret;
+}
+
+int uhook_enable(uhook_token_t* token)
+{
+    return _uhook_toggle_locked(token, 1);
+}
+
+int uhook_disable(uhook_token_t* token)
+{
+    return _uhook_toggle_locked(token, 0);
+}
+
+int uhook_enable_batch(uhook_token_t* tokens[], size_t num)
+{
+    return _uhook_toggle_batch(tokens, num, 1);
+}
+
+int uhook_disable_batch(uhook_token_t* tokens[], size_t num)
+{
+    return _uhook_toggle_batch(tokens, num, 0);
+}
+
+/**
+ * @return bool
+ */
+static int _uhook_bulk_match(const uhook_bulk_ctx_t* ctx, unsigned group)
+{
+    return ctx->all || ctx->group == group;
+}
+
+static int _uhook_bulk_collect(uhook_registry_node_t* node, void* arg)
+{
+    uhook_bulk_ctx_t* ctx = arg;
+
+    if (node->type == UHOOK_REGISTRY_INLINE)
+    {
+        uhook_target_t* target = container_of(node, uhook_target_t, node);
+        int touched = 0;
+
+        uhook_layer_t** pos = &target->layers;
+        while (*pos != NULL)
+        {
+            uhook_layer_t* layer = *pos;
+            if (!_uhook_bulk_match(ctx, layer->group))
+            {
+                pos = &layer->next;
+                continue;
+            }
+
+            *pos = layer->next;
+            layer->next = ctx->layers;
+            ctx->layers = layer;
+
+            memset(layer->token, 0, sizeof(*layer->token));
+            ctx->hook_cnt++;
+            touched = 1;
+        }
+
+        if (touched)
+        {
+            ctx->targets[ctx->target_cnt++] = target;
+        }
+        return 0;
+    }
+
+    /* A GOT/PLT hook may own two nodes, only collect it once */
+    uhook_got_t* got = node->type == UHOOK_REGISTRY_RELPLT ?
+        container_of(node, uhook_got_t, relplt) : container_of(node, uhook_got_t, reldyn);
+    if (node->type == UHOOK_REGISTRY_RELDYN && got->relplt.key != NULL)
+    {
+        return 0;
+    }
+
+    if (_uhook_bulk_match(ctx, got->group))
+    {
+        memset(got->token, 0, sizeof(*got->token));
+        ctx->gots[ctx->got_cnt++] = got;
+        ctx->hook_cnt++;
+    }
+
+    return 0;
+}
+
+static int _uhook_bulk_cmp_target(const void* a, const void* b)
+{
+    uintptr_t addr_a = (uintptr_t)(*(uhook_target_t* const*)a)->addr;
+    uintptr_t addr_b = (uintptr_t)(*(uhook_target_t* const*)b)->addr;
+    return addr_a < addr_b ? -1 : (addr_a > addr_b ? 1 : 0);
+}
+
+static int _uhook_bulk_range(void* data, size_t idx, void** addr, size_t* size)
+{
+    uhook_bulk_ctx_t* ctx = data;
+    uhook_target_t* target = ctx->targets[idx];
+
+    int need_write;
+    if (_uhook_target_prepare(target, &need_write) != UHOOK_SUCCESS || !need_write)
+    {
+        return -1;
+    }
+
+    UHOOK_ARCH_PATCH_RANGE(target->inject, addr, size);
+    return 0;
+}
+
+static void _uhook_bulk_cb(void* data, size_t idx)
+{
+    uhook_bulk_ctx_t* ctx = data;
+    _uhook_target_commit(ctx->targets[idx]);
+}
+
+/**
+ * @brief Find any hook in group, used when we cannot afford a bulk pass.
+ */
+static int _uhook_bulk_find_one(uhook_registry_node_t* node, void* arg)
+{
+    uhook_bulk_ctx_t* ctx = arg;
+
+    if (node->type != UHOOK_REGISTRY_INLINE)
+    {
+        uhook_got_t* got = node->type == UHOOK_REGISTRY_RELPLT ?
+            container_of(node, uhook_got_t, relplt) : container_of(node, uhook_got_t, reldyn);
+        if (_uhook_bulk_match(ctx, got->group))
+        {
+            ctx->gots[0] = got;
+            return 1;
+        }
+        return 0;
+    }
+
+    uhook_layer_t* layer = container_of(node, uhook_target_t, node)->layers;
+    for (; layer != NULL; layer = layer->next)
+    {
+        if (_uhook_bulk_match(ctx, layer->group))
+        {
+            ctx->layers = layer;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Uninject hooks one by one without extra memory.
+ */
+static size_t _uhook_bulk_uninject_slow(uhook_bulk_ctx_t* ctx)
+{
+    uhook_got_t* got = NULL;
+    ctx->gots = &got;
+
+    for (;;)
+    {
+        got = NULL;
+        ctx->layers = NULL;
+        uhook_registry_foreach(_uhook_bulk_find_one, ctx);
+
+        if (got != NULL)
+        {
+            _uhook_uninject(got->token);
+        }
+        else if (ctx->layers != NULL)
+        {
+            _uhook_uninject(ctx->layers->token);
+        }
+        else
+        {
+            break;
+        }
+        ctx->hook_cnt++;
+    }
+
+    return ctx->hook_cnt;
+}
+
+/**
+ * @brief Uninject call-site hooks in group.
+ * @return  Amount of uninjected hooks
+ */
+static size_t _uhook_bulk_uninject_callsite(const uhook_bulk_ctx_t* ctx)
+{
+    size_t cnt = 0;
+    uhook_callsite_t* callsite = s_callsites;
+
+    while (callsite != NULL)
+    {
+        uhook_callsite_t* next = callsite->next;
+        if (_uhook_bulk_match(ctx, callsite->group))
+        {
+            _uhook_uninject(callsite->token);
+            cnt++;
+        }
+        callsite = next;
+    }
+
+    return cnt;
+}
+
+static size_t _uhook_bulk_uninject(int all, unsigned group)
+{
+    uhook_bulk_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.all = all;
+    ctx.group = group;
+    ctx.hook_cnt = _uhook_bulk_uninject_callsite(&ctx);
+
+    size_t node_cnt = uhook_registry_size();
+    if (node_cnt == 0)
+    {
+        return ctx.hook_cnt;
+    }
+
+    ctx.targets = malloc(sizeof(uhook_target_t*) * node_cnt);
+    ctx.gots = malloc(sizeof(uhook_got_t*) * node_cnt);
+    if (ctx.targets == NULL || ctx.gots == NULL)
+    {
+        free(ctx.targets);
+        free(ctx.gots);
+        return _uhook_bulk_uninject_slow(&ctx);
+    }
+
+    uhook_registry_foreach(_uhook_bulk_collect, &ctx);
+
+    /* Sort by address so targets in the same page are written together */
+    qsort(ctx.targets, ctx.target_cnt, sizeof(uhook_target_t*), _uhook_bulk_cmp_target);
+    if (_system_modify_opcode_batch(ctx.target_cnt, _uhook_bulk_range, _uhook_bulk_cb, &ctx) < 0)
+    {
+        LOG("batch modify opcode failed");
+    }
+
+    size_t i;
+    for (i = 0; i < ctx.target_cnt; i++)
+    {
+        uhook_target_t* target = ctx.targets[i];
+        if (target->layers != NULL)
+        {
+            continue;
+        }
+
+        if (target->patched)
+        {
+            /* Batch write failed, try again the slow way */
+            _uhook_destroy_target(target);
+            continue;
+        }
+
+        uhook_registry_remove(&target->node);
+        UHOOK_ARCH_RELEASE(target->inject);
+        free(target);
+    }
+
+    while (ctx.layers != NULL)
+    {
+        uhook_layer_t* layer = ctx.layers;
+        ctx.layers = layer->next;
+        _uhook_destroy_layer(layer);
+    }
+
+    for (i = 0; i < ctx.got_cnt; i++)
+    {
+        _uhook_uninject_got(ctx.gots[i]);
+    }
+
+    free(ctx.targets);
+    free(ctx.gots);
+
+    return ctx.hook_cnt;
+}
+
+size_t uhook_uninject_group(unsigned group)
+{
+    _uhook_lock(~(uint64_t)0, 1);
+    size_t ret = _uhook_bulk_uninject(0, group);
+    _uhook_unlock(~(uint64_t)0, 1);
+
+    return ret;
+}
+
+size_t uhook_uninject_all(void)
+{
+    _uhook_lock(~(uint64_t)0, 1);
+    size_t ret = _uhook_bulk_uninject(1, 0);
+    _uhook_unlock(~(uint64_t)0, 1);
+
+    return ret;
+}
+
+int uhook_is_hooked(const void* addr)
+{
+    return uhook_registry_find(addr) != NULL;
+}
+
+size_t uhook_find_callers(const void* target, uhook_xref_t* xrefs, size_t cap)
+{
+#if defined(UHOOK_ARCH_FIND_CALLERS)
+    return UHOOK_ARCH_FIND_CALLERS(target, xrefs, cap);
+#else
+    (void)target; (void)xrefs; (void)cap;
+    return 0;
+#endif
+}
+
+int uhook_find_signature(const char* pattern, const uhook_sig_opt_t* opt,
+    void** addrs, size_t cap, size_t* num)
+{
+    return uhook_sig_find(pattern, opt, addrs, cap, num);
+}
+
+int uhook_plan(void* target, uhook_plan_t* report)
+{
+#if defined(UHOOK_ARCH_PLAN)
+    return UHOOK_ARCH_PLAN(target, report);
+#else
+    (void)target;
+    memset(report, 0, sizeof(*report));
+    report->result = UHOOK_UNKNOWN;
+    return UHOOK_UNKNOWN;
+#endif
+}
+
+int uhook_plan_module(void* symbol, unsigned threads, uhook_plan_summary_t* summary)
+{
+    return uhook_plan_module_run(symbol, threads, summary, uhook_plan);
+}
+
+int uhook_plan_cache_load(const char* path)
+{
+    return uhook_plan_cache_open(path);
+}
+
+int uhook_plan_cache_save(const char* path)
+{
+    return uhook_plan_cache_write(path);
+}
+
+int uhook_trap_stat(const void* target, unsigned long long* hits)
+{
+#if defined(UHOOK_ARCH_INJECT_TRAP)
+    uint64_t value;
+    if (!uhook_trap_hits(target, &value))
+    {
+        return 0;
+    }
+
+    *hits = value;
+    return 1;
+#else
+    (void)target; (void)hits;
+    return 0;
+#endif
 }
@@ -0,0 +1,312 @@
+#include "xref.h"
+#include "mutex.h"
+#include "once.h"
+#include "os/elf.h"
+#include <stdlib.h>
+
+/**
+ * @brief Branch candidates of one executable segment.
+ */
+typedef struct uhook_xref_index
+{
+    struct uhook_xref_index*    next;       /**< Next index */
+    uintptr_t                   base;       /**< Load address of module */
+    uintptr_t                   addr;       /**< Segment address */
+    size_t                      size;       /**< Segment size */
+    int                         alive;      /**< Whether segment is still loaded */
+    uhook_xref_list_t           direct;     /**< Direct branches sorted by destination */
+    uhook_xref_list_t           indirect;   /**< Branches through slot */
+}uhook_xref_index_t;
+
+typedef struct uhook_xref_ctx
+{
+    uhook_mutex_t               mutex;      /**< Protect index list */
+    uhook_xref_index_t*         indexes;    /**< Cached indexes */
+}uhook_xref_ctx_t;
+
+static uhook_xref_ctx_t s_xref;
+static pthread_once_t s_xref_once = PTHREAD_ONCE_INIT;
+
+static void _uhook_xref_init(void)
+{
+    uhook_mutex_init(&s_xref.mutex);
+}
+
+static int _uhook_xref_seg_cmp(const void* a, const void* b)
+{
+    uintptr_t addr_a = ((const elf_segment_t*)a)->addr;
+    uintptr_t addr_b = ((const elf_segment_t*)b)->addr;
+    return addr_a < addr_b ? -1 : (addr_a > addr_b ? 1 : 0);
+}
+
+static int _uhook_xref_site_cmp(const void* a, const void* b)
+{
+    const uhook_xref_site_t* site_a = a;
+    const uhook_xref_site_t* site_b = b;
+    if (site_a->dest != site_b->dest)
+    {
+        return site_a->dest < site_b->dest ? -1 : 1;
+    }
+    return site_a->site < site_b->site ? -1 : (site_a->site > site_b->site ? 1 : 0);
+}
+
+/**
+ * @brief Check [addr, addr + size) is in a segment that has all of \p flags.
+ * @param[in] segs  Segments sorted by address
+ * @return          bool
+ */
+static int _uhook_xref_is_mapped(const elf_segment_t* segs, size_t seg_num,
+    uintptr_t addr, size_t size, unsigned flags)
+{
+    /* The last segment that starts at or before addr */
+    size_t low = 0, high = seg_num;
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (segs[mid].addr <= addr)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    if (low == 0)
+    {
+        return 0;
+    }
+    const elf_segment_t* seg = &segs[low - 1];
+    return (seg->flags & flags) == flags && addr + size <= seg->addr + seg->size;
+}
+
+/**
+ * @brief Get loaded segments sorted by address.
+ * @return  Amount of segments
+ */
+static size_t _uhook_xref_get_segments(elf_segment_t** segs)
+{
+    size_t cap = elf_get_load_segments(NULL, 0);
+    if ((*segs = malloc(sizeof(elf_segment_t) * (cap + 1))) == NULL)
+    {
+        return 0;
+    }
+
+    size_t num = elf_get_load_segments(*segs, cap + 1);
+    num = num < cap + 1 ? num : cap + 1;
+
+    qsort(*segs, num, sizeof(elf_segment_t), _uhook_xref_seg_cmp);
+    return num;
+}
+
+static void _uhook_xref_index_release(uhook_xref_index_t* index)
+{
+    free(index->direct.sites);
+    free(index->indirect.sites);
+    free(index);
+}
+
+/**
+ * @brief Scan segment, only keep candidates that point to mapped memory.
+ */
+static uhook_xref_index_t* _uhook_xref_index_create(const elf_segment_t* seg,
+    const elf_segment_t* segs, size_t seg_num, uhook_xref_scan_fn scan)
+{
+    uhook_xref_list_t candidates = { NULL, 0, 0 };
+    uhook_xref_index_t* index = calloc(1, sizeof(uhook_xref_index_t));
+    if (index == NULL)
+    {
+        return NULL;
+    }
+    index->base = seg->base;
+    index->addr = seg->addr;
+    index->size = seg->size;
+
+    if (scan((const uint8_t*)seg->addr, seg->size, &candidates) != UHOOK_SUCCESS)
+    {
+        goto err;
+    }
+
+    size_t i;
+    for (i = 0; i < candidates.num; i++)
+    {
+        const uhook_xref_site_t* site = &candidates.sites[i];
+        int ret = UHOOK_SUCCESS;
+
+        if (site->type & UHOOK_XREF_INDIRECT)
+        {
+            if (_uhook_xref_is_mapped(segs, seg_num, site->dest, sizeof(void*), ELF_SEGMENT_READ))
+            {
+                ret = uhook_xref_list_push(&index->indirect, site->site, site->dest, site->type);
+            }
+        }
+        else if (_uhook_xref_is_mapped(segs, seg_num, site->dest, 1, ELF_SEGMENT_EXEC))
+        {
+            ret = uhook_xref_list_push(&index->direct, site->site, site->dest, site->type);
+        }
+
+        if (ret != UHOOK_SUCCESS)
+        {
+            goto err;
+        }
+    }
+    free(candidates.sites);
+
+    qsort(index->direct.sites, index->direct.num, sizeof(uhook_xref_site_t), _uhook_xref_site_cmp);
+    return index;
+
+err:
+    free(candidates.sites);
+    _uhook_xref_index_release(index);
+    return NULL;
+}
+
+static uhook_xref_index_t* _uhook_xref_index_get(const elf_segment_t* seg,
+    const elf_segment_t* segs, size_t seg_num, uhook_xref_scan_fn scan)
+{
+    uhook_xref_index_t* index = s_xref.indexes;
+    for (; index != NULL; index = index->next)
+    {
+        if (index->base == seg->base && index->addr == seg->addr && index->size == seg->size)
+        {
+            return index;
+        }
+    }
+
+    if ((index = _uhook_xref_index_create(seg, segs, seg_num, scan)) == NULL)
+    {
+        return NULL;
+    }
+    index->next = s_xref.indexes;
+    s_xref.indexes = index;
+
+    return index;
+}
+
+static void _uhook_xref_emit(const uhook_xref_site_t* site, uhook_xref_t* xrefs, size_t cap, size_t* num)
+{
+    if (*num < cap)
+    {
+        xrefs[*num].site = (void*)site->site;
+        xrefs[*num].type = site->type;
+    }
+    *num += 1;
+}
+
+static void _uhook_xref_index_query(const uhook_xref_index_t* index, uintptr_t target,
+    const elf_segment_t* segs, size_t seg_num, uhook_xref_confirm_fn confirm,
+    uhook_xref_t* xrefs, size_t cap, size_t* num)
+{
+    /* The first direct branch to target */
+    size_t low = 0, high = index->direct.num;
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (index->direct.sites[mid].dest < target)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    for (; low < index->direct.num && index->direct.sites[low].dest == target; low++)
+    {
+        if (confirm(&index->direct.sites[low]))
+        {
+            _uhook_xref_emit(&index->direct.sites[low], xrefs, cap, num);
+        }
+    }
+
+    /* Slots can be rewritten at any time, so read them on every query */
+    size_t i;
+    for (i = 0; i < index->indirect.num; i++)
+    {
+        const uhook_xref_site_t* site = &index->indirect.sites[i];
+        if (_uhook_xref_is_mapped(segs, seg_num, site->dest, sizeof(void*), ELF_SEGMENT_READ)
+            && *(const uintptr_t*)site->dest == target && confirm(site))
+        {
+            _uhook_xref_emit(site, xrefs, cap, num);
+        }
+    }
+}
+
+int uhook_xref_list_push(uhook_xref_list_t* list, uintptr_t site, uintptr_t dest, unsigned type)
+{
+    if (list->num == list->cap)
+    {
+        size_t cap = list->cap == 0 ? 64 : list->cap * 2;
+        uhook_xref_site_t* sites = realloc(list->sites, sizeof(uhook_xref_site_t) * cap);
+        if (sites == NULL)
+        {
+            return UHOOK_NOMEM;
+        }
+        list->sites = sites;
+        list->cap = cap;
+    }
+
+    list->sites[list->num].site = site;
+    list->sites[list->num].dest = dest;
+    list->sites[list->num].type = type;
+    list->num++;
+
+    return UHOOK_SUCCESS;
+}
+
+size_t uhook_xref_find(const void* target, uhook_xref_t* xrefs, size_t cap,
+    uhook_xref_scan_fn scan, uhook_xref_confirm_fn confirm)
+{
+    elf_segment_t* segs = NULL;
+    size_t seg_num = _uhook_xref_get_segments(&segs);
+    size_t num = 0;
+    if (segs == NULL)
+    {
+        return 0;
+    }
+
+    pthread_once(&s_xref_once, _uhook_xref_init);
+    uhook_mutex_lock(&s_xref.mutex);
+
+    uhook_xref_index_t* index;
+    for (index = s_xref.indexes; index != NULL; index = index->next)
+    {
+        index->alive = 0;
+    }
+
+    size_t i;
+    for (i = 0; i < seg_num; i++)
+    {
+        if (!(segs[i].flags & ELF_SEGMENT_EXEC))
+        {
+            continue;
+        }
+        if ((index = _uhook_xref_index_get(&segs[i], segs, seg_num, scan)) == NULL)
+        {
+            continue;
+        }
+
+        index->alive = 1;
+        _uhook_xref_index_query(index, (uintptr_t)target, segs, seg_num, confirm, xrefs, cap, &num);
+    }
+
+    /* Drop indexes of unloaded modules */
+    uhook_xref_index_t** pos = &s_xref.indexes;
+    while ((index = *pos) != NULL)
+    {
+        if (index->alive)
+        {
+            pos = &index->next;
+            continue;
+        }
+        *pos = index->next;
+        _uhook_xref_index_release(index);
+    }
+
+    uhook_mutex_unlock(&s_xref.mutex);
+    free(segs);
+
+    return num;
+}
@@ -0,0 +1,75 @@
+#ifndef __UHOOK_XREF_H__
+#define __UHOOK_XREF_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uhook.h"
+#include "defs.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief A branch instruction found in text.
+ */
+typedef struct uhook_xref_site
+{
+    uintptr_t       site;       /**< Address of branch instruction */
+    uintptr_t       dest;       /**< Destination, or address of slot if #UHOOK_XREF_INDIRECT */
+    unsigned        type;       /**< Bit-OR of #uhook_xref_type */
+}uhook_xref_site_t;
+
+typedef struct uhook_xref_list
+{
+    uhook_xref_site_t*  sites;  /**< Sites */
+    size_t              num;    /**< Amount of sites */
+    size_t              cap;    /**< Capacity of site list */
+}uhook_xref_list_t;
+
+/**
+ * @brief Find branch candidates in code.
+ *
+ * Candidates are only matched by opcode, they may be bytes in the middle of
+ * another instruction.
+ *
+ * @param[in] code  Start of code
+ * @param[in] size  Code size
+ * @param[out] list Call #uhook_xref_list_push() for each candidate
+ * @return          #uhook_errno
+ */
+typedef int (*uhook_xref_scan_fn)(const uint8_t* code, size_t size, uhook_xref_list_t* list);
+
+/**
+ * @brief Check that candidate is a real instruction and still has the same
+ *   destination.
+ * @param[in] site  Candidate found by #uhook_xref_scan_fn
+ * @return          bool
+ */
+typedef int (*uhook_xref_confirm_fn)(const uhook_xref_site_t* site);
+
+/**
+ * @brief Append site to list.
+ * @return          #uhook_errno
+ */
+API_LOCAL int uhook_xref_list_push(uhook_xref_list_t* list, uintptr_t site, uintptr_t dest, unsigned type);
+
+/**
+ * @brief Find branches to \p target in text of all loaded modules.
+ *
+ * Candidates of each executable segment are indexed by destination on
+ * first use, so only the first query of a module pays for the scan.
+ *
+ * @param[in] target    Branch destination
+ * @param[out] xrefs    Found branches
+ * @param[in] cap       Capacity of \p xrefs
+ * @param[in] scan      Find candidates
+ * @param[in] confirm   Confirm candidate
+ * @return              Amount of branches, may be larger than \p cap.
+ */
+API_LOCAL size_t uhook_xref_find(const void* target, uhook_xref_t* xrefs, size_t cap,
+    uhook_xref_scan_fn scan, uhook_xref_confirm_fn confirm);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -16,6 +16,35 @@ extern "C" {
 #   define DISABLE_OPTIMIZE
 #endif
 
+#if defined(__x86_64__) && defined(__GNUC__)
+
+/**
+ * @brief Define function \p name in assembly: \p insn, then enough `nop`
+ *   that it is large enough to patch, then `ret`.
+ *
+ * Being assembly, arguments and return value really are where ABI puts
+ * them, whatever the optimization level. Declare it `extern "C"` to call.
+ */
+#define TEST_ASM_FUNCTION(name, insn)           \
+    __asm__(                                    \
+        ".text\n"                               \
+        ".p2align 4\n"                          \
+        ".globl " #name "\n"                    \
+        ".type " #name ", @function\n"          \
+        #name ":\n"                             \
+        "    " insn "\n"                        \
+        "    nop\n"                             \
+        "    nop\n"                             \
+        "    nop\n"                             \
+        "    nop\n"                             \
+        "    nop\n"                             \
+        "    nop\n"                             \
+        "    ret\n"                             \
+        ".size " #name ", .-" #name "\n"        \
+    )
+
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,62 @@
+#include "common.hpp"
+
+#if defined(__x86_64__) && defined(__linux__)
+
+/**
+ * A function that is too small for any jump, and has no padding after it.
+ */
+__asm__(
+    ".text\n"
+    ".globl uhook_test_breakpoint_one\n"
+    ".type uhook_test_breakpoint_one, @function\n"
+    "uhook_test_breakpoint_one:\n"
+    "    ret\n"
+    ".size uhook_test_breakpoint_one, .-uhook_test_breakpoint_one\n"
+    ".globl uhook_test_breakpoint_next\n"
+    ".type uhook_test_breakpoint_next, @function\n"
+    "uhook_test_breakpoint_next:\n"
+    "    ret\n"
+    ".size uhook_test_breakpoint_next, .-uhook_test_breakpoint_next\n"
+);
+
+extern "C" void uhook_test_breakpoint_one(void);
+
+typedef void(*fn_sig)(void);
+
+static uhook_token_t s_token;
+static int s_counter;
+
+static void hook_one(void)
+{
+    s_counter++;
+    ((fn_sig)s_token.fcall)();
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, breakpoint)
+{
+    uhook_opt_t opt;
+    opt.priority = 0;
+    opt.group = 0;
+    opt.flags = 0;
+    ASSERT_EQ_D32(uhook_inject_ex(&s_token, (void*)uhook_test_breakpoint_one, (void*)hook_one, &opt), UHOOK_SMALLFUNC);
+
+    opt.flags = UHOOK_INJECT_BREAKPOINT;
+    ASSERT_EQ_D32(uhook_inject_ex(&s_token, (void*)uhook_test_breakpoint_one, (void*)hook_one, &opt), 0);
+
+    s_counter = 0;
+    uhook_test_breakpoint_one();
+    uhook_test_breakpoint_one();
+    ASSERT_EQ_D32(s_counter, 2);
+
+    unsigned long long hits = 0;
+    ASSERT_EQ_D32(uhook_trap_stat((void*)uhook_test_breakpoint_one, &hits), 1);
+    ASSERT_EQ_D32((int)hits, 2);
+
+    uhook_uninject(&s_token);
+    uhook_test_breakpoint_one();
+    ASSERT_EQ_D32(s_counter, 2);
+    ASSERT_EQ_D32(uhook_trap_stat((void*)uhook_test_breakpoint_one, &hits), 0);
+}
+
+#endif
@@ -0,0 +1,108 @@
+#include "common.hpp"
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(_WIN32)
+
+/**
+ * `callsite_direct` calls `callsite_callee` by `call rel32`, and
+ * `callsite_indirect` calls it by `call [rip + disp32]`.
+ */
+__asm__(
+    ".text\n"
+    ".p2align 4\n"
+    ".globl uhook_test_callsite_callee\n"
+    ".type uhook_test_callsite_callee, @function\n"
+    "uhook_test_callsite_callee:\n"
+    "    leal (%rdi, %rsi), %eax\n"
+    "    ret\n"
+    ".size uhook_test_callsite_callee, .-uhook_test_callsite_callee\n"
+    ".p2align 4\n"
+    ".globl uhook_test_callsite_direct\n"
+    ".type uhook_test_callsite_direct, @function\n"
+    "uhook_test_callsite_direct:\n"
+    "    subq $8, %rsp\n"
+    "    call uhook_test_callsite_callee\n"
+    "    addq $8, %rsp\n"
+    "    ret\n"
+    ".size uhook_test_callsite_direct, .-uhook_test_callsite_direct\n"
+    ".p2align 4\n"
+    ".globl uhook_test_callsite_indirect\n"
+    ".type uhook_test_callsite_indirect, @function\n"
+    "uhook_test_callsite_indirect:\n"
+    "    subq $8, %rsp\n"
+    "    call *uhook_test_callsite_slot(%rip)\n"
+    "    addq $8, %rsp\n"
+    "    ret\n"
+    ".size uhook_test_callsite_indirect, .-uhook_test_callsite_indirect\n"
+    ".data\n"
+    ".p2align 3\n"
+    "uhook_test_callsite_slot:\n"
+    "    .quad uhook_test_callsite_callee\n"
+    ".text\n"
+);
+
+extern "C" int uhook_test_callsite_callee(int a, int b);
+extern "C" int uhook_test_callsite_direct(int a, int b);
+extern "C" int uhook_test_callsite_indirect(int a, int b);
+
+typedef int(*fn_sig)(int, int);
+
+static uhook_token_t s_token;
+
+/* Do not call callee directly, or this call is rewritten too */
+static fn_sig volatile s_callee = uhook_test_callsite_callee;
+
+static int hook_add(int a, int b)
+{
+    return ((fn_sig)s_token.fcall)(a, b) * 10;
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, callsite)
+{
+    ASSERT_EQ_D32(uhook_inject_callsites(&s_token, (void*)uhook_test_callsite_callee, (void*)hook_add), 0);
+    ASSERT_EQ_PTR(s_token.fcall, (void*)uhook_test_callsite_callee);
+    ASSERT_EQ_D32(uhook_is_hooked((void*)uhook_test_callsite_callee), 0);
+
+    ASSERT_EQ_D32(uhook_test_callsite_direct(1, 2), 30);
+    ASSERT_EQ_D32(uhook_test_callsite_indirect(1, 2), 30);
+    ASSERT_EQ_D32(s_callee(1, 2), 3);
+
+    ASSERT_EQ_D32(uhook_disable(&s_token), 0);
+    ASSERT_EQ_D32(uhook_test_callsite_direct(1, 2), 3);
+    ASSERT_EQ_D32(uhook_enable(&s_token), 0);
+    ASSERT_EQ_D32(uhook_test_callsite_direct(1, 2), 30);
+
+    uhook_uninject(&s_token);
+    ASSERT_EQ_D32(uhook_test_callsite_direct(1, 2), 3);
+    ASSERT_EQ_D32(uhook_test_callsite_indirect(1, 2), 3);
+}
+
+/* Restore call sites before returning, so return address must be intact */
+static int hook_add_disable(int a, int b)
+{
+    uhook_disable(&s_token);
+    return ((fn_sig)s_token.fcall)(a, b) * 10;
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, callsite_disable_in_detour)
+{
+    ASSERT_EQ_D32(uhook_inject_callsites(&s_token, (void*)uhook_test_callsite_callee, (void*)hook_add_disable), 0);
+
+    ASSERT_EQ_D32(uhook_test_callsite_direct(1, 2), 30);
+    ASSERT_EQ_D32(uhook_test_callsite_direct(1, 2), 3);
+
+    ASSERT_EQ_D32(uhook_enable(&s_token), 0);
+    ASSERT_EQ_D32(uhook_test_callsite_indirect(1, 2), 30);
+    ASSERT_EQ_D32(uhook_test_callsite_indirect(1, 2), 3);
+
+    uhook_uninject(&s_token);
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, callsite_not_found)
+{
+    ASSERT_EQ_D32(uhook_inject_callsites(&s_token, (void*)hook_add, (void*)hook_add), UHOOK_NOCALLSITE);
+}
+
+#endif
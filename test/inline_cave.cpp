@@ -0,0 +1,57 @@
+#include "common.hpp"
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(_WIN32)
+
+/**
+ * A function that is too small for a near jump, followed by int3 padding
+ * that also keeps detour out of reach of a short jump.
+ */
+__asm__(
+    ".text\n"
+    ".p2align 4\n"
+    ".globl uhook_test_cave_tiny\n"
+    ".type uhook_test_cave_tiny, @function\n"
+    "uhook_test_cave_tiny:\n"
+    "    xorl %eax, %eax\n"
+    "    ret\n"
+    ".size uhook_test_cave_tiny, .-uhook_test_cave_tiny\n"
+    ".fill 285, 1, 0xcc\n"
+    ".p2align 4, 0xcc\n"
+);
+
+extern "C" int uhook_test_cave_tiny(void);
+
+typedef int(*fn_sig)(void);
+
+static uhook_token_t s_token;
+
+static int hook_tiny(void)
+{
+    return ((fn_sig)s_token.fcall)() + 42;
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, code_cave)
+{
+    uint8_t backup[32];
+    memcpy(backup, (void*)uhook_test_cave_tiny, sizeof(backup));
+
+    ASSERT_EQ_D32(uhook_inject(&s_token, (void*)uhook_test_cave_tiny, (void*)hook_tiny), 0);
+
+    /* Short jump at target lands right on the jump in code cave */
+    const uint8_t* code = (const uint8_t*)uhook_test_cave_tiny;
+    ASSERT_EQ_D32(code[0], 0xeb);
+    const uint8_t* cave = code + 2 + (int8_t)code[1];
+    ASSERT_NE_D32(cave[0] == 0xe9 || cave[0] == 0xff, 0);
+
+    ASSERT_EQ_D32(uhook_test_cave_tiny(), 42);
+    ASSERT_EQ_D32(((fn_sig)s_token.fcall)(), 0);
+
+    /* Both target and code cave are restored */
+    uhook_uninject(&s_token);
+    ASSERT_EQ_D32(memcmp(backup, (void*)uhook_test_cave_tiny, sizeof(backup)), 0);
+    ASSERT_EQ_D32(uhook_test_cave_tiny(), 0);
+}
+
+#endif
@@ -0,0 +1,61 @@
+#include "common.hpp"
+
+typedef int(*fn_sig)(int, int);
+
+static uhook_token_t s_token_mul;
+static uhook_token_t s_token_inc;
+
+static int add(int a, int b)
+{
+    return a + b;
+}
+
+static int layer_mul(int a, int b)
+{
+    return ((fn_sig)s_token_mul.fcall)(a, b) * 10;
+}
+
+static int layer_inc(int a, int b)
+{
+    return ((fn_sig)s_token_inc.fcall)(a, b) + 1;
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, chain)
+{
+    uhook_opt_t opt;
+    opt.group = 0;
+    opt.flags = 0;
+    ASSERT_EQ_D32(add(1, 2), 3);
+
+    opt.priority = 0;
+    ASSERT_EQ_D32(uhook_inject_ex(&s_token_inc, (void*)add, (void*)layer_inc, &opt), 0);
+    ASSERT_EQ_D32(add(1, 2), 4);
+
+    /* Higher priority is called first */
+    opt.priority = 10;
+    ASSERT_EQ_D32(uhook_inject_ex(&s_token_mul, (void*)add, (void*)layer_mul, &opt), 0);
+    ASSERT_EQ_D32(add(1, 2), 40);
+    ASSERT_EQ_D32(((fn_sig)s_token_mul.fcall)(1, 2), 4);
+    ASSERT_EQ_D32(((fn_sig)s_token_inc.fcall)(1, 2), 3);
+
+    /* Uninject head layer out of order */
+    uhook_uninject(&s_token_mul);
+    ASSERT_EQ_D32(add(1, 2), 4);
+
+    opt.priority = -1;
+    ASSERT_EQ_D32(uhook_inject_ex(&s_token_mul, (void*)add, (void*)layer_mul, &opt), 0);
+    ASSERT_EQ_D32(add(1, 2), 31);
+
+    /* Disabled layer is skipped */
+    ASSERT_EQ_D32(uhook_disable(&s_token_inc), 0);
+    ASSERT_EQ_D32(add(1, 2), 30);
+    ASSERT_EQ_D32(uhook_enable(&s_token_inc), 0);
+    ASSERT_EQ_D32(add(1, 2), 31);
+
+    uhook_uninject(&s_token_inc);
+    ASSERT_EQ_D32(add(1, 2), 30);
+
+    uhook_uninject(&s_token_mul);
+    ASSERT_EQ_D32(add(1, 2), 3);
+}
@@ -0,0 +1,163 @@
+#include "common.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+
+typedef int(*fn_sig)(int, int);
+
+#define TEST_CONCURRENT_THREADS 4
+#define TEST_CONCURRENT_LOOPS   200
+
+static int add_0(int a, int b)
+{
+    return a + b;
+}
+
+static int add_1(int a, int b)
+{
+    return a + b + 1;
+}
+
+static int add_2(int a, int b)
+{
+    return a + b + 2;
+}
+
+static int add_3(int a, int b)
+{
+    return a + b + 3;
+}
+
+static int del(int a, int b)
+{
+    return a - b;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+/* Entry is 12 bytes into a 16 bytes block, so redirect cannot be one store */
+__asm__(
+    ".text\n"
+    ".p2align 4\n"
+    ".skip 12, 0\n"
+    ".globl uhook_test_concurrent_unaligned\n"
+    ".type uhook_test_concurrent_unaligned, @function\n"
+    "uhook_test_concurrent_unaligned:\n"
+    "    leal 1(%rdi), %eax\n"
+    "    movl %eax, %eax\n"
+    "    movl %eax, %eax\n"
+    "    movl %eax, %eax\n"
+    "    movl %eax, %eax\n"
+    "    movl %eax, %eax\n"
+    "    movl %eax, %eax\n"
+    "    ret\n"
+    ".size uhook_test_concurrent_unaligned, .-uhook_test_concurrent_unaligned\n"
+);
+
+extern "C" int uhook_test_concurrent_unaligned(int a, int b);
+
+#endif
+
+static fn_sig s_targets[TEST_CONCURRENT_THREADS] = { add_0, add_1, add_2, add_3 };
+static std::atomic<int> s_failures;
+
+static void _test_concurrent_worker(int idx)
+{
+    fn_sig target = s_targets[idx];
+
+    int i;
+    for (i = 0; i < TEST_CONCURRENT_LOOPS; i++)
+    {
+        uhook_token_t token;
+        if (uhook_inject(&token, (void*)target, (void*)del) != 0)
+        {
+            s_failures++;
+            return;
+        }
+
+        if (target(3, 1) != 2 || ((fn_sig)token.fcall)(3, 1) != 4 + idx)
+        {
+            s_failures++;
+        }
+
+        uhook_uninject(&token);
+        if (target(3, 1) != 4 + idx)
+        {
+            s_failures++;
+        }
+    }
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, concurrent)
+{
+    s_failures = 0;
+
+    std::thread workers[TEST_CONCURRENT_THREADS];
+
+    int i;
+    for (i = 0; i < TEST_CONCURRENT_THREADS; i++)
+    {
+        workers[i] = std::thread(_test_concurrent_worker, i);
+    }
+    for (i = 0; i < TEST_CONCURRENT_THREADS; i++)
+    {
+        workers[i].join();
+    }
+
+    ASSERT_EQ_D32(s_failures.load(), 0);
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+static std::atomic<int> s_running;
+
+/* Too far for a short jump, as `del` may be next to target */
+static int (*s_detour_far)(int) = abs;
+
+static void _test_concurrent_caller(void)
+{
+    while (s_running.load())
+    {
+        int ret = uhook_test_concurrent_unaligned(3, 1);
+        if (ret != 4 && ret != 3)
+        {
+            s_failures++;
+        }
+    }
+}
+
+TEST(inline_hook, concurrent_unaligned)
+{
+    s_failures = 0;
+    s_running = 1;
+
+    std::thread callers[TEST_CONCURRENT_THREADS];
+
+    int i;
+    for (i = 0; i < TEST_CONCURRENT_THREADS; i++)
+    {
+        callers[i] = std::thread(_test_concurrent_caller);
+    }
+
+    for (i = 0; i < TEST_CONCURRENT_LOOPS; i++)
+    {
+        uhook_token_t token;
+        if (uhook_inject(&token, (void*)uhook_test_concurrent_unaligned, (void*)s_detour_far) != 0)
+        {
+            s_failures++;
+            break;
+        }
+        uhook_uninject(&token);
+    }
+
+    s_running = 0;
+    for (i = 0; i < TEST_CONCURRENT_THREADS; i++)
+    {
+        callers[i].join();
+    }
+
+    ASSERT_EQ_D32(s_failures.load(), 0);
+}
+
+#endif
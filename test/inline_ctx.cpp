@@ -0,0 +1,47 @@
+#include "common.hpp"
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(_WIN32)
+
+typedef int(*fn_sig)(int, int);
+
+static int ctx_add(int a, int b)
+{
+    return a + b;
+}
+
+static int ctx_mul(int a, int b)
+{
+    return a * b;
+}
+
+/**
+ * @brief One detour for both hooks, the result is offset by user data.
+ */
+static int ctx_detour(int a, int b)
+{
+    const uhook_ctx_t* ctx = uhook_get_ctx();
+    return ((fn_sig)ctx->fcall)(a, b) + (int)(intptr_t)ctx->ctx;
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, ctx)
+{
+    uhook_token_t token_add;
+    uhook_token_t token_mul;
+    ASSERT_EQ_D32(uhook_inject_ctx(&token_add, (void*)ctx_add, (void*)ctx_detour, (void*)100), 0);
+    ASSERT_EQ_D32(uhook_inject_ctx(&token_mul, (void*)ctx_mul, (void*)ctx_detour, (void*)1000), 0);
+
+    ASSERT_EQ_D32(ctx_add(2, 3), 105);
+    ASSERT_EQ_D32(ctx_mul(2, 3), 1006);
+    ASSERT_EQ_D32(((fn_sig)token_add.fcall)(2, 3), 5);
+
+    /* Context is published with fcall of its own layer */
+    ASSERT_EQ_PTR(uhook_get_ctx()->fcall, token_mul.fcall);
+
+    uhook_uninject(&token_add);
+    uhook_uninject(&token_mul);
+    ASSERT_EQ_D32(ctx_add(2, 3), 5);
+    ASSERT_EQ_D32(ctx_mul(2, 3), 6);
+}
+
+#endif
@@ -0,0 +1,108 @@
+#include "common.hpp"
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(_WIN32)
+
+TEST_ASM_FUNCTION(uhook_test_filter_double, "leal (%rdi,%rdi), %eax");
+
+extern "C" int uhook_test_filter_double(int a, int b);
+
+static int s_filter_hits;
+
+static int filter_detour(int a, int b)
+{
+    (void)b;
+    s_filter_hits++;
+    return a + 1000;
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, filter_arg)
+{
+    uhook_filter_t filter;
+    memset(&filter, 0, sizeof(filter));
+    filter.flags = UHOOK_FILTER_ARG;
+    filter.arg = 1;
+    filter.cmp = UHOOK_FILTER_LT;
+    filter.arg_value = 5;
+
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject_filter(&token, (void*)uhook_test_filter_double, (void*)filter_detour, &filter), 0);
+    ASSERT_EQ_D32(uhook_test_filter_double(3, 4), 1003);
+    ASSERT_EQ_D32(uhook_test_filter_double(3, 5), 6);
+    ASSERT_EQ_D32(uhook_test_filter_double(3, -1), 6);
+
+    uhook_uninject(&token);
+    ASSERT_EQ_D32(uhook_test_filter_double(3, 4), 6);
+}
+
+DISABLE_OPTIMIZE
+static int filter_caller(int a)
+{
+    return uhook_test_filter_double(a, 0);
+}
+
+DISABLE_OPTIMIZE
+static int filter_caller_end(int a)
+{
+    return a;
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, filter_caller)
+{
+    uhook_filter_t filter;
+    memset(&filter, 0, sizeof(filter));
+    filter.flags = UHOOK_FILTER_CALLER;
+    filter.caller_begin = (void*)filter_caller;
+    filter.caller_end = (void*)filter_caller_end;
+    if (filter.caller_end <= filter.caller_begin)
+    {
+        /* Layout is up to compiler */
+        return;
+    }
+
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject_filter(&token, (void*)uhook_test_filter_double, (void*)filter_detour, &filter), 0);
+    ASSERT_EQ_D32(filter_caller(3), 1003);
+    ASSERT_EQ_D32(uhook_test_filter_double(3, 0), 6);
+    uhook_uninject(&token);
+
+    ASSERT_EQ_D32(filter_caller_end(3), 3);
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, filter_sample)
+{
+    uhook_filter_t filter;
+    memset(&filter, 0, sizeof(filter));
+    filter.flags = UHOOK_FILTER_SAMPLE;
+    filter.sample = 4;
+
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject_filter(&token, (void*)uhook_test_filter_double, (void*)filter_detour, &filter), 0);
+
+    int i;
+    s_filter_hits = 0;
+    for (i = 0; i < 100; i++)
+    {
+        uhook_test_filter_double(i, 0);
+    }
+    ASSERT_EQ_D32(s_filter_hits, 25);
+
+    uhook_uninject(&token);
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, filter_invalid)
+{
+    uhook_filter_t filter;
+    memset(&filter, 0, sizeof(filter));
+    filter.flags = UHOOK_FILTER_SAMPLE;
+
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject_filter(&token, (void*)uhook_test_filter_double, (void*)filter_detour, &filter),
+        UHOOK_INVALID);
+}
+
+#endif
@@ -0,0 +1,67 @@
+#include "common.hpp"
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(_WIN32)
+
+TEST_ASM_FUNCTION(uhook_test_guard_double, "leal (%rdi,%rdi), %eax");
+TEST_ASM_FUNCTION(uhook_test_guard_fadd, "addsd %xmm1, %xmm0");
+
+extern "C" int uhook_test_guard_double(int a);
+extern "C" double uhook_test_guard_fadd(double a, double b);
+
+/**
+ * @brief Calls its own target, which would never return without guard.
+ */
+static int guard_double_detour(int a)
+{
+    return uhook_test_guard_double(a) + 100;
+}
+
+static double guard_fadd_detour(double a, double b)
+{
+    return uhook_test_guard_fadd(a, b) * 2;
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, guard)
+{
+    uhook_opt_t opt = { 0, 0, UHOOK_INJECT_GUARD };
+    uhook_token_t token_double;
+    uhook_token_t token_fadd;
+    ASSERT_EQ_D32(uhook_inject_ex(&token_double, (void*)uhook_test_guard_double, (void*)guard_double_detour, &opt), 0);
+    ASSERT_EQ_D32(uhook_inject_ex(&token_fadd, (void*)uhook_test_guard_fadd, (void*)guard_fadd_detour, &opt), 0);
+
+    ASSERT_EQ_D32(uhook_test_guard_double(3), 106);
+    ASSERT_EQ_D32((int)uhook_test_guard_fadd(1.0, 2.0), 6);
+
+    /* Guard is cleared after detour returns */
+    ASSERT_EQ_D32(uhook_test_guard_double(3), 106);
+
+    uhook_uninject(&token_double);
+    uhook_uninject(&token_fadd);
+    ASSERT_EQ_D32(uhook_test_guard_double(3), 6);
+    ASSERT_EQ_D32((int)uhook_test_guard_fadd(1.0, 2.0), 3);
+}
+
+static int guard_bypass_detour(int a)
+{
+    return a + 1000;
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, bypass)
+{
+    uhook_opt_t opt = { 0, 0, UHOOK_INJECT_BYPASS };
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject_ex(&token, (void*)uhook_test_guard_double, (void*)guard_bypass_detour, &opt), 0);
+    ASSERT_EQ_D32(uhook_test_guard_double(3), 1003);
+
+    ASSERT_EQ_D32(uhook_bypass(1), 0);
+    ASSERT_EQ_D32(uhook_test_guard_double(3), 6);
+    ASSERT_EQ_D32(uhook_bypass(0), 1);
+    ASSERT_EQ_D32(uhook_test_guard_double(3), 1003);
+
+    uhook_uninject(&token);
+    ASSERT_EQ_D32(uhook_test_guard_double(3), 6);
+}
+
+#endif
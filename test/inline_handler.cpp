@@ -0,0 +1,187 @@
+#include "common.hpp"
+#include <setjmp.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(_WIN32)
+
+TEST_ASM_FUNCTION(uhook_test_handler_double, "leal (%rdi,%rdi), %eax");
+TEST_ASM_FUNCTION(uhook_test_handler_fadd, "addsd %xmm1, %xmm0");
+
+/**
+ * Targets that call into C bodies, so stack frames of the longjmp test are
+ * known.
+ */
+__asm__(
+    ".text\n"
+    ".p2align 4\n"
+    ".globl uhook_test_handler_jump\n"
+    ".type uhook_test_handler_jump, @function\n"
+    "uhook_test_handler_jump:\n"
+    "    subq $8, %rsp\n"
+    "    call uhook_test_handler_jump_body\n"
+    "    addq $8, %rsp\n"
+    "    ret\n"
+    ".size uhook_test_handler_jump, .-uhook_test_handler_jump\n"
+    ".p2align 4\n"
+    ".globl uhook_test_handler_outer\n"
+    ".type uhook_test_handler_outer, @function\n"
+    "uhook_test_handler_outer:\n"
+    "    subq $8, %rsp\n"
+    "    call uhook_test_handler_outer_body\n"
+    "    addq $8, %rsp\n"
+    "    ret\n"
+    ".size uhook_test_handler_outer, .-uhook_test_handler_outer\n"
+);
+
+extern "C" int uhook_test_handler_double(int a);
+extern "C" double uhook_test_handler_fadd(double a, double b);
+extern "C" int uhook_test_handler_jump(int a);
+extern "C" int uhook_test_handler_outer(int a);
+
+static jmp_buf s_handler_jmp;
+
+/**
+ * @brief Leave `uhook_test_handler_jump` without returning.
+ */
+extern "C" int uhook_test_handler_jump_body(int a)
+{
+    longjmp(s_handler_jmp, a);
+}
+
+extern "C" int uhook_test_handler_outer_body(int a)
+{
+    int ret = setjmp(s_handler_jmp);
+    if (ret == 0)
+    {
+        return uhook_test_handler_jump(a);
+    }
+    return ret + 1;
+}
+
+static int s_handler_enter;
+static int s_handler_leave;
+
+static void handler_enter(uhook_regs_t* regs, void* ctx)
+{
+    s_handler_enter++;
+    regs->rdi += (intptr_t)ctx;
+}
+
+static void handler_leave(uhook_regs_t* regs, void* ctx)
+{
+    (void)ctx;
+    s_handler_leave++;
+    regs->rax *= 10;
+}
+
+static double handler_get_xmm(uhook_regs_t* regs, int idx)
+{
+    double val;
+    memcpy(&val, (char*)regs->vector + 160 + idx * 16, sizeof(val));
+    return val;
+}
+
+static void handler_set_xmm(uhook_regs_t* regs, int idx, double val)
+{
+    memcpy((char*)regs->vector + 160 + idx * 16, &val, sizeof(val));
+}
+
+static void handler_vector_enter(uhook_regs_t* regs, void* ctx)
+{
+    (void)ctx;
+    handler_set_xmm(regs, 0, handler_get_xmm(regs, 0) + 100);
+}
+
+static void handler_vector_leave(uhook_regs_t* regs, void* ctx)
+{
+    (void)ctx;
+    handler_set_xmm(regs, 0, handler_get_xmm(regs, 0) * 2);
+}
+
+/**
+ * Handler that does floating point math of its own, like code of library
+ * may do at any optimization level.
+ */
+static void handler_float(uhook_regs_t* regs, void* ctx)
+{
+    (void)regs; (void)ctx;
+    volatile double val = 3.5;
+    val = val * 7.0 + 1.0;
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, handler)
+{
+    s_handler_enter = 0;
+    s_handler_leave = 0;
+    uhook_handler_t handler = { handler_enter, handler_leave, (void*)1, 0 };
+
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject_handler(&token, (void*)uhook_test_handler_double, &handler), 0);
+
+    /* (1 + 1) * 2 * 10 */
+    ASSERT_EQ_D32(uhook_test_handler_double(1), 40);
+    ASSERT_EQ_D32(s_handler_enter, 1);
+    ASSERT_EQ_D32(s_handler_leave, 1);
+    ASSERT_EQ_D32(((int(*)(int))token.fcall)(1), 2);
+
+    uhook_uninject(&token);
+    ASSERT_EQ_D32(uhook_test_handler_double(1), 2);
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, handler_vector)
+{
+    uhook_handler_t handler = { handler_vector_enter, handler_vector_leave, NULL, UHOOK_HANDLER_VECTOR };
+
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject_handler(&token, (void*)uhook_test_handler_fadd, &handler), 0);
+
+    /* (1 + 100 + 2) * 2 */
+    ASSERT_EQ_D32((int)uhook_test_handler_fadd(1.0, 2.0), 206);
+
+    uhook_uninject(&token);
+    ASSERT_EQ_D32((int)uhook_test_handler_fadd(1.0, 2.0), 3);
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, handler_float)
+{
+    uhook_handler_t handler = { handler_float, handler_float, NULL, 0 };
+
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject_handler(&token, (void*)uhook_test_handler_fadd, &handler), 0);
+
+    /* Arguments and return value pass through without UHOOK_HANDLER_VECTOR */
+    ASSERT_EQ_D32((int)uhook_test_handler_fadd(1.0, 2.0), 3);
+    ASSERT_EQ_D32((int)uhook_test_handler_fadd(20.0, 22.0), 42);
+
+    uhook_uninject(&token);
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, handler_longjmp)
+{
+    s_handler_leave = 0;
+    uhook_handler_t handler_outer = { NULL, handler_leave, NULL, 0 };
+    uhook_handler_t handler_jump = { NULL, handler_leave, NULL, 0 };
+
+    uhook_token_t token_outer;
+    uhook_token_t token_jump;
+    ASSERT_EQ_D32(uhook_inject_handler(&token_outer, (void*)uhook_test_handler_outer, &handler_outer), 0);
+    ASSERT_EQ_D32(uhook_inject_handler(&token_jump, (void*)uhook_test_handler_jump, &handler_jump), 0);
+
+    /* More calls than shadow stack can hold, stale frames must be dropped */
+    int i;
+    for (i = 0; i < 2000; i++)
+    {
+        ASSERT_EQ_D32(uhook_test_handler_outer(1), 20);
+    }
+    ASSERT_EQ_D32(s_handler_leave, 2000);
+
+    uhook_uninject(&token_jump);
+    uhook_uninject(&token_outer);
+    ASSERT_EQ_D32(uhook_test_handler_outer(1), 2);
+}
+
+#endif
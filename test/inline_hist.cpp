@@ -0,0 +1,131 @@
+#include "common.hpp"
+#include <thread>
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(_WIN32)
+
+#define TEST_HIST_THREADS   4
+#define TEST_HIST_LOOPS     10000
+
+TEST_ASM_FUNCTION(uhook_test_hist_inc, "leal 1(%rdi), %eax");
+TEST_ASM_FUNCTION(uhook_test_hist_fadd, "addsd %xmm1, %xmm0");
+
+extern "C" int uhook_test_hist_inc(int a);
+extern "C" double uhook_test_hist_fadd(double a, double b);
+
+static int _test_hist_detour(int a)
+{
+    return a + 2;
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, hist)
+{
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject_hist(&token, (void*)uhook_test_hist_inc), 0);
+
+    uhook_hist_t hist;
+    ASSERT_EQ_D32(uhook_hist_snapshot(&token, &hist, 0), 0);
+    ASSERT_EQ_U64(hist.count, 0);
+
+    int i;
+    for (i = 0; i < 100; i++)
+    {
+        ASSERT_EQ_D32(uhook_test_hist_inc(i), i + 1);
+    }
+
+    ASSERT_EQ_D32(uhook_hist_snapshot(&token, &hist, 0), 0);
+    ASSERT_EQ_U64(hist.count, 100);
+    ASSERT_GT_U64(hist.overhead, 0);
+    ASSERT_GE_U64(hist.p50, hist.min);
+    ASSERT_GE_U64(hist.p90, hist.p50);
+    ASSERT_GE_U64(hist.p99, hist.p90);
+    ASSERT_GE_U64(hist.p999, hist.p99);
+    ASSERT_GE_U64(hist.max, hist.p999);
+
+    /* Snapshot before reset still has all calls */
+    ASSERT_EQ_D32(uhook_hist_snapshot(&token, &hist, 1), 0);
+    ASSERT_EQ_U64(hist.count, 100);
+    ASSERT_EQ_D32(uhook_hist_snapshot(&token, &hist, 0), 0);
+    ASSERT_EQ_U64(hist.count, 0);
+
+    ASSERT_EQ_D32(uhook_test_hist_inc(1), 2);
+    ASSERT_EQ_D32(uhook_hist_snapshot(&token, NULL, 1), 0);
+    ASSERT_EQ_D32(uhook_hist_snapshot(&token, &hist, 0), 0);
+    ASSERT_EQ_U64(hist.count, 0);
+
+    uhook_uninject(&token);
+    ASSERT_EQ_D32(uhook_test_hist_inc(1), 2);
+
+    /* Calls of removed hook are not inherited */
+    ASSERT_EQ_D32(uhook_inject_hist(&token, (void*)uhook_test_hist_inc), 0);
+    ASSERT_EQ_D32(uhook_hist_snapshot(&token, &hist, 0), 0);
+    ASSERT_EQ_U64(hist.count, 0);
+    uhook_uninject(&token);
+}
+
+static void _test_hist_worker(void)
+{
+    int i;
+    for (i = 0; i < TEST_HIST_LOOPS; i++)
+    {
+        uhook_test_hist_inc(i);
+    }
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, hist_threads)
+{
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject_hist(&token, (void*)uhook_test_hist_inc), 0);
+
+    std::thread workers[TEST_HIST_THREADS];
+    int i;
+    for (i = 0; i < TEST_HIST_THREADS; i++)
+    {
+        workers[i] = std::thread(_test_hist_worker);
+    }
+    for (i = 0; i < TEST_HIST_THREADS; i++)
+    {
+        workers[i].join();
+    }
+
+    /* Histograms of exited threads are merged */
+    uhook_hist_t hist;
+    ASSERT_EQ_D32(uhook_hist_snapshot(&token, &hist, 0), 0);
+    ASSERT_EQ_U64(hist.count, TEST_HIST_THREADS * TEST_HIST_LOOPS);
+
+    uhook_uninject(&token);
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, hist_float)
+{
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject_hist(&token, (void*)uhook_test_hist_fadd), 0);
+
+    /* Handlers of library must not touch float arguments or return value */
+    ASSERT_EQ_D32((int)uhook_test_hist_fadd(1.0, 2.0), 3);
+    ASSERT_EQ_D32((int)uhook_test_hist_fadd(20.0, 22.0), 42);
+
+    uhook_uninject(&token);
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, hist_invalid)
+{
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject(&token, (void*)uhook_test_hist_inc, (void*)_test_hist_detour), 0);
+    ASSERT_EQ_D32(uhook_test_hist_inc(1), 3);
+
+    uhook_hist_t hist;
+    ASSERT_EQ_D32(uhook_hist_snapshot(&token, &hist, 0), UHOOK_INVALID);
+
+    uhook_uninject(&token);
+
+    /* Stat and histogram hooks do not read each other */
+    ASSERT_EQ_D32(uhook_inject_stat(&token, (void*)uhook_test_hist_inc), 0);
+    ASSERT_EQ_D32(uhook_hist_snapshot(&token, &hist, 0), UHOOK_INVALID);
+    uhook_uninject(&token);
+}
+
+#endif
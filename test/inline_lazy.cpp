@@ -0,0 +1,78 @@
+#include "common.hpp"
+#include <stdlib.h>
+
+typedef int(*fn_sig)(int, int);
+
+static uhook_token_t s_token;
+
+static int add(int a, int b)
+{
+    return a + b;
+}
+
+static int hook_add(int a, int b)
+{
+    return ((fn_sig)s_token.fcall)(a, b) * 10;
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, lazy)
+{
+    uhook_opt_t opt;
+    opt.priority = 0;
+    opt.group = 0;
+    opt.flags = UHOOK_INJECT_LAZY;
+
+    ASSERT_EQ_D32(uhook_inject_ex(&s_token, (void*)add, (void*)hook_add, &opt), 0);
+    ASSERT_NE_PTR(s_token.fcall, NULL);
+
+    /* First call builds trampoline, second call goes to it directly */
+    ASSERT_EQ_D32(add(1, 2), 30);
+    ASSERT_EQ_D32(add(3, 4), 70);
+    ASSERT_EQ_D32(((fn_sig)s_token.fcall)(1, 2), 3);
+
+    uhook_uninject(&s_token);
+    ASSERT_EQ_D32(add(1, 2), 3);
+
+    /* Trampoline that is never built */
+    ASSERT_EQ_D32(uhook_inject_ex(&s_token, (void*)add, (void*)hook_add, &opt), 0);
+    uhook_uninject(&s_token);
+    ASSERT_EQ_D32(add(1, 2), 3);
+}
+
+typedef char*(*getenv_sig)(const char*);
+
+static char* hook_getenv(const char* name)
+{
+    return ((getenv_sig)s_token.fcall)(name);
+}
+
+/**
+ * `getenv` reads `environ` by `[rip + disp32]`. Library code is often more
+ * than 2GB away from trampoline, so eager inject may fail, and lazy inject
+ * must fail the same way instead of on first call.
+ */
+DISABLE_OPTIMIZE
+TEST(inline_hook, lazy_agrees_with_eager)
+{
+    uhook_opt_t opt;
+    opt.priority = 0;
+    opt.group = 0;
+    opt.flags = 0;
+
+    int eager = uhook_inject_ex(&s_token, (void*)getenv, (void*)hook_getenv, &opt);
+    if (eager == UHOOK_SUCCESS)
+    {
+        uhook_uninject(&s_token);
+    }
+
+    opt.flags = UHOOK_INJECT_LAZY;
+    ASSERT_EQ_D32(uhook_inject_ex(&s_token, (void*)getenv, (void*)hook_getenv, &opt), eager);
+    if (eager != UHOOK_SUCCESS)
+    {
+        return;
+    }
+
+    ASSERT_EQ_PTR(getenv("UHOOK_TEST_NO_SUCH_ENV"), NULL);
+    uhook_uninject(&s_token);
+}
@@ -0,0 +1,114 @@
+#include "common.hpp"
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(_WIN32)
+
+typedef int(*fn_sig)(int, int);
+
+static uhook_token_t s_token;
+
+__attribute__((patchable_function_entry(16, 0)))
+static int add(int a, int b)
+{
+    return a + b;
+}
+
+static int hook_add(int a, int b)
+{
+    return ((fn_sig)s_token.fcall)(a, b) * 10;
+}
+
+/**
+ * `uhook_test_sled_cross` has a sled recorded the way GCC does, but it
+ * starts 12 bytes into a 16 bytes block. It returns where its body runs,
+ * which is right after the sled only if the original is called in place.
+ */
+__asm__(
+    ".text\n"
+    ".p2align 4\n"
+    ".skip 12, 0x90\n"
+    ".globl uhook_test_sled_cross\n"
+    ".type uhook_test_sled_cross, @function\n"
+    "uhook_test_sled_cross:\n"
+    ".LUHOOK_TEST_SLED_CROSS:\n"
+    "    .skip 16, 0x90\n"
+    "    call 1f\n"
+    "1:\n"
+    "    popq %rax\n"
+    "    ret\n"
+    ".size uhook_test_sled_cross, .-uhook_test_sled_cross\n"
+    ".section __patchable_function_entries,\"awo\",@progbits,uhook_test_sled_cross\n"
+    ".p2align 3\n"
+    ".quad .LUHOOK_TEST_SLED_CROSS\n"
+    ".text\n"
+);
+
+extern "C" uintptr_t uhook_test_sled_cross(void);
+
+typedef uintptr_t(*where_sig)(void);
+
+static uintptr_t hook_sled_cross(void)
+{
+    return ((where_sig)s_token.fcall)();
+}
+
+/**
+ * Sled is patched by one near jump, or a short jump to code cave if detour
+ * is out of reach, so it is written by one atomic store and the rest of
+ * sled is never touched.
+ */
+DISABLE_OPTIMIZE
+TEST(inline_hook, patchable_entry_near_jump)
+{
+    uint8_t* site = (uint8_t*)add;
+    static const uint8_t endbr64[] = { 0xf3, 0x0f, 0x1e, 0xfa };
+    if (memcmp(site, endbr64, sizeof(endbr64)) == 0)
+    {
+        site += sizeof(endbr64);
+    }
+    uint8_t sled[16];
+    memcpy(sled, site, sizeof(sled));
+
+    ASSERT_EQ_D32(uhook_inject(&s_token, (void*)add, (void*)hook_add), 0);
+    ASSERT_EQ_D32(site[0] == 0xe9 || site[0] == 0xeb, 1);
+    ASSERT_EQ_D32(((uintptr_t)site & 0x0f) + 5 <= 16, 1);
+    ASSERT_EQ_D32(memcmp(site + 5, sled + 5, sizeof(sled) - 5), 0);
+    ASSERT_EQ_D32(add(1, 2), 30);
+
+    uhook_uninject(&s_token);
+    ASSERT_EQ_D32(memcmp(sled, site, sizeof(sled)), 0);
+}
+
+/**
+ * Near jump in such sled crosses 16 bytes block and cannot be written by
+ * one atomic store, so the sled is not used and the original is a
+ * relocated copy.
+ */
+DISABLE_OPTIMIZE
+TEST(inline_hook, patchable_entry_cross_block)
+{
+    uintptr_t in_place = uhook_test_sled_cross();
+
+    ASSERT_EQ_D32(uhook_inject(&s_token, (void*)uhook_test_sled_cross, (void*)hook_sled_cross), 0);
+    ASSERT_NE_PTR((void*)uhook_test_sled_cross(), (void*)in_place);
+    uhook_uninject(&s_token);
+    ASSERT_EQ_PTR((void*)uhook_test_sled_cross(), (void*)in_place);
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, patchable_entry)
+{
+    uint8_t sled[16];
+    memcpy(sled, (void*)add, sizeof(sled));
+
+    ASSERT_EQ_D32(uhook_inject(&s_token, (void*)add, (void*)hook_add), 0);
+    ASSERT_EQ_D32(add(1, 2), 30);
+    ASSERT_EQ_D32(((fn_sig)s_token.fcall)(1, 2), 3);
+
+    /* Only NOP sled is rewritten, so it must be restored byte by byte */
+    uhook_uninject(&s_token);
+    ASSERT_EQ_D32(memcmp(sled, (void*)add, sizeof(sled)), 0);
+    ASSERT_EQ_D32(add(1, 2), 3);
+}
+
+#endif
@@ -0,0 +1,120 @@
+#include "common.hpp"
+#include <stdlib.h>
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(_WIN32)
+
+/**
+ * `plan_loop` jumps back into its first 5 bytes, `plan_call` calls out of
+ * its body, `plan_thunk` jumps to `plan_call`.
+ */
+__asm__(
+    ".text\n"
+    ".p2align 4\n"
+    ".globl uhook_test_plan_loop\n"
+    ".type uhook_test_plan_loop, @function\n"
+    "uhook_test_plan_loop:\n"
+    "    xorl %eax, %eax\n"
+    "1:\n"
+    "    addl %edi, %eax\n"
+    "    decl %esi\n"
+    "    jnz 1b\n"
+    "    ret\n"
+    ".size uhook_test_plan_loop, .-uhook_test_plan_loop\n"
+    ".p2align 4\n"
+    ".globl uhook_test_plan_call\n"
+    ".type uhook_test_plan_call, @function\n"
+    "uhook_test_plan_call:\n"
+    "    subq $8, %rsp\n"
+    "    call uhook_test_plan_loop\n"
+    "    addq $8, %rsp\n"
+    "    ret\n"
+    ".size uhook_test_plan_call, .-uhook_test_plan_call\n"
+    ".p2align 4\n"
+    ".globl uhook_test_plan_thunk\n"
+    ".type uhook_test_plan_thunk, @function\n"
+    "uhook_test_plan_thunk:\n"
+    "    .byte 0xe9\n"
+    "    .long uhook_test_plan_call - . - 4\n"
+    ".size uhook_test_plan_thunk, .-uhook_test_plan_thunk\n"
+);
+
+extern "C" int uhook_test_plan_loop(int a, int n);
+extern "C" int uhook_test_plan_call(int a, int n);
+extern "C" int uhook_test_plan_thunk(int a, int n);
+
+DISABLE_OPTIMIZE
+TEST(plan, trampoline)
+{
+    uhook_plan_t report;
+
+    ASSERT_EQ_D32(uhook_plan((void*)uhook_test_plan_loop, &report), 0);
+    ASSERT_EQ_D32(report.result, 0);
+    ASSERT_EQ_D32((int)report.method, UHOOK_PLAN_TRAMPOLINE);
+    ASSERT_EQ_D32((int)report.patch_size, 5);
+    ASSERT_EQ_D32((int)report.branch_in, 1);
+    ASSERT_EQ_D32((int)report.reloc_num, 0);
+
+    ASSERT_EQ_D32(uhook_plan((void*)uhook_test_plan_call, &report), 0);
+    ASSERT_EQ_D32((int)report.reloc_num, 1);
+    ASSERT_EQ_D32((int)report.reloc_fail, 0);
+    ASSERT_EQ_D32((int)report.branch_in, 0);
+
+    /* Nothing is patched */
+    ASSERT_EQ_D32(uhook_is_hooked((void*)uhook_test_plan_loop), 0);
+    ASSERT_EQ_D32(uhook_test_plan_loop(2, 3), 6);
+}
+
+DISABLE_OPTIMIZE
+TEST(plan, thunk)
+{
+    uhook_plan_t report;
+    ASSERT_EQ_D32(uhook_plan((void*)uhook_test_plan_thunk, &report), 0);
+    ASSERT_EQ_D32((int)report.method, UHOOK_PLAN_THUNK);
+}
+
+DISABLE_OPTIMIZE
+TEST(plan, module)
+{
+    uhook_plan_summary_t summary;
+    ASSERT_EQ_D32(uhook_plan_module((void*)uhook_test_plan_loop, 2, &summary), 0);
+    ASSERT_NE_D32((int)summary.func_num, 0);
+    ASSERT_NE_D32((int)summary.hookable, 0);
+    ASSERT_NE_D32((int)summary.branch_in, 0);
+}
+
+/**
+ * `getenv` reads `environ` by `[rip + disp32]`, which may be out of reach
+ * from trampoline, plan must tell it the same way as inject does.
+ */
+static uhook_token_t s_plan_token;
+
+typedef char*(*plan_getenv_sig)(const char*);
+
+static char* plan_hook_getenv(const char* name)
+{
+    return ((plan_getenv_sig)s_plan_token.fcall)(name);
+}
+
+DISABLE_OPTIMIZE
+TEST(plan, agrees_with_inject)
+{
+    uhook_plan_t report;
+    uhook_plan((void*)getenv, &report);
+
+    int ret = uhook_inject(&s_plan_token, (void*)getenv, (void*)plan_hook_getenv);
+    if (ret == UHOOK_SUCCESS)
+    {
+        uhook_uninject(&s_plan_token);
+    }
+    ASSERT_EQ_D32(report.result, ret);
+    if (report.result == UHOOK_SUCCESS)
+    {
+        ASSERT_EQ_D32((int)report.reloc_fail, 0);
+    }
+    else if (report.method == UHOOK_PLAN_TRAMPOLINE)
+    {
+        ASSERT_NE_D32((int)report.reloc_fail, 0);
+    }
+}
+
+#endif
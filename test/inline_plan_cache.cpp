@@ -0,0 +1,88 @@
+#include "common.hpp"
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(_WIN32)
+
+#define TEST_PLAN_CACHE "uhook_test_plan.cache"
+
+/**
+ * `plan_cache_call` calls out of its body, so its trampoline needs
+ * relocation.
+ */
+__asm__(
+    ".text\n"
+    ".p2align 4\n"
+    ".globl uhook_test_plan_cache_double\n"
+    ".type uhook_test_plan_cache_double, @function\n"
+    "uhook_test_plan_cache_double:\n"
+    "    leal (%rdi,%rdi), %eax\n"
+    "    ret\n"
+    ".size uhook_test_plan_cache_double, .-uhook_test_plan_cache_double\n"
+    ".p2align 4\n"
+    ".globl uhook_test_plan_cache_call\n"
+    ".type uhook_test_plan_cache_call, @function\n"
+    "uhook_test_plan_cache_call:\n"
+    "    subq $8, %rsp\n"
+    "    call uhook_test_plan_cache_double\n"
+    "    addq $8, %rsp\n"
+    "    ret\n"
+    ".size uhook_test_plan_cache_call, .-uhook_test_plan_cache_call\n"
+);
+
+extern "C" int uhook_test_plan_cache_call(int a);
+
+typedef int (*fn_plan_cache)(int);
+
+static int negative(int a)
+{
+    return -a;
+}
+
+static void _test_plan_cache_inject(void)
+{
+    ASSERT_EQ_D32(uhook_test_plan_cache_call(3), 6);
+
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject(&token, (void*)uhook_test_plan_cache_call, (void*)negative), 0);
+    ASSERT_EQ_D32(uhook_test_plan_cache_call(3), -3);
+    ASSERT_EQ_D32(((fn_plan_cache)token.fcall)(3), 6);
+
+    uhook_uninject(&token);
+    ASSERT_EQ_D32(uhook_test_plan_cache_call(3), 6);
+}
+
+DISABLE_OPTIMIZE
+TEST(plan_cache, reuse)
+{
+    remove(TEST_PLAN_CACHE);
+
+    /* Nothing to load, but plans are recorded from now on */
+    ASSERT_EQ_D32(uhook_plan_cache_load(TEST_PLAN_CACHE), UHOOK_INVALID);
+    _test_plan_cache_inject();
+    ASSERT_EQ_D32(uhook_plan_cache_save(TEST_PLAN_CACHE), 0);
+
+    /* The trampoline is relocated by cached plan this time */
+    ASSERT_EQ_D32(uhook_plan_cache_load(TEST_PLAN_CACHE), 0);
+    _test_plan_cache_inject();
+
+    /* Loaded plans are saved again */
+    ASSERT_EQ_D32(uhook_plan_cache_save(TEST_PLAN_CACHE), 0);
+    ASSERT_EQ_D32(uhook_plan_cache_load(TEST_PLAN_CACHE), 0);
+
+    remove(TEST_PLAN_CACHE);
+}
+
+DISABLE_OPTIMIZE
+TEST(plan_cache, invalid)
+{
+    FILE* file = fopen(TEST_PLAN_CACHE, "wb");
+    ASSERT_NE_PTR(file, NULL);
+    fputs("not a plan cache", file);
+    fclose(file);
+
+    ASSERT_EQ_D32(uhook_plan_cache_load(TEST_PLAN_CACHE), UHOOK_INVALID);
+    _test_plan_cache_inject();
+
+    remove(TEST_PLAN_CACHE);
+}
+
+#endif
@@ -0,0 +1,128 @@
+#include "common.hpp"
+#include <atomic>
+#include <thread>
+
+typedef int(*fn_sig)(int, int);
+
+static uhook_token_t s_token_add;
+static uhook_token_t s_token_sub;
+static uhook_token_t s_token_add_2;
+
+static int add(int a, int b)
+{
+    return a + b;
+}
+
+static int sub(int a, int b)
+{
+    return a - b;
+}
+
+static int hook_add(int a, int b)
+{
+    return ((fn_sig)s_token_add.fcall)(a, b) * 10;
+}
+
+static int hook_add_2(int a, int b)
+{
+    return ((fn_sig)s_token_add_2.fcall)(a, b) + 1;
+}
+
+static int hook_sub(int a, int b)
+{
+    return ((fn_sig)s_token_sub.fcall)(a, b) * 100;
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, registry)
+{
+    uhook_opt_t opt;
+    opt.priority = 0;
+    opt.flags = 0;
+
+    ASSERT_EQ_D32(uhook_is_hooked((void*)add), 0);
+
+    opt.group = 1;
+    ASSERT_EQ_D32(uhook_inject_ex(&s_token_add, (void*)add, (void*)hook_add, &opt), 0);
+    ASSERT_EQ_D32(uhook_inject_ex(&s_token_sub, (void*)sub, (void*)hook_sub, &opt), 0);
+
+    opt.group = 2;
+    ASSERT_EQ_D32(uhook_inject_ex(&s_token_add_2, (void*)add, (void*)hook_add_2, &opt), 0);
+
+    ASSERT_NE_D32(uhook_is_hooked((void*)add), 0);
+    ASSERT_NE_D32(uhook_is_hooked((void*)sub), 0);
+    /* Same priority, so the hook injected first is called first */
+    ASSERT_EQ_D32(add(1, 2), 40);
+    ASSERT_EQ_D32(sub(3, 1), 200);
+
+    /* Only hooks in group 1 are removed, and their tokens are cleared */
+    ASSERT_EQ_SIZE(uhook_uninject_group(1), (size_t)2);
+    ASSERT_EQ_PTR(s_token_add.fcall, NULL);
+    ASSERT_EQ_PTR(s_token_sub.fcall, NULL);
+    ASSERT_EQ_D32(uhook_is_hooked((void*)sub), 0);
+    ASSERT_NE_D32(uhook_is_hooked((void*)add), 0);
+    ASSERT_EQ_D32(add(1, 2), 4);
+    ASSERT_EQ_D32(sub(3, 1), 2);
+
+    ASSERT_EQ_SIZE(uhook_uninject_all(), (size_t)1);
+    ASSERT_EQ_PTR(s_token_add_2.fcall, NULL);
+    ASSERT_EQ_D32(uhook_is_hooked((void*)add), 0);
+    ASSERT_EQ_D32(add(1, 2), 3);
+}
+
+#define TEST_REGISTRY_THREADS   4
+#define TEST_REGISTRY_LOOPS     200
+
+static std::atomic<int> s_registry_running;
+static std::atomic<int> s_registry_misses;
+
+static void _test_registry_reader(void)
+{
+    while (s_registry_running.load())
+    {
+        if (!uhook_is_hooked((void*)add))
+        {
+            s_registry_misses++;
+        }
+    }
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, registry_concurrent)
+{
+    ASSERT_EQ_D32(uhook_inject(&s_token_add, (void*)add, (void*)hook_add), 0);
+
+    s_registry_misses = 0;
+    s_registry_running = 1;
+
+    std::thread readers[TEST_REGISTRY_THREADS];
+
+    int i;
+    for (i = 0; i < TEST_REGISTRY_THREADS; i++)
+    {
+        readers[i] = std::thread(_test_registry_reader);
+    }
+
+    /* Lookups of a hook that stays must not miss while others come and go */
+    int failures = 0;
+    for (i = 0; i < TEST_REGISTRY_LOOPS; i++)
+    {
+        if (uhook_inject(&s_token_sub, (void*)sub, (void*)hook_sub) != 0)
+        {
+            failures++;
+            break;
+        }
+        uhook_uninject(&s_token_sub);
+    }
+
+    s_registry_running = 0;
+    for (i = 0; i < TEST_REGISTRY_THREADS; i++)
+    {
+        readers[i].join();
+    }
+    uhook_uninject(&s_token_add);
+
+    ASSERT_EQ_D32(failures, 0);
+    ASSERT_EQ_D32(s_registry_misses.load(), 0);
+    ASSERT_EQ_D32(uhook_is_hooked((void*)add), 0);
+}
@@ -0,0 +1,152 @@
+#include "common.hpp"
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(_WIN32)
+
+/**
+ * Signatures are made of immediate values nobody else uses.
+ */
+__asm__(
+    ".text\n"
+    ".p2align 4\n"
+    ".globl uhook_test_sig_func\n"
+    ".type uhook_test_sig_func, @function\n"
+    "uhook_test_sig_func:\n"
+    "    movl $0x5a17c0de, %eax\n"
+    "    addl %edi, %eax\n"
+    "    ret\n"
+    ".size uhook_test_sig_func, .-uhook_test_sig_func\n"
+    ".p2align 4\n"
+    ".globl uhook_test_sig_caller\n"
+    ".type uhook_test_sig_caller, @function\n"
+    "uhook_test_sig_caller:\n"
+    "    subq $8, %rsp\n"
+    "    movl $0x5a17c0df, %edi\n"
+    "    call uhook_test_sig_func\n"
+    "    addq $8, %rsp\n"
+    "    ret\n"
+    ".size uhook_test_sig_caller, .-uhook_test_sig_caller\n"
+);
+
+extern "C" int uhook_test_sig_func(int a);
+extern "C" int uhook_test_sig_caller(void);
+
+#define TEST_SIG_CACHE  "uhook_test_signature.cache"
+
+/**
+ * Record header of cache file, followed by build-id and offsets.
+ */
+typedef struct test_sig_record
+{
+    uint32_t        magic;
+    uint32_t        id_size;
+    uint64_t        key;
+    uint64_t        num;
+}test_sig_record_t;
+
+DISABLE_OPTIMIZE
+TEST(signature, find)
+{
+    void* addrs[4];
+    size_t num;
+
+    ASSERT_EQ_D32(uhook_find_signature("b8 de c0 17 5a 01 f8 c3", NULL, addrs, 4, &num), 0);
+    ASSERT_EQ_D32((int)num, 1);
+    ASSERT_EQ_PTR(addrs[0], (void*)uhook_test_sig_func);
+
+    ASSERT_EQ_D32(uhook_find_signature("b8 ?? c0 17 5a ? f8", NULL, addrs, 4, &num), 0);
+    ASSERT_EQ_D32((int)num, 1);
+    ASSERT_EQ_PTR(addrs[0], (void*)uhook_test_sig_func);
+
+    ASSERT_EQ_D32(uhook_find_signature("b8 de c0 17 5b 01 f8 c3", NULL, addrs, 4, &num), 0);
+    ASSERT_EQ_D32((int)num, 0);
+}
+
+DISABLE_OPTIMIZE
+TEST(signature, rip_relative)
+{
+    void* addrs[4];
+    size_t num;
+
+    uhook_sig_opt_t opt;
+    memset(&opt, 0, sizeof(opt));
+
+    /* `mov edi, imm32` then `call rel32` */
+    opt.rel_pos = 6;
+    opt.rel_end = 10;
+    ASSERT_EQ_D32(uhook_find_signature("bf df c0 17 5a e8 ?? ?? ?? ??", &opt, addrs, 4, &num), 0);
+    ASSERT_EQ_D32((int)num, 1);
+    ASSERT_EQ_PTR(addrs[0], (void*)uhook_test_sig_func);
+
+    opt.offset = 1;
+    ASSERT_EQ_D32(uhook_find_signature("bf df c0 17 5a e8 ?? ?? ?? ??", &opt, addrs, 4, &num), 0);
+    ASSERT_EQ_PTR(addrs[0], (void*)((char*)uhook_test_sig_func + 1));
+}
+
+DISABLE_OPTIMIZE
+TEST(signature, cache)
+{
+    void* addrs[4];
+    size_t num;
+
+    uhook_sig_opt_t opt;
+    memset(&opt, 0, sizeof(opt));
+    opt.cache = TEST_SIG_CACHE;
+    remove(TEST_SIG_CACHE);
+
+    /* The first scan fills cache, the second one is served from it */
+    ASSERT_EQ_D32(uhook_find_signature("b8 de c0 17 5a 01 f8 c3", &opt, addrs, 4, &num), 0);
+    ASSERT_EQ_D32((int)num, 1);
+    ASSERT_EQ_D32(uhook_find_signature("b8 de c0 17 5a 01 f8 c3", &opt, addrs, 4, &num), 0);
+    ASSERT_EQ_D32((int)num, 1);
+    ASSERT_EQ_PTR(addrs[0], (void*)uhook_test_sig_func);
+
+    /* Make offset stale, only record of this module has one */
+    FILE* file = fopen(TEST_SIG_CACHE, "r+b");
+    ASSERT_NE_PTR(file, NULL);
+    test_sig_record_t record;
+    long pos = -1;
+    while (pos < 0 && fread(&record, sizeof(record), 1, file) == 1)
+    {
+        fseek(file, record.id_size, SEEK_CUR);
+        if (record.num == 1)
+        {
+            pos = ftell(file);
+        }
+        fseek(file, (long)(sizeof(uint64_t) * record.num), SEEK_CUR);
+    }
+    ASSERT_GE_D32((int)pos, 0);
+
+    uint64_t offset;
+    fseek(file, pos, SEEK_SET);
+    ASSERT_EQ_SIZE(fread(&offset, sizeof(offset), 1, file), 1);
+    offset++;
+    fseek(file, pos, SEEK_SET);
+    ASSERT_EQ_SIZE(fwrite(&offset, sizeof(offset), 1, file), 1);
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+
+    /* Module is scanned again and its record is replaced, not appended */
+    ASSERT_EQ_D32(uhook_find_signature("b8 de c0 17 5a 01 f8 c3", &opt, addrs, 4, &num), 0);
+    ASSERT_EQ_D32((int)num, 1);
+    ASSERT_EQ_PTR(addrs[0], (void*)uhook_test_sig_func);
+    file = fopen(TEST_SIG_CACHE, "rb");
+    ASSERT_NE_PTR(file, NULL);
+    fseek(file, 0, SEEK_END);
+    ASSERT_EQ_D32((int)ftell(file), (int)size);
+    fclose(file);
+
+    remove(TEST_SIG_CACHE);
+}
+
+DISABLE_OPTIMIZE
+TEST(signature, invalid)
+{
+    size_t num;
+    ASSERT_EQ_D32(uhook_find_signature("?? ??", NULL, NULL, 0, &num), UHOOK_INVALID);
+    ASSERT_EQ_D32(uhook_find_signature("b8 zz", NULL, NULL, 0, &num), UHOOK_INVALID);
+}
+
+#endif
@@ -0,0 +1,73 @@
+#include "common.hpp"
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(_WIN32)
+
+TEST_ASM_FUNCTION(uhook_test_snippet_double, "leal (%rdi,%rdi), %eax");
+
+extern "C" int uhook_test_snippet_double(int a);
+
+static int s_snippet_value = 77;
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, snippet_return)
+{
+    uhook_snippet_t snippet;
+    ASSERT_EQ_D32(uhook_snippet_return(&snippet, 42), 0);
+
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject_snippet(&token, (void*)uhook_test_snippet_double, &snippet), 0);
+    ASSERT_EQ_D32(uhook_test_snippet_double(3), 42);
+    ASSERT_EQ_D32(((int(*)(int))token.fcall)(3), 6);
+
+    uhook_uninject(&token);
+    ASSERT_EQ_D32(uhook_test_snippet_double(3), 6);
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, snippet_count)
+{
+    static uhook_counter_t counter;
+    memset(&counter, 0, sizeof(counter));
+
+    uhook_snippet_t snippet;
+    ASSERT_EQ_D32(uhook_snippet_count(&snippet, &counter), 0);
+
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject_snippet(&token, (void*)uhook_test_snippet_double, &snippet), 0);
+
+    int i;
+    for (i = 0; i < 100; i++)
+    {
+        ASSERT_EQ_D32(uhook_test_snippet_double(i), i * 2);
+    }
+    ASSERT_EQ_D32((int)uhook_counter_read(&counter), 100);
+
+    uhook_uninject(&token);
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, snippet_relocate)
+{
+    /* mov eax, dword ptr [rip + 0]; ret */
+    static const unsigned char code[] = { 0x8b, 0x05, 0x00, 0x00, 0x00, 0x00, 0xc3 };
+
+    uhook_snippet_t snippet;
+    memset(&snippet, 0, sizeof(snippet));
+    memcpy(snippet.code, code, sizeof(code));
+    snippet.size = sizeof(code);
+
+    /* Assembled as if it was right before the value */
+    snippet.origin = (const char*)&s_snippet_value - 6;
+
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject_snippet(&token, (void*)uhook_test_snippet_double, &snippet), 0);
+    ASSERT_EQ_D32(uhook_test_snippet_double(3), 77);
+    uhook_uninject(&token);
+
+    /* Position independent snippet cannot address memory by rip */
+    snippet.origin = NULL;
+    ASSERT_EQ_D32(uhook_inject_snippet(&token, (void*)uhook_test_snippet_double, &snippet), UHOOK_INVALID);
+}
+
+#endif
@@ -0,0 +1,112 @@
+#include "common.hpp"
+#include <thread>
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(_WIN32)
+
+#define TEST_STAT_THREADS   4
+#define TEST_STAT_LOOPS     10000
+
+TEST_ASM_FUNCTION(uhook_test_stat_inc, "leal 1(%rdi), %eax");
+TEST_ASM_FUNCTION(uhook_test_stat_fadd, "addsd %xmm1, %xmm0");
+
+extern "C" int uhook_test_stat_inc(int a);
+extern "C" double uhook_test_stat_fadd(double a, double b);
+
+static int _test_stat_detour(int a)
+{
+    return a + 2;
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, stat)
+{
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject_stat(&token, (void*)uhook_test_stat_inc), 0);
+
+    uhook_stat_t stat;
+    ASSERT_EQ_D32(uhook_stat_read(&token, &stat), 0);
+    ASSERT_EQ_U64(stat.calls, 0);
+
+    int i;
+    for (i = 0; i < 100; i++)
+    {
+        ASSERT_EQ_D32(uhook_test_stat_inc(i), i + 1);
+    }
+
+    ASSERT_EQ_D32(uhook_stat_read(&token, &stat), 0);
+    ASSERT_EQ_U64(stat.calls, 100);
+    ASSERT_EQ_U64(stat.returns, 100);
+    ASSERT_GT_U64(stat.ns, 0);
+
+    uhook_uninject(&token);
+    ASSERT_EQ_D32(uhook_test_stat_inc(1), 2);
+
+    /* Counts of removed hook are not inherited */
+    ASSERT_EQ_D32(uhook_inject_stat(&token, (void*)uhook_test_stat_inc), 0);
+    ASSERT_EQ_D32(uhook_stat_read(&token, &stat), 0);
+    ASSERT_EQ_U64(stat.calls, 0);
+    uhook_uninject(&token);
+}
+
+static void _test_stat_worker(void)
+{
+    int i;
+    for (i = 0; i < TEST_STAT_LOOPS; i++)
+    {
+        uhook_test_stat_inc(i);
+    }
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, stat_threads)
+{
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject_stat(&token, (void*)uhook_test_stat_inc), 0);
+
+    std::thread workers[TEST_STAT_THREADS];
+    int i;
+    for (i = 0; i < TEST_STAT_THREADS; i++)
+    {
+        workers[i] = std::thread(_test_stat_worker);
+    }
+    for (i = 0; i < TEST_STAT_THREADS; i++)
+    {
+        workers[i].join();
+    }
+
+    /* Counts of exited threads are kept */
+    uhook_stat_t stat;
+    ASSERT_EQ_D32(uhook_stat_read(&token, &stat), 0);
+    ASSERT_EQ_U64(stat.calls, TEST_STAT_THREADS * TEST_STAT_LOOPS);
+    ASSERT_EQ_U64(stat.returns, TEST_STAT_THREADS * TEST_STAT_LOOPS);
+
+    uhook_uninject(&token);
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, stat_float)
+{
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject_stat(&token, (void*)uhook_test_stat_fadd), 0);
+
+    /* Handlers of library must not touch float arguments or return value */
+    ASSERT_EQ_D32((int)uhook_test_stat_fadd(1.0, 2.0), 3);
+    ASSERT_EQ_D32((int)uhook_test_stat_fadd(20.0, 22.0), 42);
+
+    uhook_uninject(&token);
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, stat_invalid)
+{
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject(&token, (void*)uhook_test_stat_inc, (void*)_test_stat_detour), 0);
+    ASSERT_EQ_D32(uhook_test_stat_inc(1), 3);
+
+    uhook_stat_t stat;
+    ASSERT_EQ_D32(uhook_stat_read(&token, &stat), UHOOK_INVALID);
+
+    uhook_uninject(&token);
+}
+
+#endif
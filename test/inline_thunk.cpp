@@ -0,0 +1,74 @@
+#include "common.hpp"
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(_WIN32)
+
+/**
+ * `thunk_outer` -> `thunk_inner` -> `thunk_real`
+ */
+__asm__(
+    ".text\n"
+    ".p2align 4\n"
+    ".globl uhook_test_thunk_outer\n"
+    ".type uhook_test_thunk_outer, @function\n"
+    "uhook_test_thunk_outer:\n"
+    "    jmp uhook_test_thunk_inner\n"
+    ".size uhook_test_thunk_outer, .-uhook_test_thunk_outer\n"
+    ".p2align 4, 0xcc\n"
+    ".globl uhook_test_thunk_inner\n"
+    ".type uhook_test_thunk_inner, @function\n"
+    "uhook_test_thunk_inner:\n"
+    "    jmp uhook_test_thunk_real\n"
+    ".size uhook_test_thunk_inner, .-uhook_test_thunk_inner\n"
+    ".p2align 4, 0xcc\n"
+    ".globl uhook_test_thunk_real\n"
+    ".type uhook_test_thunk_real, @function\n"
+    "uhook_test_thunk_real:\n"
+    "    leal (%rdi, %rsi), %eax\n"
+    "    ret\n"
+    ".size uhook_test_thunk_real, .-uhook_test_thunk_real\n"
+    ".p2align 4, 0xcc\n"
+);
+
+extern "C" int uhook_test_thunk_outer(int a, int b);
+extern "C" int uhook_test_thunk_inner(int a, int b);
+extern "C" int uhook_test_thunk_real(int a, int b);
+
+typedef int(*fn_sig)(int, int);
+
+static uhook_token_t s_token;
+
+static int hook_add(int a, int b)
+{
+    return ((fn_sig)s_token.fcall)(a, b) * 10;
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, thunk)
+{
+    ASSERT_EQ_D32(uhook_inject(&s_token, (void*)uhook_test_thunk_outer, (void*)hook_add), 0);
+    ASSERT_EQ_D32(uhook_test_thunk_outer(1, 2), 30);
+    ASSERT_EQ_D32(uhook_test_thunk_inner(1, 2), 3);
+    ASSERT_EQ_D32(((fn_sig)s_token.fcall)(1, 2), 3);
+    uhook_uninject(&s_token);
+    ASSERT_EQ_D32(uhook_test_thunk_outer(1, 2), 3);
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, thunk_follow)
+{
+    uhook_opt_t opt;
+    opt.priority = 0;
+    opt.group = 0;
+    opt.flags = UHOOK_INJECT_FOLLOW_JMP;
+
+    ASSERT_EQ_D32(uhook_inject_ex(&s_token, (void*)uhook_test_thunk_outer, (void*)hook_add, &opt), 0);
+    ASSERT_EQ_D32(uhook_is_hooked((void*)uhook_test_thunk_real), 1);
+    ASSERT_EQ_D32(uhook_test_thunk_outer(1, 2), 30);
+    ASSERT_EQ_D32(uhook_test_thunk_inner(1, 2), 30);
+    ASSERT_EQ_D32(uhook_test_thunk_real(1, 2), 30);
+
+    uhook_uninject(&s_token);
+    ASSERT_EQ_D32(uhook_test_thunk_real(1, 2), 3);
+}
+
+#endif
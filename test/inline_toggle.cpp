@@ -0,0 +1,93 @@
+#include "common.hpp"
+
+typedef int(*fn_sig)(int, int);
+
+static int add(int a, int b)
+{
+    return a + b;
+}
+
+static int mul(int a, int b)
+{
+    return a * b;
+}
+
+static int del(int a, int b)
+{
+    return a - b;
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, toggle)
+{
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject(&token, (void*)add, (void*)del), 0);
+    ASSERT_EQ_D32(add(1, 2), -1);
+
+    ASSERT_EQ_D32(uhook_disable(&token), 0);
+    ASSERT_EQ_D32(add(1, 2), 3);
+    ASSERT_EQ_D32(((fn_sig)token.fcall)(1, 2), 3);
+
+    /* disable twice is a no-op */
+    ASSERT_EQ_D32(uhook_disable(&token), 0);
+    ASSERT_EQ_D32(add(1, 2), 3);
+
+    ASSERT_EQ_D32(uhook_enable(&token), 0);
+    ASSERT_EQ_D32(add(1, 2), -1);
+    ASSERT_EQ_D32(((fn_sig)token.fcall)(1, 2), 3);
+
+    uhook_uninject(&token);
+    ASSERT_EQ_D32(add(1, 2), 3);
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, toggle_batch)
+{
+    uhook_token_t token_add, token_mul;
+    ASSERT_EQ_D32(uhook_inject(&token_add, (void*)add, (void*)del), 0);
+    ASSERT_EQ_D32(uhook_inject(&token_mul, (void*)mul, (void*)del), 0);
+
+    uhook_token_t* tokens[] = { &token_add, &token_mul };
+    ASSERT_EQ_D32(uhook_disable_batch(tokens, 2), 0);
+    ASSERT_EQ_D32(add(2, 3), 5);
+    ASSERT_EQ_D32(mul(2, 3), 6);
+
+    ASSERT_EQ_D32(uhook_enable_batch(tokens, 2), 0);
+    ASSERT_EQ_D32(add(2, 3), -1);
+    ASSERT_EQ_D32(mul(2, 3), -1);
+
+    /* uninject a disabled hook */
+    ASSERT_EQ_D32(uhook_disable(&token_mul), 0);
+    uhook_uninject(&token_add);
+    uhook_uninject(&token_mul);
+    ASSERT_EQ_D32(add(2, 3), 5);
+    ASSERT_EQ_D32(mul(2, 3), 6);
+}
+
+/**
+ * Tokens are given in no order and two of them share a target, each target
+ * is still written once.
+ */
+DISABLE_OPTIMIZE
+TEST(inline_hook, toggle_batch_shared_target)
+{
+    uhook_token_t token_add, token_add2, token_mul;
+    ASSERT_EQ_D32(uhook_inject(&token_add, (void*)add, (void*)del), 0);
+    ASSERT_EQ_D32(uhook_inject(&token_mul, (void*)mul, (void*)del), 0);
+    ASSERT_EQ_D32(uhook_inject(&token_add2, (void*)add, (void*)del), 0);
+
+    uhook_token_t* tokens[] = { &token_add2, &token_mul, &token_add };
+    ASSERT_EQ_D32(uhook_disable_batch(tokens, 3), 0);
+    ASSERT_EQ_D32(add(2, 3), 5);
+    ASSERT_EQ_D32(mul(2, 3), 6);
+
+    ASSERT_EQ_D32(uhook_enable_batch(tokens + 1, 2), 0);
+    ASSERT_EQ_D32(add(2, 3), -1);
+    ASSERT_EQ_D32(mul(2, 3), -1);
+
+    uhook_uninject(&token_add2);
+    uhook_uninject(&token_add);
+    uhook_uninject(&token_mul);
+    ASSERT_EQ_D32(add(2, 3), 5);
+    ASSERT_EQ_D32(mul(2, 3), 6);
+}
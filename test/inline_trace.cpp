@@ -0,0 +1,141 @@
+#include "common.hpp"
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(_WIN32)
+
+#define TEST_TRACE_ID       0x5a5a
+#define TEST_TRACE_CALLS    3
+#define TEST_TRACE_FILE     "uhook_test_trace.uht"
+#define TEST_TRACE_JSON     "uhook_test_trace.json"
+
+TEST_ASM_FUNCTION(uhook_test_trace_inc, "leal 1(%rdi), %eax");
+TEST_ASM_FUNCTION(uhook_test_trace_fadd, "addsd %xmm1, %xmm0");
+
+extern "C" int uhook_test_trace_inc(int a);
+extern "C" double uhook_test_trace_fadd(double a, double b);
+
+static void _test_trace_flush(void)
+{
+    uhook_trace_record_t records[64];
+    while (uhook_trace_drain(records, 64) != 0)
+    {
+    }
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, trace)
+{
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject_trace(&token, (void*)uhook_test_trace_inc, TEST_TRACE_ID), 0);
+    _test_trace_flush();
+
+    int i;
+    for (i = 0; i < TEST_TRACE_CALLS; i++)
+    {
+        ASSERT_EQ_D32(uhook_test_trace_inc(i), i + 1);
+    }
+    uhook_uninject(&token);
+
+    uhook_trace_record_t records[TEST_TRACE_CALLS * 2 + 1];
+    ASSERT_EQ_SIZE(uhook_trace_drain(records, TEST_TRACE_CALLS * 2 + 1), TEST_TRACE_CALLS * 2);
+
+    for (i = 0; i < TEST_TRACE_CALLS * 2; i++)
+    {
+        ASSERT_EQ_U32(records[i].type, (i % 2) ? UHOOK_TRACE_LEAVE : UHOOK_TRACE_ENTER);
+        ASSERT_EQ_U32(records[i].id, TEST_TRACE_ID);
+        ASSERT_EQ_U32(records[i].tid, records[0].tid);
+        ASSERT_NE_PTR((void*)(uintptr_t)records[i].caller, NULL);
+    }
+
+    /* Leave is recorded with the same caller, after enter */
+    ASSERT_EQ_U64(records[1].caller, records[0].caller);
+    ASSERT_GE_U64(records[1].ticks, records[0].ticks);
+
+    /* Nothing is left */
+    ASSERT_EQ_SIZE(uhook_trace_drain(records, TEST_TRACE_CALLS * 2 + 1), 0);
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, trace_config)
+{
+    /* Trace a call first, so result does not depend on other tests */
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject_trace(&token, (void*)uhook_test_trace_inc, TEST_TRACE_ID), 0);
+    ASSERT_EQ_D32(uhook_test_trace_inc(1), 2);
+    uhook_uninject(&token);
+    _test_trace_flush();
+
+    /* Options are fixed once a call is traced */
+    uhook_trace_opt_t opt = { 0, UHOOK_TRACE_DROP };
+    ASSERT_EQ_D32(uhook_trace_config(&opt), UHOOK_INVALID);
+    opt.policy = UHOOK_TRACE_OVERWRITE;
+    ASSERT_EQ_D32(uhook_trace_config(&opt), UHOOK_INVALID);
+
+    /* Unknown policy */
+    opt.policy = 100;
+    ASSERT_EQ_D32(uhook_trace_config(&opt), UHOOK_INVALID);
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, trace_float)
+{
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject_trace(&token, (void*)uhook_test_trace_fadd, TEST_TRACE_ID), 0);
+
+    /* Handlers of library must not touch float arguments or return value */
+    ASSERT_EQ_D32((int)uhook_test_trace_fadd(1.0, 2.0), 3);
+    ASSERT_EQ_D32((int)uhook_test_trace_fadd(20.0, 22.0), 42);
+
+    uhook_uninject(&token);
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, trace_file)
+{
+    /* Renamed, the later name is used */
+    ASSERT_EQ_D32(uhook_trace_name(TEST_TRACE_ID, "trace_old"), 0);
+    ASSERT_EQ_D32(uhook_trace_name(TEST_TRACE_ID, "trace_\"inc\""), 0);
+
+    uhook_token_t token;
+    ASSERT_EQ_D32(uhook_inject_trace(&token, (void*)uhook_test_trace_inc, TEST_TRACE_ID), 0);
+    _test_trace_flush();
+
+    ASSERT_EQ_D32(uhook_trace_open(TEST_TRACE_FILE), 0);
+    ASSERT_EQ_D32(uhook_trace_open(TEST_TRACE_FILE), UHOOK_INVALID);
+
+    int i;
+    for (i = 0; i < TEST_TRACE_CALLS; i++)
+    {
+        ASSERT_EQ_D32(uhook_test_trace_inc(i), i + 1);
+    }
+    uhook_uninject(&token);
+
+    ASSERT_EQ_D32(uhook_trace_close(), 0);
+    ASSERT_EQ_D32(uhook_trace_close(), UHOOK_INVALID);
+    ASSERT_EQ_D32(uhook_trace_to_json(TEST_TRACE_FILE, TEST_TRACE_JSON), 0);
+
+    char buf[4096];
+    FILE* file = fopen(TEST_TRACE_JSON, "rb");
+    ASSERT_NE_PTR(file, NULL);
+    size_t size = fread(buf, 1, sizeof(buf) - 1, file);
+    buf[size] = '\0';
+    fclose(file);
+
+    /* Every call is written as a pair of events with escaped name */
+    size_t num = 0;
+    const char* pos = buf;
+    while ((pos = strstr(pos, "{\"name\":\"trace_\\\"inc\\\"\",\"ph\":\"")) != NULL)
+    {
+        pos++;
+        num++;
+    }
+    ASSERT_EQ_SIZE(num, TEST_TRACE_CALLS * 2);
+
+    /* Not a trace file */
+    ASSERT_EQ_D32(uhook_trace_to_json(TEST_TRACE_JSON, TEST_TRACE_JSON), UHOOK_INVALID);
+
+    remove(TEST_TRACE_FILE);
+    remove(TEST_TRACE_JSON);
+}
+
+#endif
@@ -0,0 +1,88 @@
+#include "common.hpp"
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(_WIN32)
+
+/**
+ * `xref_callee` is reached by `call rel32`, `jmp rel32` and
+ * `call [rip + disp32]`.
+ */
+__asm__(
+    ".text\n"
+    ".p2align 4\n"
+    ".globl uhook_test_xref_callee\n"
+    ".type uhook_test_xref_callee, @function\n"
+    "uhook_test_xref_callee:\n"
+    "    leal (%rdi, %rsi), %eax\n"
+    "    ret\n"
+    ".size uhook_test_xref_callee, .-uhook_test_xref_callee\n"
+    ".p2align 4\n"
+    ".globl uhook_test_xref_call\n"
+    ".type uhook_test_xref_call, @function\n"
+    "uhook_test_xref_call:\n"
+    "    subq $8, %rsp\n"
+    "    call uhook_test_xref_callee\n"
+    "    addq $8, %rsp\n"
+    "    ret\n"
+    ".size uhook_test_xref_call, .-uhook_test_xref_call\n"
+    ".p2align 4\n"
+    ".globl uhook_test_xref_jmp\n"
+    ".type uhook_test_xref_jmp, @function\n"
+    "uhook_test_xref_jmp:\n"
+    "    subq $8, %rsp\n"
+    "    addq $8, %rsp\n"
+    /* `jmp rel32`, assembler would pick `jmp rel8` for a near function */
+    "    .byte 0xe9\n"
+    "    .long uhook_test_xref_callee - . - 4\n"
+    ".size uhook_test_xref_jmp, .-uhook_test_xref_jmp\n"
+    ".p2align 4\n"
+    ".globl uhook_test_xref_indirect\n"
+    ".type uhook_test_xref_indirect, @function\n"
+    "uhook_test_xref_indirect:\n"
+    "    subq $8, %rsp\n"
+    "    call *uhook_test_xref_slot(%rip)\n"
+    "    addq $8, %rsp\n"
+    "    ret\n"
+    ".size uhook_test_xref_indirect, .-uhook_test_xref_indirect\n"
+    ".data\n"
+    ".p2align 3\n"
+    "uhook_test_xref_slot:\n"
+    "    .quad uhook_test_xref_callee\n"
+    ".text\n"
+);
+
+extern "C" int uhook_test_xref_callee(int a, int b);
+extern "C" int uhook_test_xref_call(int a, int b);
+extern "C" int uhook_test_xref_jmp(int a, int b);
+extern "C" int uhook_test_xref_indirect(int a, int b);
+
+static int xref_type_of(const uhook_xref_t* xrefs, size_t num, void* func, size_t len)
+{
+    size_t i;
+    for (i = 0; i < num; i++)
+    {
+        if ((char*)xrefs[i].site >= (char*)func && (char*)xrefs[i].site < (char*)func + len)
+        {
+            return (int)xrefs[i].type;
+        }
+    }
+    return 0;
+}
+
+DISABLE_OPTIMIZE
+TEST(inline_hook, xref)
+{
+    uhook_xref_t xrefs[8];
+
+    ASSERT_EQ_D32((int)uhook_find_callers((void*)uhook_test_xref_callee, NULL, 0), 3);
+    ASSERT_EQ_D32((int)uhook_find_callers((void*)uhook_test_xref_callee, xrefs, 8), 3);
+
+    ASSERT_EQ_D32(xref_type_of(xrefs, 3, (void*)uhook_test_xref_call, 16), UHOOK_XREF_CALL);
+    ASSERT_EQ_D32(xref_type_of(xrefs, 3, (void*)uhook_test_xref_jmp, 16), UHOOK_XREF_JMP);
+    ASSERT_EQ_D32(xref_type_of(xrefs, 3, (void*)uhook_test_xref_indirect, 16),
+        UHOOK_XREF_CALL | UHOOK_XREF_INDIRECT);
+
+    /* Only capacity is filled */
+    ASSERT_EQ_D32((int)uhook_find_callers((void*)uhook_test_xref_callee, xrefs, 1), 3);
+}
+
+#endif
@@ -26,3 +26,18 @@ TEST(pltgot, dependency)
     uhook_uninject(&s_token);
     ASSERT_EQ_SIZE(springboard_strlen_c(str), str_len);
 }
+
+DISABLE_OPTIMIZE
+TEST(pltgot, duplicate)
+{
+    const char* str = "hello world";
+    const size_t str_len = strlen(str);
+    uhook_token_t token;
+
+    ASSERT_EQ_D32(uhook_inject_got(&s_token, "springboard_strlen_c", (void*)_hook_strlen), 0);
+    ASSERT_EQ_D32(uhook_inject_got(&token, "springboard_strlen_c", (void*)_hook_strlen), UHOOK_DUPLICATE);
+    ASSERT_EQ_SIZE(springboard_strlen_c(str), (size_t)-1);
+
+    uhook_uninject(&s_token);
+    ASSERT_EQ_SIZE(springboard_strlen_c(str), str_len);
+}